@@ -61,7 +61,7 @@ cleanup:
 * NOTE: the tag structure contains two secrets, k_prf (the key to the PRF) and alpha (a randomly chosen value to
 * blind the message.
 */
-CPOR_tag *cpor_tag_block(CPOR_params *myparams, CPOR_global *global, unsigned char *k_prf, BIGNUM **alpha, unsigned char *block, unsigned int index){
+CPOR_tag *cpor_tag_block(CPOR_params *myparams, CPOR_global *global, unsigned char *k_prf, BIGNUM **alpha, unsigned char *block, uint64_t index){
 
 	CPOR_tag *tag = NULL;
 	BN_CTX * ctx = NULL;
@@ -136,60 +136,232 @@ cleanup:
 	return NULL;
 }
 
-/* cpor_create_challenge: Create a random challenge to send to the prover.  Takes in n, the number of blocks in the file.
-*  Returns an allocated and populated CPOR_challenge struct or NULL on failure.
+/* cpor_update_tag_sectors: A client-side function that updates tag in place after sectors first_sector through
+* first_sector+num_sectors-1 of its block are rewritten.  Since sigma_i = PRF_k(i) + sum(alpha_j * m_ij), only
+* alpha_j * (m'_ij - m_ij) for each rewritten sector needs to be added.  old_sectors and new_sectors hold the old
+* and new bytes of those sectors, laid out as they are within the block.  Returns 1 on success, 0 on failure.
 */
-CPOR_challenge *cpor_create_challenge(CPOR_params *myparams, CPOR_global *global, unsigned int n){
+int cpor_update_tag_sectors(CPOR_params *myparams, CPOR_global *global, BIGNUM **alpha, CPOR_tag *tag,
+                            unsigned int first_sector, unsigned int num_sectors, unsigned char *old_sectors, unsigned char *new_sectors){
 
-	CPOR_challenge *challenge;
-	int i = 0;
-	unsigned int l;
-	unsigned int *random_indices = NULL;
-	unsigned int tmp = 0;
-	unsigned int swapwith = 0;
+	BN_CTX * ctx = NULL;
+	BIGNUM *old_message = NULL;
+	BIGNUM *new_message = NULL;
+	BIGNUM *diff = NULL;
+	BIGNUM *product = NULL;
+	int j = 0;
 	
-	if(!global || !n) return NULL;
-	if(!global->Zp) return NULL;
+	if(!global || !alpha || !tag || !old_sectors || !new_sectors) return 0;
+	if(!global->Zp) return 0;
+	if(first_sector + num_sectors > myparams->num_sectors) return 0;
+	
+	/* Allocate memory */
+	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
+	if( ((old_message = BN_new()) == NULL)) goto cleanup;
+	if( ((new_message = BN_new()) == NULL)) goto cleanup;
+	if( ((diff = BN_new()) == NULL)) goto cleanup;
+	if( ((product = BN_new()) == NULL)) goto cleanup;
+	
+	for(j = first_sector; j < first_sector + num_sectors; j++){
+		size_t sector_size = 0;
+		size_t offset = (j - first_sector) * myparams->sector_size;
+
+		if( (myparams->block_size - (j * myparams->sector_size)) > myparams->sector_size)
+			sector_size = myparams->sector_size;
+		else
+			sector_size = (myparams->block_size - (j * myparams->sector_size));
+
+		/* Unchanged sectors contribute nothing */
+		if(memcmp(old_sectors + offset, new_sectors + offset, sector_size) == 0) continue;
+		
+		/* Convert the sectors into BIGNUMs */
+		if(!BN_bin2bn(old_sectors + offset, sector_size, old_message)) goto cleanup;
+		if(!BN_bin2bn(new_sectors + offset, sector_size, new_message)) goto cleanup;
+
+		/* Check to see if the messages are still elements of Zp */
+		if(BN_ucmp(old_message, global->Zp) == 1) goto cleanup;
+		if(BN_ucmp(new_message, global->Zp) == 1) goto cleanup;
+
+		/* alpha_j * (m'_ij - m_ij) */
+		if(!BN_mod_sub(diff, new_message, old_message, global->Zp, ctx)) goto cleanup;
+		if(!BN_mod_mul(product, alpha[j], diff, global->Zp, ctx)) goto cleanup;
+		
+		/* Add it into sigma_i */
+		if(!BN_mod_add(tag->sigma, tag->sigma, product, global->Zp, ctx)) goto cleanup;
+	}
+	
+	if(old_message) BN_clear_free(old_message);
+	if(new_message) BN_clear_free(new_message);
+	if(diff) BN_clear_free(diff);
+	if(product) BN_clear_free(product);
+	if(ctx) BN_CTX_free(ctx);
 	
+	return 1;
+
+cleanup:
+	if(old_message) BN_clear_free(old_message);
+	if(new_message) BN_clear_free(new_message);
+	if(diff) BN_clear_free(diff);
+	if(product) BN_clear_free(product);
+	if(ctx) BN_CTX_free(ctx);
+	
+	return 0;
+}
+
+/* cpor_update_tag: Updates tag in place after its whole block changes from old_block to new_block.  Only
+* the sectors that differ are folded into sigma.  Returns 1 on success, 0 on failure.
+*/
+int cpor_update_tag(CPOR_params *myparams, CPOR_global *global, BIGNUM **alpha, CPOR_tag *tag, unsigned char *old_block, unsigned char *new_block){
+
+	return cpor_update_tag_sectors(myparams, global, alpha, tag, 0, myparams->num_sectors, old_block, new_block);
+}
+
+/* insert_challenge_index: Adds index to a hash set of size (a power of two) slots; returns 0 if it was there */
+static int insert_challenge_index(uint64_t *set, uint64_t size, uint64_t index){
+
+	/* Fibonacci hashing spreads runs of nearby indices across the table */
+	uint64_t slot = (index * 0x9E3779B97F4A7C15ULL) & (size - 1);
+
+	while(set[slot]){
+		if(set[slot] == index + 1) return 0;
+		slot = (slot + 1) & (size - 1);
+	}
+	set[slot] = index + 1;
+
+	return 1;
+}
+
+/* cpor_create_challenge: Create a random challenge to send to the prover.  Takes in n, the number of blocks in the file.
+*  Returns an allocated and populated CPOR_challenge struct or NULL on failure.
+*/
+CPOR_challenge *cpor_create_challenge(CPOR_params *myparams, CPOR_global *global, uint64_t n){
+
+	CPOR_challenge_seed *seed = NULL;
+	CPOR_challenge *challenge = NULL;
+
+	if( ((seed = cpor_create_challenge_seed(myparams, n)) == NULL)) return NULL;
+	challenge = cpor_expand_challenge(global, seed);
+	destroy_cpor_challenge_seed(seed);
+
+	return challenge;
+}
+
+/* cpor_create_challenge_seed: Creates a compact challenge for a file of n blocks: a fresh random seed and the
+ * number of blocks to test, l.  Returns the seed or NULL on failure.
+ */
+CPOR_challenge_seed *cpor_create_challenge_seed(CPOR_params *myparams, uint64_t n){
+
+	CPOR_challenge_seed *seed = NULL;
+
+	if(!n) return NULL;
+
+	if( ((seed = allocate_cpor_challenge_seed()) == NULL)) goto cleanup;
+	if(!RAND_bytes(seed->seed, CPOR_CHALLENGE_SEED_SIZE)) goto cleanup;
+	seed->n = n;
+	seed->run = myparams->challenge_run;
+
 	/* Set l, the number of challenge blocks. */
 	if(n > myparams->num_challenge)
-		l = myparams->num_challenge;
+		seed->l = myparams->num_challenge;
 	else
-		l = n;
-	
+		seed->l = n;
 
-	/* Allocate memory */
-	if( ((challenge = allocate_cpor_challenge(l)) == NULL)) goto cleanup;
-	
-	/* Randomly choose l indices (without replacement) */
-	/* To do this, we create an array with all indices 0 - n-1, shuffle it, and take the first l values */
-	if( ((random_indices = malloc(sizeof(unsigned int) * n)) == NULL)) goto cleanup;
-	for(i = 0; i < n; i++)
-		random_indices[i] = i;
-	for(i = 0; i < n; i++){
-		get_rand_range(0, n-1, &swapwith);
-		tmp = random_indices[swapwith];
-		random_indices[swapwith] = random_indices[i];
-		random_indices[i] = tmp;
-	}
-	for(i = 0; i < l; i++){
-		challenge->I[i] = random_indices[i];
+	return seed;
+
+cleanup:
+	if(seed) destroy_cpor_challenge_seed(seed);
+
+	return NULL;
+}
+
+/* cpor_expand_challenge: Deterministically expands a compact challenge into its indices and nu values.  The
+ * values are drawn from the AES-256-CTR keystream under the seed, so the verifier and the prover arrive at the
+ * same challenge.  If seed->run is more than 1, the file is split into aligned runs of that many blocks and
+ * whole runs are chosen, enough to cover l blocks; challenge->l is then l rounded up to whole runs (less if
+ * the final, short run is chosen).  Every block still gets its own nu.
+ * Returns the challenge or NULL on failure.
+ */
+CPOR_challenge *cpor_expand_challenge(CPOR_global *global, CPOR_challenge_seed *seed){
+
+	CPOR_challenge *challenge = NULL;
+	CPOR_rand rng;
+	uint64_t i = 0, j = 0;
+	uint64_t n = 0;
+	uint64_t run = 1;
+	uint64_t numslots = 0, k = 0;
+	uint64_t l = 0;
+	uint64_t *chosen = NULL;
+	uint64_t chosen_size = 0;
+	uint64_t *slots = NULL;
+	uint64_t pick = 0;
+	unsigned char *Zp = NULL;
+	size_t Zp_size = 0;
+	
+	if(!global || !seed || !seed->n) return NULL;
+	if(!global->Zp || BN_is_zero(global->Zp)) return NULL;
+	if(seed->l > seed->n) return NULL;
+	n = seed->n;
+	if(seed->run > 1) run = seed->run;
+	
+	/* Choose k of the numslots runs (runs of one block when sampling independently) */
+	numslots = (n / run) + ((n % run) ? 1 : 0);
+	k = (seed->l / run) + ((seed->l % run) ? 1 : 0);
+	if(k > numslots) k = numslots;
+	
+	if(!init_cpor_rand_seeded(&rng, seed->seed)) return NULL;
+
+	/* Randomly choose k slots (without replacement) using Floyd's algorithm: for each j from numslots-k to
+	 * numslots-1, pick a random slot in [0, j] and take it, or j itself if it has already been taken.  Every
+	 * k-subset is equally likely, and the work and memory depend only on k, not on n. */
+	if( ((slots = malloc(sizeof(uint64_t) * (k ? k : 1))) == NULL)) goto cleanup;
+	for(chosen_size = 1; chosen_size < 2 * k; chosen_size <<= 1);
+	if( ((chosen = malloc(sizeof(uint64_t) * chosen_size)) == NULL)) goto cleanup;
+	memset(chosen, 0, sizeof(uint64_t) * chosen_size);
+	for(i = 0; i < k; i++){
+		if(!get_rand_range(&rng, 0, numslots - k + i, &pick)) goto cleanup;
+		if(!insert_challenge_index(chosen, chosen_size, pick)){
+			pick = numslots - k + i;
+			insert_challenge_index(chosen, chosen_size, pick);
+		}
+		slots[i] = pick;
+		/* The last run stops at the end of the file */
+		l += ((pick * run + run) > n) ? (n - pick * run) : run;
 	}
+	if(l > UINT_MAX) goto cleanup;
+
+	sfree(chosen, sizeof(uint64_t) * chosen_size);
+	chosen = NULL;
 
-	sfree(random_indices, sizeof(unsigned int) * n);
+	/* Allocate memory */
+	Zp_size = BN_num_bytes(global->Zp);
+	if( ((Zp = malloc(Zp_size)) == NULL)) goto cleanup;
+	if(BN_bn2bin(global->Zp, Zp) != Zp_size) goto cleanup;
+	if( ((challenge = allocate_cpor_challenge(l, Zp_size)) == NULL)) goto cleanup;
+
+	/* Lay out the blocks of each chosen run */
+	for(i = 0, l = 0; i < k; i++)
+		for(j = slots[i] * run; (j < slots[i] * run + run) && (j < n); j++)
+			challenge->I[l++] = j;
 	
-	/* Randomly choose l elements of Zp (with replacement) */
+	/* Randomly choose l elements of Zp (with replacement), straight into the flat array of nu's */
 	for(i = 0; i < l; i++)
-		if(!BN_rand_range(challenge->nu[i], global->Zp)) goto cleanup;
+		if(!get_rand_bin_range(&rng, cpor_challenge_nu(challenge, i), Zp, Zp_size)) goto cleanup;
 	
 	/* Set the global */
 	if(!BN_copy(challenge->global->Zp, global->Zp)) goto cleanup;
 	
+	sfree(slots, sizeof(uint64_t) * (k ? k : 1));
+	free(Zp);
+	clear_cpor_rand(&rng);
+	
 	return challenge;
 	
 cleanup:
 	if(challenge) destroy_cpor_challenge(challenge);
-	if(random_indices) sfree(random_indices, sizeof(unsigned int) * n);
+	if(chosen) sfree(chosen, sizeof(uint64_t) * chosen_size);
+	if(slots) sfree(slots, sizeof(uint64_t) * (k ? k : 1));
+	if(Zp) free(Zp);
+	clear_cpor_rand(&rng);
 	
 	return NULL;
 }
@@ -200,20 +372,22 @@ CPOR_proof *cpor_create_proof_final(CPOR_proof *proof){
 }
 
 /* For each message index i, call update (we're going to call this challenge->l times */
-CPOR_proof *cpor_create_proof_update(CPOR_params *myparams, CPOR_challenge *challenge, CPOR_proof *proof, CPOR_tag *tag, unsigned char *block, unsigned int index, unsigned int i){
+CPOR_proof *cpor_create_proof_update(CPOR_params *myparams, CPOR_challenge *challenge, CPOR_proof *proof, CPOR_tag *tag, unsigned char *block, uint64_t index, unsigned int i){
 
 	BN_CTX * ctx = NULL;
 	BIGNUM *message = NULL;
 	BIGNUM *product = NULL;
+	BIGNUM *nu = NULL;
 	int j = 0;	
 	
 	if(!challenge || !tag || !block) goto cleanup;
 	
 	if(!proof)
-		if( ((proof = allocate_cpor_proof()) == NULL)) goto cleanup;
+		if( ((proof = allocate_cpor_proof(myparams)) == NULL)) goto cleanup;
 	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
 	if( ((message = BN_new()) == NULL)) goto cleanup;
 	if( ((product = BN_new()) == NULL)) goto cleanup;
+	if( ((nu = BN_bin2bn(cpor_challenge_nu(challenge, i), challenge->element_size, NULL)) == NULL)) goto cleanup;
 	
 	/* Calculate and update the mu's */	
 	for(j = 0; j < myparams->num_sectors; j++){
@@ -232,7 +406,7 @@ CPOR_proof *cpor_create_proof_update(CPOR_params *myparams, CPOR_challenge *chal
 		if(BN_ucmp(message, challenge->global->Zp) == 1) goto cleanup;
 
 		/* multiply nu_i and m_ij */
-		if(!BN_mod_mul(product, challenge->nu[i], message, challenge->global->Zp, ctx)) goto cleanup;
+		if(!BN_mod_mul(product, nu, message, challenge->global->Zp, ctx)) goto cleanup;
 
 		/* Sum the nu_i-m_ij products together */
 		if(!BN_mod_add(proof->mu[j], proof->mu[j], product, challenge->global->Zp, ctx)) goto cleanup;
@@ -241,13 +415,14 @@ CPOR_proof *cpor_create_proof_update(CPOR_params *myparams, CPOR_challenge *chal
 	
 	/* Calculate sigma */
 	/* multiply nu_i (challenge) and sigma_i (tag) */
-	if(!BN_mod_mul(product, challenge->nu[i], tag->sigma, challenge->global->Zp, ctx)) goto cleanup;
+	if(!BN_mod_mul(product, nu, tag->sigma, challenge->global->Zp, ctx)) goto cleanup;
 
 	/* Sum the nu_i-sigma_i products together */
 	if(!BN_mod_add(proof->sigma, proof->sigma, product, challenge->global->Zp, ctx)) goto cleanup;
 	
 	if(message) BN_clear_free(message);
 	if(product) BN_clear_free(product);	
+	if(nu) BN_clear_free(nu);
 	if(ctx) BN_CTX_free(ctx);
 	
 	return proof;
@@ -256,65 +431,281 @@ cleanup:
 	if(proof) destroy_cpor_proof(myparams, proof);
 	if(message) BN_clear_free(message);
 	if(product) BN_clear_free(product);
+	if(nu) BN_clear_free(nu);
 	if(ctx) BN_CTX_free(ctx);
 		
 	return NULL;
 }
 
-
-int cpor_verify_proof(CPOR_params *myparams, CPOR_global *global, CPOR_proof *proof, CPOR_challenge *challenge, unsigned char *k_prf, BIGNUM **alpha){
+/* cpor_aggregate_proof_update: Adds weight times proof to aggregate (a NULL weight counts as 1), allocating
+* aggregate if it is NULL.  Returns aggregate, or NULL on failure, in which case aggregate has been freed.
+*/
+CPOR_proof *cpor_aggregate_proof_update(CPOR_params *myparams, CPOR_global *global, CPOR_proof *aggregate, CPOR_proof *proof, BIGNUM *weight){
 
 	BN_CTX * ctx = NULL;
-	BIGNUM *prf_i = NULL;
 	BIGNUM *product = NULL;
-	BIGNUM *sigma = NULL;
-	int i = 0, j = 0, ret = -1;
+	int j = 0;
 
-	if(!global || !proof || !challenge || !k_prf || !alpha) return -1;
+	if(!global || !proof) goto cleanup;
 
+	if(!aggregate)
+		if( ((aggregate = allocate_cpor_proof(myparams)) == NULL)) goto cleanup;
 	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
 	if( ((product = BN_new()) == NULL)) goto cleanup;
-	if( ((sigma = BN_new()) == NULL)) goto cleanup;
-		
-	/* Compute the summation of all the products (nu_i * PRF_k(i)) */
+
+	if(weight){
+		if(!BN_mod_mul(product, weight, proof->sigma, global->Zp, ctx)) goto cleanup;
+	}else{
+		if(!BN_copy(product, proof->sigma)) goto cleanup;
+	}
+	if(!BN_mod_add(aggregate->sigma, aggregate->sigma, product, global->Zp, ctx)) goto cleanup;
+	for(j = 0; j < myparams->num_sectors; j++){
+		if(weight){
+			if(!BN_mod_mul(product, weight, proof->mu[j], global->Zp, ctx)) goto cleanup;
+		}else{
+			if(!BN_copy(product, proof->mu[j])) goto cleanup;
+		}
+		if(!BN_mod_add(aggregate->mu[j], aggregate->mu[j], product, global->Zp, ctx)) goto cleanup;
+	}
+
+	BN_clear_free(product);
+	BN_CTX_free(ctx);
+
+	return aggregate;
+
+cleanup:
+	if(aggregate) destroy_cpor_proof(myparams, aggregate);
+	if(product) BN_clear_free(product);
+	if(ctx) BN_CTX_free(ctx);
+
+	return NULL;
+}
+
+/* cpor_combine_proofs: Sums partial proofs, each computed over a disjoint part of the same challenge (see
+* cpor_prove_shard), into the proof of the whole challenge.  Since sigma and the mu's are sums over the
+* challenged blocks, the result is exactly the proof a single prover would have produced, and
+* cpor_verify_proof accepts it unchanged.  Returns a new proof, or NULL on failure.
+*/
+CPOR_proof *cpor_combine_proofs(CPOR_params *myparams, CPOR_challenge *challenge, CPOR_proof **proofs, unsigned int numproofs){
+
+	CPOR_proof *proof = NULL;
+	unsigned int k = 0;
+
+	if(!challenge || !proofs) return NULL;
+
+	if( ((proof = allocate_cpor_proof(myparams)) == NULL)) return NULL;
+	for(k = 0; k < numproofs; k++)
+		if( ((proof = cpor_aggregate_proof_update(myparams, challenge->global, proof, proofs[k], NULL)) == NULL)) return NULL;
+
+	return proof;
+}
+
+/* cpor_prf_sum: Adds the sum over the challenged blocks of nu_i * PRF_k(i), times weight if it isn't NULL,
+* to sum. */
+static int cpor_prf_sum(CPOR_params *myparams, CPOR_global *global, CPOR_challenge *challenge, unsigned char *k_prf,
+                        BIGNUM *weight, BIGNUM *sum, BN_CTX *ctx){
+
+	BIGNUM *prf_i = NULL;
+	BIGNUM *nu = NULL;
+	BIGNUM *product = NULL;
+	BIGNUM *partial = NULL;
+	int i = 0, ret = 0;
+
+	if( ((nu = BN_new()) == NULL)) goto cleanup;
+	if( ((product = BN_new()) == NULL)) goto cleanup;
+	if( ((partial = BN_new()) == NULL)) goto cleanup;
+	BN_zero(partial);
+
 	for(i = 0; i < challenge->l; i++){
 		/* compute PRF_k(i) */
 		if( ((prf_i = generate_prf_i(myparams, k_prf, challenge->I[i])) == NULL)) goto cleanup;
 
-		/* Multiply prf_i by nu_i */
-		if(!BN_mod_mul(product, challenge->nu[i], prf_i, global->Zp, ctx)) goto cleanup;
+		/* Multiply prf_i by nu_i, read into the one BIGNUM */
+		if(!BN_bin2bn(cpor_challenge_nu(challenge, i), challenge->element_size, nu)) goto cleanup;
+		if(!BN_mod_mul(product, nu, prf_i, global->Zp, ctx)) goto cleanup;
 		
 		/* Sum the results */
-		if(!BN_mod_add(sigma, sigma, product, global->Zp, ctx)) goto cleanup;
+		if(!BN_mod_add(partial, partial, product, global->Zp, ctx)) goto cleanup;
 		
-		if(prf_i) BN_clear_free(prf_i);
+		BN_clear_free(prf_i);
+		prf_i = NULL;
 	}
+	if(weight)
+		if(!BN_mod_mul(partial, partial, weight, global->Zp, ctx)) goto cleanup;
+	if(!BN_mod_add(sum, sum, partial, global->Zp, ctx)) goto cleanup;
+	ret = 1;
+
+cleanup:
+	if(prf_i) BN_clear_free(prf_i);
+	if(nu) BN_clear_free(nu);
+	if(product) BN_clear_free(product);
+	if(partial) BN_clear_free(partial);
+
+	return ret;
+}
+
+/* cpor_verify_prepare: Does the part of verifying a proof for challenge that doesn't depend on the proof:
+* the sum of nu_i * PRF_k(i) over the challenged blocks.  It can be done while the prover works, or ahead
+* of time (see cpor_create_verify_pool), leaving cpor_verify_finish just the alpha * mu dot product.  alpha
+* is copied, so the file's secrets needn't be kept around.  Returns the prepared state, or NULL on failure.
+*/
+CPOR_prepared *cpor_verify_prepare(CPOR_params *myparams, CPOR_global *global, CPOR_challenge *challenge, unsigned char *k_prf, BIGNUM **alpha){
+
+	BN_CTX * ctx = NULL;
+	CPOR_prepared *prepared = NULL;
+	int j = 0;
+
+	if(!global || !challenge || !k_prf || !alpha) return NULL;
+
+	if( ((prepared = allocate_cpor_prepared(myparams)) == NULL)) goto cleanup;
+	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
+	if(!BN_copy(prepared->global->Zp, global->Zp)) goto cleanup;
+	for(j = 0; j < myparams->num_sectors; j++)
+		if(!BN_copy(prepared->alpha[j], alpha[j])) goto cleanup;
+
+	/* Compute the summation of all the products (nu_i * PRF_k(i)) */
+	if(!cpor_prf_sum(myparams, global, challenge, k_prf, NULL, prepared->prf_sum, ctx)) goto cleanup;
+
+	BN_CTX_free(ctx);
+
+	return prepared;
+
+cleanup:
+	if(prepared) destroy_cpor_prepared(myparams, prepared);
+	if(ctx) BN_CTX_free(ctx);
+
+	return NULL;
+}
+
+/* cpor_verify_finish: Completes verifying proof against a challenge prepared with cpor_verify_prepare.
+* Returns 1 if the proof verifies, 0 if it doesn't and -1 on error.
+*/
+int cpor_verify_finish(CPOR_params *myparams, CPOR_prepared *prepared, CPOR_proof *proof){
+
+	BN_CTX * ctx = NULL;
+	BIGNUM *product = NULL;
+	BIGNUM *sigma = NULL;
+	int j = 0, ret = -1;
+
+	if(!prepared || !proof) return -1;
+
+	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
+	if( ((product = BN_new()) == NULL)) goto cleanup;
+	if( ((sigma = BN_dup(prepared->prf_sum)) == NULL)) goto cleanup;
 	
 	/* Compute the summation of all the products (alpha_j * mu_j) */
 	for(j = 0; j < myparams->num_sectors; j++){
 		
 		/* Multiply alpha_j by mu_j */
-		if(!BN_mod_mul(product, alpha[j], proof->mu[j], global->Zp, ctx)) goto cleanup;	
+		if(!BN_mod_mul(product, prepared->alpha[j], proof->mu[j], prepared->global->Zp, ctx)) goto cleanup;	
 		
 		/* Sum the results */
-		if(!BN_mod_add(sigma, sigma, product, global->Zp, ctx)) goto cleanup;
+		if(!BN_mod_add(sigma, sigma, product, prepared->global->Zp, ctx)) goto cleanup;
 	}
 
 	if(BN_ucmp(sigma, proof->sigma) == 0) ret = 1;
 	else ret = 0;
 	
-
+cleanup:
 	if(product) BN_clear_free(product);
 	if(sigma) BN_clear_free(sigma);
 	if(ctx) BN_CTX_free(ctx);
 		
 	return ret;
-	
+}
+
+/* cpor_verify_finish_view: cpor_verify_finish for a proof decoded in place with cpor_decode_proof.  Each mu_j
+* is loaded into the same scratch BIGNUM in turn and sigma is compared as bytes, so checking the proof allocates
+* nothing per element.  Returns 1 if the proof verifies, 0 if it doesn't and -1 on error.
+*/
+int cpor_verify_finish_view(CPOR_params *myparams, CPOR_prepared *prepared, CPOR_proof_view *proof){
+
+	BN_CTX * ctx = NULL;
+	BIGNUM *mu = NULL;
+	BIGNUM *product = NULL;
+	BIGNUM *sigma = NULL;
+	unsigned char *expected = NULL;
+	int j = 0, ret = -1;
+
+	if(!prepared || !proof || (proof->num_sectors != myparams->num_sectors)) return -1;
+	/* A proof padded narrower than Zp can't hold its elements */
+	if(proof->element_size < BN_num_bytes(prepared->global->Zp)) return 0;
+
+	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
+	if( ((mu = BN_new()) == NULL)) goto cleanup;
+	if( ((product = BN_new()) == NULL)) goto cleanup;
+	if( ((sigma = BN_dup(prepared->prf_sum)) == NULL)) goto cleanup;
+	if( ((expected = malloc(proof->element_size)) == NULL)) goto cleanup;
+
+	for(j = 0; j < myparams->num_sectors; j++){
+		if(!BN_bin2bn(proof->mu + ((size_t)j * proof->element_size), proof->element_size, mu)) goto cleanup;
+		if(!BN_mod_mul(product, prepared->alpha[j], mu, prepared->global->Zp, ctx)) goto cleanup;
+		if(!BN_mod_add(sigma, sigma, product, prepared->global->Zp, ctx)) goto cleanup;
+	}
+
+	if(BN_bn2binpad(sigma, expected, proof->element_size) < 0) goto cleanup;
+	ret = (CRYPTO_memcmp(expected, proof->sigma, proof->element_size) == 0);
+
 cleanup:
-	if(prf_i) BN_clear_free(prf_i);
+	if(expected) sfree(expected, proof->element_size);
+	if(mu) BN_clear_free(mu);
 	if(product) BN_clear_free(product);
 	if(sigma) BN_clear_free(sigma);
 	if(ctx) BN_CTX_free(ctx);
-		
-	return -1;
+
+	return ret;
+}
+
+int cpor_verify_proof(CPOR_params *myparams, CPOR_global *global, CPOR_proof *proof, CPOR_challenge *challenge, unsigned char *k_prf, BIGNUM **alpha){
+
+	CPOR_prepared *prepared = NULL;
+	int ret = -1;
+
+	if(!global || !proof || !challenge || !k_prf || !alpha) return -1;
+
+	if( ((prepared = cpor_verify_prepare(myparams, global, challenge, k_prf, alpha)) == NULL)) return -1;
+	ret = cpor_verify_finish(myparams, prepared, proof);
+	destroy_cpor_prepared(myparams, prepared);
+
+	return ret;
+}
+
+/* cpor_verify_aggregate_proof: Verifies a single proof for an aggregate challenge over several files, which
+* must all have been tagged with the same alphas (k_prf[f] is file f's PRF key).  The proof is checked as
+* sigma = sum_f weight_f * sum_i nu_fi * PRF_kf(i) + sum_j alpha_j * mu_j, so apart from the PRFs, which
+* are needed per challenged block anyway, the work is per sector rather than per file.  Returns 1 if the
+* proof verifies, 0 if it doesn't and -1 on error.
+*/
+int cpor_verify_aggregate_proof(CPOR_params *myparams, CPOR_global *global, CPOR_proof *proof, CPOR_aggregate_challenge *challenge,
+                                unsigned char **k_prf, BIGNUM **alpha){
+
+	BN_CTX * ctx = NULL;
+	BIGNUM *product = NULL;
+	BIGNUM *sigma = NULL;
+	unsigned int f = 0;
+	int j = 0, ret = -1;
+
+	if(!global || !proof || !challenge || !k_prf || !alpha) return -1;
+
+	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
+	if( ((product = BN_new()) == NULL)) goto cleanup;
+	if( ((sigma = BN_new()) == NULL)) goto cleanup;
+
+	for(f = 0; f < challenge->numfiles; f++)
+		if(!cpor_prf_sum(myparams, global, challenge->challenges[f], k_prf[f], challenge->weights[f], sigma, ctx)) goto cleanup;
+
+	for(j = 0; j < myparams->num_sectors; j++){
+		if(!BN_mod_mul(product, alpha[j], proof->mu[j], global->Zp, ctx)) goto cleanup;
+		if(!BN_mod_add(sigma, sigma, product, global->Zp, ctx)) goto cleanup;
+	}
+
+	if(BN_ucmp(sigma, proof->sigma) == 0) ret = 1;
+	else ret = 0;
+
+cleanup:
+	if(product) BN_clear_free(product);
+	if(sigma) BN_clear_free(sigma);
+	if(ctx) BN_CTX_free(ctx);
+
+	return ret;
 }
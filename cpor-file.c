@@ -28,29 +28,240 @@
 */
 
 #include "cpor.h"
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #ifdef THREADING
 #include <pthread.h>
+#include <aio.h>
+#include <errno.h>
+#include <dirent.h>
 #endif
 
-static int write_cpor_tag(FILE *tagfile, CPOR_tag *tag){
+/* Number of upcoming challenged blocks the prover asks the kernel to prefetch */
+#define CPOR_READAHEAD_BLOCKS 16
+
+/* Interleaved data+tag containers: a CPOR_CONTAINER_HEADER_SIZE header, then groups of
+ * CPOR_CONTAINER_GROUP_BLOCKS data blocks each followed by a trailer holding their tags.  The last group may
+ * be short. */
+#define CPOR_CONTAINER_MAGIC "CPORCTR1"
+#define CPOR_CONTAINER_VERSION 1
+#define CPOR_CONTAINER_HEADER_SIZE 4096
+#define CPOR_CONTAINER_GROUP_BLOCKS 16
+/* Trailers are padded to a multiple of this so data blocks stay aligned */
+#define CPOR_CONTAINER_ALIGN 4096
+
+/* Most consecutive challenged blocks the prover reads with a single call */
+#define CPOR_PROVE_RUN_BLOCKS 64
+
+/* Buffer and offset alignment required for direct (uncached) reads */
+#define CPOR_DIRECT_IO_ALIGN 4096
+
+/* A challenged block index paired with its position i in the challenge, so that the prover can visit
+ * blocks in offset order while still applying the matching nu_i */
+struct challenge_order{
+	uint64_t index;
+	unsigned int i;
+};
+
+static int compare_challenge_order(const void *a, const void *b){
+
+	const struct challenge_order *x = a;
+	const struct challenge_order *y = b;
+
+	if(x->index < y->index) return -1;
+	if(x->index > y->index) return 1;
+	return 0;
+}
+
+static void cpor_readahead(int fd, off_t offset, off_t len){
+
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+#endif
+}
+
+/* init_cpor_header: Fills in a tag or t file header describing myparams. */
+static void init_cpor_header(CPOR_params *myparams, CPOR_file_header *header, const char *magic, uint32_t flags,
+                             size_t sigma_size, uint64_t n){
+
+	memset(header, 0, sizeof(CPOR_file_header));
+	memcpy(header->magic, magic, sizeof(header->magic));
+	header->version = CPOR_FORMAT_VERSION;
+	header->header_size = sizeof(CPOR_file_header);
+	header->flags = flags;
+	header->prf_mode = CPOR_PRF_HMAC_SHA1;
+	header->lambda = myparams->lambda;
+	header->Zp_bits = myparams->Zp_bits;
+	header->prf_key_size = myparams->prf_key_size;
+	header->block_size = myparams->block_size;
+	header->sector_size = myparams->sector_size;
+	header->num_sectors = myparams->num_sectors;
+	header->sigma_size = sigma_size;
+	header->n = n;
+}
+
+/* read_cpor_header: Reads a header with the given magic from the current position of file, leaving file
+* positioned at the first record.  Each format version has exactly one header size, so a header whose
+* header_size isn't that of CPOR_FORMAT_VERSION is damaged.  Returns 1 if there is one, 0 if there isn't (a
+* file written before headers were added), in which case file is left where it was, or -1 if the header is
+* from another or damaged format.
+*/
+static int read_cpor_header(FILE *file, const char *magic, CPOR_file_header *header){
+
+	off_t pos = 0;
+
+	memset(header, 0, sizeof(CPOR_file_header));
+	if((pos = ftello(file)) < 0) return -1;
+	if((fread(header, sizeof(header->magic), 1, file) != 1) || memcmp(header->magic, magic, sizeof(header->magic))){
+		clearerr(file);
+		if(fseeko(file, pos, SEEK_SET) < 0) return -1;
+		memset(header, 0, sizeof(CPOR_file_header));
+		return 0;
+	}
+	if(fread((unsigned char *)header + sizeof(header->magic), sizeof(CPOR_file_header) - sizeof(header->magic), 1, file) != 1) return -1;
+	if(header->version != CPOR_FORMAT_VERSION){
+		fprintf(stderr, "ERROR: Unsupported file format version %u.\n", header->version);
+		return -1;
+	}
+	if(header->header_size != sizeof(CPOR_file_header)){
+		fprintf(stderr, "ERROR: Damaged file header.\n");
+		return -1;
+	}
+	if(header->prf_mode != CPOR_PRF_HMAC_SHA1){
+		fprintf(stderr, "ERROR: Unsupported PRF mode %u.\n", header->prf_mode);
+		return -1;
+	}
+	if(fseeko(file, pos + header->header_size, SEEK_SET) < 0) return -1;
+
+	return 1;
+}
+
+/* check_cpor_header: Makes sure a file's header agrees with the parameters we're about to use on it.
+* Returns 1 if it does, 0 otherwise.
+*/
+static int check_cpor_header(CPOR_params *myparams, CPOR_file_header *header){
+
+	if((header->block_size != myparams->block_size) || (header->sector_size != myparams->sector_size) ||
+		(header->num_sectors != myparams->num_sectors) || (header->prf_key_size != myparams->prf_key_size) ||
+		(header->Zp_bits != myparams->Zp_bits)){
+		fprintf(stderr, "ERROR: The file was made with block size %u, sector size %u, %u sectors and a %u bit Zp; "
+			"use cpor_read_params to pick them up.\n", header->block_size, header->sector_size, header->num_sectors, header->Zp_bits);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* write_cpor_tag_header: Writes the header of a tag file (a fixed-width array of n sigmas, each sigma_size
+* bytes) to tagfile.  Must come before the first tag.  Returns 1 on success, 0 on failure.
+*/
+int write_cpor_tag_header(CPOR_params *myparams, FILE *tagfile, size_t sigma_size, uint64_t n){
+
+	CPOR_file_header header;
+
+	if(!myparams || !tagfile) return 0;
+	init_cpor_header(myparams, &header, CPOR_TAG_MAGIC, CPOR_FORMAT_FIXED_WIDTH, sigma_size, n);
+	if(fwrite(&header, sizeof(CPOR_file_header), 1, tagfile) != 1) return 0;
+
+	return 1;
+}
+
+/* cpor_read_params: Takes the parameters (lambda, Zp_bits, the key sizes, the block and sector sizes and the
+* number of sectors) from the header of the tag or t file at filepath, so they needn't be supplied again.
+* Returns 1 if the file has a header, 0 if it doesn't (myparams is then left alone) or can't be read.
+*/
+int cpor_read_params(CPOR_params *myparams, char *filepath){
+
+	CPOR_file_header header;
+	FILE *file = NULL;
+	int ret = 0;
+
+	if(!myparams || !filepath) return 0;
+	file = fopen(filepath, "rb");
+	if(!file) return 0;
+	ret = read_cpor_header(file, CPOR_T_MAGIC, &header);
+	if(ret == 0) ret = read_cpor_header(file, CPOR_TAG_MAGIC, &header);
+	fclose(file);
+	if(ret != 1) return 0;
+
+	myparams->lambda = header.lambda;
+	myparams->Zp_bits = header.Zp_bits;
+	myparams->prf_key_size = header.prf_key_size;
+	myparams->block_size = header.block_size;
+	myparams->sector_size = header.sector_size;
+	myparams->num_sectors = header.num_sectors;
+
+	return 1;
+}
+
+/* cpor_parse_tag_header: Reads the header of a fixed-width tag file (or shard) from the len bytes at buf, for
+* provers that fetch the tag file's pieces rather than open it.  The header must agree with myparams.  Returns 1
+* on success, 0 if buf doesn't hold such a header.
+*/
+int cpor_parse_tag_header(CPOR_params *myparams, unsigned char *buf, size_t len, CPOR_file_header *header){
+
+	FILE *file = NULL;
+	int ret = 0;
+
+	if(!myparams || !buf || !len || !header) return 0;
+	if( ((file = fmemopen(buf, len, "rb")) == NULL)) return 0;
+	ret = (read_cpor_header(file, CPOR_TAG_MAGIC, header) == 1) && (header->flags & CPOR_FORMAT_FIXED_WIDTH) &&
+		header->sigma_size && check_cpor_header(myparams, header);
+	fclose(file);
+
+	return ret;
+}
+
+/* write_cpor_tag: Writes tag to a tag file as the next entry of its fixed-width array: sigma, zero-padded to
+* sigma_size bytes (the size of Zp), so it can be found by index and rewritten in place.
+*/
+static int write_cpor_tag(FILE *tagfile, CPOR_tag *tag, size_t sigma_size){
 	
 	unsigned char *sigma = NULL;
-	size_t sigma_size = 0;
 	
 	if(!tagfile || !tag) return 0;
+	if(BN_num_bytes(tag->sigma) > sigma_size) return 0;
+	
+	if( ((sigma = malloc(sigma_size)) == NULL)) return 0;
+	memset(sigma, 0, sigma_size);
+	if(BN_bn2binpad(tag->sigma, sigma, sigma_size) < 0) goto cleanup;
+	if(fwrite(sigma, sigma_size, 1, tagfile) != 1) goto cleanup;
+	
+	sfree(sigma, sigma_size);
+	
+	return 1;
+	
+cleanup:
+	sfree(sigma, sigma_size);
+	return 0;
+}
+
+/* write_cpor_tag_record: Writes tag in the format used by tag files without a header, which is still what is
+* appended to such files.  sigma is zero-padded to sigma_size bytes (the size of Zp) so every tag in the file
+* has the same width and can be rewritten in place.  The index field on disk keeps its original 32-bit width
+* and holds the low 32 bits of the index; a tag's full index is its position in the file.
+*/
+static int write_cpor_tag_record(FILE *tagfile, CPOR_tag *tag, size_t sigma_size){
+	
+	unsigned char *sigma = NULL;
+	unsigned int index32 = 0;
+	
+	if(!tagfile || !tag) return 0;
+	if(BN_num_bytes(tag->sigma) > sigma_size) return 0;
 	
 	/* Write sigma (size of sigma, then sigma itself) */
-	sigma_size = BN_num_bytes(tag->sigma);
 	fwrite(&sigma_size, sizeof(size_t), 1, tagfile);
 	if(ferror(tagfile)) goto cleanup;
 	if( ((sigma = malloc(sigma_size)) == NULL)) goto cleanup;
 	memset(sigma, 0, sigma_size);
-	if(!BN_bn2bin(tag->sigma, sigma)) goto cleanup;
+	if(BN_bn2binpad(tag->sigma, sigma, sigma_size) < 0) goto cleanup;
 	fwrite(sigma, sigma_size, 1, tagfile);
 	if(ferror(tagfile)) goto cleanup;
 	
 	/* write index */
-	fwrite(&(tag->index), sizeof(unsigned int), 1, tagfile);
+	index32 = (unsigned int)tag->index;
+	fwrite(&index32, sizeof(unsigned int), 1, tagfile);
 	if(ferror(tagfile)) goto cleanup;	
 	
 	if(sigma) sfree(sigma, sigma_size);
@@ -62,27 +273,54 @@ cleanup:
 	return 0;
 }
 
-CPOR_tag *read_cpor_tag(FILE *tagfile, unsigned int index){
+/* skip_cpor_tags: Advances tagfile, positioned at the start of a tag, past count tags. */
+static int skip_cpor_tags(FILE *tagfile, uint64_t count){
+
+	size_t sigma_size = 0;
+	uint64_t i = 0;
+
+	for(i = 0; i < count; i++){
+		if(fread(&sigma_size, sizeof(size_t), 1, tagfile) != 1) return 0;
+		if(fseeko(tagfile, (sigma_size + sizeof(unsigned int)), SEEK_CUR) < 0) return 0;
+	}
+
+	return 1;
+}
+
+/* read_cpor_tag_from: Reads the tag for block index from a tag file.  If header is the (fixed-width) header
+* of the file, the tag is read directly from its offset and from is ignored.  Otherwise the file is one without
+* a header, currently positioned at the start of tag from (from <= index), and is walked forward to index.
+* On success the file is left positioned at the start of tag index+1, so callers visiting tags in ascending
+* order never rescan the file from the start.
+*/
+static CPOR_tag *read_cpor_tag_from(FILE *tagfile, CPOR_file_header *header, uint64_t from, uint64_t index){
 
 	CPOR_tag *tag = NULL;
 	size_t sigma_size = 0;
 	unsigned char *sigma = NULL;
-	int i = 0;
+	unsigned int index32 = 0;
 
 	if(!tagfile) return NULL;
 	
 	/* Allocate memory */
 	if( ((tag = allocate_cpor_tag()) == NULL)) goto cleanup;
 	
-	/* Seek to start of tag file */
-	if(fseek(tagfile, 0, SEEK_SET) < 0) goto cleanup;
+	if(header && (header->flags & CPOR_FORMAT_FIXED_WIDTH)){
+		if((index < header->first) || (index - header->first >= header->n)) goto cleanup;
+		sigma_size = header->sigma_size;
+		if(fseeko(tagfile, (off_t)header->header_size + (off_t)(index - header->first) * sigma_size, SEEK_SET) < 0) goto cleanup;
+		if( ((sigma = malloc(sigma_size)) == NULL)) goto cleanup;
+		if(fread(sigma, sigma_size, 1, tagfile) != 1) goto cleanup;
+		if(!BN_bin2bn(sigma, sigma_size, tag->sigma)) goto cleanup;
+		tag->index = index;
+		sfree(sigma, sigma_size);
+		
+		return tag;
+	}
+	if(from > index) goto cleanup;
 	
 	/* Seek to tag offset index */
-	for(i = 0; i < index; i++){
-		fread(&sigma_size, sizeof(size_t), 1, tagfile);
-		if(ferror(tagfile)) goto cleanup;
-		if(fseek(tagfile, (sigma_size + sizeof(unsigned int)), SEEK_CUR) < 0) goto cleanup;
-	}
+	if(!skip_cpor_tags(tagfile, index - from)) goto cleanup;
 	
 	/* Read in the sigma we're looking for */
 	fread(&sigma_size, sizeof(size_t), 1, tagfile);
@@ -93,9 +331,11 @@ CPOR_tag *read_cpor_tag(FILE *tagfile, unsigned int index){
 	if(ferror(tagfile)) goto cleanup;
 	if(!BN_bin2bn(sigma, sigma_size, tag->sigma)) goto cleanup;
 	
-	/* read index */
-	fread(&(tag->index), sizeof(unsigned int), 1, tagfile);
+	/* read index; only its low 32 bits are stored */
+	fread(&index32, sizeof(unsigned int), 1, tagfile);
 	if(ferror(tagfile)) goto cleanup;
+	if(index32 != (unsigned int)index) goto cleanup;
+	tag->index = index;
 	
 	if(sigma) sfree(sigma, sigma_size);
 	
@@ -108,6 +348,92 @@ cleanup:
 	return NULL;
 }
 
+CPOR_tag *read_cpor_tag(FILE *tagfile, uint64_t index){
+
+	CPOR_file_header header;
+	int ret = 0;
+
+	if(!tagfile) return NULL;
+	
+	/* Seek to start of tag file */
+	if(fseek(tagfile, 0, SEEK_SET) < 0) return NULL;
+	if((ret = read_cpor_header(tagfile, CPOR_TAG_MAGIC, &header)) < 0) return NULL;
+	
+	return read_cpor_tag_from(tagfile, (ret == 1) ? &header : NULL, 0, index);
+}
+
+/* cpor_shard_tags: Writes the tags of blocks first through last-1 from the tag file at tagfilepath (which may
+* itself be a shard, or a tag file without a header) to a new tag file shard at shardpath, for a prover that
+* only holds those blocks; see cpor_prove_shard.  Returns 1 on success, 0 on failure.
+*/
+int cpor_shard_tags(CPOR_params *myparams, char *tagfilepath, char *shardpath, uint64_t first, uint64_t last){
+
+	CPOR_file_header header;
+	CPOR_file_header *headerp = NULL;
+	CPOR_file_header shardheader;
+	FILE *tagfile = NULL;
+	FILE *shardfile = NULL;
+	CPOR_tag *tag = NULL;
+	size_t sigma_size = 0;
+	uint64_t index = 0;
+	int ret = 0;
+
+	if(!myparams || !tagfilepath || !shardpath || (first >= last)) return 0;
+
+	tagfile = fopen(tagfilepath, "rb");
+	if(!tagfile){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", tagfilepath);
+		return 0;
+	}
+	if((ret = read_cpor_header(tagfile, CPOR_TAG_MAGIC, &header)) < 0) goto cleanup;
+	if(ret == 1){
+		if(!check_cpor_header(myparams, &header)) goto cleanup;
+		if((first < header.first) || (last - header.first > header.n)){
+			fprintf(stderr, "ERROR: %s doesn't hold the tags of blocks %llu through %llu.\n", tagfilepath,
+				(unsigned long long)first, (unsigned long long)(last - 1));
+			goto cleanup;
+		}
+		headerp = &header;
+		sigma_size = header.sigma_size;
+	}else{
+		/* Sigmas in older tag files are padded to the size of Zp, which has exactly Zp_bits bits */
+		sigma_size = (myparams->Zp_bits + 7) / 8;
+		if(!skip_cpor_tags(tagfile, first)) goto cleanup;
+	}
+
+	shardfile = fopen(shardpath, "wb");
+	if(!shardfile){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", shardpath);
+		goto cleanup;
+	}
+	init_cpor_header(myparams, &shardheader, CPOR_TAG_MAGIC, CPOR_FORMAT_FIXED_WIDTH | CPOR_FORMAT_SHARD, sigma_size, last - first);
+	shardheader.first = first;
+	if(fwrite(&shardheader, sizeof(CPOR_file_header), 1, shardfile) != 1) goto cleanup;
+
+	for(index = first; index < last; index++){
+		tag = read_cpor_tag_from(tagfile, headerp, index, index);
+		if(!tag) goto cleanup;
+		if(!write_cpor_tag(shardfile, tag, sigma_size)) goto cleanup;
+		destroy_cpor_tag(tag);
+		tag = NULL;
+	}
+
+	fclose(tagfile);
+	if(fclose(shardfile) != 0){ unlink(shardpath); return 0; }
+
+	return 1;
+
+cleanup:
+	fprintf(stderr, "ERROR: Was unable to shard %s.\n", tagfilepath);
+	if(tag) destroy_cpor_tag(tag);
+	if(tagfile) fclose(tagfile);
+	if(shardfile){
+		fclose(shardfile);
+		unlink(shardpath);
+	}
+	return 0;
+}
+
 static int write_cpor_t(CPOR_params *myparams, FILE *tfile, CPOR_key *key, CPOR_t *t){
 	
 	unsigned char *enc_input = NULL;
@@ -120,10 +446,15 @@ static int write_cpor_t(CPOR_params *myparams, FILE *tfile, CPOR_key *key, CPOR_
 	size_t t0_size = 0;
 	size_t t0_mac_size = 0;
 	size_t alpha_size = 0;
+	CPOR_file_header header;
 	int i = 0;
 	
 	if(!tfile || !key || !t) return 0;
 
+	/* Describe the parameters t was made with, so the verifier and prover needn't be told them again */
+	init_cpor_header(myparams, &header, CPOR_T_MAGIC, 0, BN_num_bytes(key->global->Zp), t->n);
+	if(fwrite(&header, sizeof(CPOR_file_header), 1, tfile) != 1) return 0;
+
 	/* Prepare to encrypt k_prf and alphas */ 
 	enc_input_size = myparams->prf_key_size;
 	if( ((enc_input = malloc(enc_input_size)) == NULL)) goto cleanup;
@@ -141,21 +472,21 @@ static int write_cpor_t(CPOR_params *myparams, FILE *tfile, CPOR_key *key, CPOR_
 		sfree(alpha, alpha_size);
 	}
 
-	/* t0_size is the size of our index, n, plus the resulting ciphertext */
-	t0_size = sizeof(unsigned int) + get_ciphertext_size(enc_input_size);
+	/* t0_size is the size of our index, n (64 bits), plus the resulting ciphertext */
+	t0_size = sizeof(uint64_t) + get_ciphertext_size(enc_input_size);
 	if( ((t0 = malloc(t0_size)) == NULL)) goto cleanup;
 	memset(t0, 0, t0_size);
 	/* Copy the number of blocks in the file into t0 */
-	memcpy(t0, &(t->n), sizeof(unsigned int));
+	memcpy(t0, &(t->n), sizeof(uint64_t));
 	
 	t0_mac_size = get_authenticator_size();
 	if( ((t0_mac = malloc(t0_mac_size)) == NULL)) goto cleanup;
 	memset(t0_mac, 0, t0_mac_size);
 	/* Encrypt and authenticate k_prf and alphas */
-	if(!encrypt_and_authentucate_secrets(key, enc_input, enc_input_size, t0 + sizeof(unsigned int), &t0_size, t0_mac, &t0_mac_size))
+	if(!encrypt_and_authentucate_secrets(key, enc_input, enc_input_size, t0 + sizeof(uint64_t), &t0_size, t0_mac, &t0_mac_size))
 		goto cleanup;
 	/* Adjust size to account for index */
-	t0_size += sizeof(unsigned int);
+	t0_size += sizeof(uint64_t);
 
 
 	/* Create t */
@@ -201,47 +532,75 @@ static CPOR_t *read_cpor_t(CPOR_params *myparams, FILE *tfile, CPOR_key *key){
 	size_t t0_mac_size = 0;
 	size_t plaintext_size = 0;
 	size_t alpha_size = 0;
+	size_t n_size = 0;
+	unsigned int n32 = 0;
+	CPOR_file_header header;
+	int ret = 0;
 	int i = 0;
 	
 	if(!tfile) return 0;
 	
+	/* t files written before headers were added start straight in with t */
+	if((ret = read_cpor_header(tfile, CPOR_T_MAGIC, &header)) < 0) return NULL;
+	if((ret == 1) && !check_cpor_header(myparams, &header)) return NULL;
+	
 	if( ((t = allocate_cpor_t(myparams)) == NULL)) goto cleanup;
 	
 	/* Read t out of the file */
-	fread(&tbytes_size, sizeof(size_t), 1, tfile);
-	if(ferror(tfile)) goto cleanup;
+	if(fread(&tbytes_size, sizeof(size_t), 1, tfile) != 1) goto cleanup;
+	if(tbytes_size < 2 * sizeof(size_t)) goto cleanup;
 	if( ((tbytes = malloc(tbytes_size)) == NULL)) goto cleanup;
-	fread(tbytes, tbytes_size, 1, tfile);
-	if(ferror(tfile)) goto cleanup;
+	if(fread(tbytes, tbytes_size, 1, tfile) != 1) goto cleanup;
 
 	/* Parse t */
 	memcpy(&t0_size, tbytes, sizeof(size_t));
+	if(t0_size > tbytes_size - 2 * sizeof(size_t)) goto cleanup;
 	if( ((t0 = malloc(t0_size)) == NULL)) goto cleanup;
 	memcpy(t0, tbytes + sizeof(size_t), t0_size);
 	memcpy(&t0_mac_size, tbytes + sizeof(size_t) + t0_size, sizeof(size_t));
+	if(t0_mac_size != tbytes_size - 2 * sizeof(size_t) - t0_size) goto cleanup;
 	if( ((t0_mac = malloc(t0_mac_size)) == NULL)) goto cleanup;
 	memcpy(t0_mac, tbytes + sizeof(size_t) + t0_size + sizeof(size_t), t0_mac_size);
 	
+	/* The ciphertext is a whole number of cipher blocks, so what's left over is n: 64 bits, or 32 bits in
+	 * t files written before indices were widened */
+	if(t0_size < sizeof(uint64_t)) goto cleanup;
+	if(((t0_size - sizeof(uint64_t)) % AES_BLOCK_SIZE) == 0) n_size = sizeof(uint64_t);
+	else if(((t0_size - sizeof(unsigned int)) % AES_BLOCK_SIZE) == 0) n_size = sizeof(unsigned int);
+	else goto cleanup;
+	
 	/* Verify and decrypt t0 */
 	if( ((plaintext = malloc(t0_size)) == NULL)) goto cleanup;
 	memset(plaintext, 0, t0_size);
-	if(!decrypt_and_verify_secrets(key, t0 + sizeof(unsigned int), t0_size - sizeof(unsigned int), plaintext, &plaintext_size, t0_mac, t0_mac_size)) goto cleanup;
+	if(!decrypt_and_verify_secrets(key, t0 + n_size, t0_size - n_size, plaintext, &plaintext_size, t0_mac, t0_mac_size)) goto cleanup;
 	
 	/* Populate the CPOR_t struct */
-	memcpy(&(t->n), t0, sizeof(unsigned int));
+	if(n_size == sizeof(uint64_t)){
+		memcpy(&(t->n), t0, sizeof(uint64_t));
+	}else{
+		memcpy(&n32, t0, sizeof(unsigned int));
+		t->n = n32;
+	}
+	/* The secrets must be exactly k_prf and num_sectors alphas, which binds the parameters in the header
+	 * to the authenticated plaintext */
 	ptp = plaintext;
+	if(plaintext_size < myparams->prf_key_size) goto cleanup;
 	memcpy(t->k_prf, plaintext, myparams->prf_key_size);
 	ptp += myparams->prf_key_size;
 	for(i=0; i < myparams->num_sectors; i++){
+		if((size_t)(plaintext + plaintext_size - ptp) < sizeof(size_t)) goto cleanup;
 		memcpy(&alpha_size, ptp, sizeof(size_t));
 		ptp += sizeof(size_t);
+		if(alpha_size > (size_t)(plaintext + plaintext_size - ptp)) goto cleanup;
 		if( ((alpha = malloc(alpha_size)) == NULL)) goto cleanup;
 		memset(alpha, 0, alpha_size);
 		memcpy(alpha, ptp, alpha_size);
 		ptp += alpha_size;
 		if(!BN_bin2bn(alpha, alpha_size, t->alpha[i])) goto cleanup;
 		sfree(alpha, alpha_size);
+		alpha = NULL;
 	}	
+	if(ptp != plaintext + plaintext_size) goto cleanup;
 
 	if(plaintext) sfree(plaintext, plaintext_size);
 	if(tbytes) sfree(tbytes, tbytes_size);
@@ -263,376 +622,3270 @@ cleanup:
 
 #ifdef THREADING
 
+struct tag_pool;
+
 struct thread_arguments{
 	CPOR_params *myparams;
-	FILE *file;		/* File to tag; a unique file descriptor to this thread */
+	struct tag_pool *pool;
+	int fd;			/* File to tag; a unique file descriptor to this thread */
+	int direct;		/* 1 if fd was opened with O_DIRECT, 0 if we fall back to dropping pages after reading */
+	unsigned char *buf[2];	/* Aligned read buffers for direct I/O */
 	CPOR_key *key;	/* CPOR keys */
 	CPOR_t *t;		/* Per-file secretes */
 	int threadid;	/* The ID of the thread used to determine which blocks to tag */
-	int numblocks;	/* The number blocks this thread needs to tag */
+	uint64_t firstblock;	/* The first block of the segment being tagged; tags[0] holds its tag */
+	uint64_t numblocks;	/* The number blocks this thread needs to tag */
 	CPOR_tag **tags;	/* Shared memory between threads used to store the result tags */
 };
 
-void *cpor_tag_thread(void *threadargs_ptr){
+/* A file's tagging workers, each with its own descriptor, kept across the segments of one cpor_tag_file */
+struct tag_pool{
+	CPOR_params *myparams;
+	struct thread_arguments *workers;
+	pthread_t *threads;
+	unsigned int numstarted;
+	uint64_t generation;	/* Bumped when a segment is handed out */
+	unsigned int pending;	/* Workers still tagging the current segment */
+	int failed;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* Signalled when a segment is handed out or stop is set */
+	pthread_cond_t done;	/* Signalled when pending reaches 0 */
+};
+
+/* cpor_tag_stride: Tags this worker's share of the segment, every num_threads-th block from its threadid.
+* Returns 1 on success, 0 on failure.
+*/
+static int cpor_tag_stride(struct thread_arguments *threadargs){
 
 	CPOR_tag *tag = NULL;
-	int block;
-	int *ret = NULL;
-	struct thread_arguments *threadargs = threadargs_ptr;
+	uint64_t block;
 	CPOR_params *myparams = threadargs->myparams;
 	unsigned char buf[myparams->block_size];
-	int i = 0;
-	
-	if(!threadargs || !threadargs->file || !threadargs->tags || !threadargs->key || !threadargs->numblocks) goto cleanup;
+	uint64_t i = 0;
 	
-	/* Allocate memory for return value - this should be freed by the checker */
-	ret = malloc(sizeof(int));
-	if(!ret) goto cleanup;
-	*ret = 0;
+	if((threadargs->fd < 0) || !threadargs->tags || !threadargs->key) return 0;
 	
 	/* For N threads, read in and tag each Nth block */
-	block = threadargs->threadid;
+	block = threadargs->firstblock + threadargs->threadid;
 	for(i = 0; i < threadargs->numblocks; i++){
 		memset(buf, 0, myparams->block_size);
-		fseek(threadargs->file, block * myparams->block_size, SEEK_SET);
-		fread(buf, myparams->block_size, 1, threadargs->file);
-		if(ferror(threadargs->file))goto cleanup;
-		//tag = cpor_tag_block(threadargs->key, buf, myparams->block_size, block);
+		if(pread(threadargs->fd, buf, myparams->block_size, (off_t)block * myparams->block_size) < 0) return 0;
 		tag = cpor_tag_block(myparams, threadargs->key->global, threadargs->t->k_prf, threadargs->t->alpha, buf, block);
-		if(!tag) goto cleanup;
+		if(!tag) return 0;
 		/* Store the tag in a buffer until all threads are done. Writer should destroy tags. */
-		threadargs->tags[block] = tag;
+		threadargs->tags[block - threadargs->firstblock] = tag;
 		block += myparams->num_threads;
 	}
 
-	*ret = 1;
-	pthread_exit(ret);
-
-cleanup:
-	pthread_exit(ret);
+	return 1;
 }
 
-#endif 
-
-
-/* cpor_tag_file:
+/* open_cpor_direct: Opens filepath for uncached reading.  Uses O_DIRECT (F_NOCACHE on OS X) when the block size
+* is suitably aligned and the filesystem accepts it; otherwise opens the file normally and sets *direct to 0 so
+* the reader drops each block from the page cache with POSIX_FADV_DONTNEED once it has been read.
+* Returns the file descriptor or -1 on failure.
 */
-int cpor_tag_file(CPOR_params *myparams, char *filepath, size_t filepath_len, char *keyfilepath,
-                  char *tagfilepath, size_t tagfilepath_len, char *tfilepath, size_t tfilepath_len){
+static int open_cpor_direct(CPOR_params *myparams, char *filepath, int *direct){
 
-	CPOR_key *key = NULL;
+	int fd = -1;
 
-	CPOR_t *t = NULL;
-	FILE *file = NULL;
-	FILE *tagfile = NULL;
-	FILE *tfile = NULL;
-	unsigned int numfileblocks = 0;
-	unsigned int index = 0;
-#ifndef DEBUG_MODE
-	char yesorno = 0;
+	*direct = 0;
+#if defined(O_DIRECT)
+	if((myparams->block_size % CPOR_DIRECT_IO_ALIGN) == 0){
+		fd = open(filepath, O_RDONLY | O_DIRECT);
+		if(fd >= 0) *direct = 1;
+	}
+#endif
+	if(fd < 0) fd = open(filepath, O_RDONLY);
+#if defined(F_NOCACHE)
+	if(fd >= 0 && fcntl(fd, F_NOCACHE, 1) == 0) *direct = 1;
 #endif
-	char realtagfilepath[MAXPATHLEN];
-	char realtfilepath[MAXPATHLEN];
-	struct stat st;
-#ifdef THREADING
-	pthread_t threads[myparams->num_threads];
-	int *thread_return = NULL;
-	struct thread_arguments threadargs[myparams->num_threads];
 
-	CPOR_tag **tags = NULL;
+	return fd;
+}
 
-	memset(threads, 0, sizeof(pthread_t) * myparams->num_threads);
-	memset(&st, 0, sizeof(struct stat));
-#else
-	unsigned char buf[myparams->block_size];
-	CPOR_tag *tag = NULL;
-#endif
+static int cpor_aio_submit(struct aiocb *cb, int *inflight, int fd, unsigned char *buf, size_t len, off_t offset){
 
-	memset(realtagfilepath, 0, MAXPATHLEN);
-	memset(realtfilepath, 0, MAXPATHLEN);
+	memset(cb, 0, sizeof(struct aiocb));
+	cb->aio_fildes = fd;
+	cb->aio_buf = buf;
+	cb->aio_nbytes = len;
+	cb->aio_offset = offset;
 
-	if(!filepath) return 0;
-	if(filepath_len >= MAXPATHLEN) return 0;
-	if(tagfilepath_len >= MAXPATHLEN) return 0;
-	if(tfilepath_len >= MAXPATHLEN) return 0;
-	
-	/* If no tag file path is specified, add a .tag extension to the filepath */
-	if(!tagfilepath && (filepath_len < MAXPATHLEN - 5)){
-		if( snprintf(realtagfilepath, MAXPATHLEN, "%s.tag", filepath) >= MAXPATHLEN ) goto cleanup;
-	}else{
-		memcpy(realtagfilepath, tagfilepath, tagfilepath_len);
+	if(aio_read(cb) != 0) return 0;
+	*inflight = 1;
+
+	return 1;
+}
+
+static ssize_t cpor_aio_wait(struct aiocb *cb, int *inflight){
+
+	const struct aiocb *list[1] = { cb };
+	int err = 0;
+
+	*inflight = 0;
+	while((err = aio_error(cb)) == EINPROGRESS)
+		aio_suspend(list, 1, NULL);
+	if(err){
+		aio_return(cb);
+		errno = err;
+		return -1;
 	}
+
+	return aio_return(cb);
+}
+
+/* cpor_tag_stride_direct: The direct I/O counterpart of cpor_tag_stride.  The worker reads its next block
+* asynchronously into one of its two aligned buffers while it tags the block held in the other.
+*/
+static int cpor_tag_stride_direct(struct thread_arguments *threadargs){
+
+	CPOR_tag *tag = NULL;
+	uint64_t block;
+	int ret = 0;
+	CPOR_params *myparams = threadargs->myparams;
+	unsigned char **buf = threadargs->buf;
+	struct aiocb cb[2];
+	int inflight[2] = { 0, 0 };
+	off_t offset = 0;
+	ssize_t nread = 0;
+	int cur = 0;
+	uint64_t i = 0;
 	
-	/* If no t file path is specified, add a .t extension to the filepath */
-	if(!tfilepath && (filepath_len < MAXPATHLEN - 3)){
-		if( snprintf(realtfilepath, MAXPATHLEN, "%s.t", filepath) >= MAXPATHLEN ) goto cleanup;
-	}else{
-		memcpy(realtfilepath, tfilepath, tfilepath_len);
-	}
+	if((threadargs->fd < 0) || !threadargs->tags || !threadargs->key || !buf[0] || !buf[1]) return 0;
 	
-	/* Check to see if the tag file exists */
-#ifndef DEBUG_MODE
-	if( (access(realtagfilepath, F_OK) == 0) || (access(realtfilepath, F_OK) == 0)){
-		printf("WARNING: Tag files for %s already exist; do you want to overwite (y/N)?", filepath);
-		scanf("%c", &yesorno);
-		if(yesorno != 'y') goto exit;
-	}
+	/* For N threads, read in and tag each Nth block */
+	block = threadargs->firstblock + threadargs->threadid;
+	offset = (off_t)block * myparams->block_size;
+	if(!cpor_aio_submit(&cb[cur], &inflight[cur], threadargs->fd, buf[cur], myparams->block_size, offset)) goto cleanup;
+	for(i = 0; i < threadargs->numblocks; i++){
+		nread = cpor_aio_wait(&cb[cur], &inflight[cur]);
+		if((nread < 0) && (errno == EINVAL) && threadargs->direct){
+#if defined(O_DIRECT)
+			/* The filesystem accepted O_DIRECT at open but rejects the reads; drop it and evict pages instead */
+			if(fcntl(threadargs->fd, F_SETFL, fcntl(threadargs->fd, F_GETFL) & ~O_DIRECT) < 0) goto cleanup;
 #endif
-	
-	tagfile = fopen(realtagfilepath, "wb");
-	if(!tagfile){
-		fprintf(stderr, "ERROR: Was not able to create %s.\n", realtagfilepath);
-		goto cleanup;
+			threadargs->direct = 0;
+			if(!cpor_aio_submit(&cb[cur], &inflight[cur], threadargs->fd, buf[cur], myparams->block_size, offset)) goto cleanup;
+			nread = cpor_aio_wait(&cb[cur], &inflight[cur]);
+		}
+		if(nread < 0) goto cleanup;
+		
+		/* Start reading the next block while we tag this one */
+		if(i + 1 < threadargs->numblocks)
+			if(!cpor_aio_submit(&cb[cur ^ 1], &inflight[cur ^ 1], threadargs->fd, buf[cur ^ 1], myparams->block_size,
+				(off_t)(block + myparams->num_threads) * myparams->block_size)) goto cleanup;
+		
+		/* The last block may be short; pad it with zeros as the buffered path does */
+		if(nread < myparams->block_size) memset(buf[cur] + nread, 0, myparams->block_size - nread);
+#ifdef POSIX_FADV_DONTNEED
+		if(!threadargs->direct) posix_fadvise(threadargs->fd, offset, myparams->block_size, POSIX_FADV_DONTNEED);
+#endif
+		tag = cpor_tag_block(myparams, threadargs->key->global, threadargs->t->k_prf, threadargs->t->alpha, buf[cur], block);
+		if(!tag) goto cleanup;
+		/* Store the tag in a buffer until all threads are done. Writer should destroy tags. */
+		threadargs->tags[block - threadargs->firstblock] = tag;
+		block += myparams->num_threads;
+		offset = (off_t)block * myparams->block_size;
+		cur ^= 1;
 	}
-	tfile = fopen(realtfilepath, "wb");
-	if(!tfile){
-		fprintf(stderr, "ERROR: Was not able to create %s.\n", realtfilepath);
-		goto cleanup;
+
+	ret = 1;
+	
+cleanup:
+	/* Don't leave the kernel reading into a buffer the next segment will use */
+	for(cur = 0; cur < 2; cur++){
+		if(!inflight[cur]) continue;
+		aio_cancel(threadargs->fd, &cb[cur]);
+		cpor_aio_wait(&cb[cur], &inflight[cur]);
 	}
+	return ret;
+}
 
-	/* Get the CPOR keys */
-	key = cpor_get_keys(myparams);
-	if(!key) goto cleanup;
+/* cpor_tag_worker: A tagging worker: tags its share of each segment handed out, until the pool stops. */
+static void *cpor_tag_worker(void *threadargs_ptr){
 
-	/* Calculate the number cpor blocks in the file */
-	if(stat(filepath, &st) < 0) return 0;
-	numfileblocks = (st.st_size / myparams->block_size);
-	if(st.st_size % myparams->block_size) numfileblocks++;
-	
-	/* Generate the per-file secrets */
-	t = cpor_create_t(myparams, key->global, numfileblocks);
-	if(!t) goto cleanup;
+	struct thread_arguments *threadargs = threadargs_ptr;
+	struct tag_pool *pool = threadargs->pool;
+	uint64_t seen = 0;
+	int ok = 0;
 
-#ifdef THREADING
+	while(1){
+		pthread_mutex_lock(&pool->lock);
+		while((pool->generation == seen) && !pool->stop) pthread_cond_wait(&pool->work, &pool->lock);
+		if(pool->stop){
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
 
-	/* Allocate buffer to hold tags until we write them out */
-	if( ((tags = malloc( (sizeof(CPOR_tag *) * numfileblocks) )) == NULL)) goto cleanup;
-	memset(tags, 0, (sizeof(CPOR_tag *) * numfileblocks));
+		ok = !threadargs->numblocks ||
+			((pool->myparams->direct_io) ? cpor_tag_stride_direct(threadargs) : cpor_tag_stride(threadargs));
 
-	for(index = 0; index < myparams->num_threads; index++){
-		/* Open a unique file descriptor for each thread to avoid race conditions */
-		threadargs[index].myparams = myparams;
-		threadargs[index].file = fopen(filepath, "rb");
-		if(!threadargs[index].file) goto cleanup;
-		threadargs[index].key = key;
-		threadargs[index].t = t;		
-		threadargs[index].threadid = index;
-		threadargs[index].numblocks = (numfileblocks / myparams->num_threads);
-		threadargs[index].tags = tags;
-		
-		/* If there is not an equal number of blocks to tag, add the extra blocks to
-		 * the corresponding threads */
-		if(index < (numfileblocks % myparams->num_threads))
-			threadargs[index].numblocks++;
-		/* If the thread has blocks to tag, spawn it */
-		if(threadargs[index].numblocks > 0)
-			if(pthread_create(&threads[index], NULL, cpor_tag_thread, (void *) &threadargs[index]) != 0) goto cleanup;
+		pthread_mutex_lock(&pool->lock);
+		if(!ok) pool->failed = 1;
+		if(--pool->pending == 0) pthread_cond_signal(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
 	}
-	/* Check to see all tags were generated */
+
+	return NULL;
+}
+
+/* report_cpor_throughput: Prints the throughput achieved tagging numblocks blocks (bytes bytes) since tv1. */
+static void report_cpor_throughput(CPOR_params *myparams, uint64_t numblocks, off_t bytes, struct timeval *tv1){
+
+	struct timeval tv2;
+	double elapsed = 0;
+	double megabytes = 0;
+
+	gettimeofday(&tv2, NULL);
+	elapsed = (double)(tv2.tv_sec - tv1->tv_sec) + ((double)(tv2.tv_usec - tv1->tv_usec) / 1000000);
+	megabytes = (double)bytes / (1024 * 1024);
+	if(elapsed > 0)
+		printf("Tagged %llu blocks (%.2f MB) in %.3f seconds: %.2f MB/s%s\n", (unsigned long long)numblocks, megabytes,
+			elapsed, megabytes / elapsed, (myparams->direct_io) ? " (direct I/O)" : "");
+}
+
+/* cpor_tag_pool_stop: Stops the pool's workers and closes their descriptors. */
+static void cpor_tag_pool_stop(struct tag_pool *pool){
+
+	unsigned int index = 0;
+
+	if(!pool) return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for(index = 0; index < pool->numstarted; index++) pthread_join(pool->threads[index], NULL);
+
+	for(index = 0; pool->workers && (index < pool->myparams->num_threads); index++){
+		if(pool->workers[index].fd >= 0) close(pool->workers[index].fd);
+		if(pool->workers[index].buf[0]) sfree(pool->workers[index].buf[0], pool->myparams->block_size);
+		if(pool->workers[index].buf[1]) sfree(pool->workers[index].buf[1], pool->myparams->block_size);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool->workers);
+	free(pool);
+}
+
+/* cpor_tag_pool_start: Opens filepath once for each of myparams->num_threads workers and starts them, idle until
+* cpor_tag_pool_run hands them a segment.  Returns the pool, or NULL on failure.
+*/
+static struct tag_pool *cpor_tag_pool_start(CPOR_params *myparams, char *filepath, CPOR_key *key, CPOR_t *t){
+
+	struct tag_pool *pool = NULL;
+	struct thread_arguments *threadargs = NULL;
+	unsigned int index = 0;
+
+	if(!myparams->num_threads) return NULL;
+
+	if( ((pool = malloc(sizeof(struct tag_pool))) == NULL)) return NULL;
+	memset(pool, 0, sizeof(struct tag_pool));
+	pool->myparams = myparams;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	if( ((pool->workers = malloc(sizeof(struct thread_arguments) * myparams->num_threads)) == NULL)) goto cleanup;
+	memset(pool->workers, 0, sizeof(struct thread_arguments) * myparams->num_threads);
+	for(index = 0; index < myparams->num_threads; index++) pool->workers[index].fd = -1;
+	if( ((pool->threads = malloc(sizeof(pthread_t) * myparams->num_threads)) == NULL)) goto cleanup;
+
+	for(index = 0; index < myparams->num_threads; index++){
+		threadargs = &pool->workers[index];
+		threadargs->myparams = myparams;
+		threadargs->pool = pool;
+		threadargs->key = key;
+		threadargs->t = t;
+		threadargs->threadid = index;
+		/* Open a unique file descriptor for each thread to avoid race conditions */
+		if(myparams->direct_io){
+			threadargs->fd = open_cpor_direct(myparams, filepath, &threadargs->direct);
+			if(posix_memalign((void **)&threadargs->buf[0], CPOR_DIRECT_IO_ALIGN, myparams->block_size) != 0){ threadargs->buf[0] = NULL; goto cleanup; }
+			if(posix_memalign((void **)&threadargs->buf[1], CPOR_DIRECT_IO_ALIGN, myparams->block_size) != 0){ threadargs->buf[1] = NULL; goto cleanup; }
+		}else{
+			threadargs->fd = open(filepath, O_RDONLY);
+		}
+		if(threadargs->fd < 0) goto cleanup;
+	}
+	for(index = 0; index < myparams->num_threads; index++){
+		if(pthread_create(&pool->threads[index], NULL, cpor_tag_worker, &pool->workers[index]) != 0) goto cleanup;
+		pool->numstarted++;
+	}
+
+	return pool;
+
+cleanup:
+	cpor_tag_pool_stop(pool);
+	return NULL;
+}
+
+/* cpor_tag_pool_run: Tags blocks firstblock through lastblock-1 on the pool's workers, storing the tag for block
+* i in tags[i - firstblock], and waits for them.  Returns 1 on success, 0 on failure.
+*/
+static int cpor_tag_pool_run(struct tag_pool *pool, uint64_t firstblock, uint64_t lastblock, CPOR_tag **tags){
+
+	CPOR_params *myparams = pool->myparams;
+	uint64_t numblocks = lastblock - firstblock;
+	unsigned int index = 0;
+	int ret = 0;
+
+	if(firstblock > lastblock) return 0;
+
+	pthread_mutex_lock(&pool->lock);
 	for(index = 0; index < myparams->num_threads; index++){
-		if(threads[index]){
-			if(pthread_join(threads[index], (void **)&thread_return) != 0) goto cleanup;
-			if(!thread_return || !(*thread_return))goto cleanup;
-			else free(thread_return);
-			/* Close the file */
-			if(threadargs[index].file)
-				fclose(threadargs[index].file);
+		pool->workers[index].firstblock = firstblock;
+		pool->workers[index].tags = tags;
+		/* If there is not an equal number of blocks to tag, add the extra blocks to
+		 * the corresponding threads */
+		pool->workers[index].numblocks = (numblocks / myparams->num_threads) + ((index < (numblocks % myparams->num_threads)) ? 1 : 0);
+	}
+	pool->pending = myparams->num_threads;
+	pool->failed = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work);
+	while(pool->pending) pthread_cond_wait(&pool->done, &pool->lock);
+	ret = !pool->failed;
+	pthread_mutex_unlock(&pool->lock);
+
+	return ret;
+}
+
+/* cpor_tag_blocks: Tags blocks firstblock through numfileblocks-1 of filepath across myparams->num_threads
+* workers, storing the tag for block i in tags[i - firstblock].  Returns 1 on success, 0 on failure.
+*/
+static int cpor_tag_blocks(CPOR_params *myparams, char *filepath, CPOR_key *key, CPOR_t *t,
+                           uint64_t firstblock, uint64_t numfileblocks, CPOR_tag **tags){
+
+	struct tag_pool *pool = NULL;
+	int ret = 0;
+
+	if(firstblock > numfileblocks) return 0;
+	if( ((pool = cpor_tag_pool_start(myparams, filepath, key, t)) == NULL)) return 0;
+	ret = cpor_tag_pool_run(pool, firstblock, numfileblocks, tags);
+	cpor_tag_pool_stop(pool);
+
+	return ret;
+}
+
+#endif 
+
+
+#ifdef THREADING
+
+/* Number of consecutive blocks a batch worker claims at a time */
+#define CPOR_BATCH_CHUNK_BLOCKS 64
+
+/* Per-file state for a batch tagging run.  A file is opened, its tag file created and its t generated only when
+ * the workers first reach it; each tag is written to its place in the tag file as soon as it is made, and the t
+ * by whichever worker tags the file's last outstanding block.  Everything but fd and tagfile is read and written
+ * under the pool lock. */
+struct batch_file{
+	char *filepath;
+	int fd;
+	int direct;			/* Decided once, when the file is opened */
+	off_t size;
+	uint64_t n;			/* Number of blocks in the file */
+	uint64_t remaining;	/* Blocks claimed but not yet tagged, plus blocks not yet claimed */
+	int failed;
+	CPOR_t *t;
+	FILE *tagfile;		/* Only its header goes through stdio; the tags are written with pwrite */
+};
+
+struct batch_pool{
+	CPOR_params *myparams;
+	CPOR_key *key;
+	size_t sigma_size;
+	struct batch_file *files;
+	unsigned int numfiles;
+	unsigned int nextfile;	/* The file and block the next chunk will be claimed from */
+	uint64_t nextblock;
+	unsigned int numfailed;
+	pthread_mutex_t lock;
+};
+
+/* Closes a fully tagged batch file's tag file and writes its .t, or removes both if anything failed. */
+static void cpor_batch_finish_file(struct batch_pool *pool, struct batch_file *bf){
+
+	CPOR_params *myparams = pool->myparams;
+	char realtagfilepath[MAXPATHLEN];
+	char realtfilepath[MAXPATHLEN];
+	FILE *tfile = NULL;
+	int ok = 0;
+
+	if(bf->fd >= 0) close(bf->fd);
+	bf->fd = -1;
+
+	if( snprintf(realtagfilepath, MAXPATHLEN, "%s.tag", bf->filepath) >= MAXPATHLEN ) goto done;
+	if( snprintf(realtfilepath, MAXPATHLEN, "%s.t", bf->filepath) >= MAXPATHLEN ) goto done;
+	if(bf->failed || !bf->tagfile) goto done;
+
+	tfile = fopen(realtfilepath, "wb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", realtfilepath);
+		goto done;
+	}
+	if(!write_cpor_t(myparams, tfile, pool->key, bf->t)) goto done;
+	ok = 1;
+
+done:
+	if(bf->tagfile && (fclose(bf->tagfile) != 0)) ok = 0;
+	if(tfile && (fclose(tfile) != 0)) ok = 0;
+	if(!ok){
+		fprintf(stderr, "ERROR: Was unable to create tag file for %s.\n", bf->filepath);
+		if(bf->tagfile) unlink(realtagfilepath);
+		if(tfile) unlink(realtfilepath);
+		pthread_mutex_lock(&pool->lock);
+		pool->numfailed++;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	bf->tagfile = NULL;
+	if(bf->t) destroy_cpor_t(myparams, bf->t);
+	bf->t = NULL;
+}
+
+/* Opens the next file in the batch, creates its tag file with the header in place and sets up its secrets.  If
+ * the filesystem accepts O_DIRECT at open but rejects the reads, the file is read through the page cache (with
+ * its pages evicted) instead; that is settled here, with a first read into buf, before any worker reads it.
+ * Called with the pool lock held. */
+static void cpor_batch_open_file(struct batch_pool *pool, struct batch_file *bf, unsigned char *buf){
+
+	CPOR_params *myparams = pool->myparams;
+	char realtagfilepath[MAXPATHLEN];
+	struct stat st;
+
+	bf->fd = -1;
+	if(stat(bf->filepath, &st) < 0){ bf->failed = 1; return; }
+	bf->size = st.st_size;
+	bf->n = (st.st_size / myparams->block_size);
+	if(st.st_size % myparams->block_size) bf->n++;
+	bf->remaining = bf->n;
+
+	if(myparams->direct_io) bf->fd = open_cpor_direct(myparams, bf->filepath, &bf->direct);
+	else bf->fd = open(bf->filepath, O_RDONLY);
+	if(bf->fd < 0){ bf->failed = 1; return; }
+	if(bf->direct && bf->n && (pread(bf->fd, buf, myparams->block_size, 0) < 0) && (errno == EINVAL)){
+#if defined(O_DIRECT)
+		fcntl(bf->fd, F_SETFL, fcntl(bf->fd, F_GETFL) & ~O_DIRECT);
+#endif
+		bf->direct = 0;
+	}
+	if( ((bf->t = cpor_create_t(myparams, pool->key->global, bf->n)) == NULL)){ bf->failed = 1; return; }
+	if(myparams->shared_alphas && !cpor_derive_alphas(myparams, pool->key, bf->t->alpha)){ bf->failed = 1; return; }
+
+	snprintf(realtagfilepath, MAXPATHLEN, "%s.tag", bf->filepath);
+	if( ((bf->tagfile = fopen(realtagfilepath, "wb")) == NULL)){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", realtagfilepath);
+		bf->failed = 1;
+		return;
+	}
+	if(!write_cpor_tag_header(myparams, bf->tagfile, pool->sigma_size, bf->n) || (fflush(bf->tagfile) != 0)) bf->failed = 1;
+}
+
+void *cpor_batch_thread(void *pool_ptr){
+
+	struct batch_pool *pool = pool_ptr;
+	CPOR_params *myparams = pool->myparams;
+	struct batch_file *bf = NULL;
+	CPOR_tag *tag = NULL;
+	unsigned char *buf = NULL;
+	unsigned char *sigma = NULL;
+	uint64_t first = 0, count = 0, block = 0, unclaimed = 0;
+	ssize_t nread = 0;
+	int finish = 0, failed = 0, direct = 0;
+
+	/* Aligned so the buffer can also be used for direct I/O */
+	if(posix_memalign((void **)&buf, CPOR_DIRECT_IO_ALIGN, myparams->block_size) != 0) return NULL;
+	if( ((sigma = malloc(pool->sigma_size)) == NULL)){
+		free(buf);
+		return NULL;
+	}
+
+	while(1){
+		/* Claim the next chunk of blocks, moving on to (and opening) the next file when this one is exhausted */
+		pthread_mutex_lock(&pool->lock);
+		bf = NULL;
+		while(pool->nextfile < pool->numfiles){
+			bf = &pool->files[pool->nextfile];
+			if(pool->nextblock == 0) cpor_batch_open_file(pool, bf, buf);
+			if(bf->failed || (pool->nextblock >= bf->n)){
+				/* Nothing (left) to claim here.  Blocks a failed file will never have claimed count as done, and
+				 * empty files finish right away. */
+				unclaimed = (pool->nextblock < bf->n) ? (bf->n - pool->nextblock) : 0;
+				bf->remaining -= unclaimed;
+				finish = (bf->remaining == 0) && (unclaimed || (bf->n == 0));
+				pool->nextfile++;
+				pool->nextblock = 0;
+				if(finish){
+					pthread_mutex_unlock(&pool->lock);
+					cpor_batch_finish_file(pool, bf);
+					pthread_mutex_lock(&pool->lock);
+				}
+				bf = NULL;
+				continue;
+			}
+			first = pool->nextblock;
+			count = bf->n - first;
+			if(count > CPOR_BATCH_CHUNK_BLOCKS) count = CPOR_BATCH_CHUNK_BLOCKS;
+			pool->nextblock += count;
+			direct = bf->direct;
+			break;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		if(!bf) break;
+
+		/* Tag the chunk, writing each tag to its place in the tag file */
+		failed = 0;
+		for(block = first; block < first + count; block++){
+			nread = pread(bf->fd, buf, myparams->block_size, (off_t)block * myparams->block_size);
+			if(nread < 0){ failed = 1; break; }
+			if(nread < myparams->block_size) memset(buf + nread, 0, myparams->block_size - nread);
+#ifdef POSIX_FADV_DONTNEED
+			if(myparams->direct_io && !direct) posix_fadvise(bf->fd, (off_t)block * myparams->block_size, myparams->block_size, POSIX_FADV_DONTNEED);
+#endif
+			if( ((tag = cpor_tag_block(myparams, pool->key->global, bf->t->k_prf, bf->t->alpha, buf, block)) == NULL)){ failed = 1; break; }
+			memset(sigma, 0, pool->sigma_size);
+			if((BN_num_bytes(tag->sigma) > pool->sigma_size) || (BN_bn2binpad(tag->sigma, sigma, pool->sigma_size) < 0) ||
+				(pwrite(fileno(bf->tagfile), sigma, pool->sigma_size, (off_t)(sizeof(CPOR_file_header) + (block * pool->sigma_size))) != (ssize_t)pool->sigma_size))
+				failed = 1;
+			destroy_cpor_tag(tag);
+		}
+
+		/* Whoever tags the last outstanding block of a file writes its outputs */
+		pthread_mutex_lock(&pool->lock);
+		if(failed) bf->failed = 1;
+		bf->remaining -= count;
+		finish = (bf->remaining == 0);
+		pthread_mutex_unlock(&pool->lock);
+		if(finish) cpor_batch_finish_file(pool, bf);
+	}
+
+	sfree(sigma, pool->sigma_size);
+	free(buf);
+	return NULL;
+}
+
+/* cpor_tag_files: Tags numfiles files as one batch, writing <file>.tag and <file>.t for each.  The keys are
+* loaded once, and blocks from all of the files are handed out in chunks to a single pool of
+* myparams->num_threads workers, so small files don't leave threads idle.  Each tag is written to the file's tag
+* file as it is made, so no file's tags are held in memory, and its t as soon as its last block is tagged.  Reports the aggregate throughput.  Returns 1 if every file was tagged,
+* 0 otherwise.
+*/
+int cpor_tag_files(CPOR_params *myparams, char **filepaths, unsigned int numfiles){
+
+	struct batch_pool pool;
+	pthread_t threads[myparams->num_threads];
+	unsigned int index = 0;
+	unsigned int numthreads = 0;
+	off_t totalsize = 0;
+	struct timeval tv1, tv2;
+	double elapsed = 0;
+	double megabytes = 0;
+
+	if(!filepaths) return 0;
+
+	memset(&pool, 0, sizeof(struct batch_pool));
+	pool.myparams = myparams;
+	pool.numfiles = numfiles;
+	if(pthread_mutex_init(&pool.lock, NULL) != 0) return 0;
+
+	if( ((pool.files = malloc(sizeof(struct batch_file) * numfiles)) == NULL)) goto cleanup;
+	memset(pool.files, 0, sizeof(struct batch_file) * numfiles);
+	for(index = 0; index < numfiles; index++){
+		pool.files[index].filepath = filepaths[index];
+		pool.files[index].fd = -1;
+		if(strlen(filepaths[index]) >= MAXPATHLEN - 5) pool.files[index].failed = 1;
+	}
+
+	/* Get the CPOR keys, once for the whole batch */
+	pool.key = cpor_get_keys(myparams);
+	if(!pool.key) goto cleanup;
+	pool.sigma_size = BN_num_bytes(pool.key->global->Zp);
+
+	gettimeofday(&tv1, NULL);
+	for(numthreads = 0; numthreads < myparams->num_threads; numthreads++)
+		if(pthread_create(&threads[numthreads], NULL, cpor_batch_thread, (void *) &pool) != 0) break;
+	if(!numthreads) goto cleanup;
+	for(index = 0; index < numthreads; index++)
+		pthread_join(threads[index], NULL);
+	gettimeofday(&tv2, NULL);
+
+	/* Report the aggregate throughput */
+	for(index = 0; index < numfiles; index++)
+		totalsize += pool.files[index].size;
+	elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+	megabytes = (double)totalsize / (1024 * 1024);
+	if(elapsed > 0)
+		printf("Tagged %u files (%.2f MB) in %.3f seconds: %.2f MB/s, %u failed\n", numfiles, megabytes,
+			elapsed, megabytes / elapsed, pool.numfailed);
+
+	destroy_cpor_key(myparams, pool.key);
+	sfree(pool.files, sizeof(struct batch_file) * numfiles);
+	pthread_mutex_destroy(&pool.lock);
+
+	return (pool.numfailed == 0);
+
+cleanup:
+	fprintf(stderr, "ERROR: Was unable to tag files.\n");
+	if(pool.key) destroy_cpor_key(myparams, pool.key);
+	if(pool.files) sfree(pool.files, sizeof(struct batch_file) * numfiles);
+	pthread_mutex_destroy(&pool.lock);
+	return 0;
+}
+
+/* Appends the regular files under dirpath (skipping existing .tag and .t outputs) to *filepaths. */
+static int cpor_collect_files(char *dirpath, char ***filepaths, unsigned int *numfiles, unsigned int *maxfiles){
+
+	DIR *dir = NULL;
+	struct dirent *entry = NULL;
+	struct stat st;
+	char path[MAXPATHLEN];
+	size_t len = 0;
+	char **grown = NULL;
+
+	if( ((dir = opendir(dirpath)) == NULL)) return 0;
+	while((entry = readdir(dir)) != NULL){
+		if((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) continue;
+		if( snprintf(path, MAXPATHLEN, "%s/%s", dirpath, entry->d_name) >= MAXPATHLEN ) continue;
+		if(lstat(path, &st) < 0) continue;
+		if(S_ISDIR(st.st_mode)){
+			if(!cpor_collect_files(path, filepaths, numfiles, maxfiles)) goto cleanup;
+			continue;
 		}
+		if(!S_ISREG(st.st_mode)) continue;
+		len = strlen(path);
+		if((len > 4) && (strcmp(path + len - 4, ".tag") == 0)) continue;
+		if((len > 2) && (strcmp(path + len - 2, ".t") == 0)) continue;
+		if(*numfiles == *maxfiles){
+			*maxfiles = (*maxfiles) ? (*maxfiles * 2) : 64;
+			if( ((grown = realloc(*filepaths, sizeof(char *) * (*maxfiles))) == NULL)) goto cleanup;
+			*filepaths = grown;
+		}
+		if( (((*filepaths)[*numfiles] = strdup(path)) == NULL)) goto cleanup;
+		(*numfiles)++;
+	}
+	closedir(dir);
+	return 1;
+
+cleanup:
+	closedir(dir);
+	return 0;
+}
+
+/* cpor_tag_tree: Tags every regular file under dirpath as a single batch with cpor_tag_files.
+* Returns 1 if every file was tagged, 0 otherwise.
+*/
+int cpor_tag_tree(CPOR_params *myparams, char *dirpath){
+
+	char **filepaths = NULL;
+	unsigned int numfiles = 0;
+	unsigned int maxfiles = 0;
+	unsigned int index = 0;
+	int ret = 0;
+
+	if(!dirpath) return 0;
+
+	if(cpor_collect_files(dirpath, &filepaths, &numfiles, &maxfiles))
+		ret = cpor_tag_files(myparams, filepaths, numfiles);
+	else
+		fprintf(stderr, "ERROR: Was not able to read %s.\n", dirpath);
+
+	for(index = 0; index < numfiles; index++)
+		free(filepaths[index]);
+	if(filepaths) free(filepaths);
+
+	return ret;
+}
+
+#endif
+
+/* Size of the digest binding a checkpoint to the tags it vouches for (SHA-256) */
+#define CPOR_CKPT_DIGEST_SIZE 32
+
+/* cpor_digest_range: Adds bytes from through to-1 of the file at fd to digest.  Returns 1 on success, 0 on failure. */
+static int cpor_digest_range(EVP_MD_CTX *digest, int fd, off_t from, off_t to){
+
+	unsigned char buf[65536];
+	ssize_t n = 0;
+
+	while(from < to){
+		n = ((to - from) < (off_t)sizeof(buf)) ? (to - from) : (off_t)sizeof(buf);
+		if( ((n = pread(fd, buf, n, from)) <= 0)) return 0;
+		if(!EVP_DigestUpdate(digest, buf, n)) return 0;
+		from += n;
+	}
+
+	return 1;
+}
+
+/* cpor_digest_value: Writes the digest of what has been added to digest so far to md, leaving digest open for
+* more.  Returns 1 on success, 0 on failure.
+*/
+static int cpor_digest_value(EVP_MD_CTX *digest, unsigned char *md){
+
+	EVP_MD_CTX *copy = NULL;
+	unsigned int len = 0;
+	int ret = 0;
+
+	if( ((copy = EVP_MD_CTX_new()) == NULL)) return 0;
+	ret = EVP_MD_CTX_copy_ex(copy, digest) && EVP_DigestFinal_ex(copy, md, &len) && (len == CPOR_CKPT_DIGEST_SIZE);
+	EVP_MD_CTX_free(copy);
+
+	return ret;
+}
+
+/* write_cpor_checkpoint: Records tagging progress for cpor_tag_file: a header (CPOR_CKPT_MAGIC) with the
+* parameters and the tag file's sigma_size and n, then the number of leading blocks whose tags are durably in the
+* tag file (hwm), the tag file length they occupy, the SHA-256 of the tag file up to there, and the per-file
+* secrets t.  The checkpoint is written beside the old one, fsynced and renamed over it, so there is always one
+* usable copy.
+*/
+static int write_cpor_checkpoint(CPOR_params *myparams, char *ckptfilepath, CPOR_key *key, CPOR_t *t, size_t sigma_size,
+                                 uint64_t hwm, uint64_t tagoffset, unsigned char *md){
+
+	CPOR_file_header header;
+	FILE *ckptfile = NULL;
+	char newckptfilepath[MAXPATHLEN];
+
+	if( snprintf(newckptfilepath, MAXPATHLEN, "%s.new", ckptfilepath) >= MAXPATHLEN ) return 0;
+
+	ckptfile = fopen(newckptfilepath, "wb");
+	if(!ckptfile){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", newckptfilepath);
+		return 0;
+	}
+	init_cpor_header(myparams, &header, CPOR_CKPT_MAGIC, CPOR_FORMAT_FIXED_WIDTH, sigma_size, t->n);
+	if(fwrite(&header, sizeof(CPOR_file_header), 1, ckptfile) != 1) goto cleanup;
+	if(fwrite(&hwm, sizeof(uint64_t), 1, ckptfile) != 1) goto cleanup;
+	if(fwrite(&tagoffset, sizeof(uint64_t), 1, ckptfile) != 1) goto cleanup;
+	if(fwrite(md, CPOR_CKPT_DIGEST_SIZE, 1, ckptfile) != 1) goto cleanup;
+	if(!write_cpor_t(myparams, ckptfile, key, t)) goto cleanup;
+	if(fflush(ckptfile) != 0) goto cleanup;
+	if(fsync(fileno(ckptfile)) < 0) goto cleanup;
+	if(fclose(ckptfile) != 0){ ckptfile = NULL; goto cleanup; }
+	ckptfile = NULL;
+	if(rename(newckptfilepath, ckptfilepath) < 0) goto cleanup;
+
+	return 1;
+
+cleanup:
+	if(ckptfile) fclose(ckptfile);
+	unlink(newckptfilepath);
+	return 0;
+}
+
+/* read_cpor_checkpoint: Reads a checkpoint written by write_cpor_checkpoint for a tag file of n tags of
+* sigma_size bytes under myparams.  Returns t, with the high-water mark, the tag file length it covers and the
+* digest of the tag file up to there in *hwm, *tagoffset and md, or NULL if there is no such checkpoint.
+*/
+static CPOR_t *read_cpor_checkpoint(CPOR_params *myparams, char *ckptfilepath, CPOR_key *key, size_t sigma_size, uint64_t n,
+                                    uint64_t *hwm, uint64_t *tagoffset, unsigned char *md){
+
+	CPOR_file_header header;
+	FILE *ckptfile = NULL;
+	CPOR_t *t = NULL;
+
+	ckptfile = fopen(ckptfilepath, "rb");
+	if(!ckptfile) return NULL;
+	if(read_cpor_header(ckptfile, CPOR_CKPT_MAGIC, &header) != 1){
+		fprintf(stderr, "ERROR: %s isn't a tagging checkpoint.\n", ckptfilepath);
+		goto cleanup;
+	}
+	if(!check_cpor_header(myparams, &header)) goto cleanup;
+	if((header.n != n) || (header.sigma_size != sigma_size)){
+		fprintf(stderr, "ERROR: %s was made for %llu tags of %u bytes, not %llu of %zu.\n", ckptfilepath,
+			(unsigned long long)header.n, header.sigma_size, (unsigned long long)n, sigma_size);
+		goto cleanup;
+	}
+	if(fread(hwm, sizeof(uint64_t), 1, ckptfile) != 1) goto cleanup;
+	if(fread(tagoffset, sizeof(uint64_t), 1, ckptfile) != 1) goto cleanup;
+	if(fread(md, CPOR_CKPT_DIGEST_SIZE, 1, ckptfile) != 1) goto cleanup;
+	if((*hwm > n) || (*tagoffset != sizeof(CPOR_file_header) + (*hwm * sigma_size))){
+		fprintf(stderr, "ERROR: %s is damaged.\n", ckptfilepath);
+		goto cleanup;
+	}
+	if( ((t = read_cpor_t(myparams, ckptfile, key)) == NULL)) goto cleanup;
+	if(t->n != n){
+		destroy_cpor_t(myparams, t);
+		t = NULL;
+	}
+
+cleanup:
+	fclose(ckptfile);
+	return t;
+}
+
+/* cpor_tag_file:
+*/
+int cpor_tag_file(CPOR_params *myparams, char *filepath, size_t filepath_len, char *keyfilepath,
+                  char *tagfilepath, size_t tagfilepath_len, char *tfilepath, size_t tfilepath_len){
+
+	CPOR_key *key = NULL;
+
+	CPOR_t *t = NULL;
+	FILE *file = NULL;
+	FILE *tagfile = NULL;
+	FILE *tfile = NULL;
+	uint64_t numfileblocks = 0;
+	uint64_t index = 0;
+#ifndef DEBUG_MODE
+	char yesorno = 0;
+#endif
+	char realtagfilepath[MAXPATHLEN];
+	char realtfilepath[MAXPATHLEN];
+	struct stat st;
+#ifdef THREADING
+	CPOR_tag **tags = NULL;
+	struct tag_pool *pool = NULL;
+	uint64_t segment = 0;
+	uint64_t first = 0, last = 0;
+	uint64_t firstblock = 0;
+	uint64_t tagoffset = 0;
+	char ckptfilepath[MAXPATHLEN];
+	int checkpointed = 0;
+	struct timeval tv1;
+	CPOR_file_header header;
+	EVP_MD_CTX *digest = NULL;
+	off_t hashed = 0;			/* Bytes of the tag file added to digest */
+	unsigned char md[CPOR_CKPT_DIGEST_SIZE];
+	unsigned char ckptmd[CPOR_CKPT_DIGEST_SIZE];
+	size_t sigma_size = 0;
+
+	memset(&st, 0, sizeof(struct stat));
+	memset(ckptfilepath, 0, MAXPATHLEN);
+#else
+	unsigned char buf[myparams->block_size];
+	CPOR_tag *tag = NULL;
+#endif
+
+	memset(realtagfilepath, 0, MAXPATHLEN);
+	memset(realtfilepath, 0, MAXPATHLEN);
+
+	if(!filepath) return 0;
+	if(filepath_len >= MAXPATHLEN) return 0;
+	if(tagfilepath_len >= MAXPATHLEN) return 0;
+	if(tfilepath_len >= MAXPATHLEN) return 0;
+	
+	/* If no tag file path is specified, add a .tag extension to the filepath */
+	if(!tagfilepath && (filepath_len < MAXPATHLEN - 5)){
+		if( snprintf(realtagfilepath, MAXPATHLEN, "%s.tag", filepath) >= MAXPATHLEN ) goto cleanup;
+	}else{
+		memcpy(realtagfilepath, tagfilepath, tagfilepath_len);
 	}
 	
-	/* Write the tags out */
-	for(index = 0; index < numfileblocks; index++){
-		if(!tags[index]) goto cleanup;
-		if(!write_cpor_tag(tagfile, tags[index])) goto cleanup;
-		destroy_cpor_tag(tags[index]);
-		tags[index] = NULL;
+	/* If no t file path is specified, add a .t extension to the filepath */
+	if(!tfilepath && (filepath_len < MAXPATHLEN - 3)){
+		if( snprintf(realtfilepath, MAXPATHLEN, "%s.t", filepath) >= MAXPATHLEN ) goto cleanup;
+	}else{
+		memcpy(realtfilepath, tfilepath, tfilepath_len);
+	}
+	
+	/* Progress is checkpointed beside the tag file */
+	if( snprintf(ckptfilepath, MAXPATHLEN, "%s.ckpt", realtagfilepath) >= MAXPATHLEN ) goto cleanup;
+	
+	/* Check to see if the tag file exists */
+#ifndef DEBUG_MODE
+	if( !myparams->resume && ((access(realtagfilepath, F_OK) == 0) || (access(realtfilepath, F_OK) == 0))){
+		printf("WARNING: Tag files for %s already exist; do you want to overwite (y/N)?", filepath);
+		scanf("%c", &yesorno);
+		if(yesorno != 'y') goto exit;
+	}
+#endif
+	
+	/* Get the CPOR keys */
+	key = cpor_get_keys(myparams);
+	if(!key) goto cleanup;
+
+	/* Calculate the number cpor blocks in the file */
+	if(stat(filepath, &st) < 0) goto cleanup;
+	numfileblocks = (st.st_size / myparams->block_size);
+	if(st.st_size % myparams->block_size) numfileblocks++;
+	
+#ifdef THREADING
+	/* What is in the tag file so far is digested, so a checkpoint can be tied to the tags it vouches for */
+	sigma_size = BN_num_bytes(key->global->Zp);
+	if(myparams->checkpoint_blocks || myparams->resume){
+		if( ((digest = EVP_MD_CTX_new()) == NULL)) goto cleanup;
+		if(!EVP_DigestInit_ex(digest, EVP_sha256(), NULL)) goto cleanup;
+	}
+	if(myparams->resume){
+		/* Pick up the per-file secrets and progress from the last checkpoint */
+		t = read_cpor_checkpoint(myparams, ckptfilepath, key, sigma_size, numfileblocks, &firstblock, &tagoffset, ckptmd);
+		if(!t){
+			fprintf(stderr, "ERROR: Was not able to resume from %s; has %s changed since it was checkpointed?\n", ckptfilepath, filepath);
+			goto cleanup;
+		}
+		
+		/* The tag file must still hold the tags the checkpoint vouches for; if it doesn't (it was made again
+		 * since, say), it is left alone */
+		tagfile = fopen(realtagfilepath, "r+b");
+		if(!tagfile){
+			fprintf(stderr, "ERROR: Was not able to open %s.\n", realtagfilepath);
+			goto cleanup;
+		}
+		if((read_cpor_header(tagfile, CPOR_TAG_MAGIC, &header) != 1) || !(header.flags & CPOR_FORMAT_FIXED_WIDTH) ||
+			(header.n != numfileblocks) || (header.sigma_size != sigma_size) ||
+			!cpor_digest_range(digest, fileno(tagfile), 0, tagoffset) || !cpor_digest_value(digest, md) ||
+			memcmp(md, ckptmd, CPOR_CKPT_DIGEST_SIZE)){
+			fprintf(stderr, "ERROR: %s doesn't hold the tags %s was made for.\n", realtagfilepath, ckptfilepath);
+			fclose(tagfile);
+			tagfile = NULL;
+			goto cleanup;
+		}
+		hashed = tagoffset;
+		checkpointed = 1;
+		
+		/* Drop any tags written after the checkpoint */
+		if(ftruncate(fileno(tagfile), tagoffset) < 0) goto cleanup;
+		if(fseeko(tagfile, tagoffset, SEEK_SET) < 0) goto cleanup;
+	}else
+#endif
+	{
+#ifdef THREADING
+		/* A checkpoint left by an earlier run is for tags about to be replaced */
+		unlink(ckptfilepath);
+#endif
+		/* Opened for reading too, so the tags can be digested for checkpoints */
+		tagfile = fopen(realtagfilepath, "w+b");
+		if(!tagfile){
+			fprintf(stderr, "ERROR: Was not able to create %s.\n", realtagfilepath);
+			goto cleanup;
+		}
+		if(!write_cpor_tag_header(myparams, tagfile, BN_num_bytes(key->global->Zp), numfileblocks)) goto cleanup;
+		
+		/* Generate the per-file secrets */
+		t = cpor_create_t(myparams, key->global, numfileblocks);
+		if(!t) goto cleanup;
+		if(myparams->shared_alphas && !cpor_derive_alphas(myparams, key, t->alpha)) goto cleanup;
+	}
+	tfile = fopen(realtfilepath, "wb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", realtfilepath);
+		goto cleanup;
+	}
+
+#ifdef THREADING
+
+	/* Tag the file a segment at a time, checkpointing after each one if asked to */
+	segment = numfileblocks - firstblock;
+	if(myparams->checkpoint_blocks && (myparams->checkpoint_blocks < segment))
+		segment = myparams->checkpoint_blocks;
+
+	/* Allocate buffer to hold a segment's tags until we write them out */
+	if(segment){
+		if( ((tags = malloc( (sizeof(CPOR_tag *) * segment) )) == NULL)) goto cleanup;
+		memset(tags, 0, (sizeof(CPOR_tag *) * segment));
+	}
+
+	/* One set of workers and descriptors serves every segment */
+	gettimeofday(&tv1, NULL);
+	if(segment && ((pool = cpor_tag_pool_start(myparams, filepath, key, t)) == NULL)) goto cleanup;
+	for(first = firstblock; first < numfileblocks; first = last){
+		last = ((numfileblocks - first) > segment) ? (first + segment) : numfileblocks;
+		
+		if(!cpor_tag_pool_run(pool, first, last, tags)) goto cleanup;
+		
+		/* Write the tags out */
+		for(index = 0; index < (last - first); index++){
+			if(!tags[index]) goto cleanup;
+			if(!write_cpor_tag(tagfile, tags[index], BN_num_bytes(key->global->Zp))) goto cleanup;
+			destroy_cpor_tag(tags[index]);
+			tags[index] = NULL;
+		}
+		
+		if(myparams->checkpoint_blocks && (last < numfileblocks)){
+			/* Make the tags durable before the checkpoint vouches for them */
+			if(fflush(tagfile) != 0) goto cleanup;
+			if(fsync(fileno(tagfile)) < 0) goto cleanup;
+			if((tagoffset = ftello(tagfile)) < 0) goto cleanup;
+			if(!cpor_digest_range(digest, fileno(tagfile), hashed, tagoffset) || !cpor_digest_value(digest, md)) goto cleanup;
+			hashed = tagoffset;
+			if(!write_cpor_checkpoint(myparams, ckptfilepath, key, t, sigma_size, last, tagoffset, md)) goto cleanup;
+			checkpointed = 1;
+		}
+	}
+	cpor_tag_pool_stop(pool);
+	pool = NULL;
+	report_cpor_throughput(myparams, numfileblocks - firstblock, st.st_size - ((off_t)firstblock * myparams->block_size), &tv1);
+	if(tags) sfree(tags, (sizeof(CPOR_tag *) * segment));
+	tags = NULL;
+
+#else
+	/* Open the file for reading */
+	file = fopen(filepath, "rb");
+	if(!file){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", filepath);
+		goto cleanup;
+	}
+
+	do{
+		memset(buf, 0, myparams->block_size);
+		fread(buf, myparams->block_size, 1, file);
+		if(ferror(file)) goto cleanup;
+		tag = cpor_tag_block(key->global, t->k_prf, t->alpha, buf, myparams->block_size, index);
+		if(!tag) goto cleanup;
+		if(!write_cpor_tag(tagfile, tag, BN_num_bytes(key->global->Zp))) goto cleanup;
+		index++;
+		destroy_cpor_tag(tag);
+	}while(!feof(file));
+#endif
+
+	/* Write t to the tfile */
+	if(!write_cpor_t(myparams, tfile, key, t)) goto cleanup;
+	if(fflush(tfile) != 0) goto cleanup;
+#ifdef THREADING
+	/* The checkpoint has served its purpose */
+	if(checkpointed) unlink(ckptfilepath);
+	if(digest) EVP_MD_CTX_free(digest);
+#endif
+
+#ifndef DEBUG_MODE
+exit:
+#endif
+	destroy_cpor_key(myparams, key);
+	destroy_cpor_t(myparams, t);
+	if(file) fclose(file);
+	if(tagfile) fclose(tagfile);
+	if(tfile) fclose(tfile);
+	return 1;
+	
+cleanup:
+
+	fprintf(stderr, "ERROR: Was unable to create tag file.\n");
+	if(key) destroy_cpor_key(myparams, key);	
+	if(t) destroy_cpor_t(myparams, t);
+	if(file) fclose(file);
+#ifdef THREADING
+	cpor_tag_pool_stop(pool);
+	if(digest) EVP_MD_CTX_free(digest);
+	if(tags){
+		for(index = 0; index < segment; index++)
+			if(tags[index]) destroy_cpor_tag(tags[index]);
+		sfree(tags, (sizeof(CPOR_tag *) * segment));
+	}
+	/* Keep the tags covered by a checkpoint so tagging can be resumed */
+	if(checkpointed && tagfile){
+		fprintf(stderr, "Progress is saved in %s; tag again with resume set to continue.\n", ckptfilepath);
+		fclose(tagfile);
+		tagfile = NULL;
+	}
+#endif
+	if(tagfile){ 
+		ftruncate(fileno(tagfile), 0);
+		unlink(realtagfilepath);
+		fclose(tagfile);
+	}
+	if(tfile){ 
+		ftruncate(fileno(tfile), 0);
+		unlink(realtfilepath);
+		fclose(tfile);
+	}	
+	return 0;
+}
+
+/* cpor_append_file: Extends the tags of a file that has grown by appending since it was last tagged.  The
+* existing t is loaded so the same k_prf and alphas are used; only blocks from the previously recorded last
+* block (which may have been partial) onward are read and tagged.  Their tags are written over the tail of the
+* tag file, which only grows, then the tag file's header and t are rewritten with the new n.  Returns 1 on
+* success, 0 on failure.  A failure before the tags are written leaves both files as they were; one while they
+* are written leaves the header and t at the old n and every tag before the old last block's untouched.
+*/
+int cpor_append_file(CPOR_params *myparams, char *filepath, size_t filepath_len, char *keyfilepath,
+                     char *tagfilepath, size_t tagfilepath_len, char *tfilepath, size_t tfilepath_len){
+
+	CPOR_key *key = NULL;
+	CPOR_t *t = NULL;
+	FILE *tagfile = NULL;
+	FILE *tfile = NULL;
+	CPOR_tag **tags = NULL;
+	CPOR_file_header header;
+	uint64_t numfileblocks = 0;
+	uint64_t firstblock = 0;
+	uint64_t index = 0;
+	off_t tagoffset = 0;
+	size_t sigma_size = 0;
+	int ret = 0;
+	char realtagfilepath[MAXPATHLEN];
+	char realtfilepath[MAXPATHLEN];
+	char newtfilepath[MAXPATHLEN];
+	struct stat st;
+	struct timeval tv1;
+
+	memset(realtagfilepath, 0, MAXPATHLEN);
+	memset(realtfilepath, 0, MAXPATHLEN);
+	memset(newtfilepath, 0, MAXPATHLEN);
+	memset(&st, 0, sizeof(struct stat));
+
+	if(!filepath) return 0;
+	if(filepath_len >= MAXPATHLEN) return 0;
+	if(tagfilepath_len >= MAXPATHLEN) return 0;
+	if(tfilepath_len >= MAXPATHLEN) return 0;
+	
+	/* If no tag file path is specified, add a .tag extension to the filepath */
+	if(!tagfilepath && (filepath_len < MAXPATHLEN - 5)){
+		if( snprintf(realtagfilepath, MAXPATHLEN, "%s.tag", filepath) >= MAXPATHLEN ) goto cleanup;
+	}else{
+		memcpy(realtagfilepath, tagfilepath, tagfilepath_len);
+	}
+	
+	/* If no t file path is specified, add a .t extension to the filepath */
+	if(!tfilepath && (filepath_len < MAXPATHLEN - 3)){
+		if( snprintf(realtfilepath, MAXPATHLEN, "%s.t", filepath) >= MAXPATHLEN ) goto cleanup;
+	}else{
+		memcpy(realtfilepath, tfilepath, tfilepath_len);
+	}
+	if( snprintf(newtfilepath, MAXPATHLEN, "%s.new", realtfilepath) >= MAXPATHLEN ) goto cleanup;
+
+	/* Get the CPOR keys */
+	key = cpor_get_keys(myparams);
+	if(!key) goto cleanup;
+	
+	/* Get the existing per-file secrets */
+	tfile = fopen(realtfilepath, "rb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", realtfilepath);
+		goto cleanup;
+	}
+	t = read_cpor_t(myparams, tfile, key);
+	if(!t){ fprintf(stderr, "Could not get t.\n"); goto cleanup; }
+	fclose(tfile);
+	tfile = NULL;
+
+	/* Calculate the number cpor blocks in the file */
+	if(stat(filepath, &st) < 0) goto cleanup;
+	numfileblocks = (st.st_size / myparams->block_size);
+	if(st.st_size % myparams->block_size) numfileblocks++;
+	if(numfileblocks < t->n){
+		fprintf(stderr, "ERROR: %s is smaller than when it was tagged; it can't be appended to.\n", filepath);
+		goto cleanup;
+	}
+	
+	/* The old last block may have been partial, so tag it again along with the new blocks */
+	firstblock = (t->n) ? (t->n - 1) : 0;
+	
+	/* Allocate buffer to hold tags until we write them out */
+	if( ((tags = malloc( (sizeof(CPOR_tag *) * (numfileblocks - firstblock)) )) == NULL)) goto cleanup;
+	memset(tags, 0, (sizeof(CPOR_tag *) * (numfileblocks - firstblock)));
+
+	gettimeofday(&tv1, NULL);
+	if(!cpor_tag_blocks(myparams, filepath, key, t, firstblock, numfileblocks, tags)) goto cleanup;
+	report_cpor_throughput(myparams, numfileblocks - firstblock, st.st_size - ((off_t)firstblock * myparams->block_size), &tv1);
+	
+	/* Find the start of the tag for firstblock and replace everything from there on */
+	tagfile = fopen(realtagfilepath, "r+b");
+	if(!tagfile){
+		fprintf(stderr, "ERROR: Was not able to open %s for writing.\n", realtagfilepath);
+		goto cleanup;
+	}
+	if((ret = read_cpor_header(tagfile, CPOR_TAG_MAGIC, &header)) < 0) goto cleanup;
+	if((ret == 1) && !check_cpor_header(myparams, &header)) goto cleanup;
+	sigma_size = BN_num_bytes(key->global->Zp);
+	if(ret == 1){
+		if(header.sigma_size != sigma_size) goto cleanup;
+		if(header.flags & CPOR_FORMAT_SHARD){
+			fprintf(stderr, "ERROR: %s is a shard; append to the whole tag file and shard it again.\n", realtagfilepath);
+			goto cleanup;
+		}
+		tagoffset = (off_t)header.header_size + (off_t)firstblock * sigma_size;
+	}else{
+		if(!skip_cpor_tags(tagfile, firstblock)) goto cleanup;
+		if((tagoffset = ftello(tagfile)) < 0) goto cleanup;
+	}
+	if(fseeko(tagfile, tagoffset, SEEK_SET) < 0) goto cleanup;
+
+	/* Write the tags out over the old tail, in the same format as the tags already there.  The file isn't cut
+	 * short first: there are at least as many new tags as old ones from here on, so it only grows, and readers
+	 * with it open never find it shorter than its header said. */
+	for(index = 0; index < (numfileblocks - firstblock); index++){
+		if(!tags[index]) goto cleanup;
+		if(ret == 1){
+			if(!write_cpor_tag(tagfile, tags[index], sigma_size)) goto cleanup;
+		}else{
+			if(!write_cpor_tag_record(tagfile, tags[index], sigma_size)) goto cleanup;
+		}
+		destroy_cpor_tag(tags[index]);
+		tags[index] = NULL;
+	}
+	if(fflush(tagfile) != 0) goto cleanup;
+	if((tagoffset = ftello(tagfile)) < 0) goto cleanup;
+	if(ftruncate(fileno(tagfile), tagoffset) < 0) goto cleanup;
+	if(fsync(fileno(tagfile)) < 0) goto cleanup;
+
+	/* Only now that the tags are down does the header claim them */
+	if(ret == 1){
+		if(fseeko(tagfile, 0, SEEK_SET) < 0) goto cleanup;
+		if(!write_cpor_tag_header(myparams, tagfile, sigma_size, numfileblocks)) goto cleanup;
+	}
+	if(fclose(tagfile) != 0){ tagfile = NULL; goto cleanup; }
+	tagfile = NULL;
+
+	/* Write the updated t alongside the old one and swap it in, so a failure never loses the secrets */
+	t->n = numfileblocks;
+	tfile = fopen(newtfilepath, "wb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", newtfilepath);
+		goto cleanup;
+	}
+	if(!write_cpor_t(myparams, tfile, key, t)) goto cleanup;
+	if(fclose(tfile) != 0){ tfile = NULL; goto cleanup; }
+	tfile = NULL;
+	if(rename(newtfilepath, realtfilepath) < 0) goto cleanup;
+
+	sfree(tags, (sizeof(CPOR_tag *) * (numfileblocks - firstblock)));
+	destroy_cpor_key(myparams, key);
+	destroy_cpor_t(myparams, t);
+	
+	return 1;
+
+cleanup:
+	fprintf(stderr, "ERROR: Was unable to append to tag file.\n");
+	if(tags){
+		for(index = 0; index < (numfileblocks - firstblock); index++)
+			if(tags[index]) destroy_cpor_tag(tags[index]);
+		sfree(tags, (sizeof(CPOR_tag *) * (numfileblocks - firstblock)));
+	}
+	if(key) destroy_cpor_key(myparams, key);
+	if(t) destroy_cpor_t(myparams, t);
+	if(tagfile) fclose(tagfile);
+	if(tfile){
+		fclose(tfile);
+		unlink(newtfilepath);
+	}
+	return 0;
+}
+
+/* cpor_tag_sink_file: A CPOR_tag_sink that appends each tag to the FILE * passed as sink_arg.  A tag file
+* written this way must start with write_cpor_tag_header.
+*/
+int cpor_tag_sink_file(void *sink_arg, CPOR_tag *tag, size_t sigma_size){
+
+	return write_cpor_tag((FILE *)sink_arg, tag, sigma_size);
+}
+
+/* cpor_tagger_begin: Starts tagging a stream whose length isn't known up front.  Loads the keys and generates
+* fresh per-file secrets.  Each tag is handed to sink, in block order, as soon as its block is complete.
+* Returns an allocated tagger, or NULL on failure.
+*/
+CPOR_tagger *cpor_tagger_begin(CPOR_params *myparams, CPOR_tag_sink sink, void *sink_arg){
+
+	CPOR_tagger *tagger = NULL;
+
+	if(!myparams || !sink) return NULL;
+
+	if( ((tagger = malloc(sizeof(CPOR_tagger))) == NULL)) return NULL;
+	memset(tagger, 0, sizeof(CPOR_tagger));
+	tagger->myparams = myparams;
+	tagger->sink = sink;
+	tagger->sink_arg = sink_arg;
+	if( ((tagger->buf = malloc(myparams->block_size)) == NULL)) goto cleanup;
+	memset(tagger->buf, 0, myparams->block_size);
+
+	/* Get the CPOR keys */
+	tagger->key = cpor_get_keys(myparams);
+	if(!tagger->key) goto cleanup;
+
+	/* Generate the per-file secrets; n is filled in by cpor_tagger_finish */
+	tagger->t = cpor_create_t(myparams, tagger->key->global, 0);
+	if(!tagger->t) goto cleanup;
+	if(myparams->shared_alphas && !cpor_derive_alphas(myparams, tagger->key, tagger->t->alpha)) goto cleanup;
+
+	return tagger;
+
+cleanup:
+	cpor_tagger_abort(tagger);
+	return NULL;
+}
+
+static int cpor_tagger_emit(CPOR_tagger *tagger, unsigned char *block){
+
+	CPOR_params *myparams = tagger->myparams;
+	CPOR_tag *tag = NULL;
+	int ret = 0;
+
+	tag = cpor_tag_block(myparams, tagger->key->global, tagger->t->k_prf, tagger->t->alpha, block, tagger->n);
+	if(!tag) return 0;
+	ret = tagger->sink(tagger->sink_arg, tag, BN_num_bytes(tagger->key->global->Zp));
+	destroy_cpor_tag(tag);
+	if(ret) tagger->n++;
+
+	return ret;
+}
+
+/* cpor_tagger_update: Feeds len more bytes of the stream to the tagger.  Every block completed by them is tagged
+* and sent to the sink; any remainder is buffered until the next call.  Returns 1 on success, 0 on failure.
+*/
+int cpor_tagger_update(CPOR_tagger *tagger, unsigned char *buf, size_t len){
+
+	CPOR_params *myparams = NULL;
+	size_t take = 0;
+
+	if(!tagger || (!buf && len)) return 0;
+	myparams = tagger->myparams;
+
+	/* Top up a partial block left over from the last call */
+	if(tagger->buf_len){
+		take = myparams->block_size - tagger->buf_len;
+		if(take > len) take = len;
+		memcpy(tagger->buf + tagger->buf_len, buf, take);
+		tagger->buf_len += take;
+		buf += take;
+		len -= take;
+		if(tagger->buf_len < myparams->block_size) return 1;
+		if(!cpor_tagger_emit(tagger, tagger->buf)) return 0;
+		tagger->buf_len = 0;
+	}
+
+	/* Tag whole blocks straight out of the caller's buffer */
+	while(len >= myparams->block_size){
+		if(!cpor_tagger_emit(tagger, buf)) return 0;
+		buf += myparams->block_size;
+		len -= myparams->block_size;
+	}
+
+	/* Hold on to the remainder */
+	if(len){
+		memcpy(tagger->buf, buf, len);
+		tagger->buf_len = len;
+	}
+
+	return 1;
+}
+
+/* cpor_tagger_finish: Tags the final, zero-padded partial block if there is one, records the number of blocks
+* in t and writes it to tfile.  The tagger is freed whether or not this succeeds.  Returns 1 on success, 0 on failure.
+*/
+int cpor_tagger_finish(CPOR_tagger *tagger, FILE *tfile){
+
+	CPOR_params *myparams = NULL;
+	int ret = 0;
+
+	if(!tagger) return 0;
+	myparams = tagger->myparams;
+
+	if(tagger->buf_len){
+		memset(tagger->buf + tagger->buf_len, 0, myparams->block_size - tagger->buf_len);
+		if(!cpor_tagger_emit(tagger, tagger->buf)) goto cleanup;
+		tagger->buf_len = 0;
+	}
+
+	tagger->t->n = tagger->n;
+	if(!write_cpor_t(myparams, tfile, tagger->key, tagger->t)) goto cleanup;
+	ret = 1;
+
+cleanup:
+	cpor_tagger_abort(tagger);
+	return ret;
+}
+
+/* cpor_tagger_abort: Frees a tagger without finishing the stream. */
+void cpor_tagger_abort(CPOR_tagger *tagger){
+
+	if(!tagger) return;
+	if(tagger->buf) sfree(tagger->buf, tagger->myparams->block_size);
+	if(tagger->key) destroy_cpor_key(tagger->myparams, tagger->key);
+	if(tagger->t) destroy_cpor_t(tagger->myparams, tagger->t);
+	sfree(tagger, sizeof(CPOR_tagger));
+}
+
+/* cpor_tag_stream: Tags everything read from input (e.g. stdin or a pipe) until end of file, writing the tags
+* to tagfilepath as they are produced and t to tfilepath at the end.  Returns 1 on success, 0 on failure.
+*/
+int cpor_tag_stream(CPOR_params *myparams, FILE *input, char *tagfilepath, char *tfilepath){
+
+	CPOR_tagger *tagger = NULL;
+	FILE *tagfile = NULL;
+	FILE *tfile = NULL;
+	unsigned char *buf = NULL;
+	size_t buf_size = 0;
+	size_t len = 0;
+	size_t sigma_size = 0;
+	off_t tagoffset = 0;
+
+	if(!input || !tagfilepath || !tfilepath) return 0;
+
+	/* Read a few blocks at a time so short reads from a pipe still fill whole blocks */
+	buf_size = (size_t)myparams->block_size * 16;
+	if( ((buf = malloc(buf_size)) == NULL)) goto cleanup;
+
+	tagfile = fopen(tagfilepath, "wb");
+	if(!tagfile){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", tagfilepath);
+		goto cleanup;
+	}
+	tfile = fopen(tfilepath, "wb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", tfilepath);
+		goto cleanup;
+	}
+
+	tagger = cpor_tagger_begin(myparams, cpor_tag_sink_file, tagfile);
+	if(!tagger) goto cleanup;
+	
+	/* The number of blocks isn't known yet; it's filled in once the stream ends */
+	sigma_size = BN_num_bytes(tagger->key->global->Zp);
+	if(!write_cpor_tag_header(myparams, tagfile, sigma_size, 0)) goto cleanup;
+
+	while((len = fread(buf, 1, buf_size, input)) > 0)
+		if(!cpor_tagger_update(tagger, buf, len)) goto cleanup;
+	if(ferror(input)) goto cleanup;
+
+	/* cpor_tagger_finish frees the tagger even on failure */
+	if(!cpor_tagger_finish(tagger, tfile)){ tagger = NULL; goto cleanup; }
+	tagger = NULL;
+	if((tagoffset = ftello(tagfile)) < 0) goto cleanup;
+	if(fseeko(tagfile, 0, SEEK_SET) < 0) goto cleanup;
+	if(!write_cpor_tag_header(myparams, tagfile, sigma_size, (tagoffset - sizeof(CPOR_file_header)) / sigma_size)) goto cleanup;
+
+	sfree(buf, buf_size);
+	buf = NULL;
+	if(fclose(tagfile) != 0){ tagfile = NULL; goto cleanup; }
+	tagfile = NULL;
+	if(fclose(tfile) != 0){ tfile = NULL; goto cleanup; }
+
+	return 1;
+
+cleanup:
+	fprintf(stderr, "ERROR: Was unable to tag stream.\n");
+	if(tagger) cpor_tagger_abort(tagger);
+	if(buf) sfree(buf, buf_size);
+	if(tagfile){
+		fclose(tagfile);
+		unlink(tagfilepath);
+	}
+	if(tfile){
+		fclose(tfile);
+		unlink(tfilepath);
+	}
+	return 0;
+}
+
+struct container_header{
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t group_blocks;	/* Data blocks per group */
+	uint32_t sigma_size;	/* Width of each tag's sigma in the trailers */
+};
+
+/* A trailer is the number of data bytes in its group followed by the group's sigmas, padded for alignment */
+static size_t container_trailer_size(struct container_header *header){
+
+	size_t size = sizeof(uint64_t) + ((size_t)header->group_blocks * header->sigma_size);
+
+	return ((size + CPOR_CONTAINER_ALIGN - 1) / CPOR_CONTAINER_ALIGN) * CPOR_CONTAINER_ALIGN;
+}
+
+/* read_cpor_container_header: Reads the header at the start of fd.  Returns 1 if fd is a container, 0 if it
+* is anything else (i.e. a plain data file).  A data file may well begin with the magic, so the whole header
+* must match what cpor_tag_container writes (zero padding included) and the file's size must split into
+* whole groups and a final group of at least one block before fd is taken for a container.
+*/
+static int read_cpor_container_header(int fd, struct container_header *header){
+
+	unsigned char buf[CPOR_CONTAINER_HEADER_SIZE];
+	struct stat st;
+	off_t group_size = 0;
+	off_t rest = 0;
+	size_t trailer_size = 0;
+	size_t i = 0;
+
+	memset(header, 0, sizeof(struct container_header));
+	if(pread(fd, buf, CPOR_CONTAINER_HEADER_SIZE, 0) != CPOR_CONTAINER_HEADER_SIZE) return 0;
+	memcpy(header, buf, sizeof(struct container_header));
+	if(memcmp(header->magic, CPOR_CONTAINER_MAGIC, sizeof(header->magic)) != 0) return 0;
+	if(header->version != CPOR_CONTAINER_VERSION) return 0;
+	if(!header->block_size || !header->group_blocks || !header->sigma_size) return 0;
+	if((header->group_blocks > CPOR_CONTAINER_GROUP_BLOCKS) || (header->sigma_size > CPOR_CONTAINER_ALIGN)) return 0;
+	for(i = sizeof(struct container_header); i < CPOR_CONTAINER_HEADER_SIZE; i++)
+		if(buf[i]) return 0;
+
+	if(fstat(fd, &st) < 0) return 0;
+	trailer_size = container_trailer_size(header);
+	group_size = ((off_t)header->group_blocks * header->block_size) + trailer_size;
+	rest = (st.st_size - CPOR_CONTAINER_HEADER_SIZE) % group_size;
+	if(st.st_size - CPOR_CONTAINER_HEADER_SIZE < group_size && !rest) return 0;
+	if(rest && ((rest < (off_t)(header->block_size + trailer_size)) || ((rest - trailer_size) % header->block_size))) return 0;
+
+	return 1;
+}
+
+struct container_writer{
+	FILE *file;
+	struct container_header header;
+	unsigned char *trailer;
+	size_t trailer_size;
+	unsigned int numtags;	/* Tags collected for the current group */
+	uint64_t data_bytes;	/* Bytes of data written to the current group */
+};
+
+/* Writes out the trailer for the current group and starts a new one. */
+static int cpor_container_flush(struct container_writer *writer){
+
+	memcpy(writer->trailer, &writer->data_bytes, sizeof(uint64_t));
+	if(fwrite(writer->trailer, writer->trailer_size, 1, writer->file) != 1) return 0;
+	memset(writer->trailer, 0, writer->trailer_size);
+	writer->numtags = 0;
+	writer->data_bytes = 0;
+
+	return 1;
+}
+
+/* Tag sink that collects tags into the current group's trailer, writing it once the group is full. */
+static int cpor_container_sink(void *sink_arg, CPOR_tag *tag, size_t sigma_size){
+
+	struct container_writer *writer = sink_arg;
+
+	if(sigma_size != writer->header.sigma_size) return 0;
+	if(BN_bn2binpad(tag->sigma, writer->trailer + sizeof(uint64_t) + ((size_t)writer->numtags * sigma_size), sigma_size) < 0) return 0;
+	writer->numtags++;
+	if(writer->numtags == writer->header.group_blocks) return cpor_container_flush(writer);
+
+	return 1;
+}
+
+/* cpor_tag_container: Tags everything read from input (a file or a stream) into an interleaved container at
+* containerpath: the data, block by block, with each group of CPOR_CONTAINER_GROUP_BLOCKS blocks followed by a
+* trailer holding their tags.  A challenged block and its tag can then be read back with one I/O, and
+* cpor_prove_file recognizes the container on its own.  t is written to tfilepath at the end.
+* Returns 1 on success, 0 on failure.
+*/
+int cpor_tag_container(CPOR_params *myparams, FILE *input, char *containerpath, char *tfilepath){
+
+	struct container_writer writer;
+	CPOR_tagger *tagger = NULL;
+	FILE *tfile = NULL;
+	unsigned char *block = NULL;
+	unsigned char *header = NULL;
+	size_t len = 0;
+
+	memset(&writer, 0, sizeof(struct container_writer));
+	if(!input || !containerpath || !tfilepath) return 0;
+
+	if( ((block = malloc(myparams->block_size)) == NULL)) goto cleanup;
+
+	writer.file = fopen(containerpath, "wb");
+	if(!writer.file){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", containerpath);
+		goto cleanup;
+	}
+	tfile = fopen(tfilepath, "wb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", tfilepath);
+		goto cleanup;
+	}
+
+	tagger = cpor_tagger_begin(myparams, cpor_container_sink, &writer);
+	if(!tagger) goto cleanup;
+
+	/* Write the header */
+	memcpy(writer.header.magic, CPOR_CONTAINER_MAGIC, sizeof(writer.header.magic));
+	writer.header.version = CPOR_CONTAINER_VERSION;
+	writer.header.block_size = myparams->block_size;
+	writer.header.group_blocks = CPOR_CONTAINER_GROUP_BLOCKS;
+	writer.header.sigma_size = BN_num_bytes(tagger->key->global->Zp);
+	writer.trailer_size = container_trailer_size(&writer.header);
+	if( ((writer.trailer = malloc(writer.trailer_size)) == NULL)) goto cleanup;
+	memset(writer.trailer, 0, writer.trailer_size);
+	if( ((header = malloc(CPOR_CONTAINER_HEADER_SIZE)) == NULL)) goto cleanup;
+	memset(header, 0, CPOR_CONTAINER_HEADER_SIZE);
+	memcpy(header, &writer.header, sizeof(struct container_header));
+	if(fwrite(header, CPOR_CONTAINER_HEADER_SIZE, 1, writer.file) != 1) goto cleanup;
+
+	/* Copy the data in a block at a time, zero-padding the last one.  Each block is in the container before the
+	 * tagger hands over its tag, so a group's data always precedes its trailer. */
+	while((len = fread(block, 1, myparams->block_size, input)) > 0){
+		if(len < myparams->block_size) memset(block + len, 0, myparams->block_size - len);
+		if(fwrite(block, myparams->block_size, 1, writer.file) != 1) goto cleanup;
+		writer.data_bytes += len;
+		if(!cpor_tagger_update(tagger, block, len)) goto cleanup;
+		if(len < myparams->block_size) break;
+	}
+	if(ferror(input)) goto cleanup;
+
+	/* Tags the final partial block, if any; cpor_tagger_finish frees the tagger even on failure */
+	if(!cpor_tagger_finish(tagger, tfile)){ tagger = NULL; goto cleanup; }
+	tagger = NULL;
+	if(writer.numtags && !cpor_container_flush(&writer)) goto cleanup;
+
+	sfree(block, myparams->block_size);
+	block = NULL;
+	sfree(header, CPOR_CONTAINER_HEADER_SIZE);
+	header = NULL;
+	sfree(writer.trailer, writer.trailer_size);
+	writer.trailer = NULL;
+	if(fclose(writer.file) != 0){ writer.file = NULL; goto cleanup; }
+	writer.file = NULL;
+	if(fclose(tfile) != 0){ tfile = NULL; goto cleanup; }
+
+	return 1;
+
+cleanup:
+	fprintf(stderr, "ERROR: Was unable to create container.\n");
+	if(tagger) cpor_tagger_abort(tagger);
+	if(block) sfree(block, myparams->block_size);
+	if(header) sfree(header, CPOR_CONTAINER_HEADER_SIZE);
+	if(writer.trailer) sfree(writer.trailer, writer.trailer_size);
+	if(writer.file){
+		fclose(writer.file);
+		unlink(containerpath);
+	}
+	if(tfile){
+		fclose(tfile);
+		unlink(tfilepath);
+	}
+	return 0;
+}
+
+/* cpor_update_tags: Patches the tags of blocks index through index+numblocks-1 in myparams->tag_filename in place
+* after sectors first_sector through first_sector+num_sectors-1 of each of them were rewritten.  old_data and
+* new_data hold those sectors for each block, one block_size stride per block.
+*/
+static int cpor_update_tags(CPOR_params *myparams, uint64_t index, uint64_t numblocks, unsigned int first_sector,
+                            unsigned int num_sectors, unsigned char *old_data, unsigned char *new_data){
+
+	CPOR_key *key = NULL;
+	CPOR_t *t = NULL;
+	CPOR_tag *tag = NULL;
+	FILE *tfile = NULL;
+	FILE *tagfile = NULL;
+	CPOR_file_header header;
+	CPOR_file_header *headerp = NULL;
+	unsigned char *sigma = NULL;
+	size_t sigma_size = 0;
+	off_t start = 0, end = 0;
+	int ret = 0;
+	uint64_t i = 0;
+
+	if(!myparams->tag_filename || !myparams->t_filename || !old_data || !new_data) return 0;
+	if(first_sector + num_sectors > myparams->num_sectors) return 0;
+
+	/* Open the t file for reading */
+	tfile = fopen(myparams->t_filename, "rb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", myparams->t_filename);
+		goto cleanup;
+	}
+	
+	/* Get the CPOR keys */
+	key = cpor_get_keys(myparams);
+	if(!key) goto cleanup;
+	
+	/* Get t for the alphas and n */
+	t = read_cpor_t(myparams, tfile, key);
+	if(!t){ fprintf(stderr, "Could not get t.\n"); goto cleanup; }
+	if((index >= t->n) || (numblocks > t->n - index)){
+		fprintf(stderr, "ERROR: Block %llu is past the end of the tagged file.\n", (unsigned long long)(index + numblocks - 1));
+		goto cleanup;
+	}
+	
+	tagfile = fopen(myparams->tag_filename, "r+b");
+	if(!tagfile){
+		fprintf(stderr, "ERROR: Was not able to open %s for writing.\n", myparams->tag_filename);
+		goto cleanup;
+	}
+	if((ret = read_cpor_header(tagfile, CPOR_TAG_MAGIC, &header)) < 0) goto cleanup;
+	if(ret == 1){
+		if(!check_cpor_header(myparams, &header)) goto cleanup;
+		headerp = &header;
+	}else{
+		if(!skip_cpor_tags(tagfile, index)) goto cleanup;
+	}
+
+	for(i = 0; i < numblocks; i++){
+		/* Read the old tag and note where its sigma lives */
+		if(headerp){
+			sigma_size = header.sigma_size;
+			start = (off_t)header.header_size + (off_t)(index + i - header.first) * sigma_size;
+		}else{
+			if((start = ftello(tagfile)) < 0) goto cleanup;
+		}
+		tag = read_cpor_tag_from(tagfile, headerp, index + i, index + i);
+		if(!tag) goto cleanup;
+		if((end = ftello(tagfile)) < 0) goto cleanup;
+		if(tag->index != index + i) goto cleanup;
+		if(!headerp){
+			sigma_size = end - start - sizeof(size_t) - sizeof(unsigned int);
+			start += sizeof(size_t);
+		}
+		
+		if(!cpor_update_tag_sectors(myparams, key->global, t->alpha, tag, first_sector, num_sectors,
+			old_data + ((size_t)i * myparams->block_size), new_data + ((size_t)i * myparams->block_size))) goto cleanup;
+		
+		/* Overwrite sigma in place */
+		if( ((sigma = malloc(sigma_size)) == NULL)) goto cleanup;
+		if(BN_bn2binpad(tag->sigma, sigma, sigma_size) < 0){
+			fprintf(stderr, "ERROR: The tag for block %llu is too narrow to update in place; re-tag the file.\n", (unsigned long long)(index + i));
+			goto cleanup;
+		}
+		if(fseeko(tagfile, start, SEEK_SET) < 0) goto cleanup;
+		if(fwrite(sigma, sigma_size, 1, tagfile) != 1) goto cleanup;
+		if(fseeko(tagfile, end, SEEK_SET) < 0) goto cleanup;
+		
+		sfree(sigma, sigma_size);
+		sigma = NULL;
+		destroy_cpor_tag(tag);
+		tag = NULL;
+	}
+
+	if(fclose(tagfile) != 0){ tagfile = NULL; goto cleanup; }
+	tagfile = NULL;
+	
+	destroy_cpor_key(myparams, key);
+	destroy_cpor_t(myparams, t);
+	fclose(tfile);
+
+	return 1;
+
+cleanup:
+	fprintf(stderr, "ERROR: Was unable to update tag file.\n");
+	if(sigma) sfree(sigma, sigma_size);
+	if(tag) destroy_cpor_tag(tag);
+	if(key) destroy_cpor_key(myparams, key);
+	if(t) destroy_cpor_t(myparams, t);
+	if(tagfile) fclose(tagfile);
+	if(tfile) fclose(tfile);
+	return 0;
+}
+
+/* cpor_update_block: Updates the tag of block index after it was rewritten in place from old_block to new_block
+* (both block_size bytes, zero-padded like a short final block).  Returns 1 on success, 0 on failure.
+*/
+int cpor_update_block(CPOR_params *myparams, uint64_t index, unsigned char *old_block, unsigned char *new_block){
+
+	return cpor_update_tags(myparams, index, 1, 0, myparams->num_sectors, old_block, new_block);
+}
+
+/* cpor_update_range: Updates the tags of numblocks consecutive blocks starting at index, given their old and
+* new contents (numblocks * block_size bytes each).  Returns 1 on success, 0 on failure.
+*/
+int cpor_update_range(CPOR_params *myparams, uint64_t index, uint64_t numblocks, unsigned char *old_data, unsigned char *new_data){
+
+	return cpor_update_tags(myparams, index, numblocks, 0, myparams->num_sectors, old_data, new_data);
+}
+
+/* cpor_update_sectors: Updates the tag of block index after only sectors first_sector through
+* first_sector+num_sectors-1 changed.  old_sectors and new_sectors hold just those sectors.
+* Returns 1 on success, 0 on failure.
+*/
+int cpor_update_sectors(CPOR_params *myparams, uint64_t index, unsigned int first_sector, unsigned int num_sectors,
+                        unsigned char *old_sectors, unsigned char *new_sectors){
+
+	return cpor_update_tags(myparams, index, 1, first_sector, num_sectors, old_sectors, new_sectors);
+}
+
+#ifdef THREADING
+
+/* Entries per set of the tag cache, and the number of locks the sets are striped across */
+#define CPOR_TAG_CACHE_WAYS 8
+#define CPOR_TAG_CACHE_STRIPES 64
+
+/* Identifies a tag file.  The modification time is part of it so tags rewritten in place (or a file
+ * re-tagged) are never served stale; entries for the old version simply age out. */
+struct tag_cache_file{
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+};
+
+struct tag_cache_entry{
+	struct tag_cache_file file;
+	uint64_t index;
+	unsigned char valid;
+	unsigned char referenced;	/* Set on every hit; gives the entry a second chance at eviction */
+};
+
+/* A set-associative cache of tags.  Each set holds CPOR_TAG_CACHE_WAYS tags and is guarded by one of
+ * CPOR_TAG_CACHE_STRIPES locks; sigma is kept in fixed-width form in one slab. */
+struct CPOR_tag_cache_struct{
+	size_t sigma_size;
+	size_t numsets;
+	struct tag_cache_entry *entries;	/* numsets * CPOR_TAG_CACHE_WAYS entries */
+	unsigned char *sigmas;				/* sigma_size bytes per entry */
+	unsigned char *hands;				/* Per-set clock hand for eviction */
+	int locked;							/* 1 once the slab has been mlocked */
+	pthread_mutex_t locks[CPOR_TAG_CACHE_STRIPES];
+	uint64_t hits[CPOR_TAG_CACHE_STRIPES];
+	uint64_t misses[CPOR_TAG_CACHE_STRIPES];
+};
+
+/* cpor_create_tag_cache: Creates a cache of up to max_tags tags, each with a sigma of at most sigma_size bytes
+* (the size of Zp).  Set myparams->tag_cache to it to have cpor_prove_file consult it; it may be shared by
+* any number of threads and files.  Returns the cache or NULL on failure.
+*/
+CPOR_tag_cache *cpor_create_tag_cache(size_t max_tags, size_t sigma_size){
+
+	CPOR_tag_cache *cache = NULL;
+	int i = 0;
+
+	if(!max_tags || !sigma_size) return NULL;
+
+	if( ((cache = malloc(sizeof(CPOR_tag_cache))) == NULL)) return NULL;
+	memset(cache, 0, sizeof(CPOR_tag_cache));
+	cache->sigma_size = sigma_size;
+	cache->numsets = (max_tags / CPOR_TAG_CACHE_WAYS) + ((max_tags % CPOR_TAG_CACHE_WAYS) ? 1 : 0);
+	if( ((cache->entries = malloc(sizeof(struct tag_cache_entry) * cache->numsets * CPOR_TAG_CACHE_WAYS)) == NULL)) goto cleanup;
+	memset(cache->entries, 0, sizeof(struct tag_cache_entry) * cache->numsets * CPOR_TAG_CACHE_WAYS);
+	if( ((cache->sigmas = malloc(sigma_size * cache->numsets * CPOR_TAG_CACHE_WAYS)) == NULL)) goto cleanup;
+	memset(cache->sigmas, 0, sigma_size * cache->numsets * CPOR_TAG_CACHE_WAYS);
+	if( ((cache->hands = malloc(cache->numsets)) == NULL)) goto cleanup;
+	memset(cache->hands, 0, cache->numsets);
+	for(i = 0; i < CPOR_TAG_CACHE_STRIPES; i++)
+		pthread_mutex_init(&cache->locks[i], NULL);
+
+	return cache;
+
+cleanup:
+	if(cache->entries) free(cache->entries);
+	if(cache->sigmas) free(cache->sigmas);
+	if(cache->hands) free(cache->hands);
+	free(cache);
+	return NULL;
+}
+
+void cpor_destroy_tag_cache(CPOR_tag_cache *cache){
+
+	size_t numentries = 0;
+	int i = 0;
+
+	if(!cache) return;
+	numentries = cache->numsets * CPOR_TAG_CACHE_WAYS;
+	if(cache->locked){
+		munlock(cache->entries, sizeof(struct tag_cache_entry) * numentries);
+		munlock(cache->sigmas, cache->sigma_size * numentries);
+	}
+	for(i = 0; i < CPOR_TAG_CACHE_STRIPES; i++)
+		pthread_mutex_destroy(&cache->locks[i]);
+	sfree(cache->entries, sizeof(struct tag_cache_entry) * numentries);
+	sfree(cache->sigmas, cache->sigma_size * numentries);
+	sfree(cache->hands, cache->numsets);
+	sfree(cache, sizeof(CPOR_tag_cache));
+}
+
+/* Fills in the identity of the tag file at tagfilepath.  Returns 1 on success, 0 on failure. */
+static int tag_cache_file_id(char *tagfilepath, struct tag_cache_file *file){
+
+	struct stat st;
+
+	memset(file, 0, sizeof(struct tag_cache_file));
+	if(stat(tagfilepath, &st) < 0) return 0;
+	file->dev = st.st_dev;
+	file->ino = st.st_ino;
+#if defined(__APPLE__)
+	file->mtime_sec = st.st_mtimespec.tv_sec;
+	file->mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+	file->mtime_sec = st.st_mtim.tv_sec;
+	file->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+
+	return 1;
+}
+
+static size_t tag_cache_set(CPOR_tag_cache *cache, struct tag_cache_file *file, uint64_t index){
+
+	uint64_t h = index;
+
+	h = (h ^ file->ino) * 0x9E3779B97F4A7C15ULL;
+	h = (h ^ file->dev ^ file->mtime_nsec) * 0x9E3779B97F4A7C15ULL;
+	h ^= (h >> 29);
+
+	return h % cache->numsets;
+}
+
+/* Looks up the tag for block index of file.  Returns a new tag on a hit, NULL on a miss. */
+static CPOR_tag *tag_cache_get(CPOR_tag_cache *cache, struct tag_cache_file *file, uint64_t index){
+
+	size_t set = tag_cache_set(cache, file, index);
+	pthread_mutex_t *lock = &cache->locks[set % CPOR_TAG_CACHE_STRIPES];
+	struct tag_cache_entry *entry = NULL;
+	CPOR_tag *tag = NULL;
+	int way = 0;
+
+	pthread_mutex_lock(lock);
+	for(way = 0; way < CPOR_TAG_CACHE_WAYS; way++){
+		entry = &cache->entries[set * CPOR_TAG_CACHE_WAYS + way];
+		if(!entry->valid || (entry->index != index) || memcmp(&entry->file, file, sizeof(struct tag_cache_file))) continue;
+		if( ((tag = allocate_cpor_tag()) == NULL)) break;
+		if(!BN_bin2bn(cache->sigmas + ((set * CPOR_TAG_CACHE_WAYS + way) * cache->sigma_size), cache->sigma_size, tag->sigma)){
+			destroy_cpor_tag(tag);
+			tag = NULL;
+			break;
+		}
+		tag->index = index;
+		entry->referenced = 1;
+		break;
+	}
+	if(tag) cache->hits[set % CPOR_TAG_CACHE_STRIPES]++;
+	else cache->misses[set % CPOR_TAG_CACHE_STRIPES]++;
+	pthread_mutex_unlock(lock);
+
+	return tag;
+}
+
+/* Stores tag in the cache, evicting the first entry of its set that hasn't been hit since the clock hand last
+ * passed it. */
+static void tag_cache_put(CPOR_tag_cache *cache, struct tag_cache_file *file, CPOR_tag *tag){
+
+	size_t set = tag_cache_set(cache, file, tag->index);
+	pthread_mutex_t *lock = &cache->locks[set % CPOR_TAG_CACHE_STRIPES];
+	struct tag_cache_entry *entry = NULL;
+	int way = 0;
+
+	if(BN_num_bytes(tag->sigma) > cache->sigma_size) return;
+
+	pthread_mutex_lock(lock);
+	/* Reuse an empty (or the same) entry if there is one */
+	for(way = 0; way < CPOR_TAG_CACHE_WAYS; way++){
+		entry = &cache->entries[set * CPOR_TAG_CACHE_WAYS + way];
+		if(!entry->valid) break;
+		if((entry->index == tag->index) && !memcmp(&entry->file, file, sizeof(struct tag_cache_file))) break;
+	}
+	if(way == CPOR_TAG_CACHE_WAYS){
+		while(1){
+			way = cache->hands[set];
+			cache->hands[set] = (way + 1) % CPOR_TAG_CACHE_WAYS;
+			entry = &cache->entries[set * CPOR_TAG_CACHE_WAYS + way];
+			if(!entry->referenced) break;
+			entry->referenced = 0;
+		}
+	}
+	if(BN_bn2binpad(tag->sigma, cache->sigmas + ((set * CPOR_TAG_CACHE_WAYS + way) * cache->sigma_size), cache->sigma_size) < 0){
+		entry->valid = 0;
+	}else{
+		entry->file = *file;
+		entry->index = tag->index;
+		entry->referenced = 0;
+		entry->valid = 1;
+	}
+	pthread_mutex_unlock(lock);
+}
+
+/* cpor_tag_cache_prewarm: Loads every tag of a small tag file (one that would take at most half the cache)
+* into cache and locks the cache in memory so prewarmed tags don't get paged out.  Locking is best effort.
+* Returns 1 on success, 0 if the file is too large or could not be read.
+*/
+int cpor_tag_cache_prewarm(CPOR_tag_cache *cache, char *tagfilepath){
+
+	struct tag_cache_file file;
+	FILE *tagfile = NULL;
+	CPOR_tag *tag = NULL;
+	CPOR_file_header header;
+	struct stat st;
+	size_t numentries = 0;
+	uint64_t index = 0;
+	int ret = 0;
+
+	if(!cache || !tagfilepath) return 0;
+	if(!tag_cache_file_id(tagfilepath, &file)) return 0;
+	numentries = cache->numsets * CPOR_TAG_CACHE_WAYS;
+
+	tagfile = fopen(tagfilepath, "rb");
+	if(!tagfile) return 0;
+	if(fstat(fileno(tagfile), &st) < 0) goto cleanup;
+	if((ret = read_cpor_header(tagfile, CPOR_TAG_MAGIC, &header)) < 0) goto cleanup;
+	if(ret == 1){
+		/* A fixed-width tag file says how many tags it holds; make sure they are all there before reading */
+		if(header.n > (numentries / 2)) goto cleanup;
+		if((uint64_t)st.st_size < header.header_size + header.n * header.sigma_size) goto cleanup;
+		for(index = header.first; index - header.first < header.n; index++){
+			tag = read_cpor_tag_from(tagfile, &header, index, index);
+			if(!tag) goto cleanup;
+			tag_cache_put(cache, &file, tag);
+			destroy_cpor_tag(tag);
+		}
+		goto lock;
+	}
+	/* Older tags are written with a sigma_size-wide sigma, a size and an index */
+	if((st.st_size / (sizeof(size_t) + cache->sigma_size + sizeof(unsigned int))) > (numentries / 2)) goto cleanup;
+
+	/* Older tags vary in width, so read whole tags until exactly the end of the file; a short read means
+	 * the last tag is cut off and the file is not one we can trust */
+	while(ftello(tagfile) < st.st_size){
+		tag = read_cpor_tag_from(tagfile, NULL, index, index);
+		if(!tag) goto cleanup;
+		if(feof(tagfile)){
+			destroy_cpor_tag(tag);
+			goto cleanup;
+		}
+		tag_cache_put(cache, &file, tag);
+		destroy_cpor_tag(tag);
+		index++;
+	}
+	if(ftello(tagfile) != st.st_size) goto cleanup;
+
+lock:
+	fclose(tagfile);
+	if(!cache->locked){
+		if(mlock(cache->entries, sizeof(struct tag_cache_entry) * numentries) == 0){
+			if(mlock(cache->sigmas, cache->sigma_size * numentries) == 0) cache->locked = 1;
+			else munlock(cache->entries, sizeof(struct tag_cache_entry) * numentries);
+		}
+	}
+
+	return 1;
+
+cleanup:
+	fclose(tagfile);
+	return 0;
+}
+
+/* cpor_tag_cache_stats: Reports the number of lookups cache has answered (hits) and passed on to the tag
+* file (misses). */
+void cpor_tag_cache_stats(CPOR_tag_cache *cache, uint64_t *hits, uint64_t *misses){
+
+	int i = 0;
+
+	if(hits) *hits = 0;
+	if(misses) *misses = 0;
+	if(!cache) return;
+	for(i = 0; i < CPOR_TAG_CACHE_STRIPES; i++){
+		pthread_mutex_lock(&cache->locks[i]);
+		if(hits) *hits += cache->hits[i];
+		if(misses) *misses += cache->misses[i];
+		pthread_mutex_unlock(&cache->locks[i]);
+	}
+}
+
+/* Kinds of secrets held by the secrets cache */
+#define CPOR_SECRETS_KEY 1
+#define CPOR_SECRETS_T 2
+
+struct secrets_cache_entry{
+	int kind;						/* CPOR_SECRETS_*, or 0 if the entry is free */
+	struct tag_cache_file file;		/* The key or t file */
+	struct tag_cache_file keyfile;	/* For a t, the key file it was decrypted with */
+	uint64_t n;						/* For a t, the number of blocks */
+	time_t loaded;
+	uint64_t used;					/* Value of the cache's clock when last used, for LRU eviction */
+	size_t next;					/* Next entry in the same bucket, plus one (0 ends the chain) */
+};
+
+/* Decoded keys and t's, so a long-lived verifier needn't reread and decrypt them for every challenge and
+ * verification.  The secrets are kept serialized in one slab (a slot per entry) that is mlocked if possible
+ * and wiped whenever an entry is evicted or the cache destroyed.  Entries are hashed by file identity,
+ * including the modification time, so a rewritten file is never served stale and a lookup only walks the
+ * entries of one bucket.  Expired entries are wiped as lookups come across them, whenever an entry is added
+ * and by cpor_secrets_cache_sweep. */
+struct CPOR_secrets_cache_struct{
+	unsigned int enc_key_size;
+	unsigned int mac_key_size;
+	unsigned int prf_key_size;
+	unsigned int num_sectors;
+	size_t Zp_size;				/* Width of Zp and of each alpha in a slot */
+	size_t slot_size;
+	size_t numentries;
+	unsigned int ttl;			/* Seconds an entry is served for (0 for no limit) */
+	struct secrets_cache_entry *entries;
+	size_t *buckets;			/* The first entry of each bucket, plus one */
+	size_t numbuckets;			/* A power of two, at least twice numentries */
+	unsigned char *slab;		/* slot_size bytes per entry */
+	int locked;					/* 1 if the slab is mlocked */
+	uint64_t clock;
+	pthread_mutex_t lock;
+};
+
+/* cpor_create_secrets_cache: Creates a cache of up to max_entries decoded keys and t's, made with the sizes in
+* myparams, each served for at most ttl seconds (0 for as long as its file is unchanged).  Set
+* myparams->secrets_cache to it to have cpor_challenge_file, cpor_verify_file and friends consult it; it
+* may be shared by any number of threads.  Returns the cache or NULL on failure.
+*/
+CPOR_secrets_cache *cpor_create_secrets_cache(CPOR_params *myparams, size_t max_entries, unsigned int ttl){
+
+	CPOR_secrets_cache *cache = NULL;
+	size_t key_size = 0, t_size = 0;
+
+	if(!myparams || !max_entries) return NULL;
+
+	if( ((cache = malloc(sizeof(CPOR_secrets_cache))) == NULL)) return NULL;
+	memset(cache, 0, sizeof(CPOR_secrets_cache));
+	cache->enc_key_size = myparams->enc_key_size;
+	cache->mac_key_size = myparams->mac_key_size;
+	cache->prf_key_size = myparams->prf_key_size;
+	cache->num_sectors = myparams->num_sectors;
+	cache->Zp_size = (myparams->Zp_bits + 7) / 8;
+	cache->numentries = max_entries;
+	cache->ttl = ttl;
+
+	/* A key is k_enc, k_mac and Zp; a t is k_prf and the alphas */
+	key_size = cache->enc_key_size + cache->mac_key_size + cache->Zp_size;
+	t_size = cache->prf_key_size + (cache->Zp_size * cache->num_sectors);
+	cache->slot_size = (key_size > t_size) ? key_size : t_size;
+
+	if( ((cache->entries = malloc(sizeof(struct secrets_cache_entry) * max_entries)) == NULL)) goto cleanup;
+	memset(cache->entries, 0, sizeof(struct secrets_cache_entry) * max_entries);
+	for(cache->numbuckets = 1; cache->numbuckets < 2 * max_entries; cache->numbuckets <<= 1);
+	if( ((cache->buckets = malloc(sizeof(size_t) * cache->numbuckets)) == NULL)) goto cleanup;
+	memset(cache->buckets, 0, sizeof(size_t) * cache->numbuckets);
+	if( ((cache->slab = malloc(cache->slot_size * max_entries)) == NULL)) goto cleanup;
+	memset(cache->slab, 0, cache->slot_size * max_entries);
+	if(mlock(cache->slab, cache->slot_size * max_entries) == 0) cache->locked = 1;
+#ifdef MADV_DONTDUMP
+	madvise(cache->slab, cache->slot_size * max_entries, MADV_DONTDUMP);
+#endif
+	pthread_mutex_init(&cache->lock, NULL);
+
+	return cache;
+
+cleanup:
+	if(cache->entries) free(cache->entries);
+	if(cache->buckets) free(cache->buckets);
+	if(cache->slab) free(cache->slab);
+	free(cache);
+	return NULL;
+}
+
+void cpor_destroy_secrets_cache(CPOR_secrets_cache *cache){
+
+	if(!cache) return;
+	OPENSSL_cleanse(cache->slab, cache->slot_size * cache->numentries);
+	if(cache->locked) munlock(cache->slab, cache->slot_size * cache->numentries);
+	free(cache->slab);
+	free(cache->entries);
+	free(cache->buckets);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+/* secrets_cache_usable: The cache only holds secrets of the sizes it was made for */
+static int secrets_cache_usable(CPOR_secrets_cache *cache, CPOR_params *myparams){
+
+	return (cache->enc_key_size == myparams->enc_key_size) && (cache->mac_key_size == myparams->mac_key_size) &&
+		(cache->prf_key_size == myparams->prf_key_size) && (cache->num_sectors == myparams->num_sectors) &&
+		(cache->Zp_size == (myparams->Zp_bits + 7) / 8);
+}
+
+static size_t secrets_cache_bucket(CPOR_secrets_cache *cache, int kind, struct tag_cache_file *file){
+
+	uint64_t h = (uint64_t)kind;
+
+	h = (h ^ file->ino) * 0x9E3779B97F4A7C15ULL;
+	h = (h ^ file->dev ^ file->mtime_sec ^ file->mtime_nsec) * 0x9E3779B97F4A7C15ULL;
+	h ^= (h >> 29);
+
+	return h & (cache->numbuckets - 1);
+}
+
+/* secrets_cache_link: Files a newly filled entry in its bucket.  Called with the cache lock held. */
+static void secrets_cache_link(CPOR_secrets_cache *cache, struct secrets_cache_entry *entry){
+
+	size_t bucket = secrets_cache_bucket(cache, entry->kind, &entry->file);
+
+	entry->next = cache->buckets[bucket];
+	cache->buckets[bucket] = (entry - cache->entries) + 1;
+}
+
+/* secrets_cache_drop: Takes entry out of its bucket and wipes it and its slot.  Called with the cache lock held. */
+static void secrets_cache_drop(CPOR_secrets_cache *cache, struct secrets_cache_entry *entry){
+
+	size_t *link = NULL;
+	size_t i = entry - cache->entries;
+
+	if(entry->kind){
+		link = &cache->buckets[secrets_cache_bucket(cache, entry->kind, &entry->file)];
+		while(*link && (*link != i + 1)) link = &cache->entries[*link - 1].next;
+		if(*link) *link = entry->next;
+	}
+	OPENSSL_cleanse(cache->slab + (i * cache->slot_size), cache->slot_size);
+	memset(entry, 0, sizeof(struct secrets_cache_entry));
+}
+
+/* secrets_cache_reap: Drops every expired entry.  Called with the cache lock held. */
+static void secrets_cache_reap(CPOR_secrets_cache *cache){
+
+	time_t now = time(NULL);
+	size_t i = 0;
+
+	if(!cache->ttl) return;
+	for(i = 0; i < cache->numentries; i++)
+		if(cache->entries[i].kind && (now - cache->entries[i].loaded >= cache->ttl))
+			secrets_cache_drop(cache, &cache->entries[i]);
+}
+
+/* cpor_secrets_cache_sweep: Wipes the secrets that have outlived the cache's ttl, for a long-lived verifier
+* to call now and then so they don't linger in memory until the next lookup or load happens upon them.
+*/
+void cpor_secrets_cache_sweep(CPOR_secrets_cache *cache){
+
+	if(!cache) return;
+	pthread_mutex_lock(&cache->lock);
+	secrets_cache_reap(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* secrets_cache_find: Returns the live entry of kind for file (and keyfile, for a t), or NULL.  Expired
+* entries in file's bucket are dropped as they are found.  Called with the cache lock held.
+*/
+static struct secrets_cache_entry *secrets_cache_find(CPOR_secrets_cache *cache, int kind, struct tag_cache_file *file,
+                                                      struct tag_cache_file *keyfile){
+
+	struct secrets_cache_entry *entry = NULL;
+	time_t now = time(NULL);
+	size_t next = cache->buckets[secrets_cache_bucket(cache, kind, file)];
+
+	while(next){
+		entry = &cache->entries[next - 1];
+		next = entry->next;
+		if(cache->ttl && (now - entry->loaded >= cache->ttl)){
+			secrets_cache_drop(cache, entry);
+			continue;
+		}
+		if(entry->kind != kind) continue;
+		if(memcmp(&entry->file, file, sizeof(struct tag_cache_file))) continue;
+		if(keyfile && memcmp(&entry->keyfile, keyfile, sizeof(struct tag_cache_file))) continue;
+		entry->used = ++cache->clock;
+		return entry;
+	}
+
+	return NULL;
+}
+
+/* secrets_cache_slot: Picks the entry to fill next (a free one, or else the least recently used), wiping it.
+* Expired entries are reaped first, so they are the ones reused.  The caller links the entry in once it is
+* filled.  Called with the cache lock held.
+*/
+static struct secrets_cache_entry *secrets_cache_slot(CPOR_secrets_cache *cache){
+
+	struct secrets_cache_entry *victim = &cache->entries[0];
+	size_t i = 0;
+
+	secrets_cache_reap(cache);
+	for(i = 0; i < cache->numentries; i++){
+		if(!cache->entries[i].kind){
+			victim = &cache->entries[i];
+			break;
+		}
+		if(cache->entries[i].used < victim->used) victim = &cache->entries[i];
+	}
+	secrets_cache_drop(cache, victim);
+	victim->loaded = time(NULL);
+	victim->used = ++cache->clock;
+
+	return victim;
+}
+
+/* secrets_cache_get_key: Returns a copy of the cached key from myparams->key_filename, loading it into the
+* cache first if need be.
+*/
+static CPOR_key *secrets_cache_get_key(CPOR_secrets_cache *cache, CPOR_params *myparams){
+
+	struct secrets_cache_entry *entry = NULL;
+	struct tag_cache_file file;
+	CPOR_key *key = NULL;
+	unsigned char *slot = NULL;
+
+	if(!tag_cache_file_id(myparams->key_filename, &file)) return cpor_get_keys(myparams);
+
+	pthread_mutex_lock(&cache->lock);
+	if( ((entry = secrets_cache_find(cache, CPOR_SECRETS_KEY, &file, NULL)) != NULL)){
+		slot = cache->slab + ((entry - cache->entries) * cache->slot_size);
+		if( ((key = allocate_cpor_key(myparams)) == NULL)) goto cleanup;
+		if( ((key->global = allocate_cpor_global()) == NULL)) goto cleanup;
+		memcpy(key->k_enc, slot, cache->enc_key_size);
+		memcpy(key->k_mac, slot + cache->enc_key_size, cache->mac_key_size);
+		if(!BN_bin2bn(slot + cache->enc_key_size + cache->mac_key_size, cache->Zp_size, key->global->Zp)) goto cleanup;
+		pthread_mutex_unlock(&cache->lock);
+		return key;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	if( ((key = cpor_get_keys(myparams)) == NULL)) return NULL;
+	if((key->k_enc_size != cache->enc_key_size) || (key->k_mac_size != cache->mac_key_size) ||
+		(BN_num_bytes(key->global->Zp) > cache->Zp_size)) return key;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = secrets_cache_slot(cache);
+	slot = cache->slab + ((entry - cache->entries) * cache->slot_size);
+	memcpy(slot, key->k_enc, cache->enc_key_size);
+	memcpy(slot + cache->enc_key_size, key->k_mac, cache->mac_key_size);
+	if(BN_bn2binpad(key->global->Zp, slot + cache->enc_key_size + cache->mac_key_size, cache->Zp_size) < 0){
+		OPENSSL_cleanse(slot, cache->slot_size);
+	}else{
+		entry->kind = CPOR_SECRETS_KEY;
+		entry->file = file;
+		secrets_cache_link(cache, entry);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return key;
+
+cleanup:
+	pthread_mutex_unlock(&cache->lock);
+	if(key) destroy_cpor_key(myparams, key);
+	return NULL;
+}
+
+/* secrets_cache_get_t: Returns a copy of the cached t from tfilepath as decrypted with key (which came from
+* myparams->key_filename), loading it into the cache first if need be.
+*/
+static CPOR_t *secrets_cache_get_t(CPOR_secrets_cache *cache, CPOR_params *myparams, char *tfilepath, CPOR_key *key){
+
+	struct secrets_cache_entry *entry = NULL;
+	struct tag_cache_file file;
+	struct tag_cache_file keyfile;
+	CPOR_t *t = NULL;
+	FILE *tfile = NULL;
+	unsigned char *slot = NULL;
+	unsigned int j = 0;
+	int cacheable = 0;
+
+	cacheable = tag_cache_file_id(tfilepath, &file) && tag_cache_file_id(myparams->key_filename, &keyfile);
+	if(cacheable){
+		pthread_mutex_lock(&cache->lock);
+		if( ((entry = secrets_cache_find(cache, CPOR_SECRETS_T, &file, &keyfile)) != NULL)){
+			slot = cache->slab + ((entry - cache->entries) * cache->slot_size);
+			if( ((t = allocate_cpor_t(myparams)) == NULL)) goto cleanup;
+			t->n = entry->n;
+			memcpy(t->k_prf, slot, cache->prf_key_size);
+			for(j = 0; j < cache->num_sectors; j++)
+				if(!BN_bin2bn(slot + cache->prf_key_size + (j * cache->Zp_size), cache->Zp_size, t->alpha[j])) goto cleanup;
+			pthread_mutex_unlock(&cache->lock);
+			return t;
+		}
+		pthread_mutex_unlock(&cache->lock);
+	}
+
+	tfile = fopen(tfilepath, "rb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", tfilepath);
+		return NULL;
+	}
+	t = read_cpor_t(myparams, tfile, key);
+	fclose(tfile);
+	if(!t || !cacheable) return t;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = secrets_cache_slot(cache);
+	slot = cache->slab + ((entry - cache->entries) * cache->slot_size);
+	memcpy(slot, t->k_prf, cache->prf_key_size);
+	for(j = 0; j < cache->num_sectors; j++)
+		if(BN_bn2binpad(t->alpha[j], slot + cache->prf_key_size + (j * cache->Zp_size), cache->Zp_size) < 0) break;
+	if(j < cache->num_sectors){
+		OPENSSL_cleanse(slot, cache->slot_size);
+	}else{
+		entry->kind = CPOR_SECRETS_T;
+		entry->file = file;
+		entry->keyfile = keyfile;
+		entry->n = t->n;
+		secrets_cache_link(cache, entry);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return t;
+
+cleanup:
+	pthread_mutex_unlock(&cache->lock);
+	if(t) destroy_cpor_t(myparams, t);
+	return NULL;
+}
+
+#endif
+
+/* get_cpor_keys: cpor_get_keys, through myparams->secrets_cache if there is one */
+static CPOR_key *get_cpor_keys(CPOR_params *myparams){
+
+#ifdef THREADING
+	if(myparams->secrets_cache && secrets_cache_usable(myparams->secrets_cache, myparams))
+		return secrets_cache_get_key(myparams->secrets_cache, myparams);
+#endif
+	return cpor_get_keys(myparams);
+}
+
+/* get_cpor_t: Reads and decrypts the t file at tfilepath with key, through myparams->secrets_cache if there
+* is one.
+*/
+static CPOR_t *get_cpor_t(CPOR_params *myparams, char *tfilepath, CPOR_key *key){
+
+	FILE *tfile = NULL;
+	CPOR_t *t = NULL;
+
+#ifdef THREADING
+	if(myparams->secrets_cache && secrets_cache_usable(myparams->secrets_cache, myparams))
+		return secrets_cache_get_t(myparams->secrets_cache, myparams, tfilepath, key);
+#endif
+	tfile = fopen(tfilepath, "rb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", tfilepath);
+		return NULL;
+	}
+	t = read_cpor_t(myparams, tfile, key);
+	fclose(tfile);
+
+	return t;
+}
+
+CPOR_challenge *cpor_challenge_file(CPOR_params *myparams){
+
+	CPOR_key *key = NULL;
+	CPOR_challenge *challenge = NULL;
+	CPOR_t *t = NULL;
+
+	if(!myparams->filename) return NULL;
+	
+	/* Get the CPOR keys */
+	key = get_cpor_keys(myparams);
+	if(!key) goto cleanup;
+	
+	/* Get t for n (the number of blocks) */
+	t = get_cpor_t(myparams, myparams->t_filename, key);
+	if(!t){ fprintf(stderr, "Could not get t.\n"); goto cleanup; }
+
+	challenge = cpor_create_challenge(myparams, key->global, t->n);
+	if(!challenge) goto cleanup;
+
+	if(key) destroy_cpor_key(myparams, key);
+	if(t) destroy_cpor_t(myparams, t);
+	
+	return challenge;
+
+cleanup:
+	if(key) destroy_cpor_key(myparams, key);
+	if(t) destroy_cpor_t(myparams, t);
+	return NULL;
+	
+}
+
+/* cpor_prove_container: Computes the proof for challenge over the container open on fd, visiting the challenged
+* blocks in the sorted order given.  All challenged blocks of a group are read with one pread that runs from the
+* first of them through the group's trailer, so each block comes back together with its tag.
+*/
+static CPOR_proof *cpor_prove_container(CPOR_params *myparams, CPOR_challenge *challenge, struct challenge_order *order,
+                                        int fd, struct container_header *header){
+
+	CPOR_proof *proof = NULL;
+	CPOR_tag *tag = NULL;
+	unsigned char *buf = NULL;
+	size_t buf_size = 0;
+	size_t trailer_size = container_trailer_size(header);
+	off_t group_size = ((off_t)header->group_blocks * header->block_size) + trailer_size;
+	off_t group_offset = 0;
+	struct stat st;
+	uint64_t numgroups = 0;
+	uint64_t group = 0;
+	uint64_t groupblocks = 0;
+	uint64_t first = 0, pos = 0;
+	int i = 0, j = 0;
+
+	if(header->block_size != myparams->block_size){
+		fprintf(stderr, "ERROR: The container was made with %u byte blocks.\n", header->block_size);
+		return NULL;
+	}
+	if(fstat(fd, &st) < 0) return NULL;
+	if(st.st_size < CPOR_CONTAINER_HEADER_SIZE) return NULL;
+	numgroups = ((st.st_size - CPOR_CONTAINER_HEADER_SIZE) / group_size) + (((st.st_size - CPOR_CONTAINER_HEADER_SIZE) % group_size) ? 1 : 0);
+
+	buf_size = (size_t)group_size;
+	if( ((buf = malloc(buf_size)) == NULL)) goto cleanup;
+	if( ((tag = allocate_cpor_tag()) == NULL)) goto cleanup;
+
+	for(i = 0; i < challenge->l; i = j){
+		group = order[i].index / header->group_blocks;
+		first = order[i].index % header->group_blocks;
+		if(group >= numgroups) goto cleanup;
+		group_offset = CPOR_CONTAINER_HEADER_SIZE + ((off_t)group * group_size);
+
+		/* The last group may hold fewer blocks; work out how many from where the file ends */
+		groupblocks = header->group_blocks;
+		if(group == numgroups - 1){
+			if((st.st_size - group_offset) < (off_t)trailer_size) goto cleanup;
+			groupblocks = (st.st_size - group_offset - trailer_size) / header->block_size;
+		}
+		if(first >= groupblocks) goto cleanup;
+
+		/* Read from the first challenged block of the group through its trailer */
+		if(pread(fd, buf, ((groupblocks - first) * header->block_size) + trailer_size,
+			group_offset + ((off_t)first * header->block_size)) != (ssize_t)(((groupblocks - first) * header->block_size) + trailer_size)) goto cleanup;
+
+		for(j = i; (j < challenge->l) && ((order[j].index / header->group_blocks) == group); j++){
+			pos = order[j].index % header->group_blocks;
+			if(pos >= groupblocks) goto cleanup;
+			if(!BN_bin2bn(buf + ((groupblocks - first) * header->block_size) + sizeof(uint64_t) + (pos * header->sigma_size),
+				header->sigma_size, tag->sigma)) goto cleanup;
+			tag->index = order[j].index;
+			proof = cpor_create_proof_update(myparams, challenge, proof, tag, buf + ((pos - first) * header->block_size),
+				order[j].index, order[j].i);
+			if(!proof) goto cleanup;
+		}
+	}
+
+	sfree(buf, buf_size);
+	destroy_cpor_tag(tag);
+
+	return cpor_create_proof_final(proof);
+
+cleanup:
+	fprintf(stderr, "ERROR: Was unable to read the challenged blocks from the container.\n");
+	if(buf) sfree(buf, buf_size);
+	if(tag) destroy_cpor_tag(tag);
+	if(proof) destroy_cpor_proof(myparams, proof);
+
+	return NULL;
+}
+
+/* A data file and its fixed-width tag file held open across proofs; see cpor_open_prover_file */
+struct CPOR_prover_file_struct{
+	int fd;						/* The data file */
+	int tagfd;					/* The tag file, read with pread so that it shrinking under us is only a short read */
+	CPOR_file_header header;	/* The tag file's header */
+	struct stat data_st;		/* What the paths named when they were opened */
+	struct stat tag_st;
+	char *filepath;
+	char *tagfilepath;
+};
+
+/* read_cpor_tag_held: Reads the tag for block index from the tag file file holds open.  Returns NULL if the
+* tag file no longer has it (it was truncated or rewritten since it was opened).
+*/
+static CPOR_tag *read_cpor_tag_held(CPOR_prover_file *file, uint64_t index){
+
+	CPOR_tag *tag = NULL;
+	unsigned char sigma[CPOR_CONTAINER_ALIGN];
+	off_t offset = 0;
+
+	if((index < file->header.first) || (index - file->header.first >= file->header.n)) return NULL;
+	offset = (off_t)file->header.header_size + (off_t)(index - file->header.first) * file->header.sigma_size;
+
+	if(pread(file->tagfd, sigma, file->header.sigma_size, offset) != (ssize_t)file->header.sigma_size) return NULL;
+	if( ((tag = allocate_cpor_tag()) == NULL)) return NULL;
+	if(!BN_bin2bn(sigma, file->header.sigma_size, tag->sigma)){
+		destroy_cpor_tag(tag);
+		return NULL;
+	}
+	tag->index = index;
+
+	return tag;
+}
+
+/* cpor_prove_order: Computes the proof over the count challenged blocks in order (sorted by index), reading
+* block index from offset (index - first) * block_size of fd and its tag from held, if set, or else from
+* myparams->tag_filename.
+* Runs of consecutive challenged blocks (as in a run challenge) are read with a single pread of up to
+* CPOR_PROVE_RUN_BLOCKS blocks.  If myparams->tag_cache is set, tags are looked up there first and the tag
+* file is only opened for the ones that miss.  With no blocks to visit the proof is all zeros.
+*/
+static CPOR_proof *cpor_prove_order(CPOR_params *myparams, CPOR_challenge *challenge, struct challenge_order *order,
+                                    unsigned int count, int fd, uint64_t first, CPOR_prover_file *held){
+	CPOR_tag *tag = NULL;
+	CPOR_proof *proof = NULL;
+	FILE *tagfile = NULL;
+	unsigned char *runbuf = NULL;
+	size_t runbuf_size = 0;
+	uint64_t tagpos = 0;
+	CPOR_file_header tagheader;
+	CPOR_file_header *tagheaderp = NULL;
+	int i = 0, j = 0, r = 0;
+	int runlen = 0;
+	int ret = 0;
+#ifdef THREADING
+	CPOR_tag_cache *cache = NULL;
+	struct tag_cache_file cachefile;
+#endif
+
+	if(!count) return allocate_cpor_proof(myparams);
+
+#ifdef THREADING
+	if(!held && myparams->tag_cache && myparams->tag_filename && tag_cache_file_id(myparams->tag_filename, &cachefile)) cache = myparams->tag_cache;
+#endif
+	
+	runbuf_size = (size_t)myparams->block_size * CPOR_PROVE_RUN_BLOCKS;
+	if( ((runbuf = malloc(runbuf_size)) == NULL)) goto cleanup;
+	
+	/* Prime the readahead window with the first few challenged blocks */
+	for(j = 0; (j < CPOR_READAHEAD_BLOCKS) && (j < count); j++)
+		cpor_readahead(fd, (off_t)myparams->block_size * (order[j].index - first), myparams->block_size);
+	
+	for(i = 0; i < count; i += runlen){
+		/* Find the run of consecutive blocks starting at order[i] */
+		for(runlen = 1; (runlen < CPOR_PROVE_RUN_BLOCKS) && (i + runlen < count); runlen++)
+			if(order[i + runlen].index != order[i].index + runlen) break;
+	
+		/* Keep the readahead window CPOR_READAHEAD_BLOCKS blocks ahead of us */
+		for(j = i + CPOR_READAHEAD_BLOCKS; (j < i + runlen + CPOR_READAHEAD_BLOCKS) && (j < count); j++)
+			cpor_readahead(fd, (off_t)myparams->block_size * (order[j].index - first), myparams->block_size);
+		
+		/* Read the data blocks of the run; anything past the end of the file reads as zeros */
+		memset(runbuf, 0, (size_t)myparams->block_size * runlen);
+		if(pread(fd, runbuf, (size_t)myparams->block_size * runlen, (off_t)myparams->block_size * (order[i].index - first)) < 0) goto cleanup;
+		
+		for(r = 0; r < runlen; r++){
+			tag = NULL;
+#ifdef THREADING
+			if(cache) tag = tag_cache_get(cache, &cachefile, order[i + r].index);
+#endif
+			if(held && ((tag = read_cpor_tag_held(held, order[i + r].index)) == NULL)) goto cleanup;
+			if(!tag){
+				if(!tagfile){
+					if(!myparams->tag_filename) goto cleanup;
+					tagfile = fopen(myparams->tag_filename, "rb");
+					if(!tagfile){
+						fprintf(stderr, "ERROR: Was unable to open %s\n", myparams->tag_filename);
+						goto cleanup;
+					}
+					if((ret = read_cpor_header(tagfile, CPOR_TAG_MAGIC, &tagheader)) < 0) goto cleanup;
+					if(ret == 1){
+						if(!check_cpor_header(myparams, &tagheader)) goto cleanup;
+						tagheaderp = &tagheader;
+						/* Fixed-width tags are read straight from their offsets */
+#ifdef POSIX_FADV_RANDOM
+						posix_fadvise(fileno(tagfile), 0, 0, POSIX_FADV_RANDOM);
+#endif
+					}else{
+						/* Older tag files are variable-width and must be walked from the front, so tell the kernel we'll read it sequentially */
+#ifdef POSIX_FADV_SEQUENTIAL
+						posix_fadvise(fileno(tagfile), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+					}
+				}
+				/* Read tag for data block at I[i], continuing forward from the last tag we read */
+				tag = read_cpor_tag_from(tagfile, tagheaderp, tagpos, order[i + r].index);
+				if(!tag) goto cleanup;
+				tagpos = order[i + r].index + 1;
+#ifdef THREADING
+				if(cache) tag_cache_put(cache, &cachefile, tag);
+#endif
+			}
+			
+			proof = cpor_create_proof_update(myparams, challenge, proof, tag, runbuf + ((size_t)myparams->block_size * r),
+				order[i + r].index, order[i + r].i);
+			if(!proof) goto cleanup;
+			
+			destroy_cpor_tag(tag);
+			tag = NULL;
+		}
+	}
+	
+	proof = cpor_create_proof_final(proof);
+	
+	sfree(runbuf, runbuf_size);
+	if(tagfile) fclose(tagfile);
+
+	return proof;
+
+cleanup:
+	if(runbuf) sfree(runbuf, runbuf_size);
+	if(tagfile) fclose(tagfile);
+	if(tag) destroy_cpor_tag(tag);
+	if(proof) destroy_cpor_proof(myparams, proof);
+
+	return NULL;
+}
+
+/* sort_challenge_order: Returns the challenged indices of challenge sorted by offset, each remembering which
+* nu_i belongs to it, or NULL on failure.  Free with sfree(order, sizeof(struct challenge_order) * challenge->l).
+*/
+static struct challenge_order *sort_challenge_order(CPOR_challenge *challenge){
+
+	struct challenge_order *order = NULL;
+	int i = 0;
+
+	if( ((order = malloc(sizeof(struct challenge_order) * challenge->l)) == NULL)) return NULL;
+	for(i = 0; i < challenge->l; i++){
+		order[i].index = challenge->I[i];
+		order[i].i = i;
+	}
+	qsort(order, challenge->l, sizeof(struct challenge_order), compare_challenge_order);
+
+	return order;
+}
+
+/* cpor_prove_file: Computes the proof for challenge over myparams->filename and myparams->tag_filename.
+* Challenged blocks are visited in ascending offset order (each carrying its own nu_i) so the data file is
+* read with short forward seeks and the tag file is walked once, front to back.  The sums are order
+* independent, so the result is identical to visiting I[] in challenge order.  If myparams->filename is a
+* container made by cpor_tag_container, the tags are read from it instead and myparams->tag_filename is not
+* used.
+*/
+CPOR_proof *cpor_prove_file(CPOR_params *myparams, CPOR_challenge *challenge){
+	CPOR_proof *proof = NULL;
+	int fd = -1;
+	struct challenge_order *order = NULL;
+	struct container_header header;
+	
+	if(!myparams->filename || !challenge) return 0;
+	if(strlen(myparams->filename) >= MAXPATHLEN) return 0;
+	if(myparams->tag_filename && (strlen(myparams->tag_filename) >= MAXPATHLEN)) return 0;
+	
+	fd = open(myparams->filename, O_RDONLY);
+	if(fd < 0){
+		fprintf(stderr, "ERROR: Was unable to open %s\n", myparams->filename);
+		return 0;
+	}
+	
+	if( ((order = sort_challenge_order(challenge)) == NULL)) goto cleanup;
+	
+	if(read_cpor_container_header(fd, &header))
+		proof = cpor_prove_container(myparams, challenge, order, fd, &header);
+	else
+		proof = cpor_prove_order(myparams, challenge, order, challenge->l, fd, 0, NULL);
+	
+cleanup:
+	if(order) sfree(order, sizeof(struct challenge_order) * challenge->l);
+	close(fd);
+
+	return proof;
+}
+
+/* cpor_prove_shard: Computes a partial proof for challenge from one shard of a file, for provers that each
+* hold part of it.  myparams->tag_filename is a shard made by cpor_shard_tags for blocks first through last-1,
+* and myparams->filename holds the same blocks, starting with block first.  Challenged blocks outside the
+* shard are skipped, so the partial proof may be all zeros.  Partial proofs from shards that cover the file
+* without overlapping sum, with cpor_combine_proofs, to the proof of the whole challenge.
+*/
+CPOR_proof *cpor_prove_shard(CPOR_params *myparams, CPOR_challenge *challenge){
+	CPOR_proof *proof = NULL;
+	CPOR_file_header header;
+	FILE *tagfile = NULL;
+	int fd = -1;
+	struct challenge_order *order = NULL;
+	unsigned int lo = 0, hi = 0;
+	
+	if(!myparams->filename || !myparams->tag_filename || !challenge) return NULL;
+	
+	/* Find out which blocks the shard holds */
+	tagfile = fopen(myparams->tag_filename, "rb");
+	if(!tagfile){
+		fprintf(stderr, "ERROR: Was unable to open %s\n", myparams->tag_filename);
+		return NULL;
+	}
+	if(read_cpor_header(tagfile, CPOR_TAG_MAGIC, &header) != 1){
+		fprintf(stderr, "ERROR: %s is not a tag file shard.\n", myparams->tag_filename);
+		goto cleanup;
+	}
+	if(!(header.flags & CPOR_FORMAT_SHARD)){
+		fprintf(stderr, "ERROR: %s is not a tag file shard.\n", myparams->tag_filename);
+		goto cleanup;
+	}
+	fclose(tagfile);
+	tagfile = NULL;
+	
+	fd = open(myparams->filename, O_RDONLY);
+	if(fd < 0){
+		fprintf(stderr, "ERROR: Was unable to open %s\n", myparams->filename);
+		goto cleanup;
+	}
+	
+	/* The challenged blocks in the shard are a contiguous stretch of the sorted order */
+	if( ((order = sort_challenge_order(challenge)) == NULL)) goto cleanup;
+	for(lo = 0; (lo < challenge->l) && (order[lo].index < header.first); lo++);
+	for(hi = lo; (hi < challenge->l) && (order[hi].index - header.first < header.n); hi++);
+	
+	proof = cpor_prove_order(myparams, challenge, order + lo, hi - lo, fd, header.first, NULL);
+	
+cleanup:
+	if(order) sfree(order, sizeof(struct challenge_order) * challenge->l);
+	if(fd >= 0) close(fd);
+	if(tagfile) fclose(tagfile);
+
+	return proof;
+}
+
+/* same_file_version: Whether two stats are of the same version of the same file */
+static int same_file_version(struct stat *a, struct stat *b){
+
+#if defined(__APPLE__)
+	if((a->st_mtimespec.tv_sec != b->st_mtimespec.tv_sec) || (a->st_mtimespec.tv_nsec != b->st_mtimespec.tv_nsec)) return 0;
+#else
+	if((a->st_mtim.tv_sec != b->st_mtim.tv_sec) || (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec)) return 0;
+#endif
+	return (a->st_dev == b->st_dev) && (a->st_ino == b->st_ino) && (a->st_size == b->st_size);
+}
+
+/* cpor_open_prover_file: Opens the data file at filepath and its tag file at tagfilepath, for a long-running
+* prover to prove against again and again without reopening them.  The tag file must have a fixed-width header
+* (it may be a shard, with filepath then holding just the shard's blocks) and be long enough for the tags it
+* claims.  Both are read with pread rather than mapped, so a file truncated or retagged in place while open
+* makes proofs fail instead of faulting the prover.  Returns the open
+* file, or NULL on failure or if the files need the general path of cpor_prove_file (a container, or a tag file
+* without a header).
+*/
+CPOR_prover_file *cpor_open_prover_file(CPOR_params *myparams, char *filepath, char *tagfilepath){
+
+	CPOR_prover_file *file = NULL;
+	struct container_header container;
+	FILE *tagfile = NULL;
+
+	if(!filepath || !tagfilepath) return NULL;
+
+	if( ((file = malloc(sizeof(CPOR_prover_file))) == NULL)) return NULL;
+	memset(file, 0, sizeof(CPOR_prover_file));
+	file->fd = file->tagfd = -1;
+	if( ((file->filepath = strdup(filepath)) == NULL)) goto cleanup;
+	if( ((file->tagfilepath = strdup(tagfilepath)) == NULL)) goto cleanup;
+
+	if( ((file->fd = open(filepath, O_RDONLY)) < 0)) goto cleanup;
+	if(fstat(file->fd, &file->data_st) < 0) goto cleanup;
+	if(read_cpor_container_header(file->fd, &container)) goto cleanup;
+
+	if( ((tagfile = fopen(tagfilepath, "rb")) == NULL)) goto cleanup;
+	if(read_cpor_header(tagfile, CPOR_TAG_MAGIC, &file->header) != 1) goto cleanup;
+	if(!(file->header.flags & CPOR_FORMAT_FIXED_WIDTH) || !check_cpor_header(myparams, &file->header)) goto cleanup;
+	if(fstat(fileno(tagfile), &file->tag_st) < 0) goto cleanup;
+	if(!file->header.sigma_size || (file->header.sigma_size > CPOR_CONTAINER_ALIGN)) goto cleanup;
+	if(file->tag_st.st_size < file->header.header_size) goto cleanup;
+	if(file->header.n > (uint64_t)(file->tag_st.st_size - file->header.header_size) / file->header.sigma_size) goto cleanup;
+
+	if( ((file->tagfd = dup(fileno(tagfile))) < 0)) goto cleanup;
+	fcntl(file->tagfd, F_SETFD, FD_CLOEXEC);
+#ifdef POSIX_FADV_RANDOM
+	posix_fadvise(file->tagfd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+	fclose(tagfile);
+
+	return file;
+
+cleanup:
+	if(tagfile) fclose(tagfile);
+	cpor_close_prover_file(file);
+	return NULL;
+}
+
+/* cpor_prover_file_current: Returns 1 if the paths file was opened from still name the files it holds, 0 if
+* either has been replaced or changed since.
+*/
+int cpor_prover_file_current(CPOR_prover_file *file){
+
+	struct stat st;
+
+	if(!file) return 0;
+	if((stat(file->filepath, &st) < 0) || !same_file_version(&st, &file->data_st)) return 0;
+	if((stat(file->tagfilepath, &st) < 0) || !same_file_version(&st, &file->tag_st)) return 0;
+
+	return 1;
+}
+
+/* cpor_prover_file_covers: Returns 1 if file's tags are for a file of n blocks (for a shard, one at least long
+* enough to hold the shard's blocks), so a challenge drawn from [0, n) is one it can answer; 0 otherwise.
+*/
+int cpor_prover_file_covers(CPOR_prover_file *file, uint64_t n){
+
+	if(!file) return 0;
+	if(file->header.flags & CPOR_FORMAT_SHARD) return (n >= file->header.first) && (n - file->header.first >= file->header.n);
+
+	return n == file->header.n;
+}
+
+/* cpor_prover_file_prefetch: Asks the kernel to start reading the blocks and tags challenge will need, so the
+* I/O proceeds while the prover is still busy with an earlier challenge.
+*/
+void cpor_prover_file_prefetch(CPOR_params *myparams, CPOR_prover_file *file, CPOR_challenge *challenge){
+
+	uint64_t index = 0;
+	int i = 0;
+
+	if(!file || !challenge) return;
+
+	for(i = 0; i < challenge->l; i++){
+		index = challenge->I[i];
+		if((index < file->header.first) || (index - file->header.first >= file->header.n)) continue;
+		cpor_readahead(file->fd, (off_t)myparams->block_size * (index - file->header.first), myparams->block_size);
+		cpor_readahead(file->tagfd, (off_t)file->header.header_size + (off_t)(index - file->header.first) * file->header.sigma_size,
+			file->header.sigma_size);
 	}
-	sfree(tags, (sizeof(CPOR_tag *) * numfileblocks));
+}
 
-#else
-	/* Open the file for reading */
-	file = fopen(filepath, "rb");
-	if(!file){
-		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", filepath);
+/* cpor_prover_file_prove: Computes the proof for challenge over an open file, as cpor_prove_file (or, for a
+* shard, cpor_prove_shard) would over its paths.  Safe to call from several threads at once.
+*/
+CPOR_proof *cpor_prover_file_prove(CPOR_params *myparams, CPOR_prover_file *file, CPOR_challenge *challenge){
+
+	CPOR_proof *proof = NULL;
+	struct challenge_order *order = NULL;
+	unsigned int lo = 0, hi = 0;
+
+	if(!file || !challenge) return NULL;
+
+	if( ((order = sort_challenge_order(challenge)) == NULL)) return NULL;
+	for(lo = 0; (lo < challenge->l) && (order[lo].index < file->header.first); lo++);
+	for(hi = lo; (hi < challenge->l) && (order[hi].index - file->header.first < file->header.n); hi++);
+	if(!(file->header.flags & CPOR_FORMAT_SHARD) && ((lo != 0) || (hi != challenge->l))){
+		fprintf(stderr, "ERROR: The challenge is for blocks past the end of %s.\n", file->filepath);
 		goto cleanup;
 	}
 
-	do{
-		memset(buf, 0, myparams->block_size);
-		fread(buf, myparams->block_size, 1, file);
-		if(ferror(file)) goto cleanup;
-		tag = cpor_tag_block(key->global, t->k_prf, t->alpha, buf, myparams->block_size, index);
-		if(!tag) goto cleanup;
-		if(!write_cpor_tag(tagfile, tag)) goto cleanup;
-		index++;
-		destroy_cpor_tag(tag);
-	}while(!feof(file));
-#endif
+	proof = cpor_prove_order(myparams, challenge, order + lo, hi - lo, file->fd, file->header.first, file);
 
-	/* Write t to the tfile */
-	if(!write_cpor_t(myparams, tfile, key, t)) goto cleanup;
+cleanup:
+	sfree(order, sizeof(struct challenge_order) * challenge->l);
 
-#ifndef DEBUG_MODE
-exit:
-#endif
-	destroy_cpor_key(myparams, key);
-	destroy_cpor_t(myparams, t);
-	if(file) fclose(file);
-	if(tagfile) fclose(tagfile);
-	if(tfile) fclose(tfile);
-	return 1;
+	return proof;
+}
+
+void cpor_close_prover_file(CPOR_prover_file *file){
+
+	if(!file) return;
+	if(file->tagfd >= 0) close(file->tagfd);
+	if(file->fd >= 0) close(file->fd);
+	if(file->filepath) free(file->filepath);
+	if(file->tagfilepath) free(file->tagfilepath);
+	sfree(file, sizeof(CPOR_prover_file));
+}
+
+int cpor_verify_file(CPOR_params *myparams, CPOR_challenge *challenge, CPOR_proof *proof){
+	CPOR_key *key = NULL;
+	CPOR_t *t = NULL;
+	int ret = -1;
+	
+	if(!myparams->filename || !challenge || !proof) return -1;
+	
+	/* Get the CPOR keys */
+	key = get_cpor_keys(myparams);
+	if(!key) goto cleanup;
+	
+	/* Get t */
+	t = get_cpor_t(myparams, myparams->t_filename, key);
+	if(!t) goto cleanup;
 	
+	ret = cpor_verify_proof(myparams, challenge->global, proof, challenge, t->k_prf, t->alpha);
+
 cleanup:
+	if(key) destroy_cpor_key(myparams, key);
+	if(t) destroy_cpor_t(myparams, t);
 
-	fprintf(stderr, "ERROR: Was unable to create tag file.\n");
-	if(key) destroy_cpor_key(myparams, key);	
+	return ret;
+}
+
+/* cpor_prepare_challenge_file: Creates a compact challenge for the file whose t is at tfilepath and prepares its
+* verification, so only the seed has to be handed out and the proof can later be checked with cpor_verify_finish
+* alone.  Returns the prepared verification and the seed in *seed, or NULL on failure.
+*/
+CPOR_prepared *cpor_prepare_challenge_file(CPOR_params *myparams, char *tfilepath, CPOR_challenge_seed **seed){
+
+	CPOR_key *key = NULL;
+	CPOR_t *t = NULL;
+	CPOR_challenge *challenge = NULL;
+	CPOR_prepared *prepared = NULL;
+
+	if(!tfilepath || !seed) return NULL;
+	*seed = NULL;
+
+	key = get_cpor_keys(myparams);
+	if(!key) goto cleanup;
+	t = get_cpor_t(myparams, tfilepath, key);
+	if(!t) goto cleanup;
+
+	if( ((*seed = cpor_create_challenge_seed(myparams, t->n)) == NULL)) goto cleanup;
+	if( ((challenge = cpor_expand_challenge(key->global, *seed)) == NULL)) goto cleanup;
+	prepared = cpor_verify_prepare(myparams, key->global, challenge, t->k_prf, t->alpha);
+
+cleanup:
+	if(!prepared && *seed){
+		destroy_cpor_challenge_seed(*seed);
+		*seed = NULL;
+	}
+	if(challenge) destroy_cpor_challenge(challenge);
+	if(key) destroy_cpor_key(myparams, key);
 	if(t) destroy_cpor_t(myparams, t);
-	if(file) fclose(file);
-	if(tagfile){ 
-		ftruncate(fileno(tagfile), 0);
-		unlink(realtagfilepath);
-		fclose(tagfile);
+
+	return prepared;
+}
+
+#ifdef THREADING
+/* A ring of challenges, each with its prepared verification, kept full by a background thread */
+struct CPOR_verify_pool_struct{
+	CPOR_params myparams;
+	CPOR_key *key;
+	CPOR_t *t;
+	unsigned int depth;
+	CPOR_challenge **challenges;	/* depth slots */
+	CPOR_prepared **prepared;		/* depth slots */
+	unsigned int head;				/* Oldest ready slot */
+	unsigned int count;				/* Number of ready slots */
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t space;			/* Signalled when a slot is taken or the pool is stopping */
+	pthread_t thread;
+};
+
+/* cpor_verify_pool_make: Creates a challenge for the pool's file and prepares its verification. */
+static int cpor_verify_pool_make(CPOR_verify_pool *pool, CPOR_challenge **challenge, CPOR_prepared **prepared){
+
+	*prepared = NULL;
+	*challenge = cpor_create_challenge(&pool->myparams, pool->key->global, pool->t->n);
+	if(!*challenge) return 0;
+	*prepared = cpor_verify_prepare(&pool->myparams, pool->key->global, *challenge, pool->t->k_prf, pool->t->alpha);
+	if(!*prepared){
+		destroy_cpor_challenge(*challenge);
+		*challenge = NULL;
+		return 0;
 	}
-	if(tfile){ 
-		ftruncate(fileno(tfile), 0);
-		unlink(realtfilepath);
-		fclose(tfile);
-	}	
-	return 0;
+
+	return 1;
 }
 
-CPOR_challenge *cpor_challenge_file(CPOR_params *myparams){
+/* Keeps the pool topped up, sleeping while it is full */
+static void *cpor_verify_pool_thread(void *pool_ptr){
 
-	CPOR_key *key = NULL;
+	CPOR_verify_pool *pool = (CPOR_verify_pool *)pool_ptr;
 	CPOR_challenge *challenge = NULL;
+	CPOR_prepared *prepared = NULL;
+	unsigned int slot = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while(1){
+		while(!pool->stop && (pool->count == pool->depth))
+			pthread_cond_wait(&pool->space, &pool->lock);
+		if(pool->stop) break;
+		pthread_mutex_unlock(&pool->lock);
+
+		/* The PRFs are the expensive part, so they're done without the lock */
+		if(!cpor_verify_pool_make(pool, &challenge, &prepared)){
+			fprintf(stderr, "ERROR: Was unable to prepare a challenge; the verify pool has stopped filling.\n");
+			return NULL;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		slot = (pool->head + pool->count) % pool->depth;
+		pool->challenges[slot] = challenge;
+		pool->prepared[slot] = prepared;
+		pool->count++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/* cpor_create_verify_pool: Starts a background thread that keeps up to depth challenges for the file
+* described by myparams (its t_filename and key_filename) ready, each with its verification prepared by
+* cpor_verify_prepare.  Take them with cpor_verify_pool_take and finish with cpor_verify_finish.  Returns the
+* pool, or NULL on failure.
+*/
+CPOR_verify_pool *cpor_create_verify_pool(CPOR_params *myparams, unsigned int depth){
+
+	CPOR_verify_pool *pool = NULL;
 	FILE *tfile = NULL;
-	CPOR_t *t = NULL;
 
-	if(!myparams->filename) return NULL;
-	
-	/* Open the t file for reading */
+	if(!myparams || !myparams->t_filename || !depth) return NULL;
+
+	if( ((pool = malloc(sizeof(CPOR_verify_pool))) == NULL)) return NULL;
+	memset(pool, 0, sizeof(CPOR_verify_pool));
+	memcpy(&pool->myparams, myparams, sizeof(CPOR_params));
+	pool->depth = depth;
+	if( ((pool->challenges = malloc(sizeof(CPOR_challenge *) * depth)) == NULL)) goto cleanup;
+	memset(pool->challenges, 0, sizeof(CPOR_challenge *) * depth);
+	if( ((pool->prepared = malloc(sizeof(CPOR_prepared *) * depth)) == NULL)) goto cleanup;
+	memset(pool->prepared, 0, sizeof(CPOR_prepared *) * depth);
+
+	/* Get the CPOR keys and t */
+	pool->key = cpor_get_keys(myparams);
+	if(!pool->key) goto cleanup;
 	tfile = fopen(myparams->t_filename, "rb");
 	if(!tfile){
 		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", myparams->t_filename);
 		goto cleanup;
 	}
-	
+	pool->t = read_cpor_t(myparams, tfile, pool->key);
+	fclose(tfile);
+	if(!pool->t){ fprintf(stderr, "Could not get t.\n"); goto cleanup; }
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->space, NULL);
+	if(pthread_create(&pool->thread, NULL, cpor_verify_pool_thread, pool) != 0){
+		pthread_mutex_destroy(&pool->lock);
+		pthread_cond_destroy(&pool->space);
+		goto cleanup;
+	}
+
+	return pool;
+
+cleanup:
+	if(pool->key) destroy_cpor_key(myparams, pool->key);
+	if(pool->t) destroy_cpor_t(myparams, pool->t);
+	if(pool->challenges) sfree(pool->challenges, sizeof(CPOR_challenge *) * depth);
+	if(pool->prepared) sfree(pool->prepared, sizeof(CPOR_prepared *) * depth);
+	sfree(pool, sizeof(CPOR_verify_pool));
+	return NULL;
+}
+
+/* cpor_verify_pool_take: Hands out the oldest ready challenge and its prepared verification, which the caller
+* then owns.  If none is ready, one is made on the spot rather than waiting.  Returns 1 on success, 0 on
+* failure.
+*/
+int cpor_verify_pool_take(CPOR_verify_pool *pool, CPOR_challenge **challenge, CPOR_prepared **prepared){
+
+	if(!pool || !challenge || !prepared) return 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if(pool->count){
+		*challenge = pool->challenges[pool->head];
+		*prepared = pool->prepared[pool->head];
+		pool->challenges[pool->head] = NULL;
+		pool->prepared[pool->head] = NULL;
+		pool->head = (pool->head + 1) % pool->depth;
+		pool->count--;
+		pthread_cond_signal(&pool->space);
+		pthread_mutex_unlock(&pool->lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return cpor_verify_pool_make(pool, challenge, prepared);
+}
+
+void cpor_destroy_verify_pool(CPOR_verify_pool *pool){
+
+	unsigned int i = 0;
+
+	if(!pool) return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_signal(&pool->space);
+	pthread_mutex_unlock(&pool->lock);
+	pthread_join(pool->thread, NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->space);
+
+	for(i = 0; i < pool->depth; i++){
+		if(pool->challenges[i]) destroy_cpor_challenge(pool->challenges[i]);
+		if(pool->prepared[i]) destroy_cpor_prepared(&pool->myparams, pool->prepared[i]);
+	}
+	sfree(pool->challenges, sizeof(CPOR_challenge *) * pool->depth);
+	sfree(pool->prepared, sizeof(CPOR_prepared *) * pool->depth);
+	destroy_cpor_key(&pool->myparams, pool->key);
+	destroy_cpor_t(&pool->myparams, pool->t);
+	sfree(pool, sizeof(CPOR_verify_pool));
+}
+#endif
+
+/* cpor_challenge_files: Creates an aggregate challenge over the numfiles files whose t files are at
+* tfilepaths: a challenge for each (of myparams->num_challenge blocks) and a random, nonzero weight for each.
+* The files must have been tagged under the same key with myparams->shared_alphas set; see cpor_prove_files.
+*/
+CPOR_aggregate_challenge *cpor_challenge_files(CPOR_params *myparams, char **tfilepaths, unsigned int numfiles){
+
+	CPOR_key *key = NULL;
+	CPOR_aggregate_challenge *challenge = NULL;
+	CPOR_t *t = NULL;
+	unsigned int f = 0;
+
+	if(!tfilepaths || !numfiles) return NULL;
+
 	/* Get the CPOR keys */
-	key = cpor_get_keys(myparams);
+	key = get_cpor_keys(myparams);
 	if(!key) goto cleanup;
-	
-	/* Get t for n (the number of blocks) */
-	t = read_cpor_t(myparams, tfile, key);
-	if(!t){ fprintf(stderr, "Could not get t.\n"); goto cleanup; }
 
-	challenge = cpor_create_challenge(myparams, key->global, t->n);
-	if(!challenge) goto cleanup;
+	if( ((challenge = allocate_cpor_aggregate_challenge(numfiles)) == NULL)) goto cleanup;
+	for(f = 0; f < numfiles; f++){
+		/* Get t for n (the number of blocks) */
+		t = get_cpor_t(myparams, tfilepaths[f], key);
+		if(!t){ fprintf(stderr, "Could not get t.\n"); goto cleanup; }
+
+		challenge->challenges[f] = cpor_create_challenge(myparams, key->global, t->n);
+		if(!challenge->challenges[f]) goto cleanup;
+		do{
+			if(!get_rand_bn_range(NULL, challenge->weights[f], key->global->Zp)) goto cleanup;
+		}while(BN_is_zero(challenge->weights[f]));
+
+		destroy_cpor_t(myparams, t);
+		t = NULL;
+	}
+
+	destroy_cpor_key(myparams, key);
 
-	if(key) destroy_cpor_key(myparams, key);
-	if(tfile) fclose(tfile);
-	if(t) destroy_cpor_t(myparams, t);
-	
 	return challenge;
 
 cleanup:
 	if(key) destroy_cpor_key(myparams, key);
-	if(tfile) fclose(tfile);
 	if(t) destroy_cpor_t(myparams, t);
+	if(challenge) destroy_cpor_aggregate_challenge(challenge);
 	return NULL;
-	
 }
 
-CPOR_proof *cpor_prove_file(CPOR_params *myparams, CPOR_challenge *challenge){
-	CPOR_tag *tag = NULL;
+/* cpor_prove_files: Answers an aggregate challenge over the files at filepaths (with their tags at
+* tagfilepaths) with a single proof, the weighted sum of the proofs for each file.  Only one file's proof is
+* held at a time.
+*/
+CPOR_proof *cpor_prove_files(CPOR_params *myparams, char **filepaths, char **tagfilepaths, CPOR_aggregate_challenge *challenge){
+
+	CPOR_params fileparams;
+	CPOR_proof *aggregate = NULL;
 	CPOR_proof *proof = NULL;
-	FILE *file = NULL;
-	FILE *tagfile = NULL;
-	unsigned char block[myparams->block_size];
-	int i = 0;
-	
-	if(!myparams->filename || !challenge) return 0;
-	if(strlen(myparams->filename) >= MAXPATHLEN) return 0;
-	if(strlen(myparams->tag_filename) >= MAXPATHLEN) return 0;
-	
-	memset(block, 0, myparams->block_size);
+	unsigned int f = 0;
 
-	file = fopen(myparams->filename, "rb");
-	if(!file){
-		fprintf(stderr, "ERROR: Was unable to open %s\n", myparams->filename);
-		return 0;
-	}
-	
-	tagfile = fopen(myparams->tag_filename, "rb");
-	if(!tagfile){
-		fprintf(stderr, "ERROR: Was unable to open %s\n", myparams->tag_filename);
-		return 0;
-	}
-	
-	for(i = 0; i < challenge->l; i++){
-		memset(block, 0, myparams->block_size);
-	
-		/* Seek to data block at I[i] */
-		if(fseek(file, (myparams->block_size * (challenge->I[i])), SEEK_SET) < 0) goto cleanup;
+	if(!filepaths || !tagfilepaths || !challenge || !challenge->numfiles) return NULL;
 
-		/* Read data block */
-		fread(block, myparams->block_size, 1, file);
-		if(ferror(file)) goto cleanup;
-		
-		/* Read tag for data block at I[i] */
-		tag = read_cpor_tag(tagfile, challenge->I[i]);
-		if(!tag) goto cleanup;
-		
-		proof = cpor_create_proof_update(myparams, challenge, proof, tag, block, challenge->I[i], i);
+	memcpy(&fileparams, myparams, sizeof(CPOR_params));
+	for(f = 0; f < challenge->numfiles; f++){
+		fileparams.filename = filepaths[f];
+		fileparams.tag_filename = tagfilepaths[f];
+		proof = cpor_prove_file(&fileparams, challenge->challenges[f]);
 		if(!proof) goto cleanup;
-		
-		destroy_cpor_tag(tag);
-		
+		aggregate = cpor_aggregate_proof_update(myparams, challenge->challenges[f]->global, aggregate, proof, challenge->weights[f]);
+		if(!aggregate) goto cleanup;
+		destroy_cpor_proof(myparams, proof);
+		proof = NULL;
 	}
-	
-	proof = cpor_create_proof_final(proof);
-	
-	if(file) fclose(file);
-	if(tagfile) fclose(tagfile);
 
-	return proof;
+	return aggregate;
 
 cleanup:
-	if(file) fclose(file);
-	if(tagfile) fclose(tagfile);
-	if(tag) destroy_cpor_tag(tag);
-
+	if(proof) destroy_cpor_proof(myparams, proof);
+	if(aggregate) destroy_cpor_proof(myparams, aggregate);
 	return NULL;
 }
 
-int cpor_verify_file(CPOR_params *myparams, CPOR_challenge *challenge, CPOR_proof *proof){
+/* cpor_verify_files: Verifies the proof for an aggregate challenge over the files whose t files are at
+* tfilepaths.  Every file must have the same alphas; a file that doesn't fails verification.  Returns 1 if
+* the proof verifies, 0 if it doesn't and -1 on error.
+*/
+int cpor_verify_files(CPOR_params *myparams, char **tfilepaths, CPOR_aggregate_challenge *challenge, CPOR_proof *proof){
+
 	CPOR_key *key = NULL;
+	CPOR_t *first = NULL;
 	CPOR_t *t = NULL;
-	FILE *tfile = NULL;
+	unsigned char **k_prf = NULL;
+	unsigned int f = 0;
+	int j = 0;
 	int ret = -1;
-	
-	if(!myparams->filename || !challenge || !proof) return -1;
-	
-	/* Open the t file for reading */
-	tfile = fopen(myparams->t_filename, "rb");
-	if(!tfile){
-		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", myparams->t_filename);
-		goto cleanup;
-	}
-	
+
+	if(!tfilepaths || !challenge || !challenge->numfiles || !proof) return -1;
+
 	/* Get the CPOR keys */
-	key = cpor_get_keys(myparams);
+	key = get_cpor_keys(myparams);
 	if(!key) goto cleanup;
-	
-	/* Get t */
-	t = read_cpor_t(myparams, tfile, key);
-	if(!t) goto cleanup;
-	
-	ret = cpor_verify_proof(myparams, challenge->global, proof, challenge, t->k_prf, t->alpha);
+
+	if( ((k_prf = malloc(sizeof(unsigned char *) * challenge->numfiles)) == NULL)) goto cleanup;
+	memset(k_prf, 0, sizeof(unsigned char *) * challenge->numfiles);
+
+	for(f = 0; f < challenge->numfiles; f++){
+		t = get_cpor_t(myparams, tfilepaths[f], key);
+		if(!t) goto cleanup;
+
+		if( ((k_prf[f] = malloc(myparams->prf_key_size)) == NULL)) goto cleanup;
+		memcpy(k_prf[f], t->k_prf, myparams->prf_key_size);
+
+		/* The single mu vector can only be checked against alphas every file shares */
+		if(!first){
+			first = t;
+		}else{
+			for(j = 0; j < myparams->num_sectors; j++){
+				if(BN_cmp(first->alpha[j], t->alpha[j]) != 0){
+					fprintf(stderr, "ERROR: %s wasn't tagged with shared alphas.\n", tfilepaths[f]);
+					ret = 0;
+					goto cleanup;
+				}
+			}
+			destroy_cpor_t(myparams, t);
+		}
+		t = NULL;
+	}
+
+	ret = cpor_verify_aggregate_proof(myparams, key->global, proof, challenge, k_prf, first->alpha);
 
 cleanup:
 	if(key) destroy_cpor_key(myparams, key);
 	if(t) destroy_cpor_t(myparams, t);
-	fclose(tfile);
-	
+	if(first) destroy_cpor_t(myparams, first);
+	if(k_prf){
+		for(f = 0; f < challenge->numfiles; f++)
+			if(k_prf[f]) sfree(k_prf[f], myparams->prf_key_size);
+		sfree(k_prf, sizeof(unsigned char *) * challenge->numfiles);
+	}
+
 	return ret;
 }
@@ -43,6 +43,16 @@ static struct option longopts[] = {
 	{"sectorsize", no_argument, NULL, 'c'},
 	{"numsectors", no_argument, NULL, 'n'},
 	{"numthreads", no_argument, NULL, 'h'},
+	{"directio", no_argument, NULL, 'd'},
+	{"checkpoint", required_argument, NULL, 'i'},
+	{"resume", no_argument, NULL, 'r'},
+	{"run", required_argument, NULL, 'u'},
+	{"container", required_argument, NULL, 'o'},
+	{"sharedalphas", no_argument, NULL, 'a'},
+	{"verifierd", required_argument, NULL, 'w'},
+	{"proverd", required_argument, NULL, 'g'},
+	{"loadtest", required_argument, NULL, 'j'},
+	{"remote", required_argument, NULL, 'x'},
 	{"keygen", no_argument, NULL, 'k'}, //TODO optional argument for key location
 	{"tag", no_argument, NULL, 't'},
 	{"verify", no_argument, NULL, 'v'},
@@ -149,11 +159,19 @@ int cpor_challenge(char *filename, char *key_filename, char *t_filename, char *t
 	myparams->block_size = block_size;				/* Message block size in bytes */				
 	myparams->num_threads = 4;
 	myparams->num_challenge = myparams->lambda;
+	myparams->challenge_run = 0;
+	myparams->direct_io = 0;
+	myparams->checkpoint_blocks = 0;
+	myparams->resume = 0;
+	myparams->shared_alphas = 0;
+	myparams->tag_cache = NULL;
+	myparams->secrets_cache = NULL;
 
 	myparams->filename = filename;
 	myparams->key_filename = key_filename;
 	myparams->t_filename = t_filename;
 	myparams->tag_filename = tag_filename;
+	myparams->container_filename = NULL;
 
 	/* The size (in bits) of the prime that creates the field Z_p */
     myparams->Zp_bits = myparams->lambda;
@@ -162,6 +180,8 @@ int cpor_challenge(char *filename, char *key_filename, char *t_filename, char *t
 	myparams->sector_size = ((myparams->Zp_bits / 8) - 1);
 	/* Number of sectors per block */
 	myparams->num_sectors = ( (myparams->block_size / myparams->sector_size) + ((myparams->block_size % myparams->sector_size) ? 1 : 0) );
+	/* A t file with a header records the parameters it was made with; those win */
+	cpor_read_params(myparams, t_filename);
 
 	printf("Challenging file %s...\n", myparams->filename);
 	printf("\tCreating challenge for %s...", myparams->filename);
@@ -218,6 +238,7 @@ void cpor_test()
 	
 // 	CPOR_challenge *challenge = NULL;
 // 	CPOR_proof *proof = NULL;
+// 	char *address = NULL;
 // 	int i = -1;
 // 	int opt = -1;
 
@@ -251,8 +272,11 @@ void cpor_test()
 
 // 	curl_global_init(CURL_GLOBAL_ALL);
 
-// 	while((opt = getopt_long(argc, argv, "b:e:h:l:m:p:kt:v:y:", longopts, NULL)) != -1){
+// 	while((opt = getopt_long(argc, argv, "ab:de:g:h:i:j:l:m:o:p:krt:u:v:w:x:y:", longopts, NULL)) != -1){
 // 		switch(opt){
+// 			case 'a':
+// 				myparams->shared_alphas = 1;
+// 				break;
 // 			case 'b':
 // 				myparams->block_size = atoi(optarg);
 // 				break;
@@ -263,9 +287,23 @@ void cpor_test()
 // 					return -1;
 // 				}
 // 				break;
+// 			case 'd':
+// 				myparams->direct_io = 1;
+// 				break;
+// 			case 'g':
+// 				address = optarg;
+// 				myparams->op = CPOR_OP_PROVERD;
+// 				break;
 // 			case 'h':
 // 				myparams->num_threads = atoi(optarg);
 // 				break;
+// 			case 'i':
+// 				myparams->checkpoint_blocks = atoi(optarg);
+// 				break;
+// 			case 'j':
+// 				address = optarg;
+// 				myparams->op = CPOR_OP_LOADTEST;
+// 				break;
 // 			case 'k':
 // 				myparams->op = CPOR_OP_KEYGEN;
 // 				break;
@@ -275,9 +313,15 @@ void cpor_test()
 // 			case 'm':
 // 				myparams->mac_key_size = atoi(optarg);
 // 				break;
+// 			case 'o':
+// 				myparams->container_filename = optarg;
+// 				break;
 // 			case 'p':
 // 				myparams->prf_key_size = atoi(optarg);
 // 				break;
+// 			case 'r':
+// 				myparams->resume = 1;
+// 				break;
 // 			case 't':
 // 				if(strlen(optarg) >= MAXPATHLEN){
 // 					fprintf(stderr, "ERROR: File name is too long.\n");
@@ -286,6 +330,9 @@ void cpor_test()
 // 				myparams->filename = optarg;
 // 				myparams->op = CPOR_OP_TAG;
 
+// 				break;
+// 			case 'u':
+// 				myparams->challenge_run = atoi(optarg);
 // 				break;
 
 // 			case 'v':
@@ -296,6 +343,14 @@ void cpor_test()
 // 				myparams->filename = optarg;
 // 				myparams->op = CPOR_OP_VERIFY;
 
+// 				break;
+// 			case 'w':
+// 				address = optarg;
+// 				myparams->op = CPOR_OP_VERIFIERD;
+// 				break;
+// 			case 'x':
+// 				address = optarg;
+// 				myparams->op = CPOR_OP_REMOTE;
 // 				break;
 // 			case 'y':
 // 				myparams->lambda = atoi(optarg);
@@ -328,68 +383,24 @@ void cpor_test()
 // 		#endif
 //             myparams->tag_filename = create_tmp_name(".tag");
 //             myparams->t_filename = create_tmp_name(".t");
-// 			if(!cpor_tag_file(myparams->filename, strlen(myparams->filename), myparams->key_filename, myparams->tag_filename, 
+// 			if(myparams->container_filename){
+// 				FILE *input = fopen(myparams->filename, "rb");
+// 				if(!input || !cpor_tag_container(myparams, input, myparams->container_filename, myparams->t_filename)) printf("No tag\n");
+// 				else printf("Done\n");
+// 				if(input) fclose(input);
+// 			}else if(myparams->server){
+// 				/* The tags go up to the server as they are made, rather than in a PUT once tagging is done */
+// 				FILE *input = fopen(myparams->filename, "rb");
+// 				if(!input || !cpor_tag_stream_upload(myparams, input, myparams->server, myparams->t_filename)) printf("No tag\n");
+// 				else printf("Done\n");
+// 				if(input) fclose(input);
+// 			}else if(!cpor_tag_file(myparams->filename, strlen(myparams->filename), myparams->key_filename, myparams->tag_filename, 
 //                 strlen(myparams->tag_filename), myparams->t_filename, strlen(myparams->t_filename))) printf("No tag\n");
 // 			else printf("Done\n");
 // 		#ifdef DEBUG_MODE
 // 			gettimeofday(&tv2, NULL);
 // 			printf("%lf\n", (double)tv2.tv_sec + (double)((double)tv2.tv_usec/1000000) - (double)((double)tv1.tv_sec) + (double)((double)tv1.tv_usec/1000000));
 // 		#endif
-//             CURL *curl = curl_easy_init();
-//             if (!curl) {
-//                 return 1;
-//             }
-
-//             CURLcode res;
-//             FILE *tag_file ;
-//             struct stat file_info;
-
-//             /* get the file size of the local file */
-//             stat(myparams->tag_filename, &file_info);
-
-//             /* get a FILE * of the same file, could also be made with
-//             fdopen() from the previous descriptor, but hey this is just
-//             an example! */
-//             tag_file = fopen(myparams->tag_filename, "rb");
-
-//             /* In windows, this will init the winsock stuff */
-//             curl_global_init(CURL_GLOBAL_ALL);
-
-//             /* get a curl handle */
-//             curl = curl_easy_init();
-//             if(curl) {
-//                 /* we want to use our own read function */
-//                 curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
-
-//                 /* enable uploading */
-//                 curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
-
-//                 /* HTTP PUT please */
-//                 curl_easy_setopt(curl, CURLOPT_PUT, 1L);
-
-//                 /* specify target URL, and note that this URL should include a file
-//                 name, not only a directory */
-//                 curl_easy_setopt(curl, CURLOPT_URL, myparams->server);
-
-//                 /* now specify which file to upload */
-//                 curl_easy_setopt(curl, CURLOPT_READDATA, tag_file);
-
-//                 /* provide the size of the upload, we specicially typecast the value
-//                 to curl_off_t since we must be sure to use the correct data size */
-//                 curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE,
-//                                 (curl_off_t)file_info.st_size);
-
-//                 /* Now run off and do what you've been told! */
-//                 res = curl_easy_perform(curl);
-//                 /* Check for errors */
-//                 if(res != CURLE_OK)
-//                     fprintf(stderr, "curl_easy_perform() failed: %s\n",
-//                             curl_easy_strerror(res));
-
-//                 /* always cleanup */
-//                 curl_easy_cleanup(curl);
-//                 fclose(tag_file); /* close the local file */
-//             }
 // 			break;
 			
 // 		case CPOR_OP_VERIFY:
@@ -422,6 +433,51 @@ void cpor_test()
 // 			if(proof) destroy_cpor_proof(proof);
 // 			break;
 
+// 		case CPOR_OP_VERIFIERD:
+// 			if(!cpor_start_verifier(myparams, address, 4096, 600)) printf("Couldn't start the verifier\n");
+// 			else for(;;) pause();
+// 			break;
+
+// 		case CPOR_OP_PROVERD:
+// 			if(!cpor_start_prover(myparams, address, NULL)) printf("Couldn't start the prover\n");
+// 			else for(;;) pause();
+// 			break;
+
+// 		case CPOR_OP_LOADTEST:
+// 			/* The file to challenge follows the prover's address */
+// 			if(optind >= argc) break;
+// 			myparams->filename = argv[optind];
+// 			myparams->key_filename = create_tmp_name(".key");
+// 			myparams->tag_filename = create_tmp_name(".tag");
+// 			myparams->t_filename = create_tmp_name(".t");
+// 			if(!cpor_prover_load_test(myparams, address, 1000, 8)) printf("Some proofs failed\n");
+// 			break;
+
+// 		case CPOR_OP_REMOTE: {
+// 			/* The files to audit follow the prover's URL; the prover names them the same way */
+// 			CPOR_remote_auditor *auditor = NULL;
+// 			CPOR_remote_audit *audits = NULL;
+// 			int numaudits = argc - optind;
+// 			if(numaudits <= 0) break;
+// 			myparams->key_filename = create_tmp_name(".key");
+// 			myparams->tag_filename = create_tmp_name(".tag");
+// 			myparams->t_filename = create_tmp_name(".t");
+// 			audits = calloc(numaudits, sizeof(CPOR_remote_audit));
+// 			auditor = cpor_create_remote_auditor(myparams, address, 0);
+// 			if(!audits || !auditor) printf("Couldn't start the audit\n");
+// 			else{
+// 				for(i = 0; i < numaudits; i++){
+// 					audits[i].filepath = argv[optind + i];
+// 					audits[i].tagfilepath = myparams->tag_filename;
+// 					audits[i].tfilepath = myparams->t_filename;
+// 				}
+// 				printf("%d of %d verified\n", cpor_remote_audit(auditor, audits, numaudits), numaudits);
+// 			}
+// 			cpor_destroy_remote_auditor(auditor);
+// 			if(audits) free(audits);
+// 			break;
+// 		}
+
 // 		case CPOR_OP_NOOP:
 // 		default:
 // 			break;
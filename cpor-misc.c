@@ -41,31 +41,169 @@ void printhex(unsigned char *ptr, size_t size){
 
 void sfree(void *ptr, size_t size){ memset(ptr, 0, size); free(ptr); ptr = NULL;}
 
-int get_rand_range(unsigned int min, unsigned int max, unsigned int *value){
-	unsigned int rado;
-	unsigned int range = max - min + 1;
+/* init_cpor_rand: Starts an empty random stream; the first draw fills it. */
+void init_cpor_rand(CPOR_rand *rng){
+
+	rng->pos = CPOR_RAND_BUFFER_SIZE;
+	rng->ctx = NULL;
+}
+
+/* init_cpor_rand_seeded: Starts a deterministic stream: the AES-256-CTR keystream keyed with the
+ * CPOR_CHALLENGE_SEED_SIZE-byte seed.  Anyone holding the seed draws the same values in the same order.
+ * Returns 1 on success, 0 on failure.
+ */
+int init_cpor_rand_seeded(CPOR_rand *rng, unsigned char *seed){
+
+	unsigned char iv[AES_BLOCK_SIZE];
+
+	init_cpor_rand(rng);
+	memset(iv, 0, AES_BLOCK_SIZE);
+	if( ((rng->ctx = EVP_CIPHER_CTX_new()) == NULL)) return 0;
+	if(!EVP_EncryptInit_ex(rng->ctx, EVP_aes_256_ctr(), NULL, seed, iv)){
+		EVP_CIPHER_CTX_free(rng->ctx);
+		rng->ctx = NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* clear_cpor_rand: Wipes any random bytes left in the stream. */
+void clear_cpor_rand(CPOR_rand *rng){
+
+	memset(rng->buf, 0, CPOR_RAND_BUFFER_SIZE);
+	rng->pos = CPOR_RAND_BUFFER_SIZE;
+	if(rng->ctx) EVP_CIPHER_CTX_free(rng->ctx);
+	rng->ctx = NULL;
+}
+
+/* Refills rng's buffer, either from RAND_bytes or, for a seeded stream, by encrypting zeros in place.
+ * A full buffer of counter blocks per call lets AES-NI pipeline the blocks. */
+static int refill_cpor_rand(CPOR_rand *rng){
+
+	int len = 0;
+
+	if(!rng->ctx) return RAND_bytes(rng->buf, CPOR_RAND_BUFFER_SIZE);
+	memset(rng->buf, 0, CPOR_RAND_BUFFER_SIZE);
+	if(!EVP_EncryptUpdate(rng->ctx, rng->buf, &len, rng->buf, CPOR_RAND_BUFFER_SIZE)) return 0;
+
+	return (len == CPOR_RAND_BUFFER_SIZE);
+}
+
+/* get_rand_bytes: Copies len random bytes into out from rng, refilling it as it runs dry.
+ * If rng is NULL, calls RAND_bytes directly.  Returns 1 on success, 0 on failure.
+ */
+int get_rand_bytes(CPOR_rand *rng, unsigned char *out, size_t len){
+
+	size_t chunk = 0;
+
+	if(!rng) return RAND_bytes(out, len);
+	while(len){
+		if(rng->pos == CPOR_RAND_BUFFER_SIZE){
+			if(!refill_cpor_rand(rng)) return 0;
+			rng->pos = 0;
+		}
+		chunk = CPOR_RAND_BUFFER_SIZE - rng->pos;
+		if(chunk > len) chunk = len;
+		memcpy(out, rng->buf + rng->pos, chunk);
+		/* Don't leave handed-out bytes behind */
+		memset(rng->buf + rng->pos, 0, chunk);
+		rng->pos += chunk;
+		out += chunk;
+		len -= chunk;
+	}
+
+	return 1;
+}
+
+/* get_rand_range: Sets *value to a uniformly random integer in [min, max], drawn from rng (or straight from
+ * RAND_bytes if rng is NULL).  Returns 1 on success, 0 on failure.
+ */
+int get_rand_range(CPOR_rand *rng, uint64_t min, uint64_t max, uint64_t *value){
+	uint64_t rado;
+	uint64_t range = max - min + 1;
 	
 	if(!value) return 0;
 	if(max < min) return 0;
+	/* The full 64-bit range; any value will do */
+	if(range == 0) return get_rand_bytes(rng, (unsigned char *)value, sizeof(uint64_t));
 	do{
-		if(!RAND_bytes((unsigned char *)&rado, sizeof(unsigned int))) return 0;
-	}while(rado > UINT_MAX - (UINT_MAX % range));
+		if(!get_rand_bytes(rng, (unsigned char *)&rado, sizeof(uint64_t))) return 0;
+	}while(rado >= UINT64_MAX - (UINT64_MAX % range));
 	
 	*value = min + (rado % range);
 	
 	return 1;
 }
 
+/* get_rand_bn_range: Sets value to a uniformly random element of [0, max), drawn from rng (or straight from
+ * RAND_bytes if rng is NULL).  Returns 1 on success, 0 on failure.
+ */
+int get_rand_bn_range(CPOR_rand *rng, BIGNUM *value, BIGNUM *max){
+
+	unsigned char small[64];
+	unsigned char *buf = small;
+	int bits = 0;
+	int bytes = 0;
+	int ret = 0;
+
+	if(!value || !max || BN_is_zero(max)) return 0;
+	bits = BN_num_bits(max);
+	bytes = BN_num_bytes(max);
+	/* This is called once per challenged block, so avoid the heap for any reasonably sized Zp */
+	if(bytes > sizeof(small))
+		if( ((buf = malloc(bytes)) == NULL)) return 0;
+	/* Draw just enough bits and retry until the value falls below max; that happens at least half the time */
+	do{
+		if(!get_rand_bytes(rng, buf, bytes)) goto cleanup;
+		if(bits % 8) buf[0] &= (0xFF >> (8 - (bits % 8)));
+		if(!BN_bin2bn(buf, bytes, value)) goto cleanup;
+	}while(BN_cmp(value, max) >= 0);
+	ret = 1;
+
+cleanup:
+	if(buf != small) sfree(buf, bytes);
+	else memset(small, 0, sizeof(small));
+	return ret;
+}
+
+/* get_rand_bin_range: Like get_rand_bn_range, but for numbers held as len big-endian bytes: sets value to a
+ * uniformly random number below max, whose first byte mustn't be zero.  It draws exactly what get_rand_bn_range
+ * would for the same max, without a BIGNUM.  Returns 1 on success, 0 on failure.
+ */
+int get_rand_bin_range(CPOR_rand *rng, unsigned char *value, const unsigned char *max, size_t len){
+
+	unsigned char mask = 0xFF;
+
+	if(!value || !max || !len || !max[0]) return 0;
+	/* Draw just enough bits: mask the first byte down to the bit length of max's */
+	while((mask >> 1) >= max[0]) mask >>= 1;
+	do{
+		if(!get_rand_bytes(rng, value, len)) return 0;
+		value[0] &= mask;
+	}while(memcmp(value, max, len) >= 0);
+
+	return 1;
+}
+
 /* gereate_prf_i: the implementation of the pseudo-random funcation f_k(i).  It takes in
  * the MAC key key and a block index.
  * It returns an allocated BIGNUM containing the resulting PRF or NULL on failure.
  * In this implementation we use HMAC-SHA1.
+ * Indices that fit in 32 bits are encoded as a 4-byte unsigned int, as they always have been, so existing
+ * tags stay valid; larger indices are encoded as 8 little-endian bytes.  The differing input lengths keep
+ * the two encodings from colliding.
  */
-BIGNUM *generate_prf_i(CPOR_params *myparams, unsigned char *key, unsigned int index){
+BIGNUM *generate_prf_i(CPOR_params *myparams, unsigned char *key, uint64_t index){
 	
 	unsigned char *prf_result = NULL;
 	size_t prf_result_size = 0;
 	BIGNUM *prf_result_bn = NULL;
+	unsigned int index32 = (unsigned int)index;
+	unsigned char index64[sizeof(uint64_t)];
+	unsigned char *prf_input = (unsigned char *)&index32;
+	size_t prf_input_size = sizeof(unsigned int);
+	int i = 0;
 	
 	if(!key) return NULL;
 	
@@ -74,8 +212,15 @@ BIGNUM *generate_prf_i(CPOR_params *myparams, unsigned char *key, unsigned int i
 	memset(prf_result, 0, EVP_MAX_MD_SIZE);
 	if( ((prf_result_bn = BN_new()) == NULL)) goto cleanup;
 	
+	if(index > UINT_MAX){
+		for(i = 0; i < sizeof(uint64_t); i++)
+			index64[i] = (unsigned char)(index >> (8 * i));
+		prf_input = index64;
+		prf_input_size = sizeof(uint64_t);
+	}
+	
 	/* Do the HMAC-SHA1 */
-	if(!HMAC(EVP_sha1(), key, myparams->prf_key_size, (unsigned char *)&index, sizeof(unsigned int),
+	if(!HMAC(EVP_sha1(), key, myparams->prf_key_size, prf_input, prf_input_size,
 		prf_result, (unsigned int *)&prf_result_size)) goto cleanup;
 		
 	/* Convert PRF result into a BIGNUM */
@@ -215,7 +360,47 @@ cleanup:
 	
 }
 
-CPOR_t *cpor_create_t(CPOR_params *myparams, CPOR_global *global, unsigned int n){
+/* cpor_derive_alphas: Replaces alpha with alphas derived from the user's key instead of drawn at random, so
+* every file tagged with the same key and parameters gets the same ones.  Files that share alphas can be
+* proven together with a single mu vector (see cpor_challenge_files).  The alphas are drawn from a stream
+* keyed by HMAC-SHA256(k_mac, label || Zp), which keeps them independent of the MACs made with k_mac.
+* Returns 1 on success, 0 on failure.
+*/
+int cpor_derive_alphas(CPOR_params *myparams, CPOR_key *key, BIGNUM **alpha){
+
+	static const char label[] = "CPOR shared alphas";
+	unsigned char seed[EVP_MAX_MD_SIZE];
+	unsigned int seed_size = 0;
+	unsigned char *input = NULL;
+	size_t input_size = 0;
+	CPOR_rand rng;
+	int i = 0, ret = 0;
+
+	init_cpor_rand(&rng);
+	if(!key || !key->k_mac || !key->global || !alpha) return 0;
+
+	/* Bind the alphas to Zp as well as to the key */
+	input_size = sizeof(label) + BN_num_bytes(key->global->Zp);
+	if( ((input = malloc(input_size)) == NULL)) return 0;
+	memcpy(input, label, sizeof(label));
+	BN_bn2bin(key->global->Zp, input + sizeof(label));
+	if(!HMAC(EVP_sha256(), key->k_mac, key->k_mac_size, input, input_size, seed, &seed_size)) goto cleanup;
+	if(seed_size < CPOR_CHALLENGE_SEED_SIZE) goto cleanup;
+
+	if(!init_cpor_rand_seeded(&rng, seed)) goto cleanup;
+	for(i = 0; i < myparams->num_sectors; i++)
+		if(!get_rand_bn_range(&rng, alpha[i], key->global->Zp)) goto cleanup;
+	ret = 1;
+
+cleanup:
+	clear_cpor_rand(&rng);
+	memset(seed, 0, sizeof(seed));
+	sfree(input, input_size);
+
+	return ret;
+}
+
+CPOR_t *cpor_create_t(CPOR_params *myparams, CPOR_global *global, uint64_t n){
 
 	CPOR_t *t = NULL;
 	int i = 0;
@@ -268,35 +453,28 @@ cleanup:
 
 void destroy_cpor_challenge(CPOR_challenge *challenge){
 
-	int i;
-
 	if(!challenge) return;
-	if(challenge->I) sfree(challenge->I, sizeof(unsigned int) * challenge->l);
-	if(challenge->nu){
-		for(i = 0; i < challenge->l; i++){
-			if(challenge->nu[i]) BN_clear_free(challenge->nu[i]);
-		}
-		sfree(challenge->nu, sizeof(BIGNUM *) * challenge->l);
-	}
+	if(challenge->I) sfree(challenge->I, sizeof(uint64_t) * challenge->l);
+	if(challenge->nu) sfree(challenge->nu, challenge->element_size * challenge->l);
 	challenge->l = 0;
 	if(challenge->global) destroy_cpor_global(challenge->global);
 	sfree(challenge, sizeof(CPOR_challenge));
 }
 
-CPOR_challenge *allocate_cpor_challenge(unsigned int l){
+/* allocate_cpor_challenge: Allocates a challenge of l blocks whose nu's are element_size bytes wide */
+CPOR_challenge *allocate_cpor_challenge(unsigned int l, size_t element_size){
 	
 	CPOR_challenge *challenge = NULL;
-	int i = 0;
 
+	if(!element_size) return NULL;
 	if( ((challenge = malloc(sizeof(CPOR_challenge))) == NULL)) return NULL;
 	memset(challenge, 0, sizeof(CPOR_challenge));
 	challenge->l = l;
-	if( ((challenge->I = malloc(sizeof(unsigned int) * challenge->l)) == NULL)) goto cleanup;
-	memset(challenge->I, 0, sizeof(unsigned int) * challenge->l);
-	if( ((challenge->nu = malloc(sizeof(BIGNUM *) * challenge->l)) == NULL)) goto cleanup;	
-	memset(challenge->nu, 0, sizeof(BIGNUM *) * challenge->l);
-	for(i = 0; i < challenge->l; i++)
-		if( ((challenge->nu[i] = BN_new()) == NULL)) goto cleanup;
+	challenge->element_size = element_size;
+	if( ((challenge->I = malloc(sizeof(uint64_t) * (l ? l : 1))) == NULL)) goto cleanup;
+	memset(challenge->I, 0, sizeof(uint64_t) * challenge->l);
+	if( ((challenge->nu = malloc(element_size * (l ? l : 1))) == NULL)) goto cleanup;
+	memset(challenge->nu, 0, element_size * challenge->l);
 	if( ((challenge->global = allocate_cpor_global()) == NULL)) goto cleanup;
 
 	return challenge;
@@ -306,6 +484,106 @@ cleanup:
 	return NULL;
 }
 
+/* cpor_challenge_nu: The ith nu of challenge, element_size big-endian bytes */
+unsigned char *cpor_challenge_nu(CPOR_challenge *challenge, unsigned int i){
+
+	return challenge->nu + ((size_t)i * challenge->element_size);
+}
+
+
+void destroy_cpor_challenge_seed(CPOR_challenge_seed *seed){
+
+	if(!seed) return;
+	sfree(seed, sizeof(CPOR_challenge_seed));
+}
+
+CPOR_challenge_seed *allocate_cpor_challenge_seed(){
+
+	CPOR_challenge_seed *seed = NULL;
+
+	if( ((seed = malloc(sizeof(CPOR_challenge_seed))) == NULL)) return NULL;
+	memset(seed, 0, sizeof(CPOR_challenge_seed));
+
+	return seed;
+}
+
+void destroy_cpor_aggregate_challenge(CPOR_aggregate_challenge *challenge){
+
+	unsigned int f = 0;
+
+	if(!challenge) return;
+	if(challenge->challenges){
+		for(f = 0; f < challenge->numfiles; f++)
+			if(challenge->challenges[f]) destroy_cpor_challenge(challenge->challenges[f]);
+		sfree(challenge->challenges, sizeof(CPOR_challenge *) * challenge->numfiles);
+	}
+	if(challenge->weights){
+		for(f = 0; f < challenge->numfiles; f++)
+			if(challenge->weights[f]) BN_clear_free(challenge->weights[f]);
+		sfree(challenge->weights, sizeof(BIGNUM *) * challenge->numfiles);
+	}
+	sfree(challenge, sizeof(CPOR_aggregate_challenge));
+}
+
+/* allocate_cpor_aggregate_challenge: Allocates an aggregate challenge over numfiles files, with the weights
+* allocated and the per-file challenges left NULL. */
+CPOR_aggregate_challenge *allocate_cpor_aggregate_challenge(unsigned int numfiles){
+
+	CPOR_aggregate_challenge *challenge = NULL;
+	unsigned int f = 0;
+
+	if( ((challenge = malloc(sizeof(CPOR_aggregate_challenge))) == NULL)) return NULL;
+	memset(challenge, 0, sizeof(CPOR_aggregate_challenge));
+	challenge->numfiles = numfiles;
+	if( ((challenge->challenges = malloc(sizeof(CPOR_challenge *) * (numfiles ? numfiles : 1))) == NULL)) goto cleanup;
+	memset(challenge->challenges, 0, sizeof(CPOR_challenge *) * (numfiles ? numfiles : 1));
+	if( ((challenge->weights = malloc(sizeof(BIGNUM *) * (numfiles ? numfiles : 1))) == NULL)) goto cleanup;
+	memset(challenge->weights, 0, sizeof(BIGNUM *) * (numfiles ? numfiles : 1));
+	for(f = 0; f < numfiles; f++)
+		if( ((challenge->weights[f] = BN_new()) == NULL)) goto cleanup;
+
+	return challenge;
+
+cleanup:
+	destroy_cpor_aggregate_challenge(challenge);
+	return NULL;
+}
+
+void destroy_cpor_prepared(CPOR_params *myparams, CPOR_prepared *prepared){
+
+	int j = 0;
+
+	if(!prepared) return;
+	if(prepared->prf_sum) BN_clear_free(prepared->prf_sum);
+	if(prepared->alpha){
+		for(j = 0; j < myparams->num_sectors; j++)
+			if(prepared->alpha[j]) BN_clear_free(prepared->alpha[j]);
+		sfree(prepared->alpha, sizeof(BIGNUM *) * myparams->num_sectors);
+	}
+	if(prepared->global) destroy_cpor_global(prepared->global);
+	sfree(prepared, sizeof(CPOR_prepared));
+}
+
+CPOR_prepared *allocate_cpor_prepared(CPOR_params *myparams){
+
+	CPOR_prepared *prepared = NULL;
+	int j = 0;
+
+	if( ((prepared = malloc(sizeof(CPOR_prepared))) == NULL)) return NULL;
+	memset(prepared, 0, sizeof(CPOR_prepared));
+	if( ((prepared->prf_sum = BN_new()) == NULL)) goto cleanup;
+	if( ((prepared->alpha = malloc(sizeof(BIGNUM *) * myparams->num_sectors)) == NULL)) goto cleanup;
+	memset(prepared->alpha, 0, sizeof(BIGNUM *) * myparams->num_sectors);
+	for(j = 0; j < myparams->num_sectors; j++)
+		if( ((prepared->alpha[j] = BN_new()) == NULL)) goto cleanup;
+	if( ((prepared->global = allocate_cpor_global()) == NULL)) goto cleanup;
+
+	return prepared;
+
+cleanup:
+	destroy_cpor_prepared(myparams, prepared);
+	return NULL;
+}
 
 void destroy_cpor_tag(CPOR_tag *tag){
 
@@ -404,3 +682,252 @@ cleanup:
 	destroy_cpor_proof(myparams, proof);
 	return NULL;		
 }
+
+/* cpor_proof_size: The number of bytes a proof takes when serialized with cpor_proof_to_bytes, each element
+* padded to element_size bytes (the size of Zp).
+*/
+size_t cpor_proof_size(CPOR_params *myparams, size_t element_size){
+
+	return element_size * (1 + (size_t)myparams->num_sectors);
+}
+
+/* cpor_proof_to_bytes: Serializes proof into buf as sigma followed by mu_0 .. mu_{s-1}, each big-endian and
+* zero-padded to element_size bytes.  buf must hold cpor_proof_size bytes.  Returns 1 on success, 0 on failure.
+*/
+int cpor_proof_to_bytes(CPOR_params *myparams, CPOR_proof *proof, size_t element_size, unsigned char *buf, size_t buf_len){
+
+	int j = 0;
+
+	if(!proof || !buf || buf_len < cpor_proof_size(myparams, element_size)) return 0;
+
+	if(BN_bn2binpad(proof->sigma, buf, element_size) < 0) return 0;
+	for(j = 0; j < myparams->num_sectors; j++)
+		if(BN_bn2binpad(proof->mu[j], buf + ((size_t)(j + 1) * element_size), element_size) < 0) return 0;
+
+	return 1;
+}
+
+/* cpor_proof_from_bytes: The inverse of cpor_proof_to_bytes.  Returns the proof, or NULL if buf_len isn't the
+* size of a proof.
+*/
+CPOR_proof *cpor_proof_from_bytes(CPOR_params *myparams, size_t element_size, unsigned char *buf, size_t buf_len){
+
+	CPOR_proof *proof = NULL;
+	int j = 0;
+
+	if(!buf || !element_size || buf_len != cpor_proof_size(myparams, element_size)) return NULL;
+
+	if( ((proof = allocate_cpor_proof(myparams)) == NULL)) return NULL;
+	if(!BN_bin2bn(buf, element_size, proof->sigma)) goto cleanup;
+	for(j = 0; j < myparams->num_sectors; j++)
+		if(!BN_bin2bn(buf + ((size_t)(j + 1) * element_size), element_size, proof->mu[j])) goto cleanup;
+
+	return proof;
+
+cleanup:
+	destroy_cpor_proof(myparams, proof);
+	return NULL;
+}
+
+/* cpor_put_be32: Writes value to the 4 bytes at buf, most significant byte first, as everything that goes
+* between hosts is
+*/
+void cpor_put_be32(unsigned char *buf, uint32_t value){
+
+	int k = 0;
+
+	for(k = 3; k >= 0; k--, value >>= 8) buf[k] = value & 0xff;
+}
+
+/* cpor_get_be32: The inverse of cpor_put_be32 */
+uint32_t cpor_get_be32(const unsigned char *buf){
+
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+/* cpor_put_be64: Writes value to the 8 bytes at buf, most significant byte first */
+void cpor_put_be64(unsigned char *buf, uint64_t value){
+
+	cpor_put_be32(buf, value >> 32);
+	cpor_put_be32(buf + 4, value & 0xffffffff);
+}
+
+/* cpor_get_be64: The inverse of cpor_put_be64 */
+uint64_t cpor_get_be64(const unsigned char *buf){
+
+	return ((uint64_t)cpor_get_be32(buf) << 32) | cpor_get_be32(buf + 4);
+}
+
+/* put_wire_header: Writes the CPOR_WIRE_HEADER_SIZE header of a wire message of kind to buf. */
+static void put_wire_header(unsigned char *buf, unsigned int kind, size_t element_size, uint32_t count){
+
+	memset(buf, 0, CPOR_WIRE_HEADER_SIZE);
+	memcpy(buf, CPOR_WIRE_MAGIC, CPOR_WIRE_MAGIC_SIZE);
+	buf[4] = CPOR_WIRE_VERSION;
+	buf[5] = kind;
+	buf[6] = (element_size >> 8) & 0xff;
+	buf[7] = element_size & 0xff;
+	cpor_put_be32(buf + 8, count);
+}
+
+/* get_wire_header: Checks the header of a wire message of kind at buf (buf_len bytes long), setting
+* *element_size and *count from it.  Returns 1 if it is one, 0 otherwise.
+*/
+static int get_wire_header(const unsigned char *buf, size_t buf_len, unsigned int kind, size_t *element_size, uint32_t *count){
+
+	if(!buf || (buf_len < CPOR_WIRE_HEADER_SIZE)) return 0;
+	if(memcmp(buf, CPOR_WIRE_MAGIC, CPOR_WIRE_MAGIC_SIZE) || (buf[4] != CPOR_WIRE_VERSION) || (buf[5] != kind)) return 0;
+	*element_size = ((size_t)buf[6] << 8) | buf[7];
+	*count = cpor_get_be32(buf + 8);
+
+	return *element_size != 0;
+}
+
+/* cpor_challenge_wire_size: The number of bytes a challenge of l blocks takes on the wire, each element padded
+* to element_size bytes (the size of Zp).
+*/
+size_t cpor_challenge_wire_size(unsigned int l, size_t element_size){
+
+	return CPOR_WIRE_HEADER_SIZE + element_size + ((size_t)l * (sizeof(uint64_t) + element_size));
+}
+
+/* cpor_proof_wire_size: The number of bytes a proof takes on the wire */
+size_t cpor_proof_wire_size(CPOR_params *myparams, size_t element_size){
+
+	return CPOR_WIRE_HEADER_SIZE + cpor_proof_size(myparams, element_size);
+}
+
+/* repad_element: Copies the big-endian number of from_size bytes at from to the to_size bytes at to, zero-padding
+* or dropping leading zeros.  Returns 1 on success, 0 if it doesn't fit.
+*/
+static int repad_element(unsigned char *to, size_t to_size, const unsigned char *from, size_t from_size){
+
+	size_t i = 0;
+
+	if(to_size >= from_size){
+		memset(to, 0, to_size - from_size);
+		memcpy(to + (to_size - from_size), from, from_size);
+		return 1;
+	}
+	for(i = 0; i < from_size - to_size; i++)
+		if(from[i]) return 0;
+	memcpy(to, from + (from_size - to_size), to_size);
+
+	return 1;
+}
+
+/* cpor_encode_challenge: Encodes challenge into the caller's buf, which must hold cpor_challenge_wire_size bytes.
+* element_size must be at least the byte length of Zp and fit a uint16.  Returns the number of bytes written,
+* or 0 on failure.
+*/
+size_t cpor_encode_challenge(CPOR_challenge *challenge, size_t element_size, unsigned char *buf, size_t buf_len){
+
+	unsigned char *pos = NULL;
+	size_t size = 0;
+	unsigned int i = 0;
+
+	if(!challenge || !challenge->global || !buf || !element_size || (element_size > 0xffff)) return 0;
+	size = cpor_challenge_wire_size(challenge->l, element_size);
+	if(buf_len < size) return 0;
+
+	put_wire_header(buf, CPOR_WIRE_CHALLENGE, element_size, challenge->l);
+	pos = buf + CPOR_WIRE_HEADER_SIZE;
+	if(BN_bn2binpad(challenge->global->Zp, pos, element_size) < 0) return 0;
+	pos += element_size;
+	for(i = 0; i < challenge->l; i++, pos += sizeof(uint64_t)) cpor_put_be64(pos, challenge->I[i]);
+	if(element_size == challenge->element_size){
+		memcpy(pos, challenge->nu, element_size * challenge->l);
+	}else{
+		for(i = 0; i < challenge->l; i++, pos += element_size)
+			if(!repad_element(pos, element_size, cpor_challenge_nu(challenge, i), challenge->element_size)) return 0;
+	}
+
+	return size;
+}
+
+/* cpor_encode_proof: Encodes proof into the caller's buf, which must hold cpor_proof_wire_size bytes.  Returns
+* the number of bytes written, or 0 on failure.
+*/
+size_t cpor_encode_proof(CPOR_params *myparams, CPOR_proof *proof, size_t element_size, unsigned char *buf, size_t buf_len){
+
+	size_t size = 0;
+
+	if(!proof || !buf || !element_size || (element_size > 0xffff)) return 0;
+	size = cpor_proof_wire_size(myparams, element_size);
+	if(buf_len < size) return 0;
+
+	put_wire_header(buf, CPOR_WIRE_PROOF, element_size, myparams->num_sectors);
+	if(!cpor_proof_to_bytes(myparams, proof, element_size, buf + CPOR_WIRE_HEADER_SIZE, size - CPOR_WIRE_HEADER_SIZE)) return 0;
+
+	return size;
+}
+
+/* cpor_decode_challenge: Decodes the challenge encoded at buf into view, in place: no memory is allocated and
+* view points into buf.  Returns 1 on success, 0 if buf_len bytes at buf aren't an encoded challenge.
+*/
+int cpor_decode_challenge(const unsigned char *buf, size_t buf_len, CPOR_challenge_view *view){
+
+	size_t element_size = 0;
+	uint32_t l = 0;
+
+	if(!view || !get_wire_header(buf, buf_len, CPOR_WIRE_CHALLENGE, &element_size, &l)) return 0;
+	/* Check the count against what arrived before sizing anything by it */
+	if(l > (buf_len - CPOR_WIRE_HEADER_SIZE) / (sizeof(uint64_t) + element_size)) return 0;
+	if(buf_len != cpor_challenge_wire_size(l, element_size)) return 0;
+
+	view->l = l;
+	view->element_size = element_size;
+	view->Zp = buf + CPOR_WIRE_HEADER_SIZE;
+	view->I = view->Zp + element_size;
+	view->nu = view->I + ((size_t)l * sizeof(uint64_t));
+
+	return 1;
+}
+
+/* cpor_decode_proof: Decodes the proof encoded at buf into view, in place.  Returns 1 on success, 0 if buf_len
+* bytes at buf aren't an encoded proof with myparams->num_sectors sectors.
+*/
+int cpor_decode_proof(CPOR_params *myparams, const unsigned char *buf, size_t buf_len, CPOR_proof_view *view){
+
+	size_t element_size = 0;
+	uint32_t num_sectors = 0;
+
+	if(!view || !get_wire_header(buf, buf_len, CPOR_WIRE_PROOF, &element_size, &num_sectors)) return 0;
+	if((num_sectors != myparams->num_sectors) || (buf_len != cpor_proof_wire_size(myparams, element_size))) return 0;
+
+	view->num_sectors = num_sectors;
+	view->element_size = element_size;
+	view->sigma = buf + CPOR_WIRE_HEADER_SIZE;
+	view->mu = view->sigma + element_size;
+
+	return 1;
+}
+
+/* cpor_challenge_view_index: The ith block index of a decoded challenge */
+uint64_t cpor_challenge_view_index(CPOR_challenge_view *view, unsigned int i){
+
+	return cpor_get_be64(view->I + ((size_t)i * sizeof(uint64_t)));
+}
+
+/* cpor_challenge_from_view: Copies a decoded challenge into a CPOR_challenge, for code that needs one.  Returns
+* it, or NULL on failure.
+*/
+CPOR_challenge *cpor_challenge_from_view(CPOR_challenge_view *view){
+
+	CPOR_challenge *challenge = NULL;
+	unsigned int i = 0;
+
+	if(!view) return NULL;
+
+	if( ((challenge = allocate_cpor_challenge(view->l, view->element_size)) == NULL)) return NULL;
+	if(!BN_bin2bn(view->Zp, view->element_size, challenge->global->Zp)) goto cleanup;
+	for(i = 0; i < view->l; i++) challenge->I[i] = cpor_challenge_view_index(view, i);
+	/* The nu's are laid out just as they are on the wire */
+	memcpy(challenge->nu, view->nu, view->element_size * view->l);
+
+	return challenge;
+
+cleanup:
+	destroy_cpor_challenge(challenge);
+	return NULL;
+}
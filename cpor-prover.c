@@ -0,0 +1,1148 @@
+/*
+* cpor-prover.c
+*
+*/
+
+#include "cpor.h"
+#include <fcntl.h>
+#include <ctype.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef THREADING
+#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#endif
+
+/* Most data files (with their tag files) the prover keeps open */
+#define CPOR_PROVER_MAX_FILES 64
+
+/* Challenges a connection may have received but not yet answered.  The I/O for the ones waiting is started as
+ * they arrive, so it overlaps with proving the one ahead of them. */
+#define CPOR_PROVER_PIPELINE_DEPTH 8
+
+/* Most client connections the prover serves at once */
+#define CPOR_PROVER_MAX_CONNECTIONS 256
+
+/* The prover drops a connection that stalls this many seconds in the middle of a request, or that stops reading
+ * its responses */
+#define CPOR_PROVER_TIMEOUT 30
+
+/* Size of a connection's input buffer, and so the longest HTTP request header accepted */
+#define CPOR_PROVER_INPUT_SIZE 16384
+
+#ifdef THREADING
+
+/* A data file held open for proving, shared by the requests using it */
+struct prover_open_file{
+	CPOR_prover_file *file;
+	char *filepath;
+	char *tagfilepath;
+	unsigned int refs;			/* Requests using it */
+	int cached;					/* Still in the table; once out, the last request to finish with it closes it */
+	uint64_t used;				/* Clock value when last handed out, for LRU eviction */
+};
+
+/* A challenge received on a connection, waiting to be proven */
+struct prover_request{
+	uint64_t id;
+	int status;					/* HTTP status to answer with if it isn't 200, or 0 */
+	CPOR_challenge *challenge;
+	size_t element_size;		/* The length of Zp */
+	struct prover_open_file *open;	/* NULL if the files couldn't be held open */
+	char filepath[MAXPATHLEN];
+	char tagfilepath[MAXPATHLEN];
+	int close_after;			/* Close the connection once this is answered */
+};
+
+struct prover_conn{
+	CPOR_prover *prover;
+	int fd;
+	int http;					/* Speaks HTTP rather than CPOR messages */
+	CPOR_shm *shm;				/* Exchanges CPOR messages through shared memory, if set */
+	unsigned char *in;			/* Input received but not yet consumed */
+	size_t in_start;
+	size_t in_end;
+	struct prover_request *queue[CPOR_PROVER_PIPELINE_DEPTH];
+	unsigned int head;
+	unsigned int count;
+	int done;					/* No more requests will be queued */
+	pthread_mutex_t lock;
+	pthread_cond_t ready;		/* Signalled when a request is queued or done is set */
+	pthread_cond_t space;		/* Signalled when a request is dequeued */
+	pthread_t responder;
+	struct prover_conn *next;
+};
+
+struct CPOR_prover_struct{
+	CPOR_params myparams;
+	char address[MAXPATHLEN];
+	char *root;					/* Requested paths are relative to this (resolved, with no symlinks), if set */
+	int listenfd;
+	int wakefd[2];				/* Wakes the acceptor to stop */
+	int stop;
+	pthread_t acceptor;
+
+	struct prover_open_file *files[CPOR_PROVER_MAX_FILES];
+	uint64_t clock;
+	pthread_mutex_t files_lock;
+
+	struct prover_conn *conns;
+	unsigned int numconns;
+	pthread_mutex_t conns_lock;
+	pthread_cond_t conns_done;	/* Signalled when a connection goes away */
+};
+
+static void destroy_open_file(struct prover_open_file *open){
+
+	if(!open) return;
+	if(open->file) cpor_close_prover_file(open->file);
+	if(open->filepath) free(open->filepath);
+	if(open->tagfilepath) free(open->tagfilepath);
+	sfree(open, sizeof(struct prover_open_file));
+}
+
+/* release_open_file: Lets go of a file handed out by acquire_open_file, closing it if it has left the table. */
+static void release_open_file(CPOR_prover *prover, struct prover_open_file *open){
+
+	int last = 0;
+
+	if(!open) return;
+
+	pthread_mutex_lock(&prover->files_lock);
+	last = (--open->refs == 0) && !open->cached;
+	pthread_mutex_unlock(&prover->files_lock);
+
+	if(last) destroy_open_file(open);
+}
+
+/* evict_open_file: Takes slot's file out of the table.  Called with the files lock held; returns the file if it
+* is to be closed now, as nothing is using it.
+*/
+static struct prover_open_file *evict_open_file(CPOR_prover *prover, unsigned int slot){
+
+	struct prover_open_file *open = prover->files[slot];
+
+	prover->files[slot] = NULL;
+	open->cached = 0;
+
+	return (open->refs == 0) ? open : NULL;
+}
+
+/* acquire_open_file: Returns the open file for filepath and tagfilepath, opening it if it isn't open already or
+* the paths now name different files.  Returns NULL if the files can't be held open (see cpor_open_prover_file).
+*/
+static struct prover_open_file *acquire_open_file(CPOR_prover *prover, char *filepath, char *tagfilepath){
+
+	struct prover_open_file *open = NULL, *evicted = NULL;
+	unsigned int i = 0, slot = CPOR_PROVER_MAX_FILES;
+
+	pthread_mutex_lock(&prover->files_lock);
+	for(i = 0; i < CPOR_PROVER_MAX_FILES; i++){
+		if(!prover->files[i]) continue;
+		if(strcmp(prover->files[i]->filepath, filepath) || strcmp(prover->files[i]->tagfilepath, tagfilepath)) continue;
+		open = prover->files[i];
+		open->refs++;
+		open->used = ++prover->clock;
+		slot = i;
+		break;
+	}
+	pthread_mutex_unlock(&prover->files_lock);
+
+	if(open){
+		if(cpor_prover_file_current(open->file)) return open;
+
+		/* The file was replaced or changed; drop it for a fresh one */
+		pthread_mutex_lock(&prover->files_lock);
+		if(prover->files[slot] == open) evict_open_file(prover, slot);
+		pthread_mutex_unlock(&prover->files_lock);
+		release_open_file(prover, open);
+		open = NULL;
+	}
+
+	if( ((open = malloc(sizeof(struct prover_open_file))) == NULL)) return NULL;
+	memset(open, 0, sizeof(struct prover_open_file));
+	open->filepath = strdup(filepath);
+	open->tagfilepath = strdup(tagfilepath);
+	if(!open->filepath || !open->tagfilepath) goto cleanup;
+	if( ((open->file = cpor_open_prover_file(&prover->myparams, filepath, tagfilepath)) == NULL)) goto cleanup;
+	open->refs = 1;
+
+	/* Take a free slot, or else the least recently used one */
+	pthread_mutex_lock(&prover->files_lock);
+	slot = 0;
+	for(i = 0; i < CPOR_PROVER_MAX_FILES; i++){
+		if(!prover->files[i]){
+			slot = i;
+			break;
+		}
+		if(prover->files[i]->used < prover->files[slot]->used) slot = i;
+	}
+	if(prover->files[slot]) evicted = evict_open_file(prover, slot);
+	open->cached = 1;
+	open->used = ++prover->clock;
+	prover->files[slot] = open;
+	pthread_mutex_unlock(&prover->files_lock);
+
+	if(evicted) destroy_open_file(evicted);
+
+	return open;
+
+cleanup:
+	destroy_open_file(open);
+	return NULL;
+}
+
+/* is_tcp_address: Whether address is a TCP host:port (the host may be empty) rather than a Unix socket path */
+static int is_tcp_address(char *address){
+
+	return strchr(address, ':') && !strchr(address, '/');
+}
+
+/* resolve_path: Puts the path the client asked for, of len bytes, into out: as is, or if the prover has a root,
+* under it.  Paths under a root must be relative and may not climb out of it, with .. or through a symlink: out
+* is the path with every symlink resolved, and must still be under the root.  Returns 1 on success, 0 if the
+* path is refused.
+*/
+static int resolve_path(CPOR_prover *prover, char *path, size_t len, char *out){
+
+	char joined[MAXPATHLEN];
+	size_t root_len = 0;
+	size_t i = 0;
+
+	if(!len || memchr(path, '\0', len)) return 0;
+
+	if(prover->root){
+		if(path[0] == '/') return 0;
+		for(i = 0; i + 1 < len; i++)
+			if((path[i] == '.') && (path[i + 1] == '.') && ((i == 0) || (path[i - 1] == '/')) && ((i + 2 == len) || (path[i + 2] == '/'))) return 0;
+		root_len = strlen(prover->root);
+		if(root_len + 1 + len >= MAXPATHLEN) return 0;
+		sprintf(joined, "%s/%.*s", prover->root, (int)len, path);
+		if(!realpath(joined, out)) return 0;
+		if(strncmp(out, prover->root, root_len)) return 0;
+		if((out[root_len] != '/') && (out[root_len] != '\0') && strcmp(prover->root, "/")) return 0;
+	}else{
+		if(len >= MAXPATHLEN) return 0;
+		memcpy(out, path, len);
+		out[len] = '\0';
+	}
+
+	return 1;
+}
+
+/* prover_decode: Fills in req from a CPOR_MSG_PROVE payload, expanding the challenge and starting the reads it
+* will need.  The seed is checked before it is expanded: its l and run may be at most CPOR_MAX_CHALLENGE,
+* and its n must be the block count of the file the tags are for (files that can't be held open, containers
+* and tag files without a header, have no such count; a challenge past their end fails when proven).  Returns 1
+* on success, 0 if the payload is malformed or refused.
+*/
+static int prover_decode(CPOR_prover *prover, unsigned char *payload, size_t len, struct prover_request *req){
+
+	CPOR_challenge_seed seed;
+	CPOR_global *global = NULL;
+	uint32_t Zp_len = 0, path_len = 0;
+	size_t pos = 0;
+
+	if(len < CPOR_MSG_SEED_SIZE + sizeof(uint32_t)) return 0;
+	cpor_get_challenge_seed(payload, &seed);
+	pos = CPOR_MSG_SEED_SIZE;
+	Zp_len = cpor_get_be32(payload + pos);
+	pos += sizeof(uint32_t);
+	if(!Zp_len || (Zp_len > len - pos)) return 0;
+	if( ((global = allocate_cpor_global()) == NULL)) return 0;
+	if(!BN_bin2bn(payload + pos, Zp_len, global->Zp) || BN_is_zero(global->Zp)) goto cleanup;
+	pos += Zp_len;
+	if(len - pos < sizeof(uint32_t)) goto cleanup;
+	path_len = cpor_get_be32(payload + pos);
+	pos += sizeof(uint32_t);
+	if(path_len > len - pos) goto cleanup;
+	if(!resolve_path(prover, (char *)payload + pos, path_len, req->filepath)) goto cleanup;
+	pos += path_len;
+	if(!resolve_path(prover, (char *)payload + pos, len - pos, req->tagfilepath)) goto cleanup;
+	if(!seed.l || (seed.l > CPOR_MAX_CHALLENGE) || (seed.run > CPOR_MAX_CHALLENGE)) goto cleanup;
+
+	/* Hold the files open across requests */
+	req->open = acquire_open_file(prover, req->filepath, req->tagfilepath);
+	if(req->open && !cpor_prover_file_covers(req->open->file, seed.n)) goto cleanup;
+
+	if( ((req->challenge = cpor_expand_challenge(global, &seed)) == NULL)) goto cleanup;
+	req->element_size = Zp_len;
+	destroy_cpor_global(global);
+
+	/* Get the reads going */
+	if(req->open) cpor_prover_file_prefetch(&prover->myparams, req->open->file, req->challenge);
+
+	OPENSSL_cleanse(&seed, sizeof(CPOR_challenge_seed));
+
+	return 1;
+
+cleanup:
+	if(req->open){
+		release_open_file(prover, req->open);
+		req->open = NULL;
+	}
+	OPENSSL_cleanse(&seed, sizeof(CPOR_challenge_seed));
+	destroy_cpor_global(global);
+	return 0;
+}
+
+static void destroy_prover_request(CPOR_prover *prover, struct prover_request *req){
+
+	if(!req) return;
+	if(req->challenge) destroy_cpor_challenge(req->challenge);
+	if(req->open) release_open_file(prover, req->open);
+	sfree(req, sizeof(struct prover_request));
+}
+
+/* conn_fill: Receives more input into the connection's buffer.  Returns the number of bytes received, or 0 at
+* the end of the stream, on error, or if the buffer is full.
+*/
+static size_t conn_fill(struct prover_conn *conn){
+
+	ssize_t n = 0;
+
+	if(conn->in_start && (conn->in_end == CPOR_PROVER_INPUT_SIZE)){
+		memmove(conn->in, conn->in + conn->in_start, conn->in_end - conn->in_start);
+		conn->in_end -= conn->in_start;
+		conn->in_start = 0;
+	}
+	if(conn->in_end == CPOR_PROVER_INPUT_SIZE) return 0;
+
+	do{
+		n = recv(conn->fd, conn->in + conn->in_end, CPOR_PROVER_INPUT_SIZE - conn->in_end, 0);
+	}while((n < 0) && (errno == EINTR));
+	if(n <= 0) return 0;
+	conn->in_end += n;
+
+	return n;
+}
+
+/* conn_read: Reads exactly len bytes from the connection.  Returns 1 on success, 0 on failure. */
+static int conn_read(struct prover_conn *conn, unsigned char *buf, size_t len){
+
+	size_t n = 0;
+
+	while(len){
+		if((conn->in_start == conn->in_end) && !conn_fill(conn)) return 0;
+		n = conn->in_end - conn->in_start;
+		if(n > len) n = len;
+		memcpy(buf, conn->in + conn->in_start, n);
+		conn->in_start += n;
+		buf += n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+/* read_msg_request: Reads a CPOR_MSG_PROVE request from the connection.  Returns it, or NULL at the end of the
+* stream or if the connection is no longer usable.
+*/
+static struct prover_request *read_msg_request(struct prover_conn *conn){
+
+	CPOR_msg_header header;
+	struct prover_request *req = NULL;
+	unsigned char *payload = NULL;
+	unsigned char buf[CPOR_MSG_HEADER_SIZE];
+
+	if(!conn_read(conn, buf, CPOR_MSG_HEADER_SIZE)) return NULL;
+	cpor_get_msg_header(buf, &header);
+	if((header.magic != CPOR_MSG_MAGIC) || (header.length > CPOR_MSG_MAX_PAYLOAD)) return NULL;
+	if( ((payload = malloc(header.length + 1)) == NULL)) return NULL;
+	if(!conn_read(conn, payload, header.length)) goto cleanup;
+
+	if( ((req = malloc(sizeof(struct prover_request))) == NULL)) goto cleanup;
+	memset(req, 0, sizeof(struct prover_request));
+	req->id = header.id;
+	if((header.op != CPOR_MSG_PROVE) || !prover_decode(conn->prover, payload, header.length, req)) req->status = 400;
+
+cleanup:
+	free(payload);
+
+	return req;
+}
+
+/* read_shm_request: Reads a CPOR_MSG_PROVE request from the connection's shared-memory exchange, decoding it
+* where it lies.  Returns it, or NULL once the exchange is over.
+*/
+static struct prover_request *read_shm_request(struct prover_conn *conn){
+
+	CPOR_msg_header header;
+	struct prover_request *req = NULL;
+	unsigned char *slot = NULL;
+
+	if( ((slot = cpor_shm_peek(conn->shm, CPOR_SHM_REQUESTS)) == NULL)) return NULL;
+	memcpy(&header, slot, sizeof(CPOR_msg_header));
+
+	if( ((req = malloc(sizeof(struct prover_request))) != NULL)){
+		memset(req, 0, sizeof(struct prover_request));
+		req->id = header.id;
+		if((header.magic != CPOR_MSG_MAGIC) || (header.op != CPOR_MSG_PROVE) || (header.length > cpor_shm_payload_size(conn->shm)) ||
+			!prover_decode(conn->prover, slot + sizeof(CPOR_msg_header), header.length, req)) req->status = 400;
+	}
+	cpor_shm_release(conn->shm, CPOR_SHM_REQUESTS);
+
+	return req;
+}
+
+/* prover_attach_shm: Switches the connection to a shared-memory exchange if its first message asks for one with
+* CPOR_MSG_SHM, answering it; a request we can't meet is refused and the connection goes on over the socket.
+* Returns 1 on success (whether or not there was such a request), 0 if the connection is no longer usable.
+*/
+static int prover_attach_shm(struct prover_conn *conn){
+
+	CPOR_msg_header header;
+	unsigned char payload[2 * sizeof(uint32_t)];
+	uint32_t slot_size = 0, num_slots = 0;
+
+	while(conn->in_end - conn->in_start < CPOR_MSG_HEADER_SIZE)
+		if(!conn_fill(conn)) return 0;
+	cpor_get_msg_header(conn->in + conn->in_start, &header);
+	if(header.op != CPOR_MSG_SHM) return 1;
+
+	conn->in_start += CPOR_MSG_HEADER_SIZE;
+	if(header.length != sizeof(payload)) return 0;
+	if(!conn_read(conn, payload, sizeof(payload))) return 0;
+	slot_size = cpor_get_be32(payload);
+	num_slots = cpor_get_be32(payload + sizeof(uint32_t));
+
+	memset(&header, 0, sizeof(CPOR_msg_header));
+	header.op = CPOR_MSG_SHM;
+	if( ((conn->shm = cpor_shm_create(conn->fd, slot_size, num_slots)) == NULL)){
+		header.status = -1;
+		return cpor_msg_send(conn->fd, &header, NULL);
+	}
+	header.status = 1;
+	if(!cpor_shm_offer(conn->shm, &header)) return 0;
+
+	return 1;
+}
+
+/* header_value: Copies the value of the HTTP header name in the header block head into value (value_size bytes,
+* NUL terminated and cut short if need be), leaving head as it is so later headers can still be found.  Returns 1
+* if there is such a header, 0 if there isn't.
+*/
+static int header_value(char *head, const char *name, char *value, size_t value_size){
+
+	size_t name_len = strlen(name);
+	size_t len = 0;
+	char *line = NULL, *start = NULL, *end = NULL;
+
+	for(line = strstr(head, "\r\n"); line && line[2]; line = strstr(line + 2, "\r\n")){
+		if(strncasecmp(line + 2, name, name_len) || (line[2 + name_len] != ':')) continue;
+		for(start = line + 3 + name_len; (*start == ' ') || (*start == '\t'); start++);
+		if( ((end = strstr(start, "\r\n")) == NULL)) end = start + strlen(start);
+		len = end - start;
+		if(len >= value_size) len = value_size - 1;
+		memcpy(value, start, len);
+		value[len] = '\0';
+		return 1;
+	}
+
+	return 0;
+}
+
+/* find_header_end: Returns where the blank line ending an HTTP header is in the connection's input, or NULL if
+* it hasn't arrived yet.
+*/
+static char *find_header_end(struct prover_conn *conn){
+
+	size_t i = 0;
+
+	for(i = conn->in_start; i + 4 <= conn->in_end; i++)
+		if(!memcmp(conn->in + i, "\r\n\r\n", 4)) return (char *)conn->in + i;
+
+	return NULL;
+}
+
+/* read_http_request: Reads an HTTP request from the connection.  A POST of a CPOR_MSG_PROVE payload to /prove
+* is a challenge; anything else gets an error answer.  Returns the request, or NULL at the end of the stream or
+* if the connection is no longer usable.
+*/
+static struct prover_request *read_http_request(struct prover_conn *conn){
+
+	struct prover_request *req = NULL;
+	unsigned char *payload = NULL;
+	char *head = NULL, *end = NULL;
+	char value[64];
+	size_t head_len = 0, length = 0;
+	int version_10 = 0;
+
+	/* Wait for the whole header */
+	while(1){
+		if( ((end = find_header_end(conn)) != NULL)) break;
+		if(!conn_fill(conn)) return NULL;
+	}
+	head_len = (end + 4) - (char *)(conn->in + conn->in_start);
+	if( ((head = malloc(head_len + 1)) == NULL)) return NULL;
+	memcpy(head, conn->in + conn->in_start, head_len);
+	head[head_len] = '\0';
+	conn->in_start += head_len;
+
+	if( ((req = malloc(sizeof(struct prover_request))) == NULL)) goto cleanup;
+	memset(req, 0, sizeof(struct prover_request));
+
+	version_10 = (strstr(head, " HTTP/1.0\r\n") != NULL);
+	if(header_value(head, "Transfer-Encoding", value, sizeof(value))){
+		/* We can't find the end of a chunked body, so we can't go on after it either */
+		req->status = 411;
+		req->close_after = 1;
+		goto cleanup;
+	}
+	if(header_value(head, "Content-Length", value, sizeof(value))) length = strtoull(value, NULL, 10);
+	if(length > CPOR_MSG_MAX_PAYLOAD){
+		req->status = 413;
+		req->close_after = 1;
+		goto cleanup;
+	}
+	if( ((payload = malloc(length + 1)) == NULL)){
+		req->status = 500;
+		req->close_after = 1;
+		goto cleanup;
+	}
+	if(!conn_read(conn, payload, length)){
+		destroy_prover_request(conn->prover, req);
+		req = NULL;
+		goto cleanup;
+	}
+	if(header_value(head, "Connection", value, sizeof(value)))
+		req->close_after = !strcasecmp(value, "close") || (version_10 && strcasecmp(value, "keep-alive"));
+	else
+		req->close_after = version_10;
+
+	if(strncmp(head, "POST /prove ", 12))
+		req->status = 404;
+	else if(!prover_decode(conn->prover, payload, length, req))
+		req->status = 400;
+
+cleanup:
+	free(head);
+	if(payload) free(payload);
+
+	return req;
+}
+
+/* send_all: Sends all len bytes of buf.  Returns 1 on success, 0 on failure. */
+static int send_all(int fd, unsigned char *buf, size_t len){
+
+	ssize_t n = 0;
+
+	while(len){
+		n = send(fd, buf, len, MSG_NOSIGNAL);
+		if((n < 0) && (errno == EINTR)) continue;
+		if(n <= 0) return 0;
+		buf += n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+/* prover_answer: Proves req and sends the answer.  Returns 1 on success, 0 if the connection is no longer
+* usable.
+*/
+static int prover_answer(struct prover_conn *conn, struct prover_request *req){
+
+	CPOR_prover *prover = conn->prover;
+	CPOR_params myparams = prover->myparams;
+	CPOR_msg_header header;
+	CPOR_proof *proof = NULL;
+	unsigned char *out = NULL, *slot = NULL;
+	size_t proof_size = 0, head_len = 0;
+	char head[256];
+	int ret = 0;
+
+	if(!req->status){
+		if(req->open){
+			proof = cpor_prover_file_prove(&myparams, req->open->file, req->challenge);
+		}else{
+			/* A container, or a tag file without a header: take the general path */
+			myparams.filename = req->filepath;
+			myparams.tag_filename = req->tagfilepath;
+			proof = cpor_prove_file(&myparams, req->challenge);
+		}
+		req->status = 500;
+		if(proof && conn->shm){
+			/* Encoded straight into its slot below */
+			req->status = 200;
+		}else if(proof){
+			proof_size = cpor_proof_size(&myparams, req->element_size);
+			if( ((out = malloc(sizeof(head) + proof_size)) != NULL) &&
+				cpor_proof_to_bytes(&myparams, proof, req->element_size, out + sizeof(head), proof_size))
+				req->status = 200;
+		}
+	}
+
+	if(conn->http){
+		if(req->status == 200){
+			head_len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+				"Content-Length: %zu\r\n%s\r\n", proof_size, req->close_after ? "Connection: close\r\n" : "");
+			/* Send the header and proof in one go, right before the proof */
+			memcpy(out + sizeof(head) - head_len, head, head_len);
+			ret = send_all(conn->fd, out + sizeof(head) - head_len, head_len + proof_size);
+		}else{
+			head_len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n%s\r\n", req->status,
+				(req->status == 404) ? "Not Found" : (req->status == 411) ? "Length Required" :
+				(req->status == 413) ? "Payload Too Large" : (req->status == 400) ? "Bad Request" : "Internal Server Error",
+				req->close_after ? "Connection: close\r\n" : "");
+			ret = send_all(conn->fd, (unsigned char *)head, head_len);
+		}
+	}else if(conn->shm){
+		/* The proof goes in its fixed-width wire layout, which the client can check where it lies */
+		if( ((slot = cpor_shm_reserve(conn->shm, CPOR_SHM_RESPONSES)) != NULL)){
+			memset(&header, 0, sizeof(CPOR_msg_header));
+			header.magic = CPOR_MSG_MAGIC;
+			header.op = CPOR_MSG_PROVE;
+			header.id = req->id;
+			if(req->status == 200)
+				header.length = cpor_encode_proof(&myparams, proof, req->element_size, slot + sizeof(CPOR_msg_header), cpor_shm_payload_size(conn->shm));
+			header.status = header.length ? 1 : -1;
+			memcpy(slot, &header, sizeof(CPOR_msg_header));
+			cpor_shm_publish(conn->shm, CPOR_SHM_RESPONSES);
+			ret = 1;
+		}
+	}else{
+		memset(&header, 0, sizeof(CPOR_msg_header));
+		header.op = CPOR_MSG_PROVE;
+		header.id = req->id;
+		header.status = (req->status == 200) ? 1 : -1;
+		header.length = (req->status == 200) ? proof_size : 0;
+		ret = cpor_msg_send(conn->fd, &header, (req->status == 200) ? out + sizeof(head) : NULL);
+	}
+
+	if(proof) destroy_cpor_proof(&myparams, proof);
+	if(out) free(out);
+
+	return ret && !req->close_after;
+}
+
+/* prover_responder_thread: Proves a connection's requests in the order they arrived and sends the answers. */
+static void *prover_responder_thread(void *arg){
+
+	struct prover_conn *conn = (struct prover_conn *)arg;
+	struct prover_request *req = NULL;
+	int ok = 1;
+
+	while(1){
+		pthread_mutex_lock(&conn->lock);
+		while(!conn->count && !conn->done) pthread_cond_wait(&conn->ready, &conn->lock);
+		if(!conn->count){
+			pthread_mutex_unlock(&conn->lock);
+			break;
+		}
+		req = conn->queue[conn->head];
+		conn->head = (conn->head + 1) % CPOR_PROVER_PIPELINE_DEPTH;
+		conn->count--;
+		pthread_cond_signal(&conn->space);
+		pthread_mutex_unlock(&conn->lock);
+
+		/* Once the connection fails, drain the rest without answering */
+		if(ok && !prover_answer(conn, req)){
+			ok = 0;
+			shutdown(conn->fd, SHUT_RDWR);
+		}
+		destroy_prover_request(conn->prover, req);
+	}
+
+	return NULL;
+}
+
+/* prover_conn_thread: Reads a connection's requests, queueing each (with its reads started) for the
+* responder, until the connection ends.
+*/
+static void *prover_conn_thread(void *arg){
+
+	struct prover_conn *conn = (struct prover_conn *)arg;
+	CPOR_prover *prover = conn->prover;
+	struct prover_conn **link = NULL;
+	struct prover_request *req = NULL;
+	int responder = 0;
+
+	/* A connection speaks CPOR messages or HTTP, which we tell apart by the first bytes */
+	while(conn->in_end < sizeof(uint32_t))
+		if(!conn_fill(conn)) goto cleanup;
+	conn->http = cpor_get_be32(conn->in) != CPOR_MSG_MAGIC;
+	if(!conn->http && !prover_attach_shm(conn)) goto cleanup;
+
+	if(pthread_create(&conn->responder, NULL, prover_responder_thread, conn) != 0) goto cleanup;
+	responder = 1;
+
+	while(!prover->stop){
+		req = conn->shm ? read_shm_request(conn) : conn->http ? read_http_request(conn) : read_msg_request(conn);
+		if(!req) break;
+
+		pthread_mutex_lock(&conn->lock);
+		while(conn->count == CPOR_PROVER_PIPELINE_DEPTH) pthread_cond_wait(&conn->space, &conn->lock);
+		conn->queue[(conn->head + conn->count) % CPOR_PROVER_PIPELINE_DEPTH] = req;
+		conn->count++;
+		pthread_cond_signal(&conn->ready);
+		pthread_mutex_unlock(&conn->lock);
+		if(req->close_after) break;
+	}
+
+cleanup:
+	pthread_mutex_lock(&conn->lock);
+	conn->done = 1;
+	pthread_cond_signal(&conn->ready);
+	pthread_mutex_unlock(&conn->lock);
+	if(responder) pthread_join(conn->responder, NULL);
+
+	cpor_shm_destroy(conn->shm);
+	close(conn->fd);
+	free(conn->in);
+	pthread_cond_destroy(&conn->space);
+	pthread_cond_destroy(&conn->ready);
+	pthread_mutex_destroy(&conn->lock);
+
+	pthread_mutex_lock(&prover->conns_lock);
+	for(link = &prover->conns; *link; link = &(*link)->next){
+		if(*link == conn){
+			*link = conn->next;
+			break;
+		}
+	}
+	prover->numconns--;
+	pthread_cond_broadcast(&prover->conns_done);
+	pthread_mutex_unlock(&prover->conns_lock);
+
+	sfree(conn, sizeof(struct prover_conn));
+
+	return NULL;
+}
+
+/* prover_accept_thread: Accepts connections, giving each a reader and a responder thread. */
+static void *prover_accept_thread(void *arg){
+
+	CPOR_prover *prover = (CPOR_prover *)arg;
+	struct prover_conn *conn = NULL;
+	struct pollfd fds[2];
+	struct timeval timeout;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int fd = -1, on = 1;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	timeout.tv_sec = CPOR_PROVER_TIMEOUT;
+	timeout.tv_usec = 0;
+
+	fds[0].fd = prover->listenfd;
+	fds[0].events = POLLIN;
+	fds[1].fd = prover->wakefd[0];
+	fds[1].events = POLLIN;
+
+	while(!prover->stop){
+		if(poll(fds, 2, -1) < 0){
+			if(errno == EINTR) continue;
+			break;
+		}
+		if(prover->stop) break;
+
+		while( ((fd = accept(prover->listenfd, NULL, NULL)) >= 0)){
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(struct timeval));
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(int));
+
+			if( ((conn = malloc(sizeof(struct prover_conn))) == NULL)) goto drop;
+			memset(conn, 0, sizeof(struct prover_conn));
+			if( ((conn->in = malloc(CPOR_PROVER_INPUT_SIZE)) == NULL)) goto drop;
+			conn->prover = prover;
+			conn->fd = fd;
+			pthread_mutex_init(&conn->lock, NULL);
+			pthread_cond_init(&conn->ready, NULL);
+			pthread_cond_init(&conn->space, NULL);
+
+			pthread_mutex_lock(&prover->conns_lock);
+			if((prover->numconns == CPOR_PROVER_MAX_CONNECTIONS) ||
+				(pthread_create(&thread, &attr, prover_conn_thread, conn) != 0)){
+				pthread_mutex_unlock(&prover->conns_lock);
+				pthread_cond_destroy(&conn->space);
+				pthread_cond_destroy(&conn->ready);
+				pthread_mutex_destroy(&conn->lock);
+				goto drop;
+			}
+			conn->next = prover->conns;
+			prover->conns = conn;
+			prover->numconns++;
+			pthread_mutex_unlock(&prover->conns_lock);
+			continue;
+
+drop:
+			if(conn){
+				if(conn->in) free(conn->in);
+				sfree(conn, sizeof(struct prover_conn));
+				conn = NULL;
+			}
+			close(fd);
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+
+	return NULL;
+}
+
+/* cpor_start_prover: Starts a prover daemon listening at address, a Unix socket path or a TCP host:port.  Each
+* connection speaks either CPOR messages (CPOR_MSG_PROVE) or HTTP/1.1, POSTing the same payload to /prove and
+* getting the proof back as the body.  Requests on a connection may be pipelined: while one is being proven,
+* those behind it (up to CPOR_PROVER_PIPELINE_DEPTH) are decoded and their reads started, and the answers go
+* back in order.  A client on the same host may ask, in its first message on a Unix socket, to exchange the
+* messages through shared memory instead (see cpor_msg_attach_shm).  Data files are held open, with their tag
+* files, across requests.  If root is set, requested paths are taken relative to it and may not leave it, by ..
+* or by symlink; otherwise any path the daemon can read may be asked for, so a root is required when address is
+* a TCP host:port.  Returns the daemon, or NULL on failure.
+*/
+CPOR_prover *cpor_start_prover(CPOR_params *myparams, char *address, char *root){
+
+	CPOR_prover *prover = NULL;
+	int i = 0;
+
+	if(!address || (strlen(address) >= MAXPATHLEN)) return NULL;
+	if(!root && is_tcp_address(address)){
+		fprintf(stderr, "ERROR: A prover listening on %s must be given a root to serve files from.\n", address);
+		return NULL;
+	}
+
+	if( ((prover = malloc(sizeof(CPOR_prover))) == NULL)) return NULL;
+	memset(prover, 0, sizeof(CPOR_prover));
+	prover->myparams = *myparams;
+	prover->listenfd = prover->wakefd[0] = prover->wakefd[1] = -1;
+	strcpy(prover->address, address);
+	pthread_mutex_init(&prover->files_lock, NULL);
+	pthread_mutex_init(&prover->conns_lock, NULL);
+	pthread_cond_init(&prover->conns_done, NULL);
+
+	if(root && ((prover->root = realpath(root, NULL)) == NULL)){
+		fprintf(stderr, "ERROR: Was unable to resolve %s.\n", root);
+		goto cleanup;
+	}
+	if(pipe(prover->wakefd) < 0) goto cleanup;
+	for(i = 0; i < 2; i++) fcntl(prover->wakefd[i], F_SETFD, FD_CLOEXEC);
+	if( ((prover->listenfd = cpor_msg_listen(address)) < 0)) goto cleanup;
+	if(pthread_create(&prover->acceptor, NULL, prover_accept_thread, prover) != 0) goto cleanup;
+
+	return prover;
+
+cleanup:
+	if(prover->listenfd >= 0){
+		close(prover->listenfd);
+		if(!is_tcp_address(address)) unlink(address);
+	}
+	if(prover->wakefd[0] >= 0) close(prover->wakefd[0]);
+	if(prover->wakefd[1] >= 0) close(prover->wakefd[1]);
+	if(prover->root) free(prover->root);
+	pthread_cond_destroy(&prover->conns_done);
+	pthread_mutex_destroy(&prover->conns_lock);
+	pthread_mutex_destroy(&prover->files_lock);
+	sfree(prover, sizeof(CPOR_prover));
+
+	return NULL;
+}
+
+/* cpor_stop_prover: Stops the daemon, waiting for the requests under way and closing its files. */
+void cpor_stop_prover(CPOR_prover *prover){
+
+	struct prover_conn *conn = NULL;
+	unsigned int i = 0;
+	char wake = 0;
+
+	if(!prover) return;
+
+	prover->stop = 1;
+	while((write(prover->wakefd[1], &wake, 1) < 0) && (errno == EINTR));
+	pthread_join(prover->acceptor, NULL);
+
+	/* Wake the connections' readers and wait for them to wind down */
+	pthread_mutex_lock(&prover->conns_lock);
+	for(conn = prover->conns; conn; conn = conn->next) shutdown(conn->fd, SHUT_RDWR);
+	while(prover->numconns) pthread_cond_wait(&prover->conns_done, &prover->conns_lock);
+	pthread_mutex_unlock(&prover->conns_lock);
+
+	close(prover->listenfd);
+	if(!is_tcp_address(prover->address)) unlink(prover->address);
+	close(prover->wakefd[0]);
+	close(prover->wakefd[1]);
+
+	for(i = 0; i < CPOR_PROVER_MAX_FILES; i++) destroy_open_file(prover->files[i]);
+	if(prover->root) free(prover->root);
+
+	pthread_cond_destroy(&prover->conns_done);
+	pthread_mutex_destroy(&prover->conns_lock);
+	pthread_mutex_destroy(&prover->files_lock);
+	sfree(prover, sizeof(CPOR_prover));
+}
+
+#endif
+
+/* cpor_prover_challenge_payload: Builds the CPOR_MSG_PROVE payload asking for a proof of the challenge seed, over
+* global->Zp, for the data file at filepath and its tag file at tagfilepath, its lengths big-endian.  It is the
+* body of an HTTP POST to /prove as well.  Returns the payload, to be freed by the caller, with its length in *len, or NULL on failure.
+*/
+unsigned char *cpor_prover_challenge_payload(CPOR_challenge_seed *seed, CPOR_global *global, char *filepath, char *tagfilepath, size_t *len){
+
+	unsigned char *payload = NULL;
+	uint32_t Zp_len = 0, path_len = 0;
+	size_t pos = 0;
+
+	if(!seed || !global || !global->Zp || !filepath || !tagfilepath || !len) return NULL;
+
+	Zp_len = BN_num_bytes(global->Zp);
+	path_len = strlen(filepath);
+	*len = CPOR_MSG_SEED_SIZE + sizeof(uint32_t) + Zp_len + sizeof(uint32_t) + path_len + strlen(tagfilepath);
+	if(*len > CPOR_MSG_MAX_PAYLOAD) return NULL;
+	if( ((payload = malloc(*len)) == NULL)) return NULL;
+
+	cpor_put_challenge_seed(payload, seed);
+	pos = CPOR_MSG_SEED_SIZE;
+	cpor_put_be32(payload + pos, Zp_len);
+	pos += sizeof(uint32_t);
+	if(BN_bn2binpad(global->Zp, payload + pos, Zp_len) < 0){
+		sfree(payload, *len);
+		return NULL;
+	}
+	pos += Zp_len;
+	cpor_put_be32(payload + pos, path_len);
+	pos += sizeof(uint32_t);
+	memcpy(payload + pos, filepath, path_len);
+	pos += path_len;
+	memcpy(payload + pos, tagfilepath, *len - pos);
+
+	return payload;
+}
+
+/* cpor_prover_send_challenge: Sends the challenge seed, over global->Zp, for the data file at filepath and its
+* tag file at tagfilepath to the prover on conn, under the caller's id.  Requests may be pipelined; the proofs
+* come back in order.  Returns 1 on success, 0 on failure.
+*/
+int cpor_prover_send_challenge(CPOR_msg_conn *conn, uint64_t id, CPOR_challenge_seed *seed, CPOR_global *global, char *filepath, char *tagfilepath){
+
+	CPOR_msg_header header;
+	unsigned char *payload = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	if( ((payload = cpor_prover_challenge_payload(seed, global, filepath, tagfilepath, &len)) == NULL)) return 0;
+
+	memset(&header, 0, sizeof(CPOR_msg_header));
+	header.op = CPOR_MSG_PROVE;
+	header.id = id;
+	header.length = len;
+	ret = cpor_msg_conn_send(conn, &header, payload);
+
+	sfree(payload, len);
+
+	return ret;
+}
+
+/* cpor_prover_recv_proof: Receives the prover's answer to the oldest outstanding challenge on conn, setting *id
+* to the id it was sent under.  Returns the proof, or NULL if the prover couldn't prove it or on failure (*id
+* is still set if the answer arrived).
+*/
+CPOR_proof *cpor_prover_recv_proof(CPOR_params *myparams, CPOR_msg_conn *conn, uint64_t *id, CPOR_global *global){
+
+	CPOR_msg_header header;
+	CPOR_proof_view view;
+	CPOR_proof *proof = NULL;
+	unsigned char *payload = NULL;
+	size_t element_size = 0;
+
+	if(!conn || !global || !global->Zp) return NULL;
+	if(!cpor_msg_conn_recv(conn, &header, &payload)) return NULL;
+	if(id) *id = header.id;
+	if((header.op == CPOR_MSG_PROVE) && (header.status == 1)){
+		element_size = BN_num_bytes(global->Zp);
+		/* Through shared memory the proof comes in the wire layout, a header ahead of the same bytes */
+		if(!conn->shm)
+			proof = cpor_proof_from_bytes(myparams, element_size, payload, header.length);
+		else if(cpor_decode_proof(myparams, payload, header.length, &view) && (view.element_size == element_size))
+			proof = cpor_proof_from_bytes(myparams, element_size, payload + CPOR_WIRE_HEADER_SIZE, header.length - CPOR_WIRE_HEADER_SIZE);
+	}
+	if(payload) free(payload);
+
+	return proof;
+}
+
+#ifdef THREADING
+
+/* The state of a load test shared by its sending and receiving sides */
+struct load_test{
+	CPOR_params *myparams;
+	CPOR_msg_conn *conn;
+	unsigned int requests;
+	unsigned int depth;
+	CPOR_prepared **prepared;	/* Each request's prepared verification, until its proof is checked */
+	double *sent;				/* When each request went out */
+	unsigned int numsent;
+	unsigned int numreceived;
+	int stop;					/* Set if either side gives up */
+	pthread_mutex_t lock;
+	pthread_cond_t space;		/* Signalled when a proof comes back */
+};
+
+static double load_test_now(){
+
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double)tv.tv_sec + ((double)tv.tv_usec / 1000000);
+}
+
+static int compare_double(const void *a, const void *b){
+
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+/* load_test_sender: Sends the load test's challenges, keeping depth of them outstanding. */
+static void *load_test_sender(void *arg){
+
+	struct load_test *test = (struct load_test *)arg;
+	CPOR_challenge_seed *seed = NULL;
+	CPOR_prepared *prepared = NULL;
+	unsigned int r = 0;
+
+	for(r = 0; r < test->requests; r++){
+		pthread_mutex_lock(&test->lock);
+		while((r - test->numreceived >= test->depth) && !test->stop) pthread_cond_wait(&test->space, &test->lock);
+		pthread_mutex_unlock(&test->lock);
+		if(test->stop) break;
+
+		/* A request's clock starts once its challenge is made */
+		prepared = cpor_prepare_challenge_file(test->myparams, test->myparams->t_filename, &seed);
+		if(!prepared) break;
+		test->prepared[r] = prepared;
+		test->sent[r] = load_test_now();
+		if(!cpor_prover_send_challenge(test->conn, r, seed, prepared->global, test->myparams->filename, test->myparams->tag_filename)) break;
+		destroy_cpor_challenge_seed(seed);
+		seed = NULL;
+
+		pthread_mutex_lock(&test->lock);
+		test->numsent = r + 1;
+		pthread_cond_broadcast(&test->space);
+		pthread_mutex_unlock(&test->lock);
+	}
+	if(seed) destroy_cpor_challenge_seed(seed);
+
+	if(r < test->requests){
+		pthread_mutex_lock(&test->lock);
+		test->stop = 1;
+		pthread_cond_broadcast(&test->space);
+		pthread_mutex_unlock(&test->lock);
+	}
+
+	return NULL;
+}
+
+/* cpor_prover_load_test: Drives the prover at address with requests challenges over myparams->filename and
+* myparams->tag_filename (whose t is myparams->t_filename), keeping depth of them in flight on one connection
+* (through shared memory for an address prefixed with "shm:").
+* Every proof is verified.  Prints the throughput and the p50 and p99 latency.  Returns 1 if every proof came
+* back and verified, 0 otherwise.
+*/
+int cpor_prover_load_test(CPOR_params *myparams, char *address, unsigned int requests, unsigned int depth){
+
+	struct load_test test;
+	CPOR_params testparams = *myparams;
+	CPOR_secrets_cache *cache = NULL;
+	CPOR_proof *proof = NULL;
+	pthread_t sender;
+	double *latency = NULL;
+	double start = 0, elapsed = 0;
+	uint64_t id = 0;
+	unsigned int r = 0, verified = 0;
+	int started = 0;
+
+	if(!myparams->filename || !myparams->tag_filename || !myparams->t_filename || !requests || !depth) return 0;
+
+	memset(&test, 0, sizeof(struct load_test));
+	test.myparams = &testparams;
+	test.requests = requests;
+	test.depth = depth;
+	pthread_mutex_init(&test.lock, NULL);
+	pthread_cond_init(&test.space, NULL);
+
+	/* Keep the key and t at hand, so making a challenge doesn't reread them */
+	if(!testparams.secrets_cache){
+		if( ((cache = cpor_create_secrets_cache(myparams, 4, 0)) == NULL)) goto cleanup;
+		testparams.secrets_cache = cache;
+	}
+	if( ((test.prepared = malloc(sizeof(CPOR_prepared *) * requests)) == NULL)) goto cleanup;
+	memset(test.prepared, 0, sizeof(CPOR_prepared *) * requests);
+	if( ((test.sent = malloc(sizeof(double) * requests)) == NULL)) goto cleanup;
+	if( ((latency = malloc(sizeof(double) * requests)) == NULL)) goto cleanup;
+	if( ((test.conn = cpor_msg_connect(address)) == NULL)){
+		fprintf(stderr, "ERROR: Was not able to connect to %s.\n", address);
+		goto cleanup;
+	}
+
+	start = load_test_now();
+	if(pthread_create(&sender, NULL, load_test_sender, &test) != 0) goto cleanup;
+	started = 1;
+
+	for(r = 0; r < requests; r++){
+		proof = NULL;
+		id = UINT64_MAX;
+		pthread_mutex_lock(&test.lock);
+		while((test.numsent <= r) && !test.stop) pthread_cond_wait(&test.space, &test.lock);
+		if(test.numsent <= r){
+			pthread_mutex_unlock(&test.lock);
+			break;
+		}
+		pthread_mutex_unlock(&test.lock);
+
+		/* The request is out, so its prepared verification is in place */
+		proof = cpor_prover_recv_proof(&testparams, test.conn, &id, test.prepared[r]->global);
+		latency[r] = load_test_now() - test.sent[r];
+		if(proof && (id == r) && (cpor_verify_finish(&testparams, test.prepared[r], proof) == 1)) verified++;
+		if(proof) destroy_cpor_proof(&testparams, proof);
+		destroy_cpor_prepared(&testparams, test.prepared[r]);
+		test.prepared[r] = NULL;
+
+		pthread_mutex_lock(&test.lock);
+		test.numreceived = r + 1;
+		pthread_cond_broadcast(&test.space);
+		pthread_mutex_unlock(&test.lock);
+		if(!proof && (id != r)) break;
+	}
+	elapsed = load_test_now() - start;
+
+	if(r){
+		qsort(latency, r, sizeof(double), compare_double);
+		printf("%u requests, %u in flight: %.1f proofs/s, latency p50 %.3f ms, p99 %.3f ms, max %.3f ms; %u of %u verified\n",
+			r, depth, r / elapsed, latency[r / 2] * 1000, latency[(r * 99) / 100] * 1000, latency[r - 1] * 1000, verified, requests);
+	}
+
+cleanup:
+	if(started){
+		/* Unblock the sender if we stopped early, including from a send (or a wait for a shared-memory slot) that
+		 * the prover isn't going to make room for */
+		pthread_mutex_lock(&test.lock);
+		if(test.numsent < requests) shutdown(test.conn->fd, SHUT_RDWR);
+		test.stop = 1;
+		pthread_cond_broadcast(&test.space);
+		pthread_mutex_unlock(&test.lock);
+		pthread_join(sender, NULL);
+	}
+	cpor_msg_close(test.conn);
+	if(test.prepared){
+		for(r = 0; r < requests; r++)
+			if(test.prepared[r]) destroy_cpor_prepared(&testparams, test.prepared[r]);
+		free(test.prepared);
+	}
+	if(test.sent) free(test.sent);
+	if(latency) free(latency);
+	if(cache) cpor_destroy_secrets_cache(cache);
+	pthread_cond_destroy(&test.space);
+	pthread_mutex_destroy(&test.lock);
+
+	return verified == requests;
+}
+
+#endif
@@ -0,0 +1,993 @@
+/*
+* cpor-remote.c
+*
+*/
+
+#include "cpor.h"
+#include <curl/curl.h>
+#ifdef THREADING
+#include <pthread.h>
+#endif
+
+/* Most audits a remote auditor keeps in flight if the caller doesn't say */
+#define CPOR_REMOTE_MAX_IN_FLIGHT 64
+
+/* Most connections a remote auditor opens to its prover.  Past that, requests wait for a connection, or share
+ * one if the prover speaks HTTP/2. */
+#define CPOR_REMOTE_MAX_CONNECTIONS 8
+
+/* An audit fails if its request and response take longer than this many seconds */
+#define CPOR_REMOTE_TIMEOUT 30
+
+/* Keys and t's a remote auditor keeps decoded, if the caller doesn't give it a cache */
+#define CPOR_REMOTE_SECRETS 64
+
+struct remote_transfer;
+
+struct CPOR_remote_auditor_struct{
+	CPOR_params myparams;
+	char *url;						/* Where the prover takes its POSTs; see cpor_start_prover */
+	unsigned int max_in_flight;
+	CURLM *multi;					/* Kept across batches, so are its connections */
+	struct curl_slist *headers;
+	CPOR_secrets_cache *cache;		/* Ours to destroy, if the caller didn't pass one */
+	struct remote_transfer **slots;	/* The audits in flight, max_in_flight slots */
+};
+
+/* An audit under way */
+struct remote_transfer{
+	CPOR_remote_audit *audit;
+	CURL *easy;
+	CPOR_prepared *prepared;
+	unsigned char *request;			/* The CPOR_MSG_PROVE payload */
+	size_t request_len;
+	unsigned char *response;		/* The proof, as it arrives */
+	size_t response_len;
+	size_t proof_size;
+	size_t element_size;			/* The length of Zp */
+	unsigned int slot;				/* Where it is in the auditor's slots */
+};
+
+static void destroy_remote_transfer(CPOR_remote_auditor *auditor, struct remote_transfer *transfer){
+
+	if(!transfer) return;
+	if(auditor->slots[transfer->slot] == transfer) auditor->slots[transfer->slot] = NULL;
+	if(transfer->easy){
+		curl_multi_remove_handle(auditor->multi, transfer->easy);
+		curl_easy_cleanup(transfer->easy);
+	}
+	if(transfer->prepared) destroy_cpor_prepared(&auditor->myparams, transfer->prepared);
+	if(transfer->request) sfree(transfer->request, transfer->request_len);
+	if(transfer->response) free(transfer->response);
+	sfree(transfer, sizeof(struct remote_transfer));
+}
+
+/* remote_write: Collects the response body.  A body longer than a proof fails the transfer. */
+static size_t remote_write(char *ptr, size_t size, size_t nmemb, void *arg){
+
+	struct remote_transfer *transfer = (struct remote_transfer *)arg;
+	size_t len = size * nmemb;
+
+	if(len > transfer->proof_size - transfer->response_len) return 0;
+	memcpy(transfer->response + transfer->response_len, ptr, len);
+	transfer->response_len += len;
+
+	return len;
+}
+
+/* remote_start: Challenges the prover for audit, adding the request to the auditor's multi handle and putting
+* it in slot.  Returns the transfer, or NULL on failure.
+*/
+static struct remote_transfer *remote_start(CPOR_remote_auditor *auditor, CPOR_remote_audit *audit, unsigned int slot){
+
+	struct remote_transfer *transfer = NULL;
+	CPOR_challenge_seed *seed = NULL;
+
+	if(!audit->filepath || !audit->tagfilepath || !audit->tfilepath) return NULL;
+
+	if( ((transfer = malloc(sizeof(struct remote_transfer))) == NULL)) return NULL;
+	memset(transfer, 0, sizeof(struct remote_transfer));
+	transfer->audit = audit;
+	transfer->slot = slot;
+
+	if( ((transfer->prepared = cpor_prepare_challenge_file(&auditor->myparams, audit->tfilepath, &seed)) == NULL)) goto cleanup;
+	transfer->request = cpor_prover_challenge_payload(seed, transfer->prepared->global, audit->filepath, audit->tagfilepath, &transfer->request_len);
+	if(!transfer->request) goto cleanup;
+	transfer->element_size = BN_num_bytes(transfer->prepared->global->Zp);
+	transfer->proof_size = cpor_proof_size(&auditor->myparams, transfer->element_size);
+	if( ((transfer->response = malloc(transfer->proof_size)) == NULL)) goto cleanup;
+
+	if( ((transfer->easy = curl_easy_init()) == NULL)) goto cleanup;
+	curl_easy_setopt(transfer->easy, CURLOPT_URL, auditor->url);
+	curl_easy_setopt(transfer->easy, CURLOPT_HTTPHEADER, auditor->headers);
+	curl_easy_setopt(transfer->easy, CURLOPT_POSTFIELDS, transfer->request);
+	curl_easy_setopt(transfer->easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)transfer->request_len);
+	curl_easy_setopt(transfer->easy, CURLOPT_WRITEFUNCTION, remote_write);
+	curl_easy_setopt(transfer->easy, CURLOPT_WRITEDATA, transfer);
+	curl_easy_setopt(transfer->easy, CURLOPT_PRIVATE, transfer);
+	curl_easy_setopt(transfer->easy, CURLOPT_TIMEOUT, (long)CPOR_REMOTE_TIMEOUT);
+	curl_easy_setopt(transfer->easy, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(transfer->easy, CURLOPT_TCP_NODELAY, 1L);
+	curl_easy_setopt(transfer->easy, CURLOPT_TCP_KEEPALIVE, 1L);
+	/* Multiplex over HTTP/2 where the prover offers it; otherwise each connection carries one request at a time */
+	curl_easy_setopt(transfer->easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt(transfer->easy, CURLOPT_PIPEWAIT, 1L);
+	if(curl_multi_add_handle(auditor->multi, transfer->easy) != CURLM_OK){
+		curl_easy_cleanup(transfer->easy);
+		transfer->easy = NULL;
+		goto cleanup;
+	}
+
+	destroy_cpor_challenge_seed(seed);
+	auditor->slots[slot] = transfer;
+
+	return transfer;
+
+cleanup:
+	if(seed) destroy_cpor_challenge_seed(seed);
+	destroy_remote_transfer(auditor, transfer);
+	return NULL;
+}
+
+/* remote_finish: Verifies the proof a finished transfer brought back, setting its audit's result. */
+static void remote_finish(CPOR_remote_auditor *auditor, struct remote_transfer *transfer, CURLcode code){
+
+	CPOR_proof_view proof;
+	long status = 0;
+
+	transfer->audit->result = -1;
+	if(code != CURLE_OK) return;
+	curl_easy_getinfo(transfer->easy, CURLINFO_RESPONSE_CODE, &status);
+	if(status != 200) return;
+
+	/* The prover answered; anything but a proof that checks out fails the audit.  The body is a proof laid out
+	 * as on the wire, minus the header, so it is checked where it lies. */
+	transfer->audit->result = 0;
+	if(transfer->response_len != transfer->proof_size) return;
+	proof.num_sectors = auditor->myparams.num_sectors;
+	proof.element_size = transfer->element_size;
+	proof.sigma = transfer->response;
+	proof.mu = transfer->response + transfer->element_size;
+	if(cpor_verify_finish_view(&auditor->myparams, transfer->prepared, &proof) == 1) transfer->audit->result = 1;
+}
+
+/* cpor_create_remote_auditor: Creates a client auditing the prover daemon (see cpor_start_prover) that takes
+* its POSTs at url, e.g. http://host:port/prove.  Up to max_in_flight audits (0 for CPOR_REMOTE_MAX_IN_FLIGHT)
+* are kept in flight at once, over connections that stay open across batches.  The key comes from
+* myparams->key_filename; the secrets cache in myparams is used if set, or else one of the auditor's own.  The
+* caller should have called curl_global_init.  Returns the auditor, or NULL on failure.
+*/
+CPOR_remote_auditor *cpor_create_remote_auditor(CPOR_params *myparams, char *url, unsigned int max_in_flight){
+
+	CPOR_remote_auditor *auditor = NULL;
+	struct curl_slist *headers = NULL;
+
+	if(!myparams || !url) return NULL;
+
+	if( ((auditor = malloc(sizeof(CPOR_remote_auditor))) == NULL)) return NULL;
+	memset(auditor, 0, sizeof(CPOR_remote_auditor));
+	auditor->myparams = *myparams;
+	auditor->max_in_flight = max_in_flight ? max_in_flight : CPOR_REMOTE_MAX_IN_FLIGHT;
+
+	if( ((auditor->url = strdup(url)) == NULL)) goto cleanup;
+	if( ((auditor->slots = malloc(sizeof(struct remote_transfer *) * auditor->max_in_flight)) == NULL)) goto cleanup;
+	memset(auditor->slots, 0, sizeof(struct remote_transfer *) * auditor->max_in_flight);
+	if(!auditor->myparams.secrets_cache){
+		if( ((auditor->cache = cpor_create_secrets_cache(myparams, CPOR_REMOTE_SECRETS, 0)) == NULL)) goto cleanup;
+		auditor->myparams.secrets_cache = auditor->cache;
+	}
+
+	/* The prover doesn't do 100-continue, and the bodies are small anyway */
+	if( ((headers = curl_slist_append(NULL, "Content-Type: application/octet-stream")) == NULL)) goto cleanup;
+	auditor->headers = headers;
+	if( ((headers = curl_slist_append(auditor->headers, "Expect:")) == NULL)) goto cleanup;
+	auditor->headers = headers;
+
+	if( ((auditor->multi = curl_multi_init()) == NULL)) goto cleanup;
+	curl_multi_setopt(auditor->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(auditor->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)CPOR_REMOTE_MAX_CONNECTIONS);
+	curl_multi_setopt(auditor->multi, CURLMOPT_MAXCONNECTS, (long)CPOR_REMOTE_MAX_CONNECTIONS);
+
+	return auditor;
+
+cleanup:
+	cpor_destroy_remote_auditor(auditor);
+	return NULL;
+}
+
+/* cpor_remote_audit: Audits the numaudits files in audits, challenging the prover for each with a fresh compact
+* challenge.  Each proof is verified as soon as it arrives, while the other audits are still in flight, and
+* its audit's result set.  Returns the number of audits whose proofs verified, or -1 on failure.
+*/
+int cpor_remote_audit(CPOR_remote_auditor *auditor, CPOR_remote_audit *audits, unsigned int numaudits){
+
+	struct remote_transfer *transfer = NULL;
+	CURLMsg *msg = NULL;
+	CURL *easy = NULL;
+	CURLcode code = CURLE_OK;
+	unsigned int next = 0, active = 0, slot = 0, i = 0;
+	int running = 0, pending = 0, finished = 0, verified = 0, ret = -1;
+
+	if(!auditor || (!audits && numaudits)) return -1;
+
+	for(i = 0; i < numaudits; i++) audits[i].result = -1;
+
+	while((next < numaudits) || active){
+		/* Keep the pipe full */
+		for(slot = 0; (slot < auditor->max_in_flight) && (next < numaudits); ){
+			if(auditor->slots[slot]){
+				slot++;
+				continue;
+			}
+			if(remote_start(auditor, &audits[next], slot)) active++;
+			next++;
+		}
+		if(!active) break;
+
+		if(curl_multi_perform(auditor->multi, &running) != CURLM_OK) goto cleanup;
+
+		finished = 0;
+		while( ((msg = curl_multi_info_read(auditor->multi, &pending)) != NULL)){
+			if(msg->msg != CURLMSG_DONE) continue;
+			easy = msg->easy_handle;
+			code = msg->data.result;
+			curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&transfer);
+			remote_finish(auditor, transfer, code);
+			if(transfer->audit->result == 1) verified++;
+			destroy_remote_transfer(auditor, transfer);
+			active--;
+			finished++;
+		}
+
+		if(!finished && running && (curl_multi_wait(auditor->multi, NULL, 0, 1000, NULL) != CURLM_OK)) goto cleanup;
+	}
+
+	ret = verified;
+
+cleanup:
+	/* Drop whatever is still in flight if the multi handle failed us */
+	for(slot = 0; slot < auditor->max_in_flight; slot++)
+		if(auditor->slots[slot]) destroy_remote_transfer(auditor, auditor->slots[slot]);
+
+	return ret;
+}
+
+/* cpor_destroy_remote_auditor: Closes the auditor's connections and frees it. */
+void cpor_destroy_remote_auditor(CPOR_remote_auditor *auditor){
+
+	if(!auditor) return;
+	if(auditor->multi) curl_multi_cleanup(auditor->multi);
+	if(auditor->headers) curl_slist_free_all(auditor->headers);
+	if(auditor->cache) cpor_destroy_secrets_cache(auditor->cache);
+	if(auditor->slots) free(auditor->slots);
+	if(auditor->url) free(auditor->url);
+	sfree(auditor, sizeof(CPOR_remote_auditor));
+}
+
+/* Most connections an object store opens at once if the caller doesn't say.  Range requests beyond that wait
+ * for a connection, or share one if the store speaks HTTP/2. */
+#define CPOR_STORE_MAX_CONNECTIONS 16
+
+/* Challenged pieces of an object this many bytes apart or closer are fetched with one range request, the gap
+ * along with them */
+#define CPOR_STORE_COALESCE_GAP 4096
+
+/* Longest range requested at once */
+#define CPOR_STORE_MAX_RANGE (1 << 20)
+
+struct CPOR_object_store_struct{
+	CURLM *multi;					/* Kept across proofs, so are its connections */
+	unsigned int max_connections;
+};
+
+/* A range GET of len bytes at offset of the object at url */
+struct store_range{
+	char *url;
+	uint64_t offset;
+	size_t len;
+	unsigned char *buf;				/* len bytes; whatever is past the end of the object stays zero */
+	size_t got;
+	int answered;					/* The body has started */
+	int whole;						/* The store ignored the Range header and is sending the whole object */
+	uint64_t skip;					/* Bytes of the whole object still to drop before the range starts */
+	CURL *easy;
+};
+
+/* The challenged blocks in offset order, each remembering its position in the challenge */
+struct store_piece{
+	uint64_t index;
+	unsigned int i;
+	unsigned int data;				/* The data range holding the block */
+	unsigned int tag;				/* The tag range holding the sigma */
+};
+
+static int compare_store_piece(const void *a, const void *b){
+
+	const struct store_piece *x = a;
+	const struct store_piece *y = b;
+
+	if(x->index < y->index) return -1;
+	if(x->index > y->index) return 1;
+	return 0;
+}
+
+/* store_write: Collects a range's body.  A 206 body longer than the range fails the transfer.  A 200 is the
+* whole object from its first byte, as sent by a store that ignores the Range header: what comes before the range
+* is dropped, and the transfer is cut off (with range->got == range->len) as soon as the range is in.
+*/
+static size_t store_write(char *ptr, size_t size, size_t nmemb, void *arg){
+
+	struct store_range *range = (struct store_range *)arg;
+	size_t len = size * nmemb;
+	size_t n = 0;
+	long status = 0;
+
+	if(!range->answered){
+		range->answered = 1;
+		curl_easy_getinfo(range->easy, CURLINFO_RESPONSE_CODE, &status);
+		if(status == 200){
+			range->whole = 1;
+			range->skip = range->offset;
+		}
+	}
+	if(range->skip){
+		n = (len < range->skip) ? len : (size_t)range->skip;
+		range->skip -= n;
+		ptr += n;
+		len -= n;
+	}
+
+	if(len > range->len - range->got){
+		if(!range->whole) return 0;
+		len = range->len - range->got;
+		memcpy(range->buf + range->got, ptr, len);
+		range->got += len;
+		return 0;
+	}
+	memcpy(range->buf + range->got, ptr, len);
+	range->got += len;
+
+	return size * nmemb;
+}
+
+/* store_fetch: Fetches the count ranges at once over the store's connections.  Returns 1 if every one came
+* back, 0 otherwise.
+*/
+static int store_fetch(CPOR_object_store *store, struct store_range *ranges, unsigned int count){
+
+	struct store_range *range = NULL;
+	CURLMsg *msg = NULL;
+	char spec[64];
+	long status = 0;
+	unsigned int r = 0, added = 0, failed = 0;
+	int running = 0, pending = 0;
+
+	for(r = 0; r < count; r++){
+		range = &ranges[r];
+		if( ((range->easy = curl_easy_init()) == NULL)) goto cleanup;
+		snprintf(spec, sizeof(spec), "%llu-%llu", (unsigned long long)range->offset, (unsigned long long)(range->offset + range->len - 1));
+		curl_easy_setopt(range->easy, CURLOPT_URL, range->url);
+		curl_easy_setopt(range->easy, CURLOPT_RANGE, spec);
+		curl_easy_setopt(range->easy, CURLOPT_WRITEFUNCTION, store_write);
+		curl_easy_setopt(range->easy, CURLOPT_WRITEDATA, range);
+		curl_easy_setopt(range->easy, CURLOPT_PRIVATE, range);
+		curl_easy_setopt(range->easy, CURLOPT_TIMEOUT, (long)CPOR_REMOTE_TIMEOUT);
+		curl_easy_setopt(range->easy, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(range->easy, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(range->easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+		curl_easy_setopt(range->easy, CURLOPT_PIPEWAIT, 1L);
+		if(curl_multi_add_handle(store->multi, range->easy) != CURLM_OK) goto cleanup;
+		added = r + 1;
+	}
+
+	do{
+		if(curl_multi_perform(store->multi, &running) != CURLM_OK) goto cleanup;
+		while( ((msg = curl_multi_info_read(store->multi, &pending)) != NULL)){
+			if(msg->msg != CURLMSG_DONE) continue;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&range);
+			status = 0;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+			/* A store ignoring Range is cut off once the range is in, which curl reports as a write error */
+			if(range->whole && (range->got == range->len) && (msg->data.result == CURLE_WRITE_ERROR)) continue;
+			if((msg->data.result != CURLE_OK) || ((status != 206) && (status != 200))) failed++;
+		}
+		if(running && (curl_multi_wait(store->multi, NULL, 0, 1000, NULL) != CURLM_OK)) goto cleanup;
+	}while(running);
+
+	if(failed) goto cleanup;
+
+	for(r = 0; r < count; r++){
+		curl_multi_remove_handle(store->multi, ranges[r].easy);
+		curl_easy_cleanup(ranges[r].easy);
+		ranges[r].easy = NULL;
+	}
+
+	return 1;
+
+cleanup:
+	for(r = 0; r < count; r++){
+		if(!ranges[r].easy) continue;
+		if(r < added) curl_multi_remove_handle(store->multi, ranges[r].easy);
+		curl_easy_cleanup(ranges[r].easy);
+		ranges[r].easy = NULL;
+	}
+	return 0;
+}
+
+/* store_plan: Groups the count pieces of piece_size bytes at offsets (ascending) of url into ranges, merging
+* pieces CPOR_STORE_COALESCE_GAP bytes apart or closer, and sets which[k] to the range holding piece k.  ranges
+* must have room for count ranges.  Returns the number of ranges, or 0 on failure.
+*/
+static unsigned int store_plan(char *url, uint64_t *offsets, unsigned int count, size_t piece_size,
+                               struct store_range *ranges, unsigned int *which){
+
+	struct store_range *range = NULL;
+	uint64_t end = 0;
+	unsigned int k = 0, numranges = 0;
+
+	for(k = 0; k < count; k++){
+		end = range ? range->offset + range->len : 0;
+		if(!range || (offsets[k] > end + CPOR_STORE_COALESCE_GAP) || (offsets[k] + piece_size - range->offset > CPOR_STORE_MAX_RANGE)){
+			range = &ranges[numranges++];
+			range->url = url;
+			range->offset = offsets[k];
+			range->len = piece_size;
+		}else if(offsets[k] + piece_size > end){
+			range->len = offsets[k] + piece_size - range->offset;
+		}
+		which[k] = numranges - 1;
+	}
+
+	for(k = 0; k < numranges; k++){
+		if( ((ranges[k].buf = malloc(ranges[k].len)) == NULL)) return 0;
+		memset(ranges[k].buf, 0, ranges[k].len);
+	}
+
+	return numranges;
+}
+
+static void free_store_ranges(struct store_range *ranges, unsigned int count){
+
+	unsigned int r = 0;
+
+	if(!ranges) return;
+	for(r = 0; r < count; r++)
+		if(ranges[r].buf) sfree(ranges[r].buf, ranges[r].len);
+	free(ranges);
+}
+
+/* cpor_open_object_store: Sets up connections to an HTTP object store (anything answering GETs with Range
+* headers, such as S3 through presigned URLs), keeping at most max_connections (0 for
+* CPOR_STORE_MAX_CONNECTIONS) open at once.  The connections are reused across proofs.  A store is for one
+* thread at a time.  The caller should have called curl_global_init.  Returns the store, or NULL on failure.
+*/
+CPOR_object_store *cpor_open_object_store(unsigned int max_connections){
+
+	CPOR_object_store *store = NULL;
+
+	if( ((store = malloc(sizeof(CPOR_object_store))) == NULL)) return NULL;
+	memset(store, 0, sizeof(CPOR_object_store));
+	store->max_connections = max_connections ? max_connections : CPOR_STORE_MAX_CONNECTIONS;
+
+	if( ((store->multi = curl_multi_init()) == NULL)){
+		sfree(store, sizeof(CPOR_object_store));
+		return NULL;
+	}
+	curl_multi_setopt(store->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(store->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)store->max_connections);
+	curl_multi_setopt(store->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)store->max_connections);
+	curl_multi_setopt(store->multi, CURLMOPT_MAXCONNECTS, (long)store->max_connections);
+
+	return store;
+}
+
+/* cpor_prove_object: Computes the proof for challenge over the data file at dataurl and its tag file at tagurl,
+* both held in an object store, as cpor_prove_file would over local copies.  The tag file must have a
+* fixed-width header; it may be a shard (see cpor_prove_shard), with dataurl then holding just the shard's
+* blocks.  After the header, the challenged blocks and tags are all fetched at once with range GETs, those
+* lying close together in one request.  A store that ignores Range headers still works, at the cost of sending
+* each object from its start up to the end of every range.  Returns the proof, or NULL on failure.
+*/
+CPOR_proof *cpor_prove_object(CPOR_params *myparams, CPOR_object_store *store, char *dataurl, char *tagurl, CPOR_challenge *challenge){
+
+	CPOR_file_header header;
+	CPOR_proof *proof = NULL;
+	CPOR_tag *tag = NULL;
+	struct store_range headrange;
+	struct store_range *ranges = NULL;
+	struct store_piece *pieces = NULL;
+	uint64_t *offsets = NULL;
+	unsigned int *which = NULL;
+	unsigned int lo = 0, hi = 0, count = 0, numdata = 0, numtags = 0, k = 0;
+	struct store_range *data = NULL, *tags = NULL;
+	int ok = 0;
+
+	if(!myparams || !store || !dataurl || !tagurl || !challenge) return NULL;
+
+	/* The header says where the sigmas are, and which blocks a shard holds */
+	memset(&headrange, 0, sizeof(struct store_range));
+	headrange.url = tagurl;
+	headrange.len = sizeof(CPOR_file_header);
+	if( ((headrange.buf = malloc(headrange.len)) == NULL)) return NULL;
+	memset(headrange.buf, 0, headrange.len);
+	if(!store_fetch(store, &headrange, 1)){
+		fprintf(stderr, "ERROR: Was unable to fetch %s\n", tagurl);
+		goto cleanup;
+	}
+	if(!cpor_parse_tag_header(myparams, headrange.buf, headrange.got, &header)){
+		fprintf(stderr, "ERROR: %s is not a fixed-width tag file.\n", tagurl);
+		goto cleanup;
+	}
+
+	if( ((pieces = malloc(sizeof(struct store_piece) * challenge->l)) == NULL)) goto cleanup;
+	for(k = 0; k < challenge->l; k++){
+		pieces[k].index = challenge->I[k];
+		pieces[k].i = k;
+	}
+	qsort(pieces, challenge->l, sizeof(struct store_piece), compare_store_piece);
+	for(lo = 0; (lo < challenge->l) && (pieces[lo].index < header.first); lo++);
+	for(hi = lo; (hi < challenge->l) && (pieces[hi].index - header.first < header.n); hi++);
+	if(!(header.flags & CPOR_FORMAT_SHARD) && ((lo != 0) || (hi != challenge->l))){
+		fprintf(stderr, "ERROR: The challenge is for blocks past the end of %s.\n", dataurl);
+		goto cleanup;
+	}
+	count = hi - lo;
+	if(!count){
+		proof = allocate_cpor_proof(myparams);
+		ok = 1;
+		goto cleanup;
+	}
+
+	/* Plan the data ranges, then the tag ranges, in one array */
+	if( ((ranges = malloc(sizeof(struct store_range) * 2 * count)) == NULL)) goto cleanup;
+	memset(ranges, 0, sizeof(struct store_range) * 2 * count);
+	if( ((offsets = malloc(sizeof(uint64_t) * count)) == NULL)) goto cleanup;
+	if( ((which = malloc(sizeof(unsigned int) * count)) == NULL)) goto cleanup;
+
+	for(k = 0; k < count; k++) offsets[k] = (uint64_t)myparams->block_size * (pieces[lo + k].index - header.first);
+	if( ((numdata = store_plan(dataurl, offsets, count, myparams->block_size, ranges, which)) == 0)) goto cleanup;
+	for(k = 0; k < count; k++) pieces[lo + k].data = which[k];
+
+	for(k = 0; k < count; k++) offsets[k] = header.header_size + (uint64_t)header.sigma_size * (pieces[lo + k].index - header.first);
+	if( ((numtags = store_plan(tagurl, offsets, count, header.sigma_size, ranges + numdata, which)) == 0)) goto cleanup;
+	for(k = 0; k < count; k++) pieces[lo + k].tag = numdata + which[k];
+
+	if(!store_fetch(store, ranges, numdata + numtags)){
+		fprintf(stderr, "ERROR: Was unable to fetch the challenged blocks of %s\n", dataurl);
+		goto cleanup;
+	}
+
+	for(k = lo; k < hi; k++){
+		data = &ranges[pieces[k].data];
+		tags = &ranges[pieces[k].tag];
+		if( ((tag = allocate_cpor_tag()) == NULL)) goto cleanup;
+		if(!BN_bin2bn(tags->buf + (header.header_size + (uint64_t)header.sigma_size * (pieces[k].index - header.first) - tags->offset),
+			header.sigma_size, tag->sigma)) goto cleanup;
+		tag->index = pieces[k].index;
+
+		proof = cpor_create_proof_update(myparams, challenge, proof, tag,
+			data->buf + ((uint64_t)myparams->block_size * (pieces[k].index - header.first) - data->offset), pieces[k].index, pieces[k].i);
+		if(!proof) goto cleanup;
+
+		destroy_cpor_tag(tag);
+		tag = NULL;
+	}
+
+	proof = cpor_create_proof_final(proof);
+	ok = 1;
+
+cleanup:
+	if(tag) destroy_cpor_tag(tag);
+	if(!ok && proof){
+		destroy_cpor_proof(myparams, proof);
+		proof = NULL;
+	}
+	free_store_ranges(ranges, 2 * count);
+	if(headrange.buf) free(headrange.buf);
+	if(pieces) sfree(pieces, sizeof(struct store_piece) * challenge->l);
+	if(offsets) free(offsets);
+	if(which) free(which);
+
+	return proof;
+}
+
+/* cpor_close_object_store: Closes the store's connections and frees it. */
+void cpor_close_object_store(CPOR_object_store *store){
+
+	if(!store) return;
+	if(store->multi) curl_multi_cleanup(store->multi);
+	sfree(store, sizeof(CPOR_object_store));
+}
+
+#ifdef THREADING
+
+/* Bytes of tags sent in each upload request.  A request is retried whole if it isn't acknowledged. */
+#define CPOR_UPLOAD_CHUNK_SIZE (256 * 1024)
+
+/* Chunks buffered for an upload: one being sent and, while it waits for its acknowledgment, the next filling.
+ * The tagger blocks once they are all in use. */
+#define CPOR_UPLOAD_CHUNKS 2
+
+/* Times a request is retried before the upload fails, and the wait before the first retry (doubled each time) */
+#define CPOR_UPLOAD_RETRIES 4
+#define CPOR_UPLOAD_RETRY_DELAY 200000
+
+/* A chunk of the tag file being uploaded */
+struct upload_chunk{
+	unsigned char *buf;				/* CPOR_UPLOAD_CHUNK_SIZE bytes */
+	size_t len;						/* Bytes filled so far */
+	uint64_t offset;				/* Where the chunk goes in the tag file */
+	int closed;						/* No more bytes will be added */
+};
+
+struct CPOR_tag_upload_struct{
+	CPOR_params *myparams;
+	char *url;
+	size_t sigma_size;
+	unsigned char *sigma;			/* Room for one sigma, padded to sigma_size */
+	CURL *easy;						/* Used by the uploader thread, and by cpor_tag_upload_finish once it has exited */
+	struct curl_slist *headers;
+	struct upload_chunk chunks[CPOR_UPLOAD_CHUNKS];
+	unsigned int head;				/* The oldest unacknowledged chunk, being sent */
+	unsigned int count;				/* Chunks in use */
+	size_t sent;					/* Bytes of the head chunk handed to curl by the current request */
+	uint64_t n;						/* Tags received */
+	int done;						/* No more tags will come */
+	int failed;						/* A chunk couldn't be delivered, or the upload was abandoned */
+	int running;					/* The uploader thread has started */
+	pthread_mutex_t lock;
+	pthread_cond_t data;			/* Signalled when a chunk gains bytes or is closed */
+	pthread_cond_t space;			/* Signalled when a chunk is acknowledged or the upload fails */
+	pthread_t thread;
+};
+
+/* upload_read: Feeds curl the head chunk, waiting for the tagger when it has sent everything there is so far.
+* Ends the request body once the chunk is closed and sent.
+*/
+static size_t upload_read(char *ptr, size_t size, size_t nmemb, void *arg){
+
+	CPOR_tag_upload *upload = (CPOR_tag_upload *)arg;
+	struct upload_chunk *chunk = NULL;
+	size_t len = 0;
+
+	pthread_mutex_lock(&upload->lock);
+	chunk = &upload->chunks[upload->head];
+	while((upload->sent == chunk->len) && !chunk->closed && !upload->failed) pthread_cond_wait(&upload->data, &upload->lock);
+	if(upload->failed){
+		pthread_mutex_unlock(&upload->lock);
+		return CURL_READFUNC_ABORT;
+	}
+	len = chunk->len - upload->sent;
+	if(len > size * nmemb) len = size * nmemb;
+	memcpy(ptr, chunk->buf + upload->sent, len);
+	upload->sent += len;
+	pthread_mutex_unlock(&upload->lock);
+
+	return len;
+}
+
+/* upload_put: PUTs a piece of the tag file at offset, streamed from upload_read (or, if buf is set, the len
+* bytes at buf).  If total is set the upload is complete and the tag file total bytes long.  Retries up to
+* CPOR_UPLOAD_RETRIES times.  Returns 1 once the endpoint acknowledges it, 0 on failure.
+*/
+static int upload_put(CPOR_tag_upload *upload, uint64_t offset, unsigned char *buf, size_t len, uint64_t total){
+
+	struct curl_slist *headers = NULL, *extra = NULL;
+	char line[64];
+	CURLcode code = CURLE_OK;
+	long status = 0;
+	unsigned int attempt = 0;
+	int failed = 0;
+	int ret = 0;
+
+	snprintf(line, sizeof(line), "CPOR-Offset: %llu", (unsigned long long)offset);
+	if( ((extra = curl_slist_append(NULL, line)) == NULL)) return 0;
+	headers = extra;
+	if(total){
+		snprintf(line, sizeof(line), "CPOR-Length: %llu", (unsigned long long)total);
+		if( ((extra = curl_slist_append(headers, line)) == NULL)) goto cleanup;
+	}
+	for(extra = upload->headers; extra; extra = extra->next)
+		if(!curl_slist_append(headers, extra->data)) goto cleanup;
+
+	for(attempt = 0; attempt <= CPOR_UPLOAD_RETRIES; attempt++){
+		if(attempt) usleep(CPOR_UPLOAD_RETRY_DELAY << (attempt - 1));
+
+		curl_easy_reset(upload->easy);
+		curl_easy_setopt(upload->easy, CURLOPT_URL, upload->url);
+		curl_easy_setopt(upload->easy, CURLOPT_HTTPHEADER, headers);
+		curl_easy_setopt(upload->easy, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(upload->easy, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(upload->easy, CURLOPT_CONNECTTIMEOUT, (long)CPOR_REMOTE_TIMEOUT);
+		if(buf){
+			curl_easy_setopt(upload->easy, CURLOPT_TIMEOUT, (long)CPOR_REMOTE_TIMEOUT);
+			curl_easy_setopt(upload->easy, CURLOPT_CUSTOMREQUEST, "PUT");
+			curl_easy_setopt(upload->easy, CURLOPT_POSTFIELDS, buf);
+			curl_easy_setopt(upload->easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)len);
+		}else{
+			/* The length isn't known until the chunk closes, so the body goes chunked; it takes as long as the
+			 * tagger does, so only an endpoint that stops taking or answering it is given up on */
+			curl_easy_setopt(upload->easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
+			curl_easy_setopt(upload->easy, CURLOPT_LOW_SPEED_TIME, (long)CPOR_REMOTE_TIMEOUT);
+			pthread_mutex_lock(&upload->lock);
+			upload->sent = 0;
+			pthread_mutex_unlock(&upload->lock);
+			curl_easy_setopt(upload->easy, CURLOPT_UPLOAD, 1L);
+			curl_easy_setopt(upload->easy, CURLOPT_READFUNCTION, upload_read);
+			curl_easy_setopt(upload->easy, CURLOPT_READDATA, upload);
+		}
+
+		code = curl_easy_perform(upload->easy);
+		status = 0;
+		if(code == CURLE_OK) curl_easy_getinfo(upload->easy, CURLINFO_RESPONSE_CODE, &status);
+		if((status >= 200) && (status < 300)){
+			ret = 1;
+			break;
+		}
+		/* A refusal, as opposed to a lost connection, won't go any better the next time */
+		pthread_mutex_lock(&upload->lock);
+		failed = upload->failed;
+		pthread_mutex_unlock(&upload->lock);
+		if(((status >= 400) && (status < 500)) || failed) break;
+	}
+	if(!ret) fprintf(stderr, "ERROR: Was unable to upload tags to %s (%s, HTTP %ld).\n", upload->url, curl_easy_strerror(code), status);
+
+cleanup:
+	curl_slist_free_all(headers);
+
+	return ret;
+}
+
+/* upload_thread: Sends the chunks in order, each in one request, retrying the oldest until it is acknowledged. */
+static void *upload_thread(void *arg){
+
+	CPOR_tag_upload *upload = (CPOR_tag_upload *)arg;
+	uint64_t offset = 0;
+
+	while(1){
+		pthread_mutex_lock(&upload->lock);
+		while(!upload->count && !upload->done) pthread_cond_wait(&upload->data, &upload->lock);
+		if(!upload->count){
+			pthread_mutex_unlock(&upload->lock);
+			break;
+		}
+		offset = upload->chunks[upload->head].offset;
+		pthread_mutex_unlock(&upload->lock);
+
+		if(!upload_put(upload, offset, NULL, 0, 0)){
+			pthread_mutex_lock(&upload->lock);
+			upload->failed = 1;
+			pthread_cond_broadcast(&upload->space);
+			pthread_mutex_unlock(&upload->lock);
+			break;
+		}
+
+		pthread_mutex_lock(&upload->lock);
+		upload->chunks[upload->head].len = 0;
+		upload->chunks[upload->head].closed = 0;
+		upload->head = (upload->head + 1) % CPOR_UPLOAD_CHUNKS;
+		upload->count--;
+		pthread_cond_broadcast(&upload->space);
+		pthread_mutex_unlock(&upload->lock);
+	}
+
+	return NULL;
+}
+
+/* upload_append: Adds len bytes at buf to the tag file being uploaded, waiting while every chunk is in use.
+* Called with the lock held.  Returns 1 on success, 0 if the upload has failed.
+*/
+static int upload_append(CPOR_tag_upload *upload, unsigned char *buf, size_t len){
+
+	struct upload_chunk *chunk = NULL, *last = NULL;
+
+	if(upload->failed) return 0;
+
+	if(upload->count) chunk = &upload->chunks[(upload->head + upload->count - 1) % CPOR_UPLOAD_CHUNKS];
+	if(chunk && (chunk->len + len > CPOR_UPLOAD_CHUNK_SIZE)){
+		chunk->closed = 1;
+		pthread_cond_broadcast(&upload->data);
+	}
+	if(!chunk || chunk->closed){
+		/* Start the next chunk once one is free; this is what holds the tagger back when the endpoint is slow */
+		while((upload->count == CPOR_UPLOAD_CHUNKS) && !upload->failed) pthread_cond_wait(&upload->space, &upload->lock);
+		if(upload->failed) return 0;
+		last = chunk;
+		chunk = &upload->chunks[(upload->head + upload->count) % CPOR_UPLOAD_CHUNKS];
+		chunk->offset = last ? last->offset + last->len : 0;
+		chunk->len = 0;
+		chunk->closed = 0;
+		upload->count++;
+	}
+
+	memcpy(chunk->buf + chunk->len, buf, len);
+	chunk->len += len;
+	pthread_cond_broadcast(&upload->data);
+
+	return 1;
+}
+
+/* cpor_tag_upload_begin: Starts uploading a tag file to url while it is being made, as the sink_arg of
+* cpor_tag_sink_upload.  The tag file goes up in chunks of CPOR_UPLOAD_CHUNK_SIZE bytes, each PUT to url with a
+* chunked body that is streamed as the tags come in and a CPOR-Offset header giving where the chunk goes in the
+* file.  Each chunk is kept until the endpoint acknowledges it, and resent if it isn't.  cpor_tag_upload_finish
+* then PUTs the final header at offset 0 with a CPOR-Length header giving the file's length.  The caller should
+* have called curl_global_init.  Returns the upload, or NULL on failure.
+*/
+CPOR_tag_upload *cpor_tag_upload_begin(CPOR_params *myparams, char *url, size_t sigma_size){
+
+	CPOR_tag_upload *upload = NULL;
+	unsigned char header[sizeof(CPOR_file_header)];
+	FILE *file = NULL;
+	unsigned int c = 0;
+
+	if(!myparams || !url || !sigma_size) return NULL;
+
+	if( ((upload = malloc(sizeof(CPOR_tag_upload))) == NULL)) return NULL;
+	memset(upload, 0, sizeof(CPOR_tag_upload));
+	upload->myparams = myparams;
+	upload->sigma_size = sigma_size;
+	pthread_mutex_init(&upload->lock, NULL);
+	pthread_cond_init(&upload->data, NULL);
+	pthread_cond_init(&upload->space, NULL);
+
+	if( ((upload->url = strdup(url)) == NULL)) goto cleanup;
+	if( ((upload->sigma = malloc(sigma_size)) == NULL)) goto cleanup;
+	for(c = 0; c < CPOR_UPLOAD_CHUNKS; c++)
+		if( ((upload->chunks[c].buf = malloc(CPOR_UPLOAD_CHUNK_SIZE)) == NULL)) goto cleanup;
+	if( ((upload->easy = curl_easy_init()) == NULL)) goto cleanup;
+	if( ((upload->headers = curl_slist_append(NULL, "Content-Type: application/octet-stream")) == NULL)) goto cleanup;
+	if(!curl_slist_append(upload->headers, "Expect:")) goto cleanup;
+
+	/* The tag file starts with its header; the number of blocks is filled in at the end */
+	if( ((file = fmemopen(header, sizeof(header), "wb")) == NULL)) goto cleanup;
+	if(!write_cpor_tag_header(myparams, file, sigma_size, 0)){
+		fclose(file);
+		goto cleanup;
+	}
+	fclose(file);
+	if(!upload_append(upload, header, sizeof(header))) goto cleanup;
+
+	if(pthread_create(&upload->thread, NULL, upload_thread, upload) != 0) goto cleanup;
+	upload->running = 1;
+
+	return upload;
+
+cleanup:
+	cpor_tag_upload_abort(upload);
+	return NULL;
+}
+
+/* cpor_tag_sink_upload: A CPOR_tag_sink that adds each tag to the upload passed as sink_arg (see
+* cpor_tag_upload_begin), blocking while the endpoint is behind.
+*/
+int cpor_tag_sink_upload(void *sink_arg, CPOR_tag *tag, size_t sigma_size){
+
+	CPOR_tag_upload *upload = (CPOR_tag_upload *)sink_arg;
+	int ret = 0;
+
+	if(!upload || !tag || (sigma_size != upload->sigma_size)) return 0;
+
+	pthread_mutex_lock(&upload->lock);
+	ret = (BN_bn2binpad(tag->sigma, upload->sigma, sigma_size) >= 0) && upload_append(upload, upload->sigma, sigma_size);
+	if(ret) upload->n++;
+	pthread_mutex_unlock(&upload->lock);
+
+	return ret;
+}
+
+/* cpor_tag_upload_finish: Waits for every tag to be acknowledged, then uploads the final header.  The upload
+* is freed whether or not this succeeds.  Returns 1 on success, 0 on failure.
+*/
+int cpor_tag_upload_finish(CPOR_tag_upload *upload){
+
+	unsigned char header[sizeof(CPOR_file_header)];
+	FILE *file = NULL;
+	int ret = 0;
+
+	if(!upload) return 0;
+
+	pthread_mutex_lock(&upload->lock);
+	if(upload->count) upload->chunks[(upload->head + upload->count - 1) % CPOR_UPLOAD_CHUNKS].closed = 1;
+	upload->done = 1;
+	pthread_cond_broadcast(&upload->data);
+	pthread_mutex_unlock(&upload->lock);
+	pthread_join(upload->thread, NULL);
+	upload->running = 0;
+	if(upload->failed) goto cleanup;
+
+	if( ((file = fmemopen(header, sizeof(header), "wb")) == NULL)) goto cleanup;
+	ret = write_cpor_tag_header(upload->myparams, file, upload->sigma_size, upload->n);
+	fclose(file);
+	if(ret) ret = upload_put(upload, 0, header, sizeof(header), sizeof(header) + upload->n * upload->sigma_size);
+
+cleanup:
+	cpor_tag_upload_abort(upload);
+	return ret;
+}
+
+/* cpor_tag_upload_abort: Gives up on an upload, leaving whatever reached the endpoint without a final header,
+* and frees it.
+*/
+void cpor_tag_upload_abort(CPOR_tag_upload *upload){
+
+	unsigned int c = 0;
+
+	if(!upload) return;
+	if(upload->running){
+		pthread_mutex_lock(&upload->lock);
+		upload->failed = 1;
+		upload->done = 1;
+		pthread_cond_broadcast(&upload->data);
+		pthread_cond_broadcast(&upload->space);
+		pthread_mutex_unlock(&upload->lock);
+		pthread_join(upload->thread, NULL);
+	}
+	for(c = 0; c < CPOR_UPLOAD_CHUNKS; c++)
+		if(upload->chunks[c].buf) free(upload->chunks[c].buf);
+	if(upload->easy) curl_easy_cleanup(upload->easy);
+	if(upload->headers) curl_slist_free_all(upload->headers);
+	if(upload->url) free(upload->url);
+	if(upload->sigma) free(upload->sigma);
+	pthread_cond_destroy(&upload->space);
+	pthread_cond_destroy(&upload->data);
+	pthread_mutex_destroy(&upload->lock);
+	sfree(upload, sizeof(CPOR_tag_upload));
+}
+
+/* cpor_tag_stream_upload: Tags everything read from input until end of file, as cpor_tag_stream does, but
+* uploads the tag file to url while tagging (see cpor_tag_upload_begin) instead of writing it locally.  t is
+* still written to tfilepath.  Returns 1 on success, 0 on failure.
+*/
+int cpor_tag_stream_upload(CPOR_params *myparams, FILE *input, char *url, char *tfilepath){
+
+	CPOR_tagger *tagger = NULL;
+	CPOR_tag_upload *upload = NULL;
+	FILE *tfile = NULL;
+	unsigned char *buf = NULL;
+	size_t buf_size = 0, len = 0;
+	int ret = 0;
+
+	if(!myparams || !input || !url || !tfilepath) return 0;
+
+	buf_size = (size_t)myparams->block_size * 16;
+	if( ((buf = malloc(buf_size)) == NULL)) goto cleanup;
+	tfile = fopen(tfilepath, "wb");
+	if(!tfile){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", tfilepath);
+		goto cleanup;
+	}
+
+	/* The upload's sink isn't known to the tagger until it exists, so point it there once both do */
+	tagger = cpor_tagger_begin(myparams, cpor_tag_sink_upload, NULL);
+	if(!tagger) goto cleanup;
+	upload = cpor_tag_upload_begin(myparams, url, BN_num_bytes(tagger->key->global->Zp));
+	if(!upload) goto cleanup;
+	tagger->sink_arg = upload;
+
+	while((len = fread(buf, 1, buf_size, input)) > 0)
+		if(!cpor_tagger_update(tagger, buf, len)) goto cleanup;
+	if(ferror(input)) goto cleanup;
+
+	/* Both finishes free what they're given, even on failure */
+	ret = cpor_tagger_finish(tagger, tfile);
+	tagger = NULL;
+	if(fclose(tfile) != 0) ret = 0;
+	tfile = NULL;
+	/* The final header marks the remote tag file complete, so it goes up only once t is safely written */
+	if(!ret) goto cleanup;
+	ret = cpor_tag_upload_finish(upload);
+	upload = NULL;
+
+cleanup:
+	if(!ret) fprintf(stderr, "ERROR: Was unable to tag stream.\n");
+	if(tagger) cpor_tagger_abort(tagger);
+	if(upload) cpor_tag_upload_abort(upload);
+	if(buf) sfree(buf, buf_size);
+	if(tfile) fclose(tfile);
+	if(!ret) unlink(tfilepath);
+
+	return ret;
+}
+
+#endif
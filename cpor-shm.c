@@ -0,0 +1,496 @@
+/*
+* cpor-shm.c
+*
+*/
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "cpor.h"
+#include <errno.h>
+#include <fcntl.h>
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#endif
+
+/* A shared-memory ring exchange is a memfd holding two rings of fixed-size slots: the requests, written by the
+ * client and read by the prover, then the responses, going the other way.  Each slot is a CPOR_msg_header and
+ * its payload.  Each ring has one producer and one consumer, which count the slots they have published and
+ * released in the ring's head and tail; a side with nothing to do says so in the ring's waiting flags and sleeps
+ * on an eventfd, which the other side writes only if the flag is set, so a busy exchange makes no system calls.
+ * The memfd and the four eventfds are handed over the control connection (a Unix socket), which carries nothing
+ * else afterwards: either side closing it ends the exchange, as does either side waiting on the other for longer
+ * than CPOR_SHM_TIMEOUT.  The number of slots is a power of two, so the slot a counter names stays the same as
+ * the counter wraps. */
+
+#if defined(__linux__)
+
+#define CPOR_SHM_MAGIC 0x43505348		/* "CPSH" */
+#define CPOR_SHM_VERSION 1
+
+/* Slots are cache line aligned, and the indices the two sides write are kept on separate lines */
+#define CPOR_SHM_ALIGN 64
+
+/* Most memory the prover maps for one exchange */
+#define CPOR_SHM_MAX_SIZE (64 << 20)
+
+/* Descriptors handed over: the memfd, then each ring's consumer and producer eventfds */
+#define CPOR_SHM_NUM_FDS 5
+
+/* Seconds a side waits for the other to publish or release a slot before giving the exchange up, as long as the
+ * prover waits on a socket */
+#define CPOR_SHM_TIMEOUT 30
+
+struct shm_ring{
+	uint32_t head;				/* Slots published, written by the producer */
+	unsigned char pad0[CPOR_SHM_ALIGN - sizeof(uint32_t)];
+	uint32_t tail;				/* Slots released, written by the consumer */
+	unsigned char pad1[CPOR_SHM_ALIGN - sizeof(uint32_t)];
+	uint32_t consumer_waiting;	/* Set while the consumer sleeps for a slot to be published */
+	uint32_t producer_waiting;	/* Set while the producer sleeps for a slot to be released */
+	unsigned char pad2[CPOR_SHM_ALIGN - (2 * sizeof(uint32_t))];
+};
+
+/* The start of the memfd; the slots follow */
+struct shm_layout{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t num_slots;
+	unsigned char pad[CPOR_SHM_ALIGN - (4 * sizeof(uint32_t))];
+	struct shm_ring rings[2];
+};
+
+struct CPOR_shm_struct{
+	int fd;						/* The control connection */
+	int memfd;
+	int events[2][2];			/* Each ring's eventfds: [0] wakes its consumer, [1] its producer */
+	struct shm_layout *layout;
+	unsigned char *slots;
+	size_t map_size;
+	uint32_t slot_size;			/* Our own copies; the other side could scribble over the shared ones */
+	uint32_t num_slots;
+	uint32_t head[2];			/* Of the ring we produce into */
+	uint32_t tail[2];			/* Of the ring we consume from */
+};
+
+static size_t shm_map_size(uint32_t slot_size, uint32_t num_slots){
+
+	return sizeof(struct shm_layout) + ((size_t)2 * num_slots * slot_size);
+}
+
+static unsigned char *shm_slot(CPOR_shm *shm, int ring, uint32_t index){
+
+	return shm->slots + ((((size_t)ring * shm->num_slots) + (index & (shm->num_slots - 1))) * shm->slot_size);
+}
+
+/* shm_wait: Sleeps until the eventfd evfd is written.  Returns 1 when it is, 0 if the control connection is
+* closed (or anything arrives on it), after CPOR_SHM_TIMEOUT seconds, or on error.
+*/
+static int shm_wait(CPOR_shm *shm, int evfd){
+
+	struct pollfd fds[2];
+	uint64_t count = 0;
+	int n = 0;
+
+	fds[0].fd = evfd;
+	fds[0].events = POLLIN;
+	fds[1].fd = shm->fd;
+	fds[1].events = POLLIN;
+
+	while(1){
+		fds[0].revents = fds[1].revents = 0;
+		if( ((n = poll(fds, 2, CPOR_SHM_TIMEOUT * 1000)) < 0)){
+			if(errno == EINTR) continue;
+			return 0;
+		}
+		if(!n || fds[1].revents) return 0;
+		if(fds[0].revents & POLLIN){
+			while((read(evfd, &count, sizeof(uint64_t)) < 0) && (errno == EINTR));
+			return 1;
+		}
+		if(fds[0].revents) return 0;
+	}
+}
+
+static void shm_wake(int evfd){
+
+	uint64_t one = 1;
+
+	while((write(evfd, &one, sizeof(uint64_t)) < 0) && (errno == EINTR));
+}
+
+/* cpor_shm_reserve: Waits for a free slot in ring, which we produce into.  Returns the slot, to be filled with a
+* CPOR_msg_header and its payload and handed over with cpor_shm_publish, or NULL if the exchange is over.
+*/
+unsigned char *cpor_shm_reserve(CPOR_shm *shm, int ring){
+
+	struct shm_ring *r = NULL;
+	uint32_t tail = 0;
+	int ok = 0;
+
+	if(!shm || (ring < 0) || (ring > 1)) return NULL;
+	r = &shm->layout->rings[ring];
+
+	while(1){
+		tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		/* A consumer claiming to be ahead of us is broken */
+		if(shm->head[ring] - tail > shm->num_slots) return NULL;
+		if(shm->head[ring] - tail < shm->num_slots) return shm_slot(shm, ring, shm->head[ring]);
+
+		/* Full: say we're waiting, then look again in case a slot came free before the consumer could see that */
+		__atomic_store_n(&r->producer_waiting, 1, __ATOMIC_SEQ_CST);
+		tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+		ok = (shm->head[ring] - tail < shm->num_slots) || shm_wait(shm, shm->events[ring][1]);
+		__atomic_store_n(&r->producer_waiting, 0, __ATOMIC_SEQ_CST);
+		if(!ok) return NULL;
+	}
+}
+
+/* cpor_shm_publish: Hands the slot from cpor_shm_reserve to ring's consumer. */
+void cpor_shm_publish(CPOR_shm *shm, int ring){
+
+	struct shm_ring *r = NULL;
+
+	if(!shm || (ring < 0) || (ring > 1)) return;
+	r = &shm->layout->rings[ring];
+
+	__atomic_store_n(&r->head, ++shm->head[ring], __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&r->consumer_waiting, __ATOMIC_SEQ_CST)) shm_wake(shm->events[ring][0]);
+}
+
+/* cpor_shm_peek: Waits for the next slot of ring, which we consume from.  Returns the slot, a CPOR_msg_header
+* and its payload, to be handed back with cpor_shm_release once read, or NULL if the exchange is over.  The
+* other side can still write to the slot: check a copy of the header, not the header in place.
+*/
+unsigned char *cpor_shm_peek(CPOR_shm *shm, int ring){
+
+	struct shm_ring *r = NULL;
+	uint32_t head = 0;
+	int ok = 0;
+
+	if(!shm || (ring < 0) || (ring > 1)) return NULL;
+	r = &shm->layout->rings[ring];
+
+	while(1){
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if(head - shm->tail[ring] > shm->num_slots) return NULL;
+		if(head != shm->tail[ring]) return shm_slot(shm, ring, shm->tail[ring]);
+
+		__atomic_store_n(&r->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+		head = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+		ok = (head != shm->tail[ring]) || shm_wait(shm, shm->events[ring][0]);
+		__atomic_store_n(&r->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+		if(!ok) return NULL;
+	}
+}
+
+/* cpor_shm_release: Hands the slot from cpor_shm_peek back to ring's producer. */
+void cpor_shm_release(CPOR_shm *shm, int ring){
+
+	struct shm_ring *r = NULL;
+
+	if(!shm || (ring < 0) || (ring > 1)) return;
+	r = &shm->layout->rings[ring];
+
+	__atomic_store_n(&r->tail, ++shm->tail[ring], __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&r->producer_waiting, __ATOMIC_SEQ_CST)) shm_wake(shm->events[ring][1]);
+}
+
+/* cpor_shm_payload_size: The most payload a slot holds after its CPOR_msg_header */
+size_t cpor_shm_payload_size(CPOR_shm *shm){
+
+	return shm ? shm->slot_size - sizeof(CPOR_msg_header) : 0;
+}
+
+static CPOR_shm *allocate_shm(){
+
+	CPOR_shm *shm = NULL;
+
+	if( ((shm = malloc(sizeof(CPOR_shm))) == NULL)) return NULL;
+	memset(shm, 0, sizeof(CPOR_shm));
+	shm->fd = shm->memfd = -1;
+	shm->events[0][0] = shm->events[0][1] = shm->events[1][0] = shm->events[1][1] = -1;
+
+	return shm;
+}
+
+/* cpor_shm_destroy: Unmaps the exchange and closes its descriptors, but not the control connection. */
+void cpor_shm_destroy(CPOR_shm *shm){
+
+	int i = 0;
+
+	if(!shm) return;
+	if(shm->layout) munmap(shm->layout, shm->map_size);
+	if(shm->memfd >= 0) close(shm->memfd);
+	for(i = 0; i < 4; i++)
+		if(shm->events[i / 2][i % 2] >= 0) close(shm->events[i / 2][i % 2]);
+	sfree(shm, sizeof(CPOR_shm));
+}
+
+/* cpor_shm_create: The prover's side.  Makes an exchange of num_slots slots of slot_size bytes each way for the
+* client on the control connection fd, within limits: a slot must hold a message header and a proof, num_slots
+* must be a power of two, and the whole is at most CPOR_SHM_MAX_SIZE.  Send it to the client with cpor_shm_offer.  Returns the exchange, or NULL
+* on failure.
+*/
+CPOR_shm *cpor_shm_create(int fd, uint32_t slot_size, uint32_t num_slots){
+
+	CPOR_shm *shm = NULL;
+	void *map = MAP_FAILED;
+	int i = 0;
+
+	if((slot_size < sizeof(CPOR_msg_header)) || (slot_size > sizeof(CPOR_msg_header) + CPOR_MSG_MAX_PAYLOAD)) return NULL;
+	if(!num_slots || (num_slots & (num_slots - 1))) return NULL;
+	slot_size = (slot_size + CPOR_SHM_ALIGN - 1) & ~(CPOR_SHM_ALIGN - 1);
+	if(num_slots > (CPOR_SHM_MAX_SIZE - sizeof(struct shm_layout)) / (2 * (size_t)slot_size)) return NULL;
+
+	if( ((shm = allocate_shm()) == NULL)) return NULL;
+	shm->fd = fd;
+	shm->slot_size = slot_size;
+	shm->num_slots = num_slots;
+	shm->map_size = shm_map_size(slot_size, num_slots);
+
+	if( ((shm->memfd = memfd_create("cpor-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)) goto cleanup;
+	if(ftruncate(shm->memfd, shm->map_size) < 0) goto cleanup;
+	/* Or the client could shrink it under us and have our next touch of a slot fault */
+	if(fcntl(shm->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) goto cleanup;
+	for(i = 0; i < 4; i++)
+		if( ((shm->events[i / 2][i % 2] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)) goto cleanup;
+	if( ((map = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->memfd, 0)) == MAP_FAILED)) goto cleanup;
+	shm->layout = (struct shm_layout *)map;
+	shm->slots = (unsigned char *)map + sizeof(struct shm_layout);
+
+	/* The memfd starts out zeroed, so the rings are empty */
+	shm->layout->magic = CPOR_SHM_MAGIC;
+	shm->layout->version = CPOR_SHM_VERSION;
+	shm->layout->slot_size = slot_size;
+	shm->layout->num_slots = num_slots;
+
+	return shm;
+
+cleanup:
+	cpor_shm_destroy(shm);
+	return NULL;
+}
+
+/* cpor_shm_offer: Sends header, with no payload, on the control connection along with the exchange's
+* descriptors.  Returns 1 on success, 0 on failure.
+*/
+int cpor_shm_offer(CPOR_shm *shm, CPOR_msg_header *header){
+
+	union{
+		struct cmsghdr align;
+		unsigned char buf[CMSG_SPACE(CPOR_SHM_NUM_FDS * sizeof(int))];
+	} control;
+	int fds[CPOR_SHM_NUM_FDS];
+	struct msghdr msg;
+	struct cmsghdr *cmsg = NULL;
+	struct iovec iov;
+	unsigned char buf[CPOR_MSG_HEADER_SIZE];
+	ssize_t n = 0;
+
+	if(!shm || !header) return 0;
+
+	fds[0] = shm->memfd;
+	fds[1] = shm->events[CPOR_SHM_REQUESTS][0];
+	fds[2] = shm->events[CPOR_SHM_REQUESTS][1];
+	fds[3] = shm->events[CPOR_SHM_RESPONSES][0];
+	fds[4] = shm->events[CPOR_SHM_RESPONSES][1];
+
+	header->magic = CPOR_MSG_MAGIC;
+	header->length = 0;
+	cpor_put_msg_header(buf, header);
+	iov.iov_base = buf;
+	iov.iov_len = CPOR_MSG_HEADER_SIZE;
+	memset(&msg, 0, sizeof(struct msghdr));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(CPOR_SHM_NUM_FDS * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	/* The header is small enough to go in one piece, and the descriptors must go with its first byte */
+	do{
+		n = sendmsg(shm->fd, &msg, MSG_NOSIGNAL);
+	}while((n < 0) && (errno == EINTR));
+
+	return n == CPOR_MSG_HEADER_SIZE;
+}
+
+/* shm_accept: The client's side of cpor_shm_offer.  Receives the prover's answer to CPOR_MSG_SHM on fd and maps
+* the exchange it sends.  Returns the exchange, or NULL if the prover refused or on failure.
+*/
+static CPOR_shm *shm_accept(int fd){
+
+	union{
+		struct cmsghdr align;
+		unsigned char buf[CMSG_SPACE(CPOR_SHM_NUM_FDS * sizeof(int))];
+	} control;
+	int fds[CPOR_SHM_NUM_FDS];
+	CPOR_msg_header header;
+	CPOR_shm *shm = NULL;
+	struct msghdr msg;
+	struct cmsghdr *cmsg = NULL;
+	struct iovec iov;
+	unsigned char buf[CPOR_MSG_HEADER_SIZE];
+	struct stat st;
+	void *map = MAP_FAILED;
+	ssize_t n = 0;
+	int numfds = 0, i = 0;
+
+	iov.iov_base = buf;
+	iov.iov_len = CPOR_MSG_HEADER_SIZE;
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	do{
+		n = recvmsg(fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	}while((n < 0) && (errno == EINTR));
+	if(n < 0) return NULL;
+
+	for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+		if((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) continue;
+		numfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if(numfds > CPOR_SHM_NUM_FDS) numfds = CPOR_SHM_NUM_FDS;
+		memcpy(fds, CMSG_DATA(cmsg), numfds * sizeof(int));
+		break;
+	}
+
+	if((n != CPOR_MSG_HEADER_SIZE) || (msg.msg_flags & MSG_CTRUNC) || (numfds != CPOR_SHM_NUM_FDS)) goto cleanup;
+	cpor_get_msg_header(buf, &header);
+	if((header.magic != CPOR_MSG_MAGIC) || (header.op != CPOR_MSG_SHM) || (header.status != 1) || header.length) goto cleanup;
+
+	if( ((shm = allocate_shm()) == NULL)) goto cleanup;
+	shm->fd = fd;
+	shm->memfd = fds[0];
+	shm->events[CPOR_SHM_REQUESTS][0] = fds[1];
+	shm->events[CPOR_SHM_REQUESTS][1] = fds[2];
+	shm->events[CPOR_SHM_RESPONSES][0] = fds[3];
+	shm->events[CPOR_SHM_RESPONSES][1] = fds[4];
+	numfds = 0;
+
+	if((fstat(shm->memfd, &st) < 0) || (st.st_size < (off_t)sizeof(struct shm_layout))) goto cleanup;
+	shm->map_size = st.st_size;
+	if( ((map = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->memfd, 0)) == MAP_FAILED)) goto cleanup;
+	shm->layout = (struct shm_layout *)map;
+	shm->slots = (unsigned char *)map + sizeof(struct shm_layout);
+	shm->slot_size = shm->layout->slot_size;
+	shm->num_slots = shm->layout->num_slots;
+	if((shm->layout->magic != CPOR_SHM_MAGIC) || (shm->layout->version != CPOR_SHM_VERSION)) goto cleanup;
+	if((shm->slot_size < sizeof(CPOR_msg_header)) || (shm->slot_size % CPOR_SHM_ALIGN) || !shm->num_slots ||
+		(shm->num_slots & (shm->num_slots - 1)) ||
+		(shm->num_slots > CPOR_SHM_MAX_SIZE / shm->slot_size) || (shm_map_size(shm->slot_size, shm->num_slots) != shm->map_size)) goto cleanup;
+
+	return shm;
+
+cleanup:
+	for(i = 0; i < numfds; i++) close(fds[i]);
+	cpor_shm_destroy(shm);
+	return NULL;
+}
+
+/* cpor_msg_attach_shm: Switches the client connection conn, to a prover daemon over a Unix socket, to exchanging
+* messages through shared memory: num_slots (a power of two) slots each way of slot_size bytes, each to hold a
+* message header and its payload, a challenge one way and a proof the other.  It must be done before anything
+* else is sent.  From then on cpor_msg_conn_send and cpor_msg_conn_recv on conn go through the exchange, with
+* proofs coming back in the wire format (see cpor_encode_proof), which cpor_prover_recv_proof expects of such a
+* connection; close it with cpor_msg_close.  One thread may send and another receive at once, as over the socket.
+* Returns 1 on success, 0 on failure, after which conn still speaks over the socket if the prover refused.
+*/
+int cpor_msg_attach_shm(CPOR_msg_conn *conn, uint32_t slot_size, uint32_t num_slots){
+
+	CPOR_msg_header header;
+	unsigned char payload[2 * sizeof(uint32_t)];
+
+	if(!conn || (conn->fd < 0) || conn->shm) return 0;
+
+	cpor_put_be32(payload, slot_size);
+	cpor_put_be32(payload + sizeof(uint32_t), num_slots);
+	memset(&header, 0, sizeof(CPOR_msg_header));
+	header.op = CPOR_MSG_SHM;
+	header.length = sizeof(payload);
+	if(!cpor_msg_send(conn->fd, &header, payload)) return 0;
+	if( ((conn->shm = shm_accept(conn->fd)) == NULL)) return 0;
+
+	return 1;
+}
+
+/* cpor_shm_send_msg: The client's cpor_msg_send through the exchange.  Returns 1 on success, 0 on failure. */
+int cpor_shm_send_msg(CPOR_shm *shm, CPOR_msg_header *header, unsigned char *payload){
+
+	unsigned char *slot = NULL;
+
+	if(!shm || !header || (header->length && !payload) || (header->length > cpor_shm_payload_size(shm))) return 0;
+	if( ((slot = cpor_shm_reserve(shm, CPOR_SHM_REQUESTS)) == NULL)) return 0;
+
+	header->magic = CPOR_MSG_MAGIC;
+	memcpy(slot, header, sizeof(CPOR_msg_header));
+	if(header->length) memcpy(slot + sizeof(CPOR_msg_header), payload, header->length);
+	cpor_shm_publish(shm, CPOR_SHM_REQUESTS);
+
+	return 1;
+}
+
+/* cpor_shm_recv_msg: The client's cpor_msg_recv through the exchange.  Returns 1 on success, 0 on failure. */
+int cpor_shm_recv_msg(CPOR_shm *shm, CPOR_msg_header *header, unsigned char **payload){
+
+	unsigned char *slot = NULL;
+	int ret = 0;
+
+	if(!shm || !header || !payload) return 0;
+	*payload = NULL;
+	if( ((slot = cpor_shm_peek(shm, CPOR_SHM_RESPONSES)) == NULL)) return 0;
+
+	memcpy(header, slot, sizeof(CPOR_msg_header));
+	if((header->magic != CPOR_MSG_MAGIC) || (header->length > cpor_shm_payload_size(shm))) goto cleanup;
+	if(header->length){
+		if( ((*payload = malloc(header->length + 1)) == NULL)) goto cleanup;
+		memcpy(*payload, slot + sizeof(CPOR_msg_header), header->length);
+		(*payload)[header->length] = '\0';
+	}
+	ret = 1;
+
+cleanup:
+	cpor_shm_release(shm, CPOR_SHM_RESPONSES);
+
+	return ret;
+}
+
+#else
+
+/* Without memfds, every connection speaks over its socket */
+
+unsigned char *cpor_shm_reserve(CPOR_shm *shm, int ring){ return NULL; }
+
+void cpor_shm_publish(CPOR_shm *shm, int ring){ }
+
+unsigned char *cpor_shm_peek(CPOR_shm *shm, int ring){ return NULL; }
+
+void cpor_shm_release(CPOR_shm *shm, int ring){ }
+
+size_t cpor_shm_payload_size(CPOR_shm *shm){ return 0; }
+
+void cpor_shm_destroy(CPOR_shm *shm){ }
+
+CPOR_shm *cpor_shm_create(int fd, uint32_t slot_size, uint32_t num_slots){ return NULL; }
+
+int cpor_shm_offer(CPOR_shm *shm, CPOR_msg_header *header){ return 0; }
+
+int cpor_msg_attach_shm(CPOR_msg_conn *conn, uint32_t slot_size, uint32_t num_slots){ return 0; }
+
+int cpor_shm_send_msg(CPOR_shm *shm, CPOR_msg_header *header, unsigned char *payload){ return 0; }
+
+int cpor_shm_recv_msg(CPOR_shm *shm, CPOR_msg_header *header, unsigned char **payload){ return 0; }
+
+#endif
@@ -0,0 +1,913 @@
+/*
+* cpor-verifier.c
+*
+*/
+
+#include "cpor.h"
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef THREADING
+#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#endif
+
+/* Most client connections a verifier daemon serves at once */
+#define CPOR_VERIFIER_MAX_CONNECTIONS 1024
+
+/* Most pipelined requests a worker serves from one connection before giving the others a turn */
+#define CPOR_VERIFIER_BATCH 32
+
+/* A worker gives up on a connection that stalls this many seconds in the middle of a request, or that stops
+ * reading its responses */
+#define CPOR_VERIFIER_RECV_TIMEOUT 5
+
+/* Seconds between sweeps of the secrets cache for entries past their ttl */
+#define CPOR_VERIFIER_SWEEP_INTERVAL 10
+
+/* Written to the wake pipe to stop the poll thread; it is neither a descriptor nor the complement of one */
+#define CPOR_VERIFIER_STOP INT_MIN
+
+/* send_full: Sends all of the iovcnt buffers in iov, retrying short writes.  iov is consumed.  Returns 1 on
+* success, 0 on failure.
+*/
+static int send_full(int fd, struct iovec *iov, int iovcnt){
+
+	struct msghdr msg;
+	ssize_t sent = 0;
+
+	while(iovcnt > 0){
+		memset(&msg, 0, sizeof(struct msghdr));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if(sent < 0){
+			if(errno == EINTR) continue;
+			return 0;
+		}
+		while(iovcnt && ((size_t)sent >= iov->iov_len)){
+			sent -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt){
+			iov->iov_base = (unsigned char *)iov->iov_base + sent;
+			iov->iov_len -= sent;
+		}
+	}
+
+	return 1;
+}
+
+/* recv_full: Receives exactly len bytes into buf.  Returns 1 on success, 0 on failure or end of stream. */
+static int recv_full(int fd, void *buf, size_t len){
+
+	size_t got = 0;
+	ssize_t n = 0;
+
+	while(got < len){
+		n = recv(fd, (unsigned char *)buf + got, len - got, 0);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return 0;
+		got += n;
+	}
+
+	return 1;
+}
+
+/* cpor_msg_send: Sends header and its header->length bytes of payload as one message on the socket fd.  Returns 1
+* on success, 0 on failure.
+*/
+int cpor_msg_send(int fd, CPOR_msg_header *header, unsigned char *payload){
+
+	struct iovec iov[2];
+	unsigned char buf[CPOR_MSG_HEADER_SIZE];
+
+	if(!header || (header->length && !payload) || (header->length > CPOR_MSG_MAX_PAYLOAD)) return 0;
+
+	header->magic = CPOR_MSG_MAGIC;
+	cpor_put_msg_header(buf, header);
+	iov[0].iov_base = buf;
+	iov[0].iov_len = CPOR_MSG_HEADER_SIZE;
+	iov[1].iov_base = payload;
+	iov[1].iov_len = header->length;
+
+	return send_full(fd, iov, 2);
+}
+
+/* cpor_msg_recv: Receives a message from the socket fd.  The payload is returned in *payload, NUL terminated for convenience, for
+* the caller to free (it is NULL for an empty payload).  Returns 1 on success, 0 on failure, end of stream or a
+* message that isn't ours.
+*/
+int cpor_msg_recv(int fd, CPOR_msg_header *header, unsigned char **payload){
+
+	unsigned char buf[CPOR_MSG_HEADER_SIZE];
+
+	if(!header || !payload) return 0;
+	*payload = NULL;
+
+	if(!recv_full(fd, buf, CPOR_MSG_HEADER_SIZE)) return 0;
+	cpor_get_msg_header(buf, header);
+	if((header->magic != CPOR_MSG_MAGIC) || (header->length > CPOR_MSG_MAX_PAYLOAD)) return 0;
+	if(!header->length) return 1;
+
+	if( ((*payload = malloc(header->length + 1)) == NULL)) return 0;
+	if(!recv_full(fd, *payload, header->length)){
+		free(*payload);
+		*payload = NULL;
+		return 0;
+	}
+	(*payload)[header->length] = '\0';
+
+	return 1;
+}
+
+/* cpor_msg_conn_send: cpor_msg_send on a client connection, through its shared-memory exchange if it has one */
+int cpor_msg_conn_send(CPOR_msg_conn *conn, CPOR_msg_header *header, unsigned char *payload){
+
+	if(!conn) return 0;
+	if(conn->shm) return cpor_shm_send_msg(conn->shm, header, payload);
+
+	return cpor_msg_send(conn->fd, header, payload);
+}
+
+/* cpor_msg_conn_recv: cpor_msg_recv on a client connection, through its shared-memory exchange if it has one */
+int cpor_msg_conn_recv(CPOR_msg_conn *conn, CPOR_msg_header *header, unsigned char **payload){
+
+	if(!conn) return 0;
+	if(conn->shm) return cpor_shm_recv_msg(conn->shm, header, payload);
+
+	return cpor_msg_recv(conn->fd, header, payload);
+}
+
+/* cpor_put_msg_header: Serializes header into the CPOR_MSG_HEADER_SIZE bytes at buf: magic, op, id, status and
+* length, big-endian
+*/
+void cpor_put_msg_header(unsigned char *buf, CPOR_msg_header *header){
+
+	cpor_put_be32(buf, header->magic);
+	cpor_put_be32(buf + 4, header->op);
+	cpor_put_be64(buf + 8, header->id);
+	cpor_put_be32(buf + 16, (uint32_t)header->status);
+	cpor_put_be32(buf + 20, header->length);
+}
+
+/* cpor_get_msg_header: The inverse of cpor_put_msg_header */
+void cpor_get_msg_header(unsigned char *buf, CPOR_msg_header *header){
+
+	header->magic = cpor_get_be32(buf);
+	header->op = cpor_get_be32(buf + 4);
+	header->id = cpor_get_be64(buf + 8);
+	header->status = (int32_t)cpor_get_be32(buf + 16);
+	header->length = cpor_get_be32(buf + 20);
+}
+
+/* cpor_put_challenge_seed: Serializes seed into the CPOR_MSG_SEED_SIZE bytes at buf: the seed, then l, run and n,
+* big-endian
+*/
+void cpor_put_challenge_seed(unsigned char *buf, CPOR_challenge_seed *seed){
+
+	memcpy(buf, seed->seed, CPOR_CHALLENGE_SEED_SIZE);
+	cpor_put_be32(buf + CPOR_CHALLENGE_SEED_SIZE, seed->l);
+	cpor_put_be32(buf + CPOR_CHALLENGE_SEED_SIZE + 4, seed->run);
+	cpor_put_be64(buf + CPOR_CHALLENGE_SEED_SIZE + 8, seed->n);
+}
+
+/* cpor_get_challenge_seed: The inverse of cpor_put_challenge_seed */
+void cpor_get_challenge_seed(unsigned char *buf, CPOR_challenge_seed *seed){
+
+	memcpy(seed->seed, buf, CPOR_CHALLENGE_SEED_SIZE);
+	seed->l = cpor_get_be32(buf + CPOR_CHALLENGE_SEED_SIZE);
+	seed->run = cpor_get_be32(buf + CPOR_CHALLENGE_SEED_SIZE + 4);
+	seed->n = cpor_get_be64(buf + CPOR_CHALLENGE_SEED_SIZE + 8);
+}
+
+/* is_tcp_address: Whether address is a TCP host:port (the host may be empty) rather than a Unix socket path */
+static int is_tcp_address(char *address){
+
+	return strchr(address, ':') && !strchr(address, '/');
+}
+
+/* resolve_tcp_address: Looks up the host:port address.  Returns the addresses to try, for freeaddrinfo, or
+* NULL on failure.
+*/
+static struct addrinfo *resolve_tcp_address(char *address, int passive){
+
+	struct addrinfo hints, *res = NULL;
+	char host[NI_MAXHOST];
+	char *colon = strrchr(address, ':');
+
+	if(!colon || ((size_t)(colon - address) >= sizeof(host))) return NULL;
+	memcpy(host, address, colon - address);
+	host[colon - address] = '\0';
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if(passive) hints.ai_flags = AI_PASSIVE;
+	if(getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &res) != 0) return NULL;
+
+	return res;
+}
+
+/* cpor_msg_listen: Listens at address, a Unix socket path or a TCP host:port, replacing any stale socket at the
+* path.  Returns the listening socket, non-blocking, or -1 on failure.
+*/
+int cpor_msg_listen(char *address){
+
+	struct sockaddr_un addr;
+	struct addrinfo *res = NULL, *ai = NULL;
+	int fd = -1, on = 1;
+
+	if(!address) return -1;
+
+	if(is_tcp_address(address)){
+		if( ((res = resolve_tcp_address(address, 1)) == NULL)) return -1;
+		for(ai = res; ai; ai = ai->ai_next){
+			if( ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, ai->ai_protocol)) < 0)) continue;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int));
+			if((bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) && (listen(fd, SOMAXCONN) == 0)) break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+	}else{
+		if(strlen(address) >= sizeof(addr.sun_path)) return -1;
+		memset(&addr, 0, sizeof(struct sockaddr_un));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, address);
+		unlink(address);
+		if( ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0)) return -1;
+		if((bind(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) < 0) || (listen(fd, SOMAXCONN) < 0)){
+			close(fd);
+			fd = -1;
+		}
+	}
+	if(fd < 0) fprintf(stderr, "ERROR: Was not able to listen at %s.\n", address);
+
+	return fd;
+}
+
+/* connect_address: Connects to address, a Unix socket path or a TCP host:port.  Returns the socket, or -1 on
+* failure.
+*/
+static int connect_address(char *address){
+
+	struct sockaddr_un addr;
+	struct addrinfo *res = NULL, *ai = NULL;
+	int fd = -1, on = 1;
+
+	if(is_tcp_address(address)){
+		if( ((res = resolve_tcp_address(address, 0)) == NULL)) return -1;
+		for(ai = res; ai; ai = ai->ai_next){
+			if( ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) < 0)) continue;
+			if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+		/* Requests are small and pipelined; don't hold them back waiting for acks */
+		if(fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(int));
+
+		return fd;
+	}
+
+	if(strlen(address) >= sizeof(addr.sun_path)) return -1;
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, address);
+
+	if( ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)) return -1;
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) < 0){
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* cpor_msg_connect: Connects to address, a Unix socket path or a TCP host:port.  A Unix socket path prefixed
+* with "shm:" gets a connection exchanging messages with a prover daemon through shared memory (see
+* cpor_msg_attach_shm), used just as a socket would be.  Close the connection with cpor_msg_close.  Returns the
+* connection, or NULL on failure.
+*/
+CPOR_msg_conn *cpor_msg_connect(char *address){
+
+	CPOR_msg_conn *conn = NULL;
+	int shm = 0;
+
+	if(!address) return NULL;
+	if(!strncmp(address, "shm:", 4)){
+		address += 4;
+		if(is_tcp_address(address)) return NULL;
+		shm = 1;
+	}
+
+	if( ((conn = malloc(sizeof(CPOR_msg_conn))) == NULL)) return NULL;
+	memset(conn, 0, sizeof(CPOR_msg_conn));
+	if( ((conn->fd = connect_address(address)) < 0)) goto cleanup;
+	if(shm && !cpor_msg_attach_shm(conn, CPOR_SHM_SLOT_SIZE, CPOR_SHM_SLOTS)) goto cleanup;
+
+	return conn;
+
+cleanup:
+	cpor_msg_close(conn);
+	return NULL;
+}
+
+/* cpor_msg_close: Closes a client connection, and its shared-memory exchange if it has one. */
+void cpor_msg_close(CPOR_msg_conn *conn){
+
+	if(!conn) return;
+	cpor_shm_destroy(conn->shm);
+	if(conn->fd >= 0) close(conn->fd);
+	sfree(conn, sizeof(CPOR_msg_conn));
+}
+
+/* cpor_verifier_connect: Connects to the verifier daemon listening at socketpath (or a TCP host:port).  Returns
+* the connection, or NULL on failure.
+*/
+CPOR_msg_conn *cpor_verifier_connect(char *socketpath){
+
+	return cpor_msg_connect(socketpath);
+}
+
+/* cpor_verifier_send_challenge: Asks the verifier on conn for a challenge of l blocks (in runs of run) over the
+* file whose t is at tfilepath; an l of 0 takes the daemon's defaults.  Requests may be pipelined: the responses
+* come back in the order the requests were sent, and must be read while sending more, as the daemon drops a
+* connection it can't write to.  Returns 1 on success, 0 on failure.
+*/
+int cpor_verifier_send_challenge(CPOR_msg_conn *conn, char *tfilepath, unsigned int l, unsigned int run){
+
+	CPOR_msg_header header;
+	unsigned char *payload = NULL;
+	size_t path_len = 0;
+	int ret = 0;
+
+	if(!tfilepath) return 0;
+	path_len = strlen(tfilepath);
+	if(path_len + 8 > CPOR_MSG_MAX_PAYLOAD) return 0;
+
+	if( ((payload = malloc(path_len + 8)) == NULL)) return 0;
+	cpor_put_be32(payload, l);
+	cpor_put_be32(payload + 4, run);
+	memcpy(payload + 8, tfilepath, path_len);
+
+	memset(&header, 0, sizeof(CPOR_msg_header));
+	header.op = CPOR_MSG_CHALLENGE;
+	header.length = path_len + 8;
+	ret = cpor_msg_conn_send(conn, &header, payload);
+
+	free(payload);
+
+	return ret;
+}
+
+/* cpor_verifier_recv_challenge: Receives the response to a challenge request.  Sets *audit to the id the proof
+* must be sent back under and global->Zp to the field the challenge is over.  Returns the challenge seed, for the
+* prover to expand with cpor_expand_challenge, or NULL on failure.
+*/
+CPOR_challenge_seed *cpor_verifier_recv_challenge(CPOR_msg_conn *conn, uint64_t *audit, CPOR_global *global){
+
+	CPOR_msg_header header;
+	CPOR_challenge_seed *seed = NULL;
+	unsigned char *payload = NULL;
+
+	if(!audit || !global || !global->Zp) return NULL;
+
+	if(!cpor_msg_conn_recv(conn, &header, &payload)) return NULL;
+	if((header.op != CPOR_MSG_CHALLENGE) || (header.status != 1) || (header.length <= CPOR_MSG_SEED_SIZE)) goto cleanup;
+
+	if( ((seed = allocate_cpor_challenge_seed()) == NULL)) goto cleanup;
+	cpor_get_challenge_seed(payload, seed);
+	if(!BN_bin2bn(payload + CPOR_MSG_SEED_SIZE, header.length - CPOR_MSG_SEED_SIZE, global->Zp)) goto cleanup;
+	*audit = header.id;
+
+	free(payload);
+
+	return seed;
+
+cleanup:
+	if(seed) destroy_cpor_challenge_seed(seed);
+	if(payload) free(payload);
+	return NULL;
+}
+
+/* cpor_verifier_send_proof: Sends proof, for the challenge over global->Zp issued as audit, to be verified.
+* Returns 1 on success, 0 on failure.
+*/
+int cpor_verifier_send_proof(CPOR_params *myparams, CPOR_msg_conn *conn, uint64_t audit, CPOR_global *global, CPOR_proof *proof){
+
+	CPOR_msg_header header;
+	unsigned char *payload = NULL;
+	size_t element_size = 0;
+	size_t proof_size = 0;
+	int ret = 0;
+
+	if(!global || !global->Zp || !proof) return 0;
+	element_size = BN_num_bytes(global->Zp);
+	proof_size = cpor_proof_size(myparams, element_size);
+	if(proof_size > CPOR_MSG_MAX_PAYLOAD) return 0;
+
+	if( ((payload = malloc(proof_size)) == NULL)) return 0;
+	if(!cpor_proof_to_bytes(myparams, proof, element_size, payload, proof_size)) goto cleanup;
+
+	memset(&header, 0, sizeof(CPOR_msg_header));
+	header.op = CPOR_MSG_VERIFY;
+	header.id = audit;
+	header.length = proof_size;
+	ret = cpor_msg_conn_send(conn, &header, payload);
+
+cleanup:
+	free(payload);
+
+	return ret;
+}
+
+/* cpor_verifier_recv_result: Receives the response to a proof, setting *audit (if not NULL) to the audit it was
+* for.  Returns 1 if the proof verified, 0 if it didn't and -1 on error, including an unknown or expired audit.
+*/
+int cpor_verifier_recv_result(CPOR_msg_conn *conn, uint64_t *audit){
+
+	CPOR_msg_header header;
+	unsigned char *payload = NULL;
+
+	if(!cpor_msg_conn_recv(conn, &header, &payload)) return -1;
+	if(payload) free(payload);
+	if(header.op != CPOR_MSG_VERIFY) return -1;
+	if(audit) *audit = header.id;
+
+	return (header.status == 1 || header.status == 0) ? header.status : -1;
+}
+
+#ifdef THREADING
+
+/* An issued challenge awaiting its proof */
+struct verifier_audit{
+	CPOR_prepared *prepared;	/* NULL if the slot is free */
+	uint32_t generation;		/* Bumped each time the slot is reused, so a stale audit id misses */
+	time_t expires;				/* 0 for never */
+	unsigned int next_free;
+};
+
+struct CPOR_verifier_struct{
+	CPOR_params myparams;
+	CPOR_secrets_cache *secrets_cache;	/* Ours to destroy, if myparams didn't come with a cache */
+	char socketpath[MAXPATHLEN];
+	int listenfd;
+	int wakefd[2];					/* Workers hand connections back to the poll thread through this pipe */
+	int stop;
+
+	/* In-flight audits.  An audit id is the slot's generation in the high 32 bits and its index in the low. */
+	struct verifier_audit *audits;
+	unsigned int max_audits;
+	unsigned int audit_ttl;			/* 0 for no limit */
+	unsigned int free_audit;		/* Head of the free list; max_audits if it is empty */
+	pthread_mutex_t audits_lock;
+
+	/* Connections with a request waiting, for the workers */
+	int *ready;
+	unsigned int ready_head;
+	unsigned int ready_count;
+	pthread_mutex_t ready_lock;
+	pthread_cond_t ready_cond;
+
+	pthread_t poller;
+	pthread_t *workers;
+	unsigned int num_workers;
+};
+
+/* verifier_reap_audits: Frees the slots of expired audits.  Called with the audits lock held. */
+static void verifier_reap_audits(CPOR_verifier *verifier){
+
+	time_t now = time(NULL);
+	unsigned int i = 0;
+
+	for(i = 0; i < verifier->max_audits; i++){
+		if(!verifier->audits[i].prepared || !verifier->audits[i].expires || (verifier->audits[i].expires > now)) continue;
+		destroy_cpor_prepared(&verifier->myparams, verifier->audits[i].prepared);
+		verifier->audits[i].prepared = NULL;
+		verifier->audits[i].next_free = verifier->free_audit;
+		verifier->free_audit = i;
+	}
+}
+
+/* verifier_add_audit: Files prepared under a new audit id.  Returns the id, or 0 if there are already
+* max_audits audits in flight.
+*/
+static uint64_t verifier_add_audit(CPOR_verifier *verifier, CPOR_prepared *prepared){
+
+	struct verifier_audit *audit = NULL;
+	unsigned int slot = 0;
+	uint64_t id = 0;
+
+	pthread_mutex_lock(&verifier->audits_lock);
+	if(verifier->free_audit == verifier->max_audits) verifier_reap_audits(verifier);
+	if(verifier->free_audit == verifier->max_audits) goto cleanup;
+
+	slot = verifier->free_audit;
+	audit = &verifier->audits[slot];
+	verifier->free_audit = audit->next_free;
+
+	if(++audit->generation == 0) audit->generation = 1;
+	audit->prepared = prepared;
+	audit->expires = (verifier->audit_ttl) ? time(NULL) + verifier->audit_ttl : 0;
+	id = ((uint64_t)audit->generation << 32) | slot;
+
+cleanup:
+	pthread_mutex_unlock(&verifier->audits_lock);
+
+	return id;
+}
+
+/* verifier_take_audit: Removes the audit id from the in-flight table, so each challenge is answered once.
+* Returns its prepared verification, or NULL if there is no such audit or it has expired.
+*/
+static CPOR_prepared *verifier_take_audit(CPOR_verifier *verifier, uint64_t id){
+
+	struct verifier_audit *audit = NULL;
+	CPOR_prepared *prepared = NULL;
+	unsigned int slot = (unsigned int)(id & 0xffffffff);
+
+	if(slot >= verifier->max_audits) return NULL;
+
+	pthread_mutex_lock(&verifier->audits_lock);
+	audit = &verifier->audits[slot];
+	if(!audit->prepared || (audit->generation != (uint32_t)(id >> 32))) goto cleanup;
+
+	if(!audit->expires || (audit->expires > time(NULL)))
+		prepared = audit->prepared;
+	else
+		destroy_cpor_prepared(&verifier->myparams, audit->prepared);
+	audit->prepared = NULL;
+	audit->next_free = verifier->free_audit;
+	verifier->free_audit = slot;
+
+cleanup:
+	pthread_mutex_unlock(&verifier->audits_lock);
+
+	return prepared;
+}
+
+/* verifier_challenge: Serves a CPOR_MSG_CHALLENGE request, filling in response and its payload.  An l or run over
+* CPOR_MAX_CHALLENGE is refused, as the prover refuses it.
+*/
+static void verifier_challenge(CPOR_verifier *verifier, CPOR_msg_header *request, unsigned char *payload,
+                               CPOR_msg_header *response, unsigned char **response_payload){
+
+	CPOR_params myparams = verifier->myparams;
+	CPOR_prepared *prepared = NULL;
+	CPOR_challenge_seed *seed = NULL;
+	unsigned char *out = NULL;
+	uint32_t l = 0, run = 0;
+	size_t Zp_size = 0;
+	char *tfilepath = NULL;
+
+	if(request->length <= 8) return;
+	l = cpor_get_be32(payload);
+	run = cpor_get_be32(payload + 4);
+	tfilepath = (char *)payload + 8;
+	if((strlen(tfilepath) != request->length - 8) || (strlen(tfilepath) >= MAXPATHLEN)) return;
+	if((l > CPOR_MAX_CHALLENGE) || (run > CPOR_MAX_CHALLENGE)) return;
+	if(l){
+		myparams.num_challenge = l;
+		myparams.challenge_run = run;
+	}
+
+	if( ((prepared = cpor_prepare_challenge_file(&myparams, tfilepath, &seed)) == NULL)) goto cleanup;
+	Zp_size = BN_num_bytes(prepared->global->Zp);
+	if( ((out = malloc(CPOR_MSG_SEED_SIZE + Zp_size)) == NULL)) goto cleanup;
+	cpor_put_challenge_seed(out, seed);
+	if(BN_bn2binpad(prepared->global->Zp, out + CPOR_MSG_SEED_SIZE, Zp_size) < 0) goto cleanup;
+
+	if( ((response->id = verifier_add_audit(verifier, prepared)) == 0)) goto cleanup;
+	prepared = NULL;
+	response->status = 1;
+	response->length = CPOR_MSG_SEED_SIZE + Zp_size;
+	*response_payload = out;
+	out = NULL;
+
+cleanup:
+	if(prepared) destroy_cpor_prepared(&myparams, prepared);
+	if(seed) destroy_cpor_challenge_seed(seed);
+	if(out) free(out);
+}
+
+/* verifier_verify: Serves a CPOR_MSG_VERIFY request, filling in response. */
+static void verifier_verify(CPOR_verifier *verifier, CPOR_msg_header *request, unsigned char *payload,
+                            CPOR_msg_header *response){
+
+	CPOR_prepared *prepared = NULL;
+	CPOR_proof *proof = NULL;
+
+	if( ((prepared = verifier_take_audit(verifier, request->id)) == NULL)) return;
+
+	proof = cpor_proof_from_bytes(&verifier->myparams, BN_num_bytes(prepared->global->Zp), payload, request->length);
+	if(proof) response->status = cpor_verify_finish(&verifier->myparams, prepared, proof);
+
+	if(proof) destroy_cpor_proof(&verifier->myparams, proof);
+	destroy_cpor_prepared(&verifier->myparams, prepared);
+}
+
+/* verifier_serve: Reads one request from fd and answers it.  Returns 1 on success, 0 if the connection should
+* be closed.
+*/
+static int verifier_serve(CPOR_verifier *verifier, int fd){
+
+	CPOR_msg_header request, response;
+	unsigned char *payload = NULL;
+	unsigned char *response_payload = NULL;
+	int ret = 0;
+
+	if(!cpor_msg_recv(fd, &request, &payload)) return 0;
+
+	memset(&response, 0, sizeof(CPOR_msg_header));
+	response.op = request.op;
+	response.id = request.id;
+	response.status = -1;
+
+	switch(request.op){
+		case CPOR_MSG_CHALLENGE:
+			verifier_challenge(verifier, &request, payload, &response, &response_payload);
+			break;
+		case CPOR_MSG_VERIFY:
+			verifier_verify(verifier, &request, payload, &response);
+			break;
+		default:
+			break;
+	}
+
+	ret = cpor_msg_send(fd, &response, response_payload);
+
+	if(payload) free(payload);
+	if(response_payload) free(response_payload);
+
+	return ret;
+}
+
+/* verifier_worker_thread: Serves connections handed over by the poll thread.  Requests already waiting on a
+* connection are served back to back before it is handed back, so pipelined requests don't each pay a trip
+* through poll.
+*/
+static void *verifier_worker_thread(void *arg){
+
+	CPOR_verifier *verifier = (CPOR_verifier *)arg;
+	struct pollfd pfd;
+	unsigned int served = 0;
+	int fd = -1, message = 0, ok = 0;
+
+	while(1){
+		pthread_mutex_lock(&verifier->ready_lock);
+		while(!verifier->ready_count && !verifier->stop)
+			pthread_cond_wait(&verifier->ready_cond, &verifier->ready_lock);
+		if(verifier->stop){
+			pthread_mutex_unlock(&verifier->ready_lock);
+			break;
+		}
+		fd = verifier->ready[verifier->ready_head];
+		verifier->ready_head = (verifier->ready_head + 1) % CPOR_VERIFIER_MAX_CONNECTIONS;
+		verifier->ready_count--;
+		pthread_mutex_unlock(&verifier->ready_lock);
+
+		for(served = 0; served < CPOR_VERIFIER_BATCH; served++){
+			if( ((ok = verifier_serve(verifier, fd)) == 0)) break;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if((poll(&pfd, 1, 0) <= 0) || !(pfd.revents & POLLIN)) break;
+		}
+
+		/* Hand the connection back: its descriptor to watch it again, its complement to close it */
+		message = ok ? fd : ~fd;
+		while((write(verifier->wakefd[1], &message, sizeof(int)) < 0) && (errno == EINTR));
+	}
+
+	return NULL;
+}
+
+/* verifier_poll_thread: Accepts connections and watches them, queueing each that has a request waiting for the
+* workers.  A queued connection isn't watched again until its worker hands it back.  Every
+* CPOR_VERIFIER_SWEEP_INTERVAL seconds it also sweeps expired keys and t's out of the secrets cache.
+*/
+static void *verifier_poll_thread(void *arg){
+
+	CPOR_verifier *verifier = (CPOR_verifier *)arg;
+	struct pollfd *fds = NULL;
+	struct timeval timeout;
+	int messages[64];
+	ssize_t got = 0;
+	nfds_t nfds = 2, i = 0;
+	int fd = -1, m = 0, on = 1;
+	time_t swept = time(NULL);
+
+	if( ((fds = malloc(sizeof(struct pollfd) * (2 + CPOR_VERIFIER_MAX_CONNECTIONS))) == NULL)) return NULL;
+	fds[0].fd = verifier->listenfd;
+	fds[0].events = POLLIN;
+	fds[1].fd = verifier->wakefd[0];
+	fds[1].events = POLLIN;
+
+	timeout.tv_sec = CPOR_VERIFIER_RECV_TIMEOUT;
+	timeout.tv_usec = 0;
+
+	while(!verifier->stop){
+		if(poll(fds, nfds, CPOR_VERIFIER_SWEEP_INTERVAL * 1000) < 0){
+			if(errno == EINTR) continue;
+			break;
+		}
+		if(verifier->stop) break;
+
+		if(time(NULL) - swept >= CPOR_VERIFIER_SWEEP_INTERVAL){
+			cpor_secrets_cache_sweep(verifier->myparams.secrets_cache);
+			swept = time(NULL);
+		}
+
+		/* Queue the connections with requests waiting; a disarmed connection's descriptor is complemented */
+		for(i = 2; i < nfds; i++){
+			if((fds[i].fd < 0) || !fds[i].revents) continue;
+			pthread_mutex_lock(&verifier->ready_lock);
+			verifier->ready[(verifier->ready_head + verifier->ready_count) % CPOR_VERIFIER_MAX_CONNECTIONS] = fds[i].fd;
+			verifier->ready_count++;
+			pthread_cond_signal(&verifier->ready_cond);
+			pthread_mutex_unlock(&verifier->ready_lock);
+			fds[i].fd = ~fds[i].fd;
+			fds[i].revents = 0;
+		}
+
+		/* Take back the connections the workers are done with */
+		if(fds[1].revents){
+			while( ((got = read(verifier->wakefd[0], messages, sizeof(messages))) > 0)){
+				for(m = 0; m < got / (ssize_t)sizeof(int); m++){
+					if(messages[m] == CPOR_VERIFIER_STOP) continue;
+					fd = (messages[m] < 0) ? ~messages[m] : messages[m];
+					for(i = 2; i < nfds; i++) if(fds[i].fd == ~fd) break;
+					if(i == nfds) continue;
+					if(messages[m] >= 0){
+						fds[i].fd = fd;
+					}else{
+						close(fd);
+						fds[i] = fds[--nfds];
+					}
+				}
+			}
+		}
+
+		if(fds[0].revents){
+			while( ((fd = accept(verifier->listenfd, NULL, NULL)) >= 0)){
+				if(nfds == 2 + CPOR_VERIFIER_MAX_CONNECTIONS){
+					close(fd);
+					continue;
+				}
+				/* The workers read whole requests and write whole responses, so the connection blocks, but not forever */
+				fcntl(fd, F_SETFD, FD_CLOEXEC);
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(int));
+				setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval));
+				setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(struct timeval));
+				fds[nfds].fd = fd;
+				fds[nfds].events = POLLIN;
+				fds[nfds].revents = 0;
+				nfds++;
+			}
+		}
+	}
+
+	/* Close the connections no worker has; the rest are closed when the workers hand them back */
+	for(i = 2; i < nfds; i++)
+		if(fds[i].fd >= 0) close(fds[i].fd);
+	free(fds);
+
+	return NULL;
+}
+
+/* cpor_start_verifier: Starts a verifier daemon listening on a Unix socket at socketpath (or a TCP host:port).  It issues compact
+* challenges, keeping the prepared verification of each (see cpor_verify_prepare) under an audit id until the
+* proof arrives, so a proof costs only cpor_verify_finish.  Up to max_audits challenges may be in flight; each
+* expires audit_ttl seconds after it was issued (0 for never).  Keys and t's are read through myparams->secrets_cache, or a
+* cache of the daemon's own if there is none.  Requests are served by myparams->num_threads workers.  Returns the
+* daemon, or NULL on failure.
+*/
+CPOR_verifier *cpor_start_verifier(CPOR_params *myparams, char *socketpath, unsigned int max_audits, unsigned int audit_ttl){
+
+	CPOR_verifier *verifier = NULL;
+	unsigned int i = 0;
+
+	if(!socketpath || (strlen(socketpath) >= MAXPATHLEN) || !max_audits || (max_audits > UINT32_MAX - 1)) return NULL;
+
+	if( ((verifier = malloc(sizeof(CPOR_verifier))) == NULL)) return NULL;
+	memset(verifier, 0, sizeof(CPOR_verifier));
+	verifier->myparams = *myparams;
+	verifier->listenfd = verifier->wakefd[0] = verifier->wakefd[1] = -1;
+	verifier->max_audits = max_audits;
+	verifier->audit_ttl = audit_ttl;
+	strcpy(verifier->socketpath, socketpath);
+	pthread_mutex_init(&verifier->audits_lock, NULL);
+	pthread_mutex_init(&verifier->ready_lock, NULL);
+	pthread_cond_init(&verifier->ready_cond, NULL);
+
+	if(!verifier->myparams.secrets_cache){
+		verifier->secrets_cache = cpor_create_secrets_cache(myparams, 64, audit_ttl);
+		if(!verifier->secrets_cache) goto cleanup;
+		verifier->myparams.secrets_cache = verifier->secrets_cache;
+	}
+
+	if( ((verifier->audits = malloc(sizeof(struct verifier_audit) * max_audits)) == NULL)) goto cleanup;
+	memset(verifier->audits, 0, sizeof(struct verifier_audit) * max_audits);
+	for(i = 0; i < max_audits; i++) verifier->audits[i].next_free = i + 1;
+	verifier->free_audit = 0;
+
+	if( ((verifier->ready = malloc(sizeof(int) * CPOR_VERIFIER_MAX_CONNECTIONS)) == NULL)) goto cleanup;
+	if(pipe(verifier->wakefd) < 0) goto cleanup;
+	for(i = 0; i < 2; i++){
+		fcntl(verifier->wakefd[i], F_SETFD, FD_CLOEXEC);
+		fcntl(verifier->wakefd[i], F_SETFL, O_NONBLOCK);
+	}
+
+	if( ((verifier->listenfd = cpor_msg_listen(socketpath)) < 0)) goto cleanup;
+
+	verifier->num_workers = (myparams->num_threads) ? myparams->num_threads : 1;
+	if( ((verifier->workers = malloc(sizeof(pthread_t) * verifier->num_workers)) == NULL)) goto cleanup;
+	for(i = 0; i < verifier->num_workers; i++){
+		if(pthread_create(&verifier->workers[i], NULL, verifier_worker_thread, verifier) != 0){
+			verifier->num_workers = i;
+			goto cleanup;
+		}
+	}
+	if(pthread_create(&verifier->poller, NULL, verifier_poll_thread, verifier) != 0) goto cleanup;
+
+	return verifier;
+
+cleanup:
+	pthread_mutex_lock(&verifier->ready_lock);
+	verifier->stop = 1;
+	pthread_cond_broadcast(&verifier->ready_cond);
+	pthread_mutex_unlock(&verifier->ready_lock);
+	for(i = 0; i < verifier->num_workers; i++) pthread_join(verifier->workers[i], NULL);
+	if(verifier->workers) free(verifier->workers);
+	if(verifier->listenfd >= 0){
+		close(verifier->listenfd);
+		if(!is_tcp_address(socketpath)) unlink(socketpath);
+	}
+	if(verifier->wakefd[0] >= 0) close(verifier->wakefd[0]);
+	if(verifier->wakefd[1] >= 0) close(verifier->wakefd[1]);
+	if(verifier->ready) free(verifier->ready);
+	if(verifier->audits) free(verifier->audits);
+	if(verifier->secrets_cache) cpor_destroy_secrets_cache(verifier->secrets_cache);
+	pthread_cond_destroy(&verifier->ready_cond);
+	pthread_mutex_destroy(&verifier->ready_lock);
+	pthread_mutex_destroy(&verifier->audits_lock);
+	sfree(verifier, sizeof(CPOR_verifier));
+
+	return NULL;
+}
+
+/* cpor_stop_verifier: Stops the daemon, closing its connections and dropping the audits still in flight. */
+void cpor_stop_verifier(CPOR_verifier *verifier){
+
+	int message = CPOR_VERIFIER_STOP, fd = 0;
+	unsigned int i = 0;
+
+	if(!verifier) return;
+
+	pthread_mutex_lock(&verifier->ready_lock);
+	verifier->stop = 1;
+	pthread_cond_broadcast(&verifier->ready_cond);
+	pthread_mutex_unlock(&verifier->ready_lock);
+	while((write(verifier->wakefd[1], &message, sizeof(int)) < 0) && (errno == EINTR));
+
+	pthread_join(verifier->poller, NULL);
+	for(i = 0; i < verifier->num_workers; i++) pthread_join(verifier->workers[i], NULL);
+
+	/* Close what the workers handed back after the poll thread stopped, and anything still queued */
+	while(read(verifier->wakefd[0], &message, sizeof(int)) == sizeof(int)){
+		if(message == CPOR_VERIFIER_STOP) continue;
+		fd = (message < 0) ? ~message : message;
+		close(fd);
+	}
+	for(i = 0; i < verifier->ready_count; i++)
+		close(verifier->ready[(verifier->ready_head + i) % CPOR_VERIFIER_MAX_CONNECTIONS]);
+
+	close(verifier->listenfd);
+	if(!is_tcp_address(verifier->socketpath)) unlink(verifier->socketpath);
+	close(verifier->wakefd[0]);
+	close(verifier->wakefd[1]);
+
+	for(i = 0; i < verifier->max_audits; i++)
+		if(verifier->audits[i].prepared) destroy_cpor_prepared(&verifier->myparams, verifier->audits[i].prepared);
+	free(verifier->audits);
+	free(verifier->ready);
+	free(verifier->workers);
+	if(verifier->secrets_cache) cpor_destroy_secrets_cache(verifier->secrets_cache);
+
+	pthread_cond_destroy(&verifier->ready_cond);
+	pthread_mutex_destroy(&verifier->ready_lock);
+	pthread_mutex_destroy(&verifier->audits_lock);
+	sfree(verifier, sizeof(CPOR_verifier));
+}
+
+#endif
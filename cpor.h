@@ -37,6 +37,7 @@
 #include <openssl/aes.h>
 #include <openssl/evp.h>
 #include <string.h>
+#include <stdint.h>
 #include <limits.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -52,6 +53,10 @@
 #define CPOR_OP_TAG 0x01
 #define CPOR_OP_VERIFY 0x02
 #define CPOR_OP_KEYGEN 0x03
+#define CPOR_OP_VERIFIERD 0x04
+#define CPOR_OP_PROVERD 0x05
+#define CPOR_OP_LOADTEST 0x06
+#define CPOR_OP_REMOTE 0x07
 
 //#define NUM_THREADS 4
 
@@ -71,6 +76,39 @@
 //#define CPOR_NUM_SECTORS ( (CPOR_BLOCK_SIZE/CPOR_SECTOR_SIZE) + ((CPOR_BLOCK_SIZE % CPOR_SECTOR_SIZE) ? 1 : 0) ) /* Number of sectors per block */
 
 
+/* A prover-side cache of tags shared across proofs; see cpor_create_tag_cache */
+typedef struct CPOR_tag_cache_struct CPOR_tag_cache;
+
+/* A verifier-side cache of decoded keys and t's; see cpor_create_secrets_cache */
+typedef struct CPOR_secrets_cache_struct CPOR_secrets_cache;
+
+/* A verifier-side pool of challenges prepared ahead of time; see cpor_create_verify_pool */
+typedef struct CPOR_verify_pool_struct CPOR_verify_pool;
+
+/* A verifier daemon serving challenges and verifications over a Unix socket; see cpor_start_verifier */
+typedef struct CPOR_verifier_struct CPOR_verifier;
+
+/* A data file and its tags held open by a long-running prover; see cpor_open_prover_file */
+typedef struct CPOR_prover_file_struct CPOR_prover_file;
+
+/* A prover daemon answering challenges over a socket or HTTP; see cpor_start_prover */
+typedef struct CPOR_prover_struct CPOR_prover;
+
+/* A verifier-side client auditing a remote prover over HTTP; see cpor_create_remote_auditor */
+typedef struct CPOR_remote_auditor_struct CPOR_remote_auditor;
+
+/* Connections to an HTTP object store holding data and tag files, for a prover; see cpor_open_object_store */
+typedef struct CPOR_object_store_struct CPOR_object_store;
+
+/* A tag file being uploaded over HTTP while it is made; see cpor_tag_upload_begin */
+typedef struct CPOR_tag_upload_struct CPOR_tag_upload;
+
+/* A shared-memory exchange of messages with a co-located prover; see cpor_msg_attach_shm */
+typedef struct CPOR_shm_struct CPOR_shm;
+
+/* A client's connection to a daemon; see cpor_msg_connect */
+typedef struct CPOR_msg_conn_struct CPOR_msg_conn;
+
 typedef struct CPOR_parameters_struct CPOR_params;
 
 struct CPOR_parameters_struct{
@@ -86,8 +124,15 @@ struct CPOR_parameters_struct{
 		unsigned int sector_size;	/* Message sector size in bytes */
 		unsigned int num_sectors;	/* Number of sectors per block */
 		unsigned int num_challenge;	/* Number of blocks to challenge */
+		unsigned int challenge_run;	/* Challenge runs of this many consecutive blocks (0 or 1 picks blocks independently) */
 		
 		unsigned int num_threads;	/* Number of tagging threads */
+		unsigned int direct_io;		/* Read the file with uncached (O_DIRECT) I/O while tagging */
+		unsigned int checkpoint_blocks;	/* Checkpoint tagging progress every this many blocks (0 disables) */
+		unsigned int resume;		/* Resume tagging from the last checkpoint */
+		unsigned int shared_alphas;	/* Derive the alphas from the key, so files can be proven together (see cpor_derive_alphas) */
+		CPOR_tag_cache *tag_cache;	/* Tags cached across proofs (NULL reads every tag from the tag file) */
+		CPOR_secrets_cache *secrets_cache;	/* Keys and t's cached across challenges and verifications (NULL rereads them) */
 		
 		char *filename;
 		
@@ -98,6 +143,7 @@ struct CPOR_parameters_struct{
 		char *key_filename;
 		char *t_filename;
 		char *tag_filename;
+		char *container_filename;	/* If set, tag into an interleaved data+tag container at this path */
 };
 
 extern CPOR_params params;
@@ -124,14 +170,14 @@ typedef struct CPOR_tag_struct CPOR_tag;
 
 struct CPOR_tag_struct{
 	BIGNUM *sigma;			/* The resulting authenticator, sigma_i*/
-	unsigned int index;		/* The index for the authenticator, i */
+	uint64_t index;			/* The index for the authenticator, i */
 };
 
 typedef struct CPOR_t_struct CPOR_t;
 
 struct CPOR_t_struct{
 	
-	unsigned int n;			/* The number of blocks in the file */
+	uint64_t n;				/* The number of blocks in the file */
 	unsigned char *k_prf;	/* The randomly generated PRF key for this file */
 	BIGNUM **alpha;
 };
@@ -142,11 +188,36 @@ typedef struct CPOR_challenge_struct CPOR_challenge;
 struct CPOR_challenge_struct{
 
 	unsigned int l;			/* The number of elements to be tested */
-	unsigned int *I;		/* An array of l indicies to be tested */
-	BIGNUM **nu;			/* An array of l random elements */
+	uint64_t *I;			/* An array of l indicies to be tested */
+	size_t element_size;	/* The width of each nu: the byte length of Zp */
+	unsigned char *nu;		/* l random elements, big-endian, one after another; see cpor_challenge_nu */
 	CPOR_global *global;
 };
 
+/* Size (in bytes) of the seed a compact challenge is expanded from; it keys AES-256-CTR */
+#define CPOR_CHALLENGE_SEED_SIZE 32
+
+/* A compact challenge.  Both sides expand it into the same I and nu with cpor_expand_challenge, so only this
+ * fixed-size struct has to be sent to the prover. */
+typedef struct CPOR_challenge_seed_struct CPOR_challenge_seed;
+
+struct CPOR_challenge_seed_struct{
+	unsigned char seed[CPOR_CHALLENGE_SEED_SIZE];
+	unsigned int l;			/* The number of elements to be tested */
+	unsigned int run;		/* Length of the runs of consecutive blocks tested (0 or 1 for independent blocks) */
+	uint64_t n;				/* The number of blocks in the file; indices are drawn from [0, n) */
+};
+
+/* A challenge over several files, all tagged under the same key with shared alphas.  The prover answers it
+ * with one proof: the sum over the files of weights[f] times the proof for challenges[f]. */
+typedef struct CPOR_aggregate_challenge_struct CPOR_aggregate_challenge;
+
+struct CPOR_aggregate_challenge_struct{
+	unsigned int numfiles;
+	CPOR_challenge **challenges;	/* A challenge for each file */
+	BIGNUM **weights;				/* A random weight in Zp for each file */
+};
+
 typedef struct CPOR_proof_struct CPOR_proof;
 
 struct CPOR_proof_struct{
@@ -154,16 +225,358 @@ struct CPOR_proof_struct{
 	BIGNUM **mu;
 };
 
+/* What verifying a proof needs that doesn't depend on the proof; see cpor_verify_prepare */
+typedef struct CPOR_prepared_struct CPOR_prepared;
+
+struct CPOR_prepared_struct{
+	BIGNUM *prf_sum;		/* The sum over the challenged blocks of nu_i * PRF_k(i) */
+	BIGNUM **alpha;			/* A copy of the file's alphas */
+	CPOR_global *global;
+};
+
+/* Requests to the daemons and their responses are a CPOR_msg_header followed by length bytes of payload.  On a
+ * socket, which may be TCP, the header goes as CPOR_MSG_HEADER_SIZE bytes (see cpor_put_msg_header) and every
+ * integer in a payload as well is big-endian, as in the wire format below; only the slots of a shared-memory
+ * exchange, which never leaves the host, hold the header as it is in memory. */
+#define CPOR_MSG_MAGIC 0x43504d31		/* "CPM1" */
+#define CPOR_MSG_MAX_PAYLOAD (1 << 20)
+#define CPOR_MSG_HEADER_SIZE 24
+
+/* Most blocks a daemon's challenge may ask for, and the longest run it may ask for them in.  Holding both to this
+ * keeps expanding a challenge (at most l + run - 1 blocks) from costing the daemon more than it can afford. */
+#define CPOR_MAX_CHALLENGE 65536
+
+/* Message ops */
+#define CPOR_MSG_CHALLENGE 1	/* Payload: uint32 l, uint32 run (l of 0 takes the daemon's defaults; both at most
+								 * CPOR_MAX_CHALLENGE), then the t file's path.
+								 * Response: id is the audit id; payload is a serialized CPOR_challenge_seed then Zp. */
+#define CPOR_MSG_VERIFY 2		/* id is the audit id; payload is the proof, see cpor_proof_to_bytes.
+								 * Response: status is the result of cpor_verify_finish. */
+#define CPOR_MSG_PROVE 3		/* Payload: a serialized CPOR_challenge_seed, uint32 length of Zp, Zp, uint32 length of the
+								 * data file's path, that path, then the tag file's path.
+								 * Response: id is echoed; payload is the proof, see cpor_proof_to_bytes. */
+#define CPOR_MSG_SHM 4			/* Payload: uint32 slot size, uint32 number of slots (a power of two).  Only as the first message on a Unix
+								 * socket.  Response: status 1 and no payload, with the exchange's descriptors attached;
+								 * from then on messages go through it, see cpor_msg_attach_shm. */
+
+/* The rings of a shared-memory exchange */
+#define CPOR_SHM_REQUESTS 0
+#define CPOR_SHM_RESPONSES 1
+
+/* The exchange a "shm:" address asks for: each slot holds a challenge, or a proof under the default parameters */
+#define CPOR_SHM_SLOT_SIZE 16384
+#define CPOR_SHM_SLOTS 16
+
+/* Size of a CPOR_challenge_seed on the wire: the seed, l, run and n */
+#define CPOR_MSG_SEED_SIZE (CPOR_CHALLENGE_SEED_SIZE + 16)
+
+typedef struct CPOR_msg_header_struct CPOR_msg_header;
+
+struct CPOR_msg_header_struct{
+	uint32_t magic;			/* CPOR_MSG_MAGIC */
+	uint32_t op;			/* CPOR_MSG_*; echoed in the response */
+	uint64_t id;			/* The audit the message is about */
+	int32_t status;			/* In responses: 1 on success (or a proof that verified), 0 for a proof that didn't, -1 on error */
+	uint32_t length;		/* Bytes of payload that follow */
+};
+
+struct CPOR_msg_conn_struct{
+	int fd;					/* The socket */
+	CPOR_shm *shm;			/* The shared-memory exchange messages go through instead, if set */
+};
+
+/* One audit of a file held by a remote prover; see cpor_remote_audit */
+typedef struct CPOR_remote_audit_struct CPOR_remote_audit;
+
+struct CPOR_remote_audit_struct{
+	char *filepath;			/* The data file, as the prover names it */
+	char *tagfilepath;		/* Its tag file, as the prover names it */
+	char *tfilepath;		/* Its t file, held by the verifier */
+	int result;				/* Set by cpor_remote_audit: 1 if the proof verified, 0 if it didn't, -1 on error */
+};
+
+/* Challenges and proofs on the wire: a CPOR_WIRE_HEADER_SIZE header, then fixed-width fields.  Every element of
+ * Zp is big-endian and zero-padded to the header's element width (the byte length of Zp); the other integers are
+ * big-endian too.  The header is the magic, a version byte, a kind byte, the element width as a uint16, the
+ * count (l for a challenge, the number of sectors for a proof) as a uint32 and four reserved zero bytes.
+ *   A challenge: Zp, then l uint64 block indices, then l nu's.
+ *   A proof: sigma, then the mu's (as cpor_proof_to_bytes lays them out). */
+#define CPOR_WIRE_MAGIC "CPRW"
+#define CPOR_WIRE_MAGIC_SIZE 4
+#define CPOR_WIRE_VERSION 1
+#define CPOR_WIRE_HEADER_SIZE 16
+
+/* Wire kinds */
+#define CPOR_WIRE_CHALLENGE 1
+#define CPOR_WIRE_PROOF 2
+
+/* A challenge decoded in place: its fields point into the buffer it was decoded from, which must outlive it.
+ * See cpor_decode_challenge. */
+typedef struct CPOR_challenge_view_struct CPOR_challenge_view;
+
+struct CPOR_challenge_view_struct{
+	unsigned int l;
+	size_t element_size;
+	const unsigned char *Zp;
+	const unsigned char *I;		/* l big-endian uint64s; see cpor_challenge_view_index */
+	const unsigned char *nu;	/* l elements */
+};
+
+/* A proof decoded in place; see cpor_decode_proof */
+typedef struct CPOR_proof_view_struct CPOR_proof_view;
+
+struct CPOR_proof_view_struct{
+	unsigned int num_sectors;
+	size_t element_size;
+	const unsigned char *sigma;
+	const unsigned char *mu;	/* num_sectors elements */
+};
+
+/* Number of bytes of CSPRNG output fetched at a time by a CPOR_rand stream */
+#define CPOR_RAND_BUFFER_SIZE 1024
+
+/* A buffered stream of RAND_bytes output, so drawing many small random numbers costs one RAND_bytes call per
+ * CPOR_RAND_BUFFER_SIZE bytes rather than one per number */
+typedef struct CPOR_rand_struct CPOR_rand;
+
+struct CPOR_rand_struct{
+	unsigned char buf[CPOR_RAND_BUFFER_SIZE];
+	size_t pos;				/* Bytes of buf already handed out */
+	EVP_CIPHER_CTX *ctx;	/* If set, the stream is the AES-256-CTR keystream under a seed instead of RAND_bytes */
+};
+
+/* Tag and t files (and cpor_tag_file's checkpoints) start with a header recording the parameters they were made with */
+#define CPOR_TAG_MAGIC "CPORTAG2"
+#define CPOR_T_MAGIC "CPORT002"
+#define CPOR_CKPT_MAGIC "CPORCKPT"
+#define CPOR_FORMAT_VERSION 3	/* 2 was the header without first, before shards */
+
+/* Format flags */
+#define CPOR_FORMAT_FIXED_WIDTH 0x01	/* The tags are an array of fixed-width sigmas, indexed by block */
+#define CPOR_FORMAT_SHARD 0x02			/* The tags are only those of blocks first through first+n-1 */
+
+/* PRF modes */
+#define CPOR_PRF_HMAC_SHA1 1
+
+typedef struct CPOR_file_header_struct CPOR_file_header;
+
+struct CPOR_file_header_struct{
+	char magic[8];			/* CPOR_TAG_MAGIC, CPOR_T_MAGIC or CPOR_CKPT_MAGIC */
+	uint32_t version;		/* CPOR_FORMAT_VERSION */
+	uint32_t header_size;	/* Size of the header; the records follow it */
+	uint32_t flags;			/* CPOR_FORMAT_* */
+	uint32_t prf_mode;		/* CPOR_PRF_* */
+	uint32_t lambda;
+	uint32_t Zp_bits;
+	uint32_t prf_key_size;
+	uint32_t block_size;
+	uint32_t sector_size;
+	uint32_t num_sectors;
+	uint32_t sigma_size;	/* Width of each sigma in the tag array */
+	uint32_t reserved;
+	uint64_t n;				/* The number of blocks in the file (or, for a shard, in the shard) */
+	uint64_t first;			/* The first block a shard's tags are for (0 for a whole file) */
+};
+
+/* Receives each tag produced by a streaming tagger, in block order.  sigma_size is the fixed width of sigma
+ * on disk.  Returns 1 on success, 0 on failure. */
+typedef int (*CPOR_tag_sink)(void *sink_arg, CPOR_tag *tag, size_t sigma_size);
+
+typedef struct CPOR_tagger_struct CPOR_tagger;
+
+struct CPOR_tagger_struct{
+	CPOR_params *myparams;
+	CPOR_key *key;
+	CPOR_t *t;				/* Per-file secrets; t->n is only known once the stream is finished */
+	unsigned char *buf;		/* The partial block received so far */
+	size_t buf_len;			/* Number of bytes in buf */
+	uint64_t n;				/* Number of blocks tagged so far */
+	CPOR_tag_sink sink;
+	void *sink_arg;
+};
+
 /* File-level CPOR functions from cpor-file.c */
 int cpor_tag_file(CPOR_params *myparams, char *filepath, size_t filepath_len, char *keyfilepath, char *tagfilepath, size_t tagfilepath_len, char *tfilepath, size_t tfilepath_len);
 
+int cpor_tag_files(CPOR_params *myparams, char **filepaths, unsigned int numfiles);
+
+int cpor_tag_tree(CPOR_params *myparams, char *dirpath);
+
+int cpor_append_file(CPOR_params *myparams, char *filepath, size_t filepath_len, char *keyfilepath, char *tagfilepath, size_t tagfilepath_len, char *tfilepath, size_t tfilepath_len);
+
+int cpor_update_block(CPOR_params *myparams, uint64_t index, unsigned char *old_block, unsigned char *new_block);
+
+int cpor_update_range(CPOR_params *myparams, uint64_t index, uint64_t numblocks, unsigned char *old_data, unsigned char *new_data);
+
+int cpor_update_sectors(CPOR_params *myparams, uint64_t index, unsigned int first_sector, unsigned int num_sectors, unsigned char *old_sectors, unsigned char *new_sectors);
+
+CPOR_tagger *cpor_tagger_begin(CPOR_params *myparams, CPOR_tag_sink sink, void *sink_arg);
+
+int cpor_tagger_update(CPOR_tagger *tagger, unsigned char *buf, size_t len);
+
+int cpor_tagger_finish(CPOR_tagger *tagger, FILE *tfile);
+
+void cpor_tagger_abort(CPOR_tagger *tagger);
+
+int cpor_tag_sink_file(void *sink_arg, CPOR_tag *tag, size_t sigma_size);
+
+int write_cpor_tag_header(CPOR_params *myparams, FILE *tagfile, size_t sigma_size, uint64_t n);
+
+int cpor_read_params(CPOR_params *myparams, char *filepath);
+
+int cpor_parse_tag_header(CPOR_params *myparams, unsigned char *buf, size_t len, CPOR_file_header *header);
+
+int cpor_shard_tags(CPOR_params *myparams, char *tagfilepath, char *shardpath, uint64_t first, uint64_t last);
+
+int cpor_tag_stream(CPOR_params *myparams, FILE *input, char *tagfilepath, char *tfilepath);
+
+int cpor_tag_container(CPOR_params *myparams, FILE *input, char *containerpath, char *tfilepath);
+
+CPOR_tag_cache *cpor_create_tag_cache(size_t max_tags, size_t sigma_size);
+
+void cpor_destroy_tag_cache(CPOR_tag_cache *cache);
+
+int cpor_tag_cache_prewarm(CPOR_tag_cache *cache, char *tagfilepath);
+
+void cpor_tag_cache_stats(CPOR_tag_cache *cache, uint64_t *hits, uint64_t *misses);
+
+CPOR_secrets_cache *cpor_create_secrets_cache(CPOR_params *myparams, size_t max_entries, unsigned int ttl);
+
+void cpor_destroy_secrets_cache(CPOR_secrets_cache *cache);
+
+void cpor_secrets_cache_sweep(CPOR_secrets_cache *cache);
+
 CPOR_challenge *cpor_challenge_file(CPOR_params *myparams);
 
 CPOR_proof *cpor_prove_file(CPOR_params *myparams, CPOR_challenge *challenge);
 
+CPOR_proof *cpor_prove_shard(CPOR_params *myparams, CPOR_challenge *challenge);
+
+CPOR_prover_file *cpor_open_prover_file(CPOR_params *myparams, char *filepath, char *tagfilepath);
+
+int cpor_prover_file_current(CPOR_prover_file *file);
+
+int cpor_prover_file_covers(CPOR_prover_file *file, uint64_t n);
+
+void cpor_prover_file_prefetch(CPOR_params *myparams, CPOR_prover_file *file, CPOR_challenge *challenge);
+
+CPOR_proof *cpor_prover_file_prove(CPOR_params *myparams, CPOR_prover_file *file, CPOR_challenge *challenge);
+
+void cpor_close_prover_file(CPOR_prover_file *file);
+
 int cpor_verify_file(CPOR_params *myparams, CPOR_challenge *challenge, CPOR_proof *proof);
 
-CPOR_tag *read_cpor_tag(FILE *tagfile, unsigned int index);
+CPOR_prepared *cpor_prepare_challenge_file(CPOR_params *myparams, char *tfilepath, CPOR_challenge_seed **seed);
+
+CPOR_verify_pool *cpor_create_verify_pool(CPOR_params *myparams, unsigned int depth);
+
+int cpor_verify_pool_take(CPOR_verify_pool *pool, CPOR_challenge **challenge, CPOR_prepared **prepared);
+
+void cpor_destroy_verify_pool(CPOR_verify_pool *pool);
+
+CPOR_aggregate_challenge *cpor_challenge_files(CPOR_params *myparams, char **tfilepaths, unsigned int numfiles);
+
+CPOR_proof *cpor_prove_files(CPOR_params *myparams, char **filepaths, char **tagfilepaths, CPOR_aggregate_challenge *challenge);
+
+int cpor_verify_files(CPOR_params *myparams, char **tfilepaths, CPOR_aggregate_challenge *challenge, CPOR_proof *proof);
+
+CPOR_tag *read_cpor_tag(FILE *tagfile, uint64_t index);
+
+/* The verifier daemon and its client from cpor-verifier.c */
+CPOR_verifier *cpor_start_verifier(CPOR_params *myparams, char *socketpath, unsigned int max_audits, unsigned int audit_ttl);
+
+void cpor_stop_verifier(CPOR_verifier *verifier);
+
+CPOR_msg_conn *cpor_verifier_connect(char *socketpath);
+
+int cpor_verifier_send_challenge(CPOR_msg_conn *conn, char *tfilepath, unsigned int l, unsigned int run);
+
+CPOR_challenge_seed *cpor_verifier_recv_challenge(CPOR_msg_conn *conn, uint64_t *audit, CPOR_global *global);
+
+int cpor_verifier_send_proof(CPOR_params *myparams, CPOR_msg_conn *conn, uint64_t audit, CPOR_global *global, CPOR_proof *proof);
+
+int cpor_verifier_recv_result(CPOR_msg_conn *conn, uint64_t *audit);
+
+int cpor_msg_send(int fd, CPOR_msg_header *header, unsigned char *payload);
+
+int cpor_msg_recv(int fd, CPOR_msg_header *header, unsigned char **payload);
+
+int cpor_msg_conn_send(CPOR_msg_conn *conn, CPOR_msg_header *header, unsigned char *payload);
+
+int cpor_msg_conn_recv(CPOR_msg_conn *conn, CPOR_msg_header *header, unsigned char **payload);
+
+int cpor_msg_listen(char *address);
+
+CPOR_msg_conn *cpor_msg_connect(char *address);
+
+void cpor_msg_close(CPOR_msg_conn *conn);
+
+void cpor_put_challenge_seed(unsigned char *buf, CPOR_challenge_seed *seed);
+
+void cpor_get_challenge_seed(unsigned char *buf, CPOR_challenge_seed *seed);
+
+void cpor_put_msg_header(unsigned char *buf, CPOR_msg_header *header);
+
+void cpor_get_msg_header(unsigned char *buf, CPOR_msg_header *header);
+
+/* The prover daemon from cpor-prover.c */
+CPOR_prover *cpor_start_prover(CPOR_params *myparams, char *address, char *root);
+
+void cpor_stop_prover(CPOR_prover *prover);
+
+unsigned char *cpor_prover_challenge_payload(CPOR_challenge_seed *seed, CPOR_global *global, char *filepath, char *tagfilepath, size_t *len);
+
+int cpor_prover_send_challenge(CPOR_msg_conn *conn, uint64_t id, CPOR_challenge_seed *seed, CPOR_global *global, char *filepath, char *tagfilepath);
+
+CPOR_proof *cpor_prover_recv_proof(CPOR_params *myparams, CPOR_msg_conn *conn, uint64_t *id, CPOR_global *global);
+
+int cpor_prover_load_test(CPOR_params *myparams, char *address, unsigned int requests, unsigned int depth);
+
+/* Shared-memory message exchange from cpor-shm.c */
+int cpor_msg_attach_shm(CPOR_msg_conn *conn, uint32_t slot_size, uint32_t num_slots);
+
+int cpor_shm_send_msg(CPOR_shm *shm, CPOR_msg_header *header, unsigned char *payload);
+
+int cpor_shm_recv_msg(CPOR_shm *shm, CPOR_msg_header *header, unsigned char **payload);
+
+CPOR_shm *cpor_shm_create(int fd, uint32_t slot_size, uint32_t num_slots);
+
+int cpor_shm_offer(CPOR_shm *shm, CPOR_msg_header *header);
+
+void cpor_shm_destroy(CPOR_shm *shm);
+
+size_t cpor_shm_payload_size(CPOR_shm *shm);
+
+unsigned char *cpor_shm_reserve(CPOR_shm *shm, int ring);
+
+void cpor_shm_publish(CPOR_shm *shm, int ring);
+
+unsigned char *cpor_shm_peek(CPOR_shm *shm, int ring);
+
+void cpor_shm_release(CPOR_shm *shm, int ring);
+
+/* Remote audits from cpor-remote.c */
+CPOR_remote_auditor *cpor_create_remote_auditor(CPOR_params *myparams, char *url, unsigned int max_in_flight);
+
+int cpor_remote_audit(CPOR_remote_auditor *auditor, CPOR_remote_audit *audits, unsigned int numaudits);
+
+void cpor_destroy_remote_auditor(CPOR_remote_auditor *auditor);
+
+CPOR_object_store *cpor_open_object_store(unsigned int max_connections);
+
+CPOR_proof *cpor_prove_object(CPOR_params *myparams, CPOR_object_store *store, char *dataurl, char *tagurl, CPOR_challenge *challenge);
+
+void cpor_close_object_store(CPOR_object_store *store);
+
+CPOR_tag_upload *cpor_tag_upload_begin(CPOR_params *myparams, char *url, size_t sigma_size);
+
+int cpor_tag_sink_upload(void *sink_arg, CPOR_tag *tag, size_t sigma_size);
+
+int cpor_tag_upload_finish(CPOR_tag_upload *upload);
+
+void cpor_tag_upload_abort(CPOR_tag_upload *upload);
+
+int cpor_tag_stream_upload(CPOR_params *myparams, FILE *input, char *url, char *tfilepath);
 
 /* Key management from cpor-keys.c */
 
@@ -172,17 +585,40 @@ CPOR_key *cpor_create_new_keys();
 /* Core CPOR functions from cpor-core.c */
 CPOR_global *cpor_create_global(unsigned int bits);
 
-CPOR_tag *cpor_tag_block(CPOR_params *myparams, CPOR_global *global, unsigned char *k_prf, BIGNUM **alpha, unsigned char *block, unsigned int index);
+CPOR_tag *cpor_tag_block(CPOR_params *myparams, CPOR_global *global, unsigned char *k_prf, BIGNUM **alpha, unsigned char *block, uint64_t index);
+
+int cpor_update_tag(CPOR_params *myparams, CPOR_global *global, BIGNUM **alpha, CPOR_tag *tag, unsigned char *old_block, unsigned char *new_block);
+
+int cpor_update_tag_sectors(CPOR_params *myparams, CPOR_global *global, BIGNUM **alpha, CPOR_tag *tag, unsigned int first_sector, unsigned int num_sectors, unsigned char *old_sectors, unsigned char *new_sectors);
+
+CPOR_challenge *cpor_create_challenge(CPOR_params *myparams, CPOR_global *global, uint64_t n);
 
-CPOR_challenge *cpor_create_challenge(CPOR_params *myparams, CPOR_global *global, unsigned int n);
+CPOR_challenge_seed *cpor_create_challenge_seed(CPOR_params *myparams, uint64_t n);
 
-CPOR_proof *cpor_create_proof_update(CPOR_params *myparams, CPOR_challenge *challenge, CPOR_proof *proof, CPOR_tag *tag, unsigned char *block, unsigned int index, unsigned int i);
+CPOR_challenge *cpor_expand_challenge(CPOR_global *global, CPOR_challenge_seed *seed);
+
+CPOR_proof *cpor_create_proof_update(CPOR_params *myparams, CPOR_challenge *challenge, CPOR_proof *proof, CPOR_tag *tag, unsigned char *block, uint64_t index, unsigned int i);
 
 CPOR_proof *cpor_create_proof_final(CPOR_proof *proof);
 
+CPOR_proof *cpor_combine_proofs(CPOR_params *myparams, CPOR_challenge *challenge, CPOR_proof **proofs, unsigned int numproofs);
+
+CPOR_proof *cpor_aggregate_proof_update(CPOR_params *myparams, CPOR_global *global, CPOR_proof *aggregate, CPOR_proof *proof, BIGNUM *weight);
+
 int cpor_verify_proof(CPOR_params *myparams, CPOR_global *global, CPOR_proof *proof, CPOR_challenge *challenge, unsigned char *k_prf, BIGNUM **alpha);
 
+CPOR_prepared *cpor_verify_prepare(CPOR_params *myparams, CPOR_global *global, CPOR_challenge *challenge, unsigned char *k_prf, BIGNUM **alpha);
+
+int cpor_verify_finish(CPOR_params *myparams, CPOR_prepared *prepared, CPOR_proof *proof);
+
+int cpor_verify_finish_view(CPOR_params *myparams, CPOR_prepared *prepared, CPOR_proof_view *proof);
+
+int cpor_verify_aggregate_proof(CPOR_params *myparams, CPOR_global *global, CPOR_proof *proof, CPOR_aggregate_challenge *challenge,
+                                unsigned char **k_prf, BIGNUM **alpha);
+
 /* Key functions from cpor-keys.c */
+CPOR_key *allocate_cpor_key(CPOR_params *myparams);
+
 CPOR_key *cpor_get_keys(CPOR_params *myparams);
 
 void destroy_cpor_key(CPOR_params *myparams, CPOR_key *key);
@@ -191,7 +627,19 @@ void destroy_cpor_key(CPOR_params *myparams, CPOR_key *key);
 
 void sfree(void *ptr, size_t size);
 
-int get_rand_range(unsigned int min, unsigned int max, unsigned int *value);
+void init_cpor_rand(CPOR_rand *rng);
+
+int init_cpor_rand_seeded(CPOR_rand *rng, unsigned char *seed);
+
+void clear_cpor_rand(CPOR_rand *rng);
+
+int get_rand_bytes(CPOR_rand *rng, unsigned char *out, size_t len);
+
+int get_rand_range(CPOR_rand *rng, uint64_t min, uint64_t max, uint64_t *value);
+
+int get_rand_bn_range(CPOR_rand *rng, BIGNUM *value, BIGNUM *max);
+
+int get_rand_bin_range(CPOR_rand *rng, unsigned char *value, const unsigned char *max, size_t len);
 
 size_t get_ciphertext_size(size_t plaintext_len);
 
@@ -201,15 +649,55 @@ int decrypt_and_verify_secrets(CPOR_key *key, unsigned char *input, size_t input
 
 int encrypt_and_authentucate_secrets(CPOR_key *key, unsigned char *input, size_t input_len, unsigned char *ciphertext, size_t *ciphertext_len, unsigned char *authenticator, size_t *authenticator_len);
 
-CPOR_t *cpor_create_t(CPOR_params *myparams, CPOR_global *global, unsigned int n);
+CPOR_t *cpor_create_t(CPOR_params *myparams, CPOR_global *global, uint64_t n);
+
+int cpor_derive_alphas(CPOR_params *myparams, CPOR_key *key, BIGNUM **alpha);
 
-BIGNUM *generate_prf_i(CPOR_params *myparams, unsigned char *key, unsigned int index);
+BIGNUM *generate_prf_i(CPOR_params *myparams, unsigned char *key, uint64_t index);
 
-CPOR_proof *allocate_cpor_proof();
+CPOR_proof *allocate_cpor_proof(CPOR_params *myparams);
 void destroy_cpor_proof(CPOR_params *myparams, CPOR_proof *proof);
 
+size_t cpor_proof_size(CPOR_params *myparams, size_t element_size);
+
+int cpor_proof_to_bytes(CPOR_params *myparams, CPOR_proof *proof, size_t element_size, unsigned char *buf, size_t buf_len);
+
+CPOR_proof *cpor_proof_from_bytes(CPOR_params *myparams, size_t element_size, unsigned char *buf, size_t buf_len);
+
+void cpor_put_be32(unsigned char *buf, uint32_t value);
+
+uint32_t cpor_get_be32(const unsigned char *buf);
+
+void cpor_put_be64(unsigned char *buf, uint64_t value);
+
+uint64_t cpor_get_be64(const unsigned char *buf);
+
+size_t cpor_challenge_wire_size(unsigned int l, size_t element_size);
+
+size_t cpor_proof_wire_size(CPOR_params *myparams, size_t element_size);
+
+size_t cpor_encode_challenge(CPOR_challenge *challenge, size_t element_size, unsigned char *buf, size_t buf_len);
+
+size_t cpor_encode_proof(CPOR_params *myparams, CPOR_proof *proof, size_t element_size, unsigned char *buf, size_t buf_len);
+
+int cpor_decode_challenge(const unsigned char *buf, size_t buf_len, CPOR_challenge_view *view);
+
+int cpor_decode_proof(CPOR_params *myparams, const unsigned char *buf, size_t buf_len, CPOR_proof_view *view);
+
+uint64_t cpor_challenge_view_index(CPOR_challenge_view *view, unsigned int i);
+
+CPOR_challenge *cpor_challenge_from_view(CPOR_challenge_view *view);
+
 void destroy_cpor_challenge(CPOR_challenge *challenge);
-CPOR_challenge *allocate_cpor_challenge(unsigned int l);
+CPOR_challenge *allocate_cpor_challenge(unsigned int l, size_t element_size);
+
+unsigned char *cpor_challenge_nu(CPOR_challenge *challenge, unsigned int i);
+void destroy_cpor_challenge_seed(CPOR_challenge_seed *seed);
+CPOR_challenge_seed *allocate_cpor_challenge_seed();
+void destroy_cpor_aggregate_challenge(CPOR_aggregate_challenge *challenge);
+void destroy_cpor_prepared(CPOR_params *myparams, CPOR_prepared *prepared);
+CPOR_prepared *allocate_cpor_prepared(CPOR_params *myparams);
+CPOR_aggregate_challenge *allocate_cpor_aggregate_challenge(unsigned int numfiles);
 
 void destroy_cpor_tag(CPOR_tag *tag);
 CPOR_tag *allocate_cpor_tag();
@@ -0,0 +1,77 @@
+/*
+* test-aggregate.c
+*
+* Tests cpor_challenge_files, cpor_prove_files and cpor_verify_files: files of different sizes tagged under one
+* key with shared alphas must answer an aggregate challenge with a single proof that verifies; a damaged block
+* in any one file must fail it, and so must a file tagged without shared alphas.
+*/
+
+#include "test-common.h"
+
+#define AGGREGATE_KEY "aggregate.key"
+#define AGGREGATE_FILES 3
+
+static char *aggregate_paths[AGGREGATE_FILES] = {"aggregate-0.dat", "aggregate-1.dat", "aggregate-2.dat"};
+static char *aggregate_tagpaths[AGGREGATE_FILES] = {"aggregate-0.dat.tag", "aggregate-1.dat.tag", "aggregate-2.dat.tag"};
+static char *aggregate_tpaths[AGGREGATE_FILES] = {"aggregate-0.dat.t", "aggregate-1.dat.t", "aggregate-2.dat.t"};
+
+/* aggregate_verify: Challenges every block of the files, proves and returns cpor_verify_files's result */
+static int aggregate_verify(CPOR_params *p){
+
+	CPOR_aggregate_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	int ret = 0;
+
+	CHECK((challenge = cpor_challenge_files(p, aggregate_tpaths, AGGREGATE_FILES)) != NULL);
+	CHECK((proof = cpor_prove_files(p, aggregate_paths, aggregate_tagpaths, challenge)) != NULL);
+	ret = cpor_verify_files(p, aggregate_tpaths, challenge, proof);
+	destroy_cpor_proof(p, proof);
+	destroy_cpor_aggregate_challenge(challenge);
+
+	return ret;
+}
+
+int main(){
+
+	CPOR_params p;
+	size_t sizes[AGGREGATE_FILES];
+	unsigned char byte = 0;
+	int i = 0, fd = -1;
+
+	test_params(&p, 1024);
+	p.shared_alphas = 1;
+	p.num_challenge = 100;
+	sizes[0] = 10 * p.block_size;
+	sizes[1] = (40 * p.block_size) + 7;
+	sizes[2] = 300;
+	unlink(AGGREGATE_KEY);
+	for(i = 0; i < AGGREGATE_FILES; i++)
+		CHECK(test_tag_random_file(&p, aggregate_paths[i], sizes[i], AGGREGATE_KEY));
+	CHECK(aggregate_verify(&p) == 1);
+
+	/* A flipped bit in the middle file fails the whole proof */
+	CHECK((fd = open(aggregate_paths[1], O_RDWR)) >= 0);
+	CHECK(pread(fd, &byte, 1, 20 * p.block_size) == 1);
+	byte ^= 0x80;
+	CHECK(pwrite(fd, &byte, 1, 20 * p.block_size) == 1);
+	CHECK(aggregate_verify(&p) == 0);
+	byte ^= 0x80;
+	CHECK(pwrite(fd, &byte, 1, 20 * p.block_size) == 1);
+	close(fd);
+	CHECK(aggregate_verify(&p) == 1);
+
+	/* The last file retagged with alphas of its own can't be checked against the others' */
+	p.shared_alphas = 0;
+	CHECK(test_tag_random_file(&p, aggregate_paths[2], sizes[2], AGGREGATE_KEY));
+	p.shared_alphas = 1;
+	CHECK(aggregate_verify(&p) == 0);
+
+	for(i = 0; i < AGGREGATE_FILES; i++){
+		unlink(aggregate_paths[i]);
+		unlink(aggregate_tagpaths[i]);
+		unlink(aggregate_tpaths[i]);
+	}
+	unlink(AGGREGATE_KEY);
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+* test-append.c
+*
+* Tests cpor_append_file: a file that grows, from a short final block and then from a whole one, must prove
+* over every block, old and new, once its tags are extended; and a file that shrank is refused, leaving its
+* tags as they were.
+*/
+
+#include "test-common.h"
+
+#define APPEND_DATA "append.dat"
+#define APPEND_KEY "append.key"
+
+/* append_bytes: Appends size random bytes to APPEND_DATA */
+static void append_bytes(size_t size){
+
+	unsigned char buf[4096];
+	size_t n = 0;
+	FILE *file = NULL;
+
+	CHECK((file = fopen(APPEND_DATA, "ab")) != NULL);
+	while(size){
+		n = (size > sizeof(buf)) ? sizeof(buf) : size;
+		CHECK(RAND_bytes(buf, n));
+		CHECK(fwrite(buf, n, 1, file) == 1);
+		size -= n;
+	}
+	CHECK(fclose(file) == 0);
+}
+
+/* append_check: Checks the tags cover the n blocks of the file and that a proof over all of them verifies */
+static void append_check(CPOR_params *p, uint64_t n, size_t sigma_size){
+
+	CPOR_params myparams = *p;
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	struct stat st;
+
+	CHECK(stat(p->tag_filename, &st) == 0);
+	CHECK((uint64_t)st.st_size == sizeof(CPOR_file_header) + (n * sigma_size));
+	myparams.num_challenge = n;
+	CHECK((challenge = cpor_challenge_file(&myparams)) != NULL);
+	CHECK(challenge->l == n);
+	CHECK((proof = cpor_prove_file(&myparams, challenge)) != NULL);
+	CHECK(cpor_verify_file(&myparams, challenge, proof) == 1);
+	destroy_cpor_proof(&myparams, proof);
+	destroy_cpor_challenge(challenge);
+}
+
+/* append_tag: Extends the tags of APPEND_DATA.  Returns cpor_append_file's result. */
+static int append_tag(CPOR_params *p){
+
+	return cpor_append_file(p, APPEND_DATA, strlen(APPEND_DATA), APPEND_KEY, p->tag_filename, strlen(p->tag_filename),
+		p->t_filename, strlen(p->t_filename));
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_key *key = NULL;
+	size_t sigma_size = 0;
+	struct stat st;
+
+	test_params(&p, 1024);
+	unlink(APPEND_KEY);
+	CHECK(test_tag_random_file(&p, APPEND_DATA, (20 * p.block_size) + 300, APPEND_KEY));
+	CHECK((key = cpor_get_keys(&p)) != NULL);
+	sigma_size = BN_num_bytes(key->global->Zp);
+	destroy_cpor_key(&p, key);
+	append_check(&p, 21, sigma_size);
+
+	/* The short final block fills up and five more follow, the last one whole */
+	append_bytes((p.block_size - 300) + (5 * p.block_size));
+	CHECK(append_tag(&p));
+	append_check(&p, 26, sigma_size);
+
+	/* Growing from a whole final block, to a short one */
+	append_bytes((3 * p.block_size) + 17);
+	CHECK(append_tag(&p));
+	append_check(&p, 30, sigma_size);
+
+	/* A file that shrank can't be appended to */
+	CHECK(truncate(APPEND_DATA, 10 * p.block_size) == 0);
+	CHECK(!append_tag(&p));
+	CHECK(stat(p.tag_filename, &st) == 0);
+	CHECK((uint64_t)st.st_size == sizeof(CPOR_file_header) + (30 * sigma_size));
+	unlink(APPEND_DATA);
+	unlink(p.tag_filename);
+	unlink(p.t_filename);
+	unlink(APPEND_KEY);
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+* test-batch.c
+*
+* Tests cpor_tag_files: files of several sizes (empty, shorter than a block, a block, and many blocks ending in a
+* short one) tagged as one batch, through the page cache and with direct I/O.  Every tag file must be a full
+* fixed-width array and every file must prove; a file that isn't there fails the batch without the others.
+*/
+
+#include "test-common.h"
+
+#define BATCH_KEY "batch.key"
+#define BATCH_FILES 5
+
+static char *batch_paths[BATCH_FILES + 1] = {"batch-0.dat", "batch-1.dat", "batch-2.dat", "batch-3.dat", "batch-4.dat",
+	"batch-missing.dat"};
+
+/* batch_check: Checks the tag file of the file at path, of size bytes, and that a proof over it verifies */
+static void batch_check(CPOR_params *p, char *path, size_t size, size_t sigma_size){
+
+	CPOR_params myparams = *p;
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	char tagpath[64], tpath[64];
+	struct stat st;
+	uint64_t n = (size + p->block_size - 1) / p->block_size;
+
+	snprintf(tagpath, sizeof(tagpath), "%s.tag", path);
+	snprintf(tpath, sizeof(tpath), "%s.t", path);
+	CHECK(stat(tagpath, &st) == 0);
+	CHECK((uint64_t)st.st_size == sizeof(CPOR_file_header) + (n * sigma_size));
+	CHECK(access(tpath, F_OK) == 0);
+	if(!n) return;
+
+	myparams.filename = path;
+	myparams.tag_filename = tagpath;
+	myparams.t_filename = tpath;
+	myparams.num_challenge = (n < 64) ? n : 64;
+	CHECK((challenge = cpor_challenge_file(&myparams)) != NULL);
+	CHECK((proof = cpor_prove_file(&myparams, challenge)) != NULL);
+	CHECK(cpor_verify_file(&myparams, challenge, proof) == 1);
+	destroy_cpor_proof(&myparams, proof);
+	destroy_cpor_challenge(challenge);
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_key *key = NULL;
+	char path[64];
+	size_t sizes[BATCH_FILES];
+	size_t sigma_size = 0;
+	int i = 0, direct = 0;
+
+	test_params(&p, 4096);
+	p.num_threads = 4;
+	p.key_filename = BATCH_KEY;
+	unlink(BATCH_KEY);
+	CHECK((key = cpor_create_new_keys(&p)) != NULL);
+	sigma_size = BN_num_bytes(key->global->Zp);
+	destroy_cpor_key(&p, key);
+
+	sizes[0] = 0;
+	sizes[1] = 100;
+	sizes[2] = p.block_size;
+	sizes[3] = (300 * p.block_size) + 1;
+	sizes[4] = 1000 * p.block_size;
+	for(i = 0; i < BATCH_FILES; i++) CHECK(test_random_file(batch_paths[i], sizes[i]));
+	unlink(batch_paths[BATCH_FILES]);
+
+	for(direct = 0; direct <= 1; direct++){
+		p.direct_io = direct;
+		CHECK(cpor_tag_files(&p, batch_paths, BATCH_FILES));
+		for(i = 0; i < BATCH_FILES; i++) batch_check(&p, batch_paths[i], sizes[i], sigma_size);
+	}
+
+	/* A missing file fails the batch, but only itself */
+	p.direct_io = 0;
+	CHECK(!cpor_tag_files(&p, batch_paths, BATCH_FILES + 1));
+	for(i = 0; i < BATCH_FILES; i++) batch_check(&p, batch_paths[i], sizes[i], sigma_size);
+	snprintf(path, sizeof(path), "%s.tag", batch_paths[BATCH_FILES]);
+	CHECK(access(path, F_OK) != 0);
+
+	for(i = 0; i < BATCH_FILES; i++){
+		unlink(batch_paths[i]);
+		snprintf(path, sizeof(path), "%s.tag", batch_paths[i]);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s.t", batch_paths[i]);
+		unlink(path);
+	}
+	unlink(BATCH_KEY);
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+* test-cache.c
+*
+* Tests the caches and the verify pool.  Proofs through a tag cache must verify and, once the cache is warm, be
+* answered from it; a tag rewritten by cpor_update_block must not be served stale.  Challenges and
+* verifications through a secrets cache must verify, and keep verifying after the file is tagged afresh.  Every
+* challenge taken from a verify pool, more than it holds, must finish verifying against its proof.
+*/
+
+#include "test-common.h"
+#include <sys/time.h>
+
+#define CACHE_DATA "cache.dat"
+#define CACHE_KEY "cache.key"
+#define CACHE_BLOCKS 40
+#define CACHE_POOL_DEPTH 3
+
+/* cache_verify: Proves every block of the file and returns cpor_verify_file's result */
+static int cache_verify(CPOR_params *p){
+
+	CPOR_params myparams = *p;
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	int ret = 0;
+
+	myparams.num_challenge = CACHE_BLOCKS;
+	CHECK((challenge = cpor_challenge_file(&myparams)) != NULL);
+	CHECK((proof = cpor_prove_file(&myparams, challenge)) != NULL);
+	ret = cpor_verify_file(&myparams, challenge, proof);
+	destroy_cpor_proof(&myparams, proof);
+	destroy_cpor_challenge(challenge);
+
+	return ret;
+}
+
+/* cache_backdate: Sets the modification time of path a minute back.  The caches tell versions of a file apart
+* by it, and a rewrite within the same clock tick wouldn't change it.
+*/
+static void cache_backdate(char *path){
+
+	struct stat st;
+	struct timeval times[2];
+
+	CHECK(stat(path, &st) == 0);
+	times[0].tv_sec = times[1].tv_sec = st.st_mtime - 60;
+	times[0].tv_usec = times[1].tv_usec = 0;
+	CHECK(utimes(path, times) == 0);
+}
+
+/* cache_tags: Checks the tag cache through proofs, prewarming and an updated block */
+static void cache_tags(CPOR_params *p, size_t sigma_size){
+
+	CPOR_params myparams = *p;
+	unsigned char old_block[1024], new_block[1024];
+	uint64_t hits = 0, misses = 0, before = 0;
+	int fd = -1;
+
+	CHECK((myparams.tag_cache = cpor_create_tag_cache(1024, sigma_size)) != NULL);
+
+	/* Cold, every tag is a miss; warm, every tag is a hit */
+	CHECK(cache_verify(&myparams) == 1);
+	cpor_tag_cache_stats(myparams.tag_cache, &hits, &misses);
+	CHECK((hits == 0) && (misses == CACHE_BLOCKS));
+	CHECK(cache_verify(&myparams) == 1);
+	cpor_tag_cache_stats(myparams.tag_cache, &hits, &misses);
+	CHECK((hits == CACHE_BLOCKS) && (misses == CACHE_BLOCKS));
+
+	/* A rewritten block's new tag is read, not the cached one */
+	CHECK(myparams.block_size == sizeof(old_block));
+	CHECK((fd = open(CACHE_DATA, O_RDWR)) >= 0);
+	CHECK(pread(fd, old_block, sizeof(old_block), 7 * sizeof(old_block)) == sizeof(old_block));
+	CHECK(RAND_bytes(new_block, sizeof(new_block)));
+	CHECK(pwrite(fd, new_block, sizeof(new_block), 7 * sizeof(new_block)) == sizeof(new_block));
+	close(fd);
+	cache_backdate(myparams.tag_filename);
+	CHECK(cpor_update_block(&myparams, 7, old_block, new_block));
+	CHECK(cache_verify(&myparams) == 1);
+
+	/* Prewarmed, the next proof misses nothing */
+	CHECK(cpor_tag_cache_prewarm(myparams.tag_cache, myparams.tag_filename));
+	cpor_tag_cache_stats(myparams.tag_cache, NULL, &before);
+	CHECK(cache_verify(&myparams) == 1);
+	cpor_tag_cache_stats(myparams.tag_cache, NULL, &misses);
+	CHECK(misses == before);
+
+	cpor_destroy_tag_cache(myparams.tag_cache);
+}
+
+/* cache_secrets: Checks verification through a secrets cache, before and after the file is tagged afresh */
+static void cache_secrets(CPOR_params *p){
+
+	CPOR_params myparams = *p;
+
+	CHECK((myparams.secrets_cache = cpor_create_secrets_cache(&myparams, 8, 0)) != NULL);
+	CHECK(cache_verify(&myparams) == 1);
+	CHECK(cache_verify(&myparams) == 1);
+
+	/* New data, a new t: the cached t must not be used for it */
+	cache_backdate(myparams.t_filename);
+	CHECK(test_tag_random_file(&myparams, CACHE_DATA, CACHE_BLOCKS * myparams.block_size, CACHE_KEY));
+	CHECK(cache_verify(&myparams) == 1);
+	cpor_secrets_cache_sweep(myparams.secrets_cache);
+	CHECK(cache_verify(&myparams) == 1);
+
+	cpor_destroy_secrets_cache(myparams.secrets_cache);
+}
+
+/* cache_pool: Takes more challenges from a verify pool than it holds, checking each against its proof */
+static void cache_pool(CPOR_params *p){
+
+	CPOR_verify_pool *pool = NULL;
+	CPOR_challenge *challenge = NULL;
+	CPOR_prepared *prepared = NULL, *other = NULL;
+	CPOR_proof *proof = NULL;
+	int i = 0;
+
+	CHECK((pool = cpor_create_verify_pool(p, CACHE_POOL_DEPTH)) != NULL);
+	for(i = 0; i < 2 * CACHE_POOL_DEPTH; i++){
+		CHECK(cpor_verify_pool_take(pool, &challenge, &prepared));
+		CHECK((proof = cpor_prove_file(p, challenge)) != NULL);
+		CHECK(cpor_verify_finish(p, prepared, proof) == 1);
+		/* A proof only answers its own challenge */
+		if(other){
+			CHECK(cpor_verify_finish(p, other, proof) == 0);
+			destroy_cpor_prepared(p, other);
+		}
+		other = prepared;
+		destroy_cpor_proof(p, proof);
+		destroy_cpor_challenge(challenge);
+	}
+	destroy_cpor_prepared(p, other);
+	cpor_destroy_verify_pool(pool);
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_key *key = NULL;
+	size_t sigma_size = 0;
+
+	test_params(&p, 1024);
+	p.num_challenge = 16;
+	unlink(CACHE_KEY);
+	CHECK(test_tag_random_file(&p, CACHE_DATA, CACHE_BLOCKS * p.block_size, CACHE_KEY));
+	CHECK((key = cpor_get_keys(&p)) != NULL);
+	sigma_size = BN_num_bytes(key->global->Zp);
+	destroy_cpor_key(&p, key);
+
+	cache_tags(&p, sigma_size);
+	cache_secrets(&p);
+	cache_pool(&p);
+
+	unlink(CACHE_DATA);
+	unlink(p.tag_filename);
+	unlink(p.t_filename);
+	unlink(CACHE_KEY);
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+* test-common.h
+*
+* Shared setup for the tests.  Each test is a program that exits 0 on success, 1 on failure and
+* TEST_SKIP if it can't run here.  Tests make their files in the current directory.
+*/
+
+#ifndef __CPOR_TEST_COMMON_H__
+#define __CPOR_TEST_COMMON_H__
+
+#include "../cpor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Exit status telling ctest (SKIP_RETURN_CODE) and make check that a test couldn't run here */
+#define TEST_SKIP 77
+
+#define CHECK(cond) do{ \
+	if(!(cond)){ \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		exit(1); \
+	} \
+}while(0)
+
+/* test_params: The defaults the command line uses (an 80-bit Zp), with the given block size */
+static inline void test_params(CPOR_params *p, unsigned int block_size){
+
+	memset(p, 0, sizeof(CPOR_params));
+	p->lambda = 80;
+	p->Zp_bits = 80;
+	p->prf_key_size = 20;
+	p->enc_key_size = 32;
+	p->mac_key_size = 20;
+	p->block_size = block_size;
+	p->sector_size = (p->Zp_bits / 8) - 1;
+	p->num_sectors = (p->block_size / p->sector_size) + ((p->block_size % p->sector_size) ? 1 : 0);
+	p->num_challenge = 64;
+	p->num_threads = 2;
+}
+
+/* test_random_file: Writes size random bytes to path.  Returns 1 on success, 0 on failure. */
+static inline int test_random_file(char *path, size_t size){
+
+	unsigned char buf[65536];
+	size_t n = 0;
+	FILE *file = NULL;
+
+	if( ((file = fopen(path, "wb")) == NULL)) return 0;
+	while(size){
+		n = (size > sizeof(buf)) ? sizeof(buf) : size;
+		if(!RAND_bytes(buf, n) || (fwrite(buf, n, 1, file) != 1)){
+			fclose(file);
+			return 0;
+		}
+		size -= n;
+	}
+
+	return fclose(file) == 0;
+}
+
+/* test_tag_random_file: Makes a key at keypath and a random file of size bytes at path, and tags it into
+* path.tag and path.t.  Points p's file names at them.  Returns 1 on success, 0 on failure.
+*/
+static inline int test_tag_random_file(CPOR_params *p, char *path, size_t size, char *keypath){
+
+	static char tagpath[MAXPATHLEN], tpath[MAXPATHLEN];
+	CPOR_key *key = NULL;
+
+	snprintf(tagpath, MAXPATHLEN, "%s.tag", path);
+	snprintf(tpath, MAXPATHLEN, "%s.t", path);
+	p->filename = path;
+	p->key_filename = keypath;
+	p->tag_filename = tagpath;
+	p->t_filename = tpath;
+
+	if(!test_random_file(path, size)) return 0;
+	if(access(keypath, F_OK) != 0){
+		if( ((key = cpor_create_new_keys(p)) == NULL)) return 0;
+		destroy_cpor_key(p, key);
+	}
+
+	return cpor_tag_file(p, path, strlen(path), keypath, tagpath, strlen(tagpath), tpath, strlen(tpath));
+}
+
+/* test_free_port: Returns a TCP port on 127.0.0.1 that nothing was listening on a moment ago, or 0. */
+static inline int test_free_port(){
+
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd = -1, port = 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if( ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)) return 0;
+	if((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) && (getsockname(fd, (struct sockaddr *)&addr, &len) == 0))
+		port = ntohs(addr.sin_port);
+	close(fd);
+
+	return port;
+}
+
+/* test_listen: Listens on a free TCP port of 127.0.0.1 for a stand-in server, setting *port.  Returns the
+* socket, or -1 on failure.
+*/
+static inline int test_listen(int *port){
+
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd = -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if( ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)) return -1;
+	if((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (getsockname(fd, (struct sockaddr *)&addr, &len) < 0) ||
+		(listen(fd, 64) < 0)){
+		close(fd);
+		return -1;
+	}
+	*port = ntohs(addr.sin_port);
+
+	return fd;
+}
+
+/* test_send_all: Sends len bytes of buf on fd.  Returns 1 on success, 0 if the client went away. */
+static inline int test_send_all(int fd, const void *buf, size_t len){
+
+	ssize_t n = 0;
+
+	while(len){
+		if( ((n = send(fd, buf, len, MSG_NOSIGNAL)) <= 0)) return 0;
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+#endif
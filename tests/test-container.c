@@ -0,0 +1,105 @@
+/*
+* test-container.c
+*
+* Tests cpor_tag_container: data over several groups, ending in a short block, tagged into a container must
+* prove over every block through cpor_prove_file, which finds the container on its own; a damaged block in the
+* container must fail the proof.
+*/
+
+#include "test-common.h"
+
+#define CONTAINER_INPUT "container.in"
+#define CONTAINER_DATA "container.dat"
+#define CONTAINER_T "container.dat.t"
+#define CONTAINER_KEY "container.key"
+#define CONTAINER_BLOCKS 50
+#define CONTAINER_TAIL 123
+
+/* container_verify: Proves every block of the container and returns cpor_verify_file's result */
+static int container_verify(CPOR_params *p){
+
+	CPOR_params myparams = *p;
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	int ret = 0;
+
+	myparams.num_challenge = CONTAINER_BLOCKS + 1;
+	CHECK((challenge = cpor_challenge_file(&myparams)) != NULL);
+	CHECK(challenge->l == CONTAINER_BLOCKS + 1);
+	CHECK((proof = cpor_prove_file(&myparams, challenge)) != NULL);
+	ret = cpor_verify_file(&myparams, challenge, proof);
+	destroy_cpor_proof(&myparams, proof);
+	destroy_cpor_challenge(challenge);
+
+	return ret;
+}
+
+/* container_find: Returns the offset in the container of the first 64 bytes of block index of the input */
+static off_t container_find(CPOR_params *p, uint64_t index){
+
+	unsigned char needle[64];
+	unsigned char *buf = NULL;
+	struct stat st;
+	off_t offset = 0;
+	int fd = -1;
+
+	CHECK((fd = open(CONTAINER_INPUT, O_RDONLY)) >= 0);
+	CHECK(pread(fd, needle, sizeof(needle), (off_t)index * p->block_size) == sizeof(needle));
+	close(fd);
+	CHECK((fd = open(CONTAINER_DATA, O_RDONLY)) >= 0);
+	CHECK(fstat(fd, &st) == 0);
+	CHECK((buf = malloc(st.st_size)) != NULL);
+	CHECK(pread(fd, buf, st.st_size, 0) == st.st_size);
+	close(fd);
+	while(memcmp(buf + offset, needle, sizeof(needle)) != 0){
+		offset++;
+		CHECK(offset + sizeof(needle) <= st.st_size);
+	}
+	free(buf);
+
+	return offset;
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_key *key = NULL;
+	FILE *input = NULL;
+	unsigned char byte = 0;
+	off_t offset = 0;
+	int fd = -1;
+
+	test_params(&p, 1024);
+	p.key_filename = CONTAINER_KEY;
+	p.filename = CONTAINER_DATA;
+	p.tag_filename = NULL;
+	p.t_filename = CONTAINER_T;
+	unlink(CONTAINER_KEY);
+	CHECK((key = cpor_create_new_keys(&p)) != NULL);
+	destroy_cpor_key(&p, key);
+	CHECK(test_random_file(CONTAINER_INPUT, (CONTAINER_BLOCKS * p.block_size) + CONTAINER_TAIL));
+
+	CHECK((input = fopen(CONTAINER_INPUT, "rb")) != NULL);
+	CHECK(cpor_tag_container(&p, input, CONTAINER_DATA, CONTAINER_T));
+	fclose(input);
+	CHECK(container_verify(&p) == 1);
+
+	/* A flipped bit in a block of the third group fails the proof */
+	offset = container_find(&p, 40);
+	CHECK((fd = open(CONTAINER_DATA, O_RDWR)) >= 0);
+	CHECK(pread(fd, &byte, 1, offset) == 1);
+	byte ^= 1;
+	CHECK(pwrite(fd, &byte, 1, offset) == 1);
+	CHECK(container_verify(&p) == 0);
+	byte ^= 1;
+	CHECK(pwrite(fd, &byte, 1, offset) == 1);
+	close(fd);
+	CHECK(container_verify(&p) == 1);
+
+	unlink(CONTAINER_INPUT);
+	unlink(CONTAINER_DATA);
+	unlink(CONTAINER_T);
+	unlink(CONTAINER_KEY);
+
+	return 0;
+}
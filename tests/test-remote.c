@@ -0,0 +1,153 @@
+/*
+* test-remote.c
+*
+* Loopback test of the remote auditor against the prover daemon over HTTP.  One batch of audits, many in flight
+* at once, covers a sound file, a file damaged after it was tagged and a file the prover doesn't have: every
+* audit of the sound file must verify, every audit of the damaged one must come back 0 (a proof that doesn't
+* check out) and the missing one -1.  Each file has as many blocks as a challenge asks for, so every audit of
+* the damaged file touches the damaged block.  Paths that leave the prover's root, by being absolute, by .. or
+* through a symlink, must be refused.
+*/
+
+#include "test-common.h"
+#include <curl/curl.h>
+
+#define REMOTE_KEY "remote.key"
+#define REMOTE_GOOD "remote-good.dat"
+#define REMOTE_BAD "remote-bad.dat"
+#define REMOTE_MISSING "remote-missing.dat"
+#define REMOTE_INSIDE "remote-inside.dat"
+#define REMOTE_OUTSIDE "remote-outside.dat"
+#define REMOTE_BLOCKS 64
+#define REMOTE_AUDITS 96
+#define REMOTE_IN_FLIGHT 32
+
+/* remote_copy: Copies the file at from to a new file named by the mkstemp template to.  Returns 1 on success, 0 on
+* failure.
+*/
+static int remote_copy(char *from, char *to){
+
+	char buf[65536];
+	ssize_t n = 0;
+	int in = -1, out = -1, ret = 0;
+
+	if( ((in = open(from, O_RDONLY)) < 0)) return 0;
+	if( ((out = mkstemp(to)) < 0)) goto cleanup;
+	while((n = read(in, buf, sizeof(buf))) > 0)
+		if(write(out, buf, n) != n) goto cleanup;
+	ret = (n == 0);
+
+cleanup:
+	close(in);
+	if(out >= 0) close(out);
+	return ret;
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_prover *prover = NULL;
+	CPOR_remote_auditor *auditor = NULL;
+	CPOR_remote_audit audits[REMOTE_AUDITS];
+	char address[64], url[128];
+	char outside[] = "/tmp/cpor-remote-XXXXXX";
+	char abspath[MAXPATHLEN], cwd[MAXPATHLEN], uppath[2 * MAXPATHLEN];
+	int expected[REMOTE_AUDITS];
+	int verified = 0;
+	int port = 0;
+	int i = 0;
+	FILE *file = NULL;
+	unsigned char byte = 0;
+
+	CHECK(curl_global_init(CURL_GLOBAL_ALL) == 0);
+	test_params(&p, 4096);
+	p.num_challenge = REMOTE_BLOCKS;
+	unlink(REMOTE_KEY);
+	CHECK(test_tag_random_file(&p, REMOTE_BAD, REMOTE_BLOCKS * p.block_size, REMOTE_KEY));
+	CHECK(test_tag_random_file(&p, REMOTE_GOOD, REMOTE_BLOCKS * p.block_size, REMOTE_KEY));
+
+	/* Damage one byte of the bad file's tenth block */
+	CHECK((file = fopen(REMOTE_BAD, "r+b")) != NULL);
+	CHECK(fseek(file, (10 * p.block_size) + 5, SEEK_SET) == 0);
+	CHECK(fread(&byte, 1, 1, file) == 1);
+	byte ^= 0x01;
+	CHECK(fseek(file, (10 * p.block_size) + 5, SEEK_SET) == 0);
+	CHECK(fwrite(&byte, 1, 1, file) == 1);
+	CHECK(fclose(file) == 0);
+
+	/* The prover serves the current directory over TCP */
+	CHECK((port = test_free_port()) != 0);
+	snprintf(address, sizeof(address), "127.0.0.1:%d", port);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/prove", port);
+	CHECK((prover = cpor_start_prover(&p, address, ".")) != NULL);
+	CHECK((auditor = cpor_create_remote_auditor(&p, url, REMOTE_IN_FLIGHT)) != NULL);
+
+	for(i = 0; i < REMOTE_AUDITS; i++){
+		if(i == REMOTE_AUDITS / 2){
+			audits[i].filepath = REMOTE_MISSING;
+			audits[i].tagfilepath = REMOTE_MISSING ".tag";
+			audits[i].tfilepath = REMOTE_GOOD ".t";
+			expected[i] = -1;
+		}else if((i % 4) == 3){
+			audits[i].filepath = REMOTE_BAD;
+			audits[i].tagfilepath = REMOTE_BAD ".tag";
+			audits[i].tfilepath = REMOTE_BAD ".t";
+			expected[i] = 0;
+		}else{
+			audits[i].filepath = REMOTE_GOOD;
+			audits[i].tagfilepath = REMOTE_GOOD ".tag";
+			audits[i].tfilepath = REMOTE_GOOD ".t";
+			expected[i] = 1;
+			verified++;
+		}
+		audits[i].result = 2;
+	}
+
+	CHECK(cpor_remote_audit(auditor, audits, REMOTE_AUDITS) == verified);
+	for(i = 0; i < REMOTE_AUDITS; i++){
+		if(audits[i].result != expected[i]) fprintf(stderr, "audit %d of %s: %d\n", i, audits[i].filepath, audits[i].result);
+		CHECK(audits[i].result == expected[i]);
+	}
+
+	/* The auditor's connections and cached secrets carry over to another batch */
+	CHECK(cpor_remote_audit(auditor, audits, 8) == 6);
+
+	/* Each of these names the good file (or a copy outside the root), so would verify if the prover let it
+	 * leave its root: by an absolute path, by .., or through a symlink.  A symlink inside the root is fine. */
+	CHECK(realpath(REMOTE_GOOD, abspath) != NULL);
+	CHECK(getcwd(cwd, sizeof(cwd)) != NULL);
+	snprintf(uppath, sizeof(uppath), "../%s/%s", strrchr(cwd, '/') + 1, REMOTE_GOOD);
+	CHECK(remote_copy(REMOTE_GOOD, outside));
+	unlink(REMOTE_INSIDE);
+	unlink(REMOTE_OUTSIDE);
+	CHECK(symlink(REMOTE_GOOD, REMOTE_INSIDE) == 0);
+	CHECK(symlink(outside, REMOTE_OUTSIDE) == 0);
+	audits[0].filepath = abspath;
+	audits[1].filepath = uppath;
+	audits[2].filepath = REMOTE_OUTSIDE;
+	audits[3].filepath = REMOTE_INSIDE;
+	for(i = 0; i < 4; i++){
+		audits[i].tagfilepath = REMOTE_GOOD ".tag";
+		audits[i].tfilepath = REMOTE_GOOD ".t";
+		audits[i].result = 2;
+	}
+	CHECK(cpor_remote_audit(auditor, audits, 4) == 1);
+	for(i = 0; i < 3; i++) CHECK(audits[i].result == -1);
+	CHECK(audits[3].result == 1);
+
+	cpor_destroy_remote_auditor(auditor);
+	cpor_stop_prover(prover);
+	curl_global_cleanup();
+	unlink(REMOTE_INSIDE);
+	unlink(REMOTE_OUTSIDE);
+	unlink(outside);
+	unlink(REMOTE_GOOD);
+	unlink(REMOTE_GOOD ".tag");
+	unlink(REMOTE_GOOD ".t");
+	unlink(REMOTE_BAD);
+	unlink(REMOTE_BAD ".tag");
+	unlink(REMOTE_BAD ".t");
+	unlink(REMOTE_KEY);
+
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+* test-resume.c
+*
+* Tests cpor_tag_file's checkpoints: a tagging run killed part way (by going over its file size limit) and then
+* resumed must give tags that prove; a fresh run over a checkpoint left by a killed one must drop it, so a later
+* resume can't pick it up; and a checkpoint that doesn't match the tag file beside it must be refused, leaving
+* the tag file as it was.
+*/
+
+#include "test-common.h"
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define RESUME_DATA "resume.dat"
+#define RESUME_KEY "resume.key"
+#define RESUME_CKPT RESUME_DATA ".tag.ckpt"
+#define RESUME_STALE RESUME_DATA ".stale"
+#define RESUME_BLOCKS 2048
+#define RESUME_SEGMENT 512
+
+/* resume_tag: Tags RESUME_DATA under p.  Returns cpor_tag_file's result. */
+static int resume_tag(CPOR_params *p){
+
+	return cpor_tag_file(p, RESUME_DATA, strlen(RESUME_DATA), RESUME_KEY, p->tag_filename, strlen(p->tag_filename),
+		p->t_filename, strlen(p->t_filename));
+}
+
+/* resume_kill: Tags RESUME_DATA with checkpoints in a child that is killed (SIGXFSZ) once the tag file grows
+* past the first checkpoint, leaving a checkpoint and a partly written tag file behind
+*/
+static void resume_kill(CPOR_params *p, size_t sigma_size){
+
+	CPOR_params myparams = *p;
+	struct rlimit limit;
+	struct stat st;
+	pid_t pid = 0;
+	int status = 0;
+
+	unlink(p->tag_filename);
+	unlink(p->t_filename);
+	CHECK((pid = fork()) >= 0);
+	if(pid == 0){
+		limit.rlim_cur = limit.rlim_max = 0;
+		setrlimit(RLIMIT_CORE, &limit);
+		limit.rlim_cur = limit.rlim_max = sizeof(CPOR_file_header) + (RESUME_SEGMENT * sigma_size) + (RESUME_SEGMENT * sigma_size / 2);
+		setrlimit(RLIMIT_FSIZE, &limit);
+		myparams.checkpoint_blocks = RESUME_SEGMENT;
+		resume_tag(&myparams);
+		_exit(0);
+	}
+	CHECK(waitpid(pid, &status, 0) == pid);
+	CHECK(WIFSIGNALED(status) && (WTERMSIG(status) == SIGXFSZ));
+	CHECK(access(RESUME_CKPT, F_OK) == 0);
+	CHECK(stat(p->tag_filename, &st) == 0);
+	CHECK((uint64_t)st.st_size > sizeof(CPOR_file_header) + (RESUME_SEGMENT * sigma_size));
+}
+
+/* resume_check: Checks the tag file is complete and that a proof over every block verifies */
+static void resume_check(CPOR_params *p, size_t sigma_size){
+
+	CPOR_params myparams = *p;
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	struct stat st;
+
+	CHECK(stat(p->tag_filename, &st) == 0);
+	CHECK((uint64_t)st.st_size == sizeof(CPOR_file_header) + (RESUME_BLOCKS * sigma_size));
+	myparams.num_challenge = RESUME_BLOCKS;
+	CHECK((challenge = cpor_challenge_file(&myparams)) != NULL);
+	CHECK((proof = cpor_prove_file(&myparams, challenge)) != NULL);
+	CHECK(cpor_verify_file(&myparams, challenge, proof) == 1);
+	destroy_cpor_proof(&myparams, proof);
+	destroy_cpor_challenge(challenge);
+}
+
+/* resume_copy: Copies the file at from to to */
+static void resume_copy(char *from, char *to){
+
+	char buf[65536];
+	size_t n = 0;
+	FILE *in = NULL, *out = NULL;
+
+	CHECK((in = fopen(from, "rb")) != NULL);
+	CHECK((out = fopen(to, "wb")) != NULL);
+	while((n = fread(buf, 1, sizeof(buf), in)) > 0) CHECK(fwrite(buf, n, 1, out) == 1);
+	fclose(in);
+	CHECK(fclose(out) == 0);
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_key *key = NULL;
+	size_t sigma_size = 0;
+
+	test_params(&p, 1024);
+	unlink(RESUME_KEY);
+	unlink(RESUME_CKPT);
+	CHECK(test_tag_random_file(&p, RESUME_DATA, (RESUME_BLOCKS * p.block_size) - 1, RESUME_KEY));
+	CHECK((key = cpor_get_keys(&p)) != NULL);
+	sigma_size = BN_num_bytes(key->global->Zp);
+	destroy_cpor_key(&p, key);
+
+	/* Killed, then resumed */
+	resume_kill(&p, sigma_size);
+	p.resume = 1;
+	CHECK(resume_tag(&p));
+	p.resume = 0;
+	CHECK(access(RESUME_CKPT, F_OK) != 0);
+	resume_check(&p, sigma_size);
+
+	/* Killed, then tagged afresh: the checkpoint goes, and a resume afterwards finds nothing to resume */
+	resume_kill(&p, sigma_size);
+	resume_copy(RESUME_CKPT, RESUME_STALE);
+	unlink(p.tag_filename);
+	unlink(p.t_filename);
+	CHECK(resume_tag(&p));
+	CHECK(access(RESUME_CKPT, F_OK) != 0);
+	resume_check(&p, sigma_size);
+	p.resume = 1;
+	CHECK(!resume_tag(&p));
+	resume_check(&p, sigma_size);
+
+	/* A checkpoint from another run is refused, and the tags it doesn't match are left alone */
+	CHECK(rename(RESUME_STALE, RESUME_CKPT) == 0);
+	CHECK(!resume_tag(&p));
+	resume_check(&p, sigma_size);
+	p.resume = 0;
+
+	unlink(RESUME_CKPT);
+	unlink(RESUME_DATA);
+	unlink(p.tag_filename);
+	unlink(p.t_filename);
+	unlink(RESUME_KEY);
+
+	return 0;
+}
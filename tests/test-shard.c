@@ -0,0 +1,114 @@
+/*
+* test-shard.c
+*
+* Tests cpor_shard_tags, cpor_prove_shard and cpor_combine_proofs: a file split into shards at uneven block
+* boundaries (the last shard holding the short final block), each proven on its own, must combine into a proof
+* the whole file's verifier accepts; leaving out a shard or damaging one's data must fail.
+*/
+
+#include "test-common.h"
+
+#define SHARD_DATA "shard.dat"
+#define SHARD_KEY "shard.key"
+#define SHARD_BLOCKS 100
+#define SHARD_TAIL 500
+#define SHARD_COUNT 3
+
+/* Shards are blocks shard_bounds[k] through shard_bounds[k+1]-1 */
+static uint64_t shard_bounds[SHARD_COUNT + 1] = {0, 37, 38, SHARD_BLOCKS + 1};
+
+/* shard_copy: Copies blocks first through last-1 of the data file to path */
+static void shard_copy(CPOR_params *p, char *path, uint64_t first, uint64_t last){
+
+	unsigned char block[1024];
+	ssize_t got = 0;
+	int in = -1, out = -1;
+
+	CHECK(p->block_size == sizeof(block));
+	CHECK((in = open(SHARD_DATA, O_RDONLY)) >= 0);
+	CHECK((out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) >= 0);
+	for(; first < last; first++){
+		CHECK((got = pread(in, block, sizeof(block), (off_t)first * p->block_size)) > 0);
+		CHECK(write(out, block, got) == got);
+	}
+	close(in);
+	CHECK(close(out) == 0);
+}
+
+/* shard_prove: Proves challenge from each shard and returns cpor_verify_file's result for the combination of the
+* numproofs shards from the first one
+*/
+static int shard_prove(CPOR_params *p, CPOR_challenge *challenge, unsigned int numproofs){
+
+	CPOR_params myparams = *p;
+	CPOR_proof *proofs[SHARD_COUNT];
+	CPOR_proof *proof = NULL;
+	char datapath[64], tagpath[64];
+	unsigned int k = 0;
+	int ret = 0;
+
+	for(k = 0; k < numproofs; k++){
+		snprintf(datapath, sizeof(datapath), "%s.%u", SHARD_DATA, k);
+		snprintf(tagpath, sizeof(tagpath), "%s.%u.tag", SHARD_DATA, k);
+		myparams.filename = datapath;
+		myparams.tag_filename = tagpath;
+		CHECK((proofs[k] = cpor_prove_shard(&myparams, challenge)) != NULL);
+	}
+	CHECK((proof = cpor_combine_proofs(p, challenge, proofs, numproofs)) != NULL);
+	ret = cpor_verify_file(p, challenge, proof);
+	for(k = 0; k < numproofs; k++) destroy_cpor_proof(p, proofs[k]);
+	destroy_cpor_proof(p, proof);
+
+	return ret;
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_challenge *challenge = NULL;
+	char datapath[64], tagpath[64];
+	unsigned char byte = 0;
+	unsigned int k = 0;
+	int fd = -1;
+
+	test_params(&p, 1024);
+	unlink(SHARD_KEY);
+	CHECK(test_tag_random_file(&p, SHARD_DATA, (SHARD_BLOCKS * p.block_size) + SHARD_TAIL, SHARD_KEY));
+	for(k = 0; k < SHARD_COUNT; k++){
+		snprintf(datapath, sizeof(datapath), "%s.%u", SHARD_DATA, k);
+		snprintf(tagpath, sizeof(tagpath), "%s.%u.tag", SHARD_DATA, k);
+		shard_copy(&p, datapath, shard_bounds[k], shard_bounds[k + 1]);
+		CHECK(cpor_shard_tags(&p, p.tag_filename, tagpath, shard_bounds[k], shard_bounds[k + 1]));
+	}
+
+	/* Every block is challenged, so every shard contributes */
+	p.num_challenge = SHARD_BLOCKS + 1;
+	CHECK((challenge = cpor_challenge_file(&p)) != NULL);
+	CHECK(shard_prove(&p, challenge, SHARD_COUNT) == 1);
+
+	/* Without the last shard the proof is short its blocks */
+	CHECK(shard_prove(&p, challenge, SHARD_COUNT - 1) == 0);
+
+	/* A damaged block in a shard fails the combined proof */
+	snprintf(datapath, sizeof(datapath), "%s.%u", SHARD_DATA, 1);
+	CHECK((fd = open(datapath, O_RDWR)) >= 0);
+	CHECK(pread(fd, &byte, 1, 0) == 1);
+	byte ^= 1;
+	CHECK(pwrite(fd, &byte, 1, 0) == 1);
+	close(fd);
+	CHECK(shard_prove(&p, challenge, SHARD_COUNT) == 0);
+
+	destroy_cpor_challenge(challenge);
+	for(k = 0; k < SHARD_COUNT; k++){
+		snprintf(datapath, sizeof(datapath), "%s.%u", SHARD_DATA, k);
+		snprintf(tagpath, sizeof(tagpath), "%s.%u.tag", SHARD_DATA, k);
+		unlink(datapath);
+		unlink(tagpath);
+	}
+	unlink(SHARD_DATA);
+	unlink(p.tag_filename);
+	unlink(p.t_filename);
+	unlink(SHARD_KEY);
+
+	return 0;
+}
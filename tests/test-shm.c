@@ -0,0 +1,86 @@
+/*
+* test-shm.c
+*
+* Runs the prover load test against the prover daemon through a shared-memory exchange ("shm:" address), with
+* one request in flight at a time, as many as the rings have slots, and more than that, so the sender has to
+* wait for slots to come free; then from two clients at once, each with its own exchange; and once over the
+* plain socket for comparison.  Every proof must come back and verify.  An exchange whose number of slots isn't
+* a power of two must be refused, leaving the connection to go on over its socket.
+*/
+
+#include "test-common.h"
+#include <pthread.h>
+
+#define SHM_DATA "shm.dat"
+#define SHM_KEY "shm.key"
+#define SHM_SOCKET "shm.sock"
+#define SHM_ADDRESS "shm:" SHM_SOCKET
+#define SHM_BLOCKS 256
+#define SHM_REQUESTS 200
+
+static CPOR_params shm_params;
+
+/* shm_client: A load test from another client, alongside the main thread's */
+static void *shm_client(void *arg){
+
+	CPOR_params myparams = shm_params;
+
+	*(int *)arg = cpor_prover_load_test(&myparams, SHM_ADDRESS, SHM_REQUESTS, 8);
+
+	return NULL;
+}
+
+int main(){
+
+	CPOR_prover *prover = NULL;
+	CPOR_prepared *prepared = NULL;
+	CPOR_challenge_seed *seed = NULL;
+	CPOR_proof *proof = NULL;
+	CPOR_msg_conn *conn = NULL;
+	pthread_t client;
+	uint64_t id = 0;
+	int other = 0;
+
+	test_params(&shm_params, 4096);
+	shm_params.num_challenge = 16;
+	unlink(SHM_KEY);
+	CHECK(test_tag_random_file(&shm_params, SHM_DATA, SHM_BLOCKS * shm_params.block_size, SHM_KEY));
+	CHECK((prover = cpor_start_prover(&shm_params, SHM_SOCKET, ".")) != NULL);
+
+	/* The connection really is through shared memory */
+	CHECK((conn = cpor_msg_connect(SHM_ADDRESS)) != NULL);
+	CHECK(conn->shm != NULL);
+	cpor_msg_close(conn);
+
+	/* Slot counts that aren't a power of two are refused, and the socket still serves */
+	CHECK((conn = cpor_msg_connect(SHM_SOCKET)) != NULL);
+	CHECK(!cpor_msg_attach_shm(conn, CPOR_SHM_SLOT_SIZE, 3));
+	CHECK(conn->shm == NULL);
+	CHECK((prepared = cpor_prepare_challenge_file(&shm_params, shm_params.t_filename, &seed)) != NULL);
+	CHECK(cpor_prover_send_challenge(conn, 7, seed, prepared->global, shm_params.filename, shm_params.tag_filename));
+	CHECK((proof = cpor_prover_recv_proof(&shm_params, conn, &id, prepared->global)) != NULL);
+	CHECK((id == 7) && (cpor_verify_finish(&shm_params, prepared, proof) == 1));
+	destroy_cpor_proof(&shm_params, proof);
+	destroy_cpor_challenge_seed(seed);
+	destroy_cpor_prepared(&shm_params, prepared);
+	cpor_msg_close(conn);
+
+	CHECK(cpor_prover_load_test(&shm_params, SHM_ADDRESS, SHM_REQUESTS, 1));
+	CHECK(cpor_prover_load_test(&shm_params, SHM_ADDRESS, SHM_REQUESTS, CPOR_SHM_SLOTS));
+	CHECK(cpor_prover_load_test(&shm_params, SHM_ADDRESS, SHM_REQUESTS, 4 * CPOR_SHM_SLOTS));
+
+	CHECK(pthread_create(&client, NULL, shm_client, &other) == 0);
+	CHECK(cpor_prover_load_test(&shm_params, SHM_ADDRESS, SHM_REQUESTS, 8));
+	CHECK(pthread_join(client, NULL) == 0);
+	CHECK(other);
+
+	CHECK(cpor_prover_load_test(&shm_params, SHM_SOCKET, SHM_REQUESTS, 8));
+
+	cpor_stop_prover(prover);
+	unlink(SHM_DATA);
+	unlink(shm_params.tag_filename);
+	unlink(shm_params.t_filename);
+	unlink(SHM_KEY);
+
+	return 0;
+}
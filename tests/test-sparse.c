@@ -0,0 +1,109 @@
+/*
+* test-sparse.c
+*
+* Proves blocks past 2^32 of a sparse file, to check that block indices and file offsets are 64-bit end to end:
+* the tag file's header, the PRF input, the tag and data reads, the proof and its verification.  The file has a
+* 64-byte block size so 2^32 blocks take 256 GB of holes rather than 16 TB.  Only the challenged blocks get
+* data and tags; tagging the rest would take days.
+*/
+
+#include "test-common.h"
+
+#define SPARSE_BLOCK_SIZE 64
+#define SPARSE_DATA "sparse.dat"
+#define SPARSE_TAG "sparse.dat.tag"
+
+int main(){
+
+	CPOR_params p;
+	CPOR_global *global = NULL;
+	CPOR_t *t = NULL;
+	CPOR_tag *tag = NULL, *low = NULL;
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	BIGNUM *nu = NULL;
+	FILE *tagfile = NULL;
+	unsigned char block[SPARSE_BLOCK_SIZE];
+	unsigned char sigma[64];
+	uint64_t n = (1ULL << 32) + 8;
+	uint64_t indices[] = { 3, (1ULL << 32) - 1, 1ULL << 32, (1ULL << 32) + 5, (1ULL << 32) + 7 };
+	unsigned int l = sizeof(indices) / sizeof(uint64_t), i = 0;
+	size_t sigma_size = 0;
+	int fd = -1;
+
+	test_params(&p, SPARSE_BLOCK_SIZE);
+	p.filename = SPARSE_DATA;
+	p.tag_filename = SPARSE_TAG;
+	CHECK((global = cpor_create_global(p.Zp_bits)) != NULL);
+	CHECK((t = cpor_create_t(&p, global, n)) != NULL);
+	sigma_size = BN_num_bytes(global->Zp);
+	CHECK(sigma_size <= sizeof(sigma));
+
+	/* A data file of n blocks, all holes */
+	CHECK((fd = open(SPARSE_DATA, O_RDWR | O_CREAT | O_TRUNC, 0600)) >= 0);
+	if(ftruncate(fd, (off_t)(n * SPARSE_BLOCK_SIZE)) < 0){
+		fprintf(stderr, "This filesystem can't hold a %llu byte sparse file; skipping.\n", (unsigned long long)(n * SPARSE_BLOCK_SIZE));
+		close(fd);
+		unlink(SPARSE_DATA);
+		return TEST_SKIP;
+	}
+
+	/* A tag file whose header claims all n blocks, with holes for the tags we don't make */
+	CHECK((tagfile = fopen(SPARSE_TAG, "wb")) != NULL);
+	CHECK(write_cpor_tag_header(&p, tagfile, sigma_size, n));
+	CHECK(fflush(tagfile) == 0);
+	CHECK(ftruncate(fileno(tagfile), (off_t)(sizeof(CPOR_file_header) + (n * sigma_size))) == 0);
+
+	/* Give each challenged block data and a tag, at offsets only 64-bit arithmetic reaches */
+	for(i = 0; i < l; i++){
+		CHECK(RAND_bytes(block, sizeof(block)));
+		CHECK(pwrite(fd, block, sizeof(block), (off_t)(indices[i] * SPARSE_BLOCK_SIZE)) == sizeof(block));
+		CHECK((tag = cpor_tag_block(&p, global, t->k_prf, t->alpha, block, indices[i])) != NULL);
+		CHECK(BN_bn2binpad(tag->sigma, sigma, sigma_size) == (int)sigma_size);
+		CHECK(fseeko(tagfile, (off_t)(sizeof(CPOR_file_header) + (indices[i] * sigma_size)), SEEK_SET) == 0);
+		CHECK(fwrite(sigma, sigma_size, 1, tagfile) == 1);
+
+		/* The PRF sees all 64 bits of the index: block 2^32 + k isn't tagged as block k */
+		if(indices[i] >> 32){
+			CHECK((low = cpor_tag_block(&p, global, t->k_prf, t->alpha, block, indices[i] & 0xffffffff)) != NULL);
+			CHECK(BN_cmp(low->sigma, tag->sigma) != 0);
+			destroy_cpor_tag(low);
+		}
+		destroy_cpor_tag(tag);
+	}
+	CHECK(fclose(tagfile) == 0);
+
+	/* Challenge exactly those blocks */
+	CHECK((nu = BN_new()) != NULL);
+	CHECK((challenge = allocate_cpor_challenge(l, BN_num_bytes(global->Zp))) != NULL);
+	CHECK(BN_copy(challenge->global->Zp, global->Zp) != NULL);
+	for(i = 0; i < l; i++){
+		challenge->I[i] = indices[i];
+		CHECK(BN_rand_range(nu, global->Zp));
+		CHECK(BN_bn2binpad(nu, cpor_challenge_nu(challenge, i), challenge->element_size) >= 0);
+	}
+
+	CHECK((proof = cpor_prove_file(&p, challenge)) != NULL);
+	CHECK(cpor_verify_proof(&p, global, proof, challenge, t->k_prf, t->alpha) == 1);
+	destroy_cpor_proof(&p, proof);
+
+	/* Damage block 2^32 + 5: the proof must now fail */
+	CHECK(pread(fd, block, sizeof(block), (off_t)(indices[3] * SPARSE_BLOCK_SIZE)) == sizeof(block));
+	block[0] ^= 1;
+	CHECK(pwrite(fd, block, sizeof(block), (off_t)(indices[3] * SPARSE_BLOCK_SIZE)) == sizeof(block));
+	CHECK((proof = cpor_prove_file(&p, challenge)) != NULL);
+	CHECK(cpor_verify_proof(&p, global, proof, challenge, t->k_prf, t->alpha) == 0);
+	destroy_cpor_proof(&p, proof);
+
+	close(fd);
+	unlink(SPARSE_DATA);
+	unlink(SPARSE_TAG);
+	destroy_cpor_challenge(challenge);
+	BN_free(nu);
+	destroy_cpor_t(&p, t);
+	destroy_cpor_global(global);
+
+	printf("Proved %u blocks of a %llu block sparse file\n", l, (unsigned long long)n);
+
+	return 0;
+}
@@ -0,0 +1,303 @@
+/*
+* test-store.c
+*
+* Tests cpor_prove_object against a stand-in object store: a small HTTP server in a thread of the test, serving
+* the files in the current directory and logging every range asked for.  It checks that challenged blocks lying
+* CPOR_STORE_COALESCE_GAP bytes apart or closer are fetched in one range and that no range is longer than
+* CPOR_STORE_MAX_RANGE, that a last block cut short by the end of the file is proven as if zero-padded, and that
+* a store ignoring Range headers (answering 200 with the whole object from offset 0) still gets a proof.  Shards
+* in the store, proven one by one, must combine into a proof that verifies, and a damaged block must fail one.
+*/
+
+#include "test-common.h"
+#include <curl/curl.h>
+#include <pthread.h>
+#include <strings.h>
+
+#define STORE_KEY "store.key"
+#define STORE_DATA "store.dat"
+#define STORE_FULL_BLOCKS 699
+#define STORE_TAIL 1000			/* Bytes of the short block after them */
+#define STORE_MAX_LOG 64
+#define STORE_SPLIT 300				/* The two shards are blocks up to this one, and from it on */
+
+/* What the server was asked for: a range of a path, or last == -1 for no range */
+struct store_request{
+	char path[64];
+	long long first;
+	long long last;
+	int status;
+};
+
+static struct{
+	int fd;
+	int port;
+	struct store_request log[STORE_MAX_LOG];
+	int numlog;
+	pthread_mutex_t lock;
+} server;
+
+/* store_serve: Answers the GETs on one connection.  Paths under /whole/ are served as by a store that ignores
+* Range headers.
+*/
+static void *store_serve(void *arg){
+
+	struct store_request req;
+	struct stat st;
+	char in[8192], head[256], *end = NULL, *range = NULL, *path = NULL;
+	unsigned char body[65536];
+	size_t have = 0, head_len = 0;
+	ssize_t n = 0;
+	long long first = 0, last = 0, pos = 0;
+	int fd = (int)(intptr_t)arg, file = -1, whole = 0;
+
+	while(1){
+		while( ((end = strstr(in, "\r\n\r\n")) == NULL) || (have == 0)){
+			if((have == sizeof(in) - 1) || ((n = recv(fd, in + have, sizeof(in) - 1 - have, 0)) <= 0)) goto done;
+			have += n;
+			in[have] = '\0';
+		}
+		head_len = end + 4 - in;
+		end[2] = '\0';
+
+		memset(&req, 0, sizeof(req));
+		req.last = -1;
+		if(sscanf(in, "GET /%63s HTTP/1.1", req.path) != 1) goto done;
+		path = req.path;
+		if( ((whole = !strncmp(path, "whole/", 6)))) path += 6;
+		for(range = strstr(in, "\r\n"); range; range = strstr(range + 2, "\r\n"))
+			if(!strncasecmp(range + 2, "Range: bytes=", 13) && (sscanf(range + 15, "%lld-%lld", &req.first, &req.last) == 2)) break;
+
+		/* Answer: 200 with the whole object, 206 with the part of the range it has, or 416 */
+		file = open(path, O_RDONLY);
+		if((file < 0) || (fstat(file, &st) < 0)){
+			req.status = 404;
+			first = 0;
+			last = -1;
+		}else if(whole || (req.last < 0)){
+			req.status = 200;
+			first = 0;
+			last = st.st_size - 1;
+		}else if(req.first >= st.st_size){
+			req.status = 416;
+			first = 0;
+			last = -1;
+		}else{
+			req.status = 206;
+			first = req.first;
+			last = (req.last < st.st_size) ? req.last : st.st_size - 1;
+		}
+		pthread_mutex_lock(&server.lock);
+		if(server.numlog < STORE_MAX_LOG) server.log[server.numlog++] = req;
+		pthread_mutex_unlock(&server.lock);
+
+		if(req.status == 206)
+			snprintf(head, sizeof(head), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\n\r\n",
+				first, last, (long long)st.st_size, last - first + 1);
+		else
+			snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %lld\r\n\r\n", req.status,
+				(req.status == 200) ? "OK" : (req.status == 404) ? "Not Found" : "Range Not Satisfiable", last - first + 1);
+		if(!test_send_all(fd, head, strlen(head))) goto done;
+		for(pos = first; pos <= last; pos += n){
+			n = ((last - pos + 1) < (long long)sizeof(body)) ? (last - pos + 1) : (long long)sizeof(body);
+			if((pread(file, body, n, pos) != n) || !test_send_all(fd, body, n)) goto done;
+		}
+		if(file >= 0) close(file);
+		file = -1;
+
+		memmove(in, in + head_len, have - head_len + 1);
+		have -= head_len;
+	}
+
+done:
+	if(file >= 0) close(file);
+	close(fd);
+	return NULL;
+}
+
+static void *store_accept(void *arg){
+
+	pthread_t thread;
+	int fd = -1;
+
+	while( ((fd = accept(server.fd, NULL, NULL)) >= 0))
+		if(pthread_create(&thread, NULL, store_serve, (void *)(intptr_t)fd) == 0) pthread_detach(thread);
+		else close(fd);
+
+	return NULL;
+}
+
+/* store_start: Starts the server on a free port of 127.0.0.1.  Returns 1 on success, 0 on failure. */
+static int store_start(){
+
+	pthread_t thread;
+
+	pthread_mutex_init(&server.lock, NULL);
+	if( ((server.fd = test_listen(&server.port)) < 0)) return 0;
+	if(pthread_create(&thread, NULL, store_accept, NULL) != 0) return 0;
+	pthread_detach(thread);
+
+	return 1;
+}
+
+/* store_logged: Whether the server was asked for first through last of path, and answered with status */
+static int store_logged(char *path, long long first, long long last, int status){
+
+	int i = 0, found = 0;
+
+	pthread_mutex_lock(&server.lock);
+	for(i = 0; i < server.numlog; i++)
+		if(!strcmp(server.log[i].path, path) && (server.log[i].first == first) && (server.log[i].last == last) &&
+			(server.log[i].status == status)) found = 1;
+	pthread_mutex_unlock(&server.lock);
+
+	return found;
+}
+
+static int store_numlogged(){
+
+	int n = 0;
+
+	pthread_mutex_lock(&server.lock);
+	n = server.numlog;
+	server.numlog = 0;
+	pthread_mutex_unlock(&server.lock);
+
+	return n;
+}
+
+/* store_shard: Writes shard k of the file, its data and its tags, to store-shard-k.dat and store-shard-k.tag */
+static void store_shard(CPOR_params *p, char *tagpath, int k){
+
+	char datapath[64], shardtagpath[64];
+	unsigned char *buf = NULL;
+	off_t from = k ? (off_t)STORE_SPLIT * p->block_size : 0;
+	size_t len = k ? ((STORE_FULL_BLOCKS - STORE_SPLIT) * p->block_size) + STORE_TAIL : STORE_SPLIT * p->block_size;
+	int in = -1, out = -1;
+
+	snprintf(datapath, sizeof(datapath), "store-shard-%d.dat", k);
+	snprintf(shardtagpath, sizeof(shardtagpath), "store-shard-%d.tag", k);
+	CHECK((buf = malloc(len)) != NULL);
+	CHECK((in = open(STORE_DATA, O_RDONLY)) >= 0);
+	CHECK(pread(in, buf, len, from) == len);
+	close(in);
+	CHECK((out = open(datapath, O_WRONLY | O_CREAT | O_TRUNC, 0600)) >= 0);
+	CHECK(write(out, buf, len) == len);
+	CHECK(close(out) == 0);
+	free(buf);
+	CHECK(cpor_shard_tags(p, tagpath, shardtagpath, k ? STORE_SPLIT : 0, k ? STORE_FULL_BLOCKS + 1 : STORE_SPLIT));
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_object_store *store = NULL;
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL, *shards[2];
+	BIGNUM *nu = NULL;
+	CPOR_key *key = NULL;
+	char dataurl[128], tagurl[128], tagpath[64];
+	uint64_t indices[308];
+	unsigned int l = 0, i = 0;
+	long long B = 4096, H = sizeof(CPOR_file_header), S = 0;
+	unsigned char byte = 0;
+	int fd = -1;
+
+	CHECK(curl_global_init(CURL_GLOBAL_ALL) == 0);
+	test_params(&p, (unsigned int)B);
+	unlink(STORE_KEY);
+	CHECK(test_tag_random_file(&p, STORE_DATA, (STORE_FULL_BLOCKS * B) + STORE_TAIL, STORE_KEY));
+	snprintf(tagpath, sizeof(tagpath), "%s", p.tag_filename);
+	CHECK((key = cpor_get_keys(&p)) != NULL);
+	S = BN_num_bytes(key->global->Zp);
+	CHECK(store_start());
+	CHECK((store = cpor_open_object_store(4)) != NULL);
+
+	/* Blocks 0, 1, 3 and 5 are a block (4 KB) apart or less, so are one range, as are 100 and 101.  The 301
+	 * blocks from 300 are split at 1 MB, after 256 of them.  The last block is the short one. */
+	indices[l++] = 0;
+	indices[l++] = 1;
+	indices[l++] = 3;
+	indices[l++] = 5;
+	indices[l++] = 100;
+	indices[l++] = 101;
+	for(i = 300; i <= 600; i++) indices[l++] = i;
+	indices[l++] = STORE_FULL_BLOCKS;
+	CHECK((nu = BN_new()) != NULL);
+	CHECK((challenge = allocate_cpor_challenge(l, BN_num_bytes(key->global->Zp))) != NULL);
+	CHECK(BN_copy(challenge->global->Zp, key->global->Zp) != NULL);
+	for(i = 0; i < l; i++){
+		challenge->I[i] = indices[l - 1 - i];
+		CHECK(BN_rand_range(nu, key->global->Zp));
+		CHECK(BN_bn2binpad(nu, cpor_challenge_nu(challenge, i), challenge->element_size) >= 0);
+	}
+
+	snprintf(dataurl, sizeof(dataurl), "http://127.0.0.1:%d/%s", server.port, STORE_DATA);
+	snprintf(tagurl, sizeof(tagurl), "http://127.0.0.1:%d/%s", server.port, tagpath);
+	CHECK((proof = cpor_prove_object(&p, store, dataurl, tagurl, challenge)) != NULL);
+	CHECK(cpor_verify_file(&p, challenge, proof) == 1);
+	destroy_cpor_proof(&p, proof);
+
+	/* The header, five data ranges and one range of tags (the sigmas all lie within 4 KB of each other) */
+	CHECK(store_logged(tagpath, 0, H - 1, 206));
+	CHECK(store_logged(STORE_DATA, 0, (6 * B) - 1, 206));
+	CHECK(store_logged(STORE_DATA, 100 * B, (102 * B) - 1, 206));
+	CHECK(store_logged(STORE_DATA, 300 * B, (300 * B) + (1 << 20) - 1, 206));
+	CHECK(store_logged(STORE_DATA, 556 * B, (601 * B) - 1, 206));
+	CHECK(store_logged(STORE_DATA, STORE_FULL_BLOCKS * B, ((STORE_FULL_BLOCKS + 1) * B) - 1, 206));
+	CHECK(store_logged(tagpath, H, H + ((STORE_FULL_BLOCKS + 1) * S) - 1, 206));
+	CHECK(store_numlogged() == 7);
+
+	/* The same from a store that ignores Range */
+	snprintf(dataurl, sizeof(dataurl), "http://127.0.0.1:%d/whole/%s", server.port, STORE_DATA);
+	snprintf(tagurl, sizeof(tagurl), "http://127.0.0.1:%d/whole/%s", server.port, tagpath);
+	CHECK((proof = cpor_prove_object(&p, store, dataurl, tagurl, challenge)) != NULL);
+	CHECK(cpor_verify_file(&p, challenge, proof) == 1);
+	destroy_cpor_proof(&p, proof);
+	CHECK(store_numlogged() == 7);
+
+	/* A tag URL that isn't a tag file, and a missing object, get no proof */
+	CHECK((proof = cpor_prove_object(&p, store, dataurl, dataurl, challenge)) == NULL);
+	snprintf(dataurl, sizeof(dataurl), "http://127.0.0.1:%d/missing.dat", server.port);
+	CHECK((proof = cpor_prove_object(&p, store, dataurl, tagurl, challenge)) == NULL);
+
+	/* Two shards in the store, each proven on its own, combine into a proof of the whole file */
+	for(i = 0; i < 2; i++){
+		store_shard(&p, tagpath, i);
+		snprintf(dataurl, sizeof(dataurl), "http://127.0.0.1:%d/store-shard-%u.dat", server.port, i);
+		snprintf(tagurl, sizeof(tagurl), "http://127.0.0.1:%d/store-shard-%u.tag", server.port, i);
+		CHECK((shards[i] = cpor_prove_object(&p, store, dataurl, tagurl, challenge)) != NULL);
+	}
+	CHECK((proof = cpor_combine_proofs(&p, challenge, shards, 2)) != NULL);
+	CHECK(cpor_verify_file(&p, challenge, proof) == 1);
+	destroy_cpor_proof(&p, proof);
+	for(i = 0; i < 2; i++) destroy_cpor_proof(&p, shards[i]);
+
+	/* A flipped bit in a challenged block fails the proof */
+	CHECK((fd = open(STORE_DATA, O_RDWR)) >= 0);
+	CHECK(pread(fd, &byte, 1, 101 * B) == 1);
+	byte ^= 1;
+	CHECK(pwrite(fd, &byte, 1, 101 * B) == 1);
+	close(fd);
+	snprintf(dataurl, sizeof(dataurl), "http://127.0.0.1:%d/%s", server.port, STORE_DATA);
+	snprintf(tagurl, sizeof(tagurl), "http://127.0.0.1:%d/%s", server.port, tagpath);
+	CHECK((proof = cpor_prove_object(&p, store, dataurl, tagurl, challenge)) != NULL);
+	CHECK(cpor_verify_file(&p, challenge, proof) == 0);
+	destroy_cpor_proof(&p, proof);
+
+	cpor_close_object_store(store);
+	destroy_cpor_challenge(challenge);
+	BN_free(nu);
+	destroy_cpor_key(&p, key);
+	curl_global_cleanup();
+	unlink("store-shard-0.dat");
+	unlink("store-shard-0.tag");
+	unlink("store-shard-1.dat");
+	unlink("store-shard-1.tag");
+	unlink(STORE_DATA);
+	unlink(tagpath);
+	unlink(p.t_filename);
+	unlink(STORE_KEY);
+
+	return 0;
+}
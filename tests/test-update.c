@@ -0,0 +1,85 @@
+/*
+* test-update.c
+*
+* Tests cpor_update_block: blocks rewritten in place, including the short final block, must prove once their
+* tags are updated; a block rewritten without updating its tag must fail the proof until it is; and a block
+* past the end of the tagged file is refused.
+*/
+
+#include "test-common.h"
+
+#define UPDATE_DATA "update.dat"
+#define UPDATE_KEY "update.key"
+#define UPDATE_BLOCKS 64
+#define UPDATE_TAIL 100
+
+/* update_verify: Proves every block of the file and returns cpor_verify_file's result */
+static int update_verify(CPOR_params *p){
+
+	CPOR_params myparams = *p;
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	int ret = 0;
+
+	myparams.num_challenge = UPDATE_BLOCKS + 1;
+	CHECK((challenge = cpor_challenge_file(&myparams)) != NULL);
+	CHECK(challenge->l == UPDATE_BLOCKS + 1);
+	CHECK((proof = cpor_prove_file(&myparams, challenge)) != NULL);
+	ret = cpor_verify_file(&myparams, challenge, proof);
+	destroy_cpor_proof(&myparams, proof);
+	destroy_cpor_challenge(challenge);
+
+	return ret;
+}
+
+/* update_rewrite: Rewrites size bytes of block index with random bytes, leaving the old and new block (zero-padded
+* to a whole block) in old_block and new_block
+*/
+static void update_rewrite(CPOR_params *p, int fd, uint64_t index, size_t size, unsigned char *old_block, unsigned char *new_block){
+
+	off_t offset = (off_t)index * p->block_size;
+
+	memset(old_block, 0, p->block_size);
+	memset(new_block, 0, p->block_size);
+	CHECK(pread(fd, old_block, size, offset) == size);
+	CHECK(RAND_bytes(new_block, size));
+	CHECK(pwrite(fd, new_block, size, offset) == size);
+}
+
+int main(){
+
+	CPOR_params p;
+	unsigned char old_block[1024], new_block[1024];
+	int fd = -1;
+
+	test_params(&p, sizeof(old_block));
+	unlink(UPDATE_KEY);
+	CHECK(test_tag_random_file(&p, UPDATE_DATA, (UPDATE_BLOCKS * p.block_size) + UPDATE_TAIL, UPDATE_KEY));
+	CHECK((fd = open(UPDATE_DATA, O_RDWR)) >= 0);
+	CHECK(update_verify(&p) == 1);
+
+	/* A whole block and the short final block, each rewritten and updated */
+	update_rewrite(&p, fd, 5, p.block_size, old_block, new_block);
+	CHECK(cpor_update_block(&p, 5, old_block, new_block));
+	update_rewrite(&p, fd, UPDATE_BLOCKS, UPDATE_TAIL, old_block, new_block);
+	CHECK(cpor_update_block(&p, UPDATE_BLOCKS, old_block, new_block));
+	CHECK(update_verify(&p) == 1);
+
+	/* A block rewritten without its tag fails, until the tag catches up */
+	update_rewrite(&p, fd, 9, p.block_size, old_block, new_block);
+	CHECK(update_verify(&p) == 0);
+	CHECK(cpor_update_block(&p, 9, old_block, new_block));
+	CHECK(update_verify(&p) == 1);
+
+	/* There's no block past the end to update */
+	CHECK(!cpor_update_block(&p, UPDATE_BLOCKS + 1, old_block, new_block));
+	CHECK(update_verify(&p) == 1);
+
+	close(fd);
+	unlink(UPDATE_DATA);
+	unlink(p.tag_filename);
+	unlink(p.t_filename);
+	unlink(UPDATE_KEY);
+
+	return 0;
+}
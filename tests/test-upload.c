@@ -0,0 +1,356 @@
+/*
+* test-upload.c
+*
+* Tests the tag upload against a stand-in endpoint: a small HTTP server in a thread of the test that writes
+* each PUT's body into the file named by its path, at the body's CPOR-Offset.  It fails the first chunk after
+* the first once, so the upload must keep that chunk and resend it while the tagger waits.  The tags of a file
+* made by cpor_tag_file, sent through the upload, must come out as the same tag file byte for byte; a file
+* tagged while it is uploaded must prove; an endpoint refusing the upload must fail it; and an upload whose t
+* can't be written must not be marked complete with its final header.
+*/
+
+#include "test-common.h"
+#include <curl/curl.h>
+#include <pthread.h>
+#include <strings.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define UPLOAD_KEY "upload.key"
+#define UPLOAD_DATA "upload.dat"
+#define UPLOAD_COPY "upload-copy.tag"
+#define UPLOAD_STREAM "upload-stream.tag"
+#define UPLOAD_STREAM_T "upload-stream.t"
+#define UPLOAD_REFUSED "refused.tag"
+#define UPLOAD_NO_T "no-t.tag"
+#define UPLOAD_BLOCK_SIZE 128
+#define UPLOAD_BLOCKS 65536			/* 640 KB of 80-bit tags, so several chunks */
+#define UPLOAD_MAX_BODY (1 << 20)
+#define UPLOAD_MAX_LOG 64
+
+/* A PUT the endpoint answered */
+struct upload_request{
+	char path[64];
+	unsigned long long offset;
+	unsigned long long total;		/* The CPOR-Length, or 0 */
+	size_t len;
+	int status;
+};
+
+static struct{
+	int fd;
+	int port;
+	int failed;						/* The chunk to fail once has been failed */
+	struct upload_request log[UPLOAD_MAX_LOG];
+	int numlog;
+	pthread_mutex_t lock;
+} server;
+
+/* Bytes received on a connection and not yet parsed */
+struct upload_conn{
+	int fd;
+	char buf[65536];
+	size_t start;
+	size_t end;
+};
+
+/* conn_fill: Waits for more bytes.  Returns 1 on success, 0 if the client went away or the buffer is full. */
+static int conn_fill(struct upload_conn *conn){
+
+	ssize_t n = 0;
+
+	if(conn->start == conn->end) conn->start = conn->end = 0;
+	if(conn->end == sizeof(conn->buf)) return 0;
+	if( ((n = recv(conn->fd, conn->buf + conn->end, sizeof(conn->buf) - conn->end, 0)) <= 0)) return 0;
+	conn->end += n;
+
+	return 1;
+}
+
+/* conn_line: Reads a line, without its CRLF, into line.  Returns 1 on success, 0 on failure. */
+static int conn_line(struct upload_conn *conn, char *line, size_t size){
+
+	size_t len = 0;
+
+	while(1){
+		for(len = 0; conn->start + len + 1 < conn->end; len++)
+			if((conn->buf[conn->start + len] == '\r') && (conn->buf[conn->start + len + 1] == '\n')) break;
+		if(conn->start + len + 1 < conn->end) break;
+		if(conn->start){
+			memmove(conn->buf, conn->buf + conn->start, conn->end - conn->start);
+			conn->end -= conn->start;
+			conn->start = 0;
+		}
+		if(!conn_fill(conn)) return 0;
+	}
+	if(len >= size) return 0;
+	memcpy(line, conn->buf + conn->start, len);
+	line[len] = '\0';
+	conn->start += len + 2;
+
+	return 1;
+}
+
+/* conn_read: Reads len bytes into buf.  Returns 1 on success, 0 on failure. */
+static int conn_read(struct upload_conn *conn, unsigned char *buf, size_t len){
+
+	size_t n = 0;
+
+	while(len){
+		if((conn->start == conn->end) && !conn_fill(conn)) return 0;
+		n = conn->end - conn->start;
+		if(n > len) n = len;
+		memcpy(buf, conn->buf + conn->start, n);
+		conn->start += n;
+		buf += n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+/* upload_serve: Answers the PUTs on one connection, with a plain or chunked body */
+static void *upload_serve(void *arg){
+
+	struct upload_conn *conn = NULL;
+	struct upload_request req;
+	unsigned char *body = NULL;
+	char line[1024];
+	const char *answer = NULL;
+	size_t len = 0, piece = 0;
+	int chunked = 0, file = -1;
+
+	if( ((conn = malloc(sizeof(struct upload_conn))) == NULL)) goto done;
+	conn->fd = (int)(intptr_t)arg;
+	conn->start = conn->end = 0;
+	if( ((body = malloc(UPLOAD_MAX_BODY)) == NULL)) goto done;
+
+	while(conn_line(conn, line, sizeof(line))){
+		memset(&req, 0, sizeof(req));
+		if(sscanf(line, "PUT /%63s HTTP/1.1", req.path) != 1) goto done;
+		len = 0;
+		chunked = 0;
+		while(1){
+			if(!conn_line(conn, line, sizeof(line))) goto done;
+			if(!line[0]) break;
+			if(!strncasecmp(line, "CPOR-Offset:", 12)) req.offset = strtoull(line + 12, NULL, 10);
+			else if(!strncasecmp(line, "CPOR-Length:", 12)) req.total = strtoull(line + 12, NULL, 10);
+			else if(!strncasecmp(line, "Content-Length:", 15)) len = strtoul(line + 15, NULL, 10);
+			else if(!strncasecmp(line, "Transfer-Encoding:", 18) && strstr(line + 18, "chunked")) chunked = 1;
+		}
+
+		if(chunked){
+			for(len = 0; ; len += piece){
+				if(!conn_line(conn, line, sizeof(line))) goto done;
+				if( ((piece = strtoul(line, NULL, 16)) == 0)) break;
+				if((len + piece > UPLOAD_MAX_BODY) || !conn_read(conn, body + len, piece)) goto done;
+				if(!conn_line(conn, line, sizeof(line)) || line[0]) goto done;
+			}
+			if(!conn_line(conn, line, sizeof(line)) || line[0]) goto done;
+		}else if((len > UPLOAD_MAX_BODY) || !conn_read(conn, body, len)) goto done;
+		req.len = len;
+
+		/* Fail the first chunk after the first, once, having taken all of it */
+		pthread_mutex_lock(&server.lock);
+		if(!strncmp(req.path, "refused/", 8)) req.status = 403;
+		else if(req.offset && !server.failed){
+			server.failed = 1;
+			req.status = 503;
+		}else req.status = 200;
+		if(server.numlog < UPLOAD_MAX_LOG) server.log[server.numlog++] = req;
+		pthread_mutex_unlock(&server.lock);
+
+		if(req.status == 200){
+			if( ((file = open(req.path, O_WRONLY | O_CREAT, 0644)) < 0)) goto done;
+			if(pwrite(file, body, len, req.offset) != (ssize_t)len) req.status = 500;
+			if(req.total && (ftruncate(file, req.total) < 0)) req.status = 500;
+			close(file);
+			file = -1;
+		}
+		if(req.status == 200) answer = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+		else if(req.status == 403) answer = "HTTP/1.1 403 Forbidden\r\nContent-Length: 0\r\n\r\n";
+		else if(req.status == 503) answer = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+		else answer = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+		if(!test_send_all(conn->fd, answer, strlen(answer))) goto done;
+	}
+
+done:
+	if(conn){
+		close(conn->fd);
+		free(conn);
+	}else close((int)(intptr_t)arg);
+	if(body) free(body);
+
+	return NULL;
+}
+
+static void *upload_accept(void *arg){
+
+	pthread_t thread;
+	int fd = -1;
+
+	while( ((fd = accept(server.fd, NULL, NULL)) >= 0))
+		if(pthread_create(&thread, NULL, upload_serve, (void *)(intptr_t)fd) == 0) pthread_detach(thread);
+		else close(fd);
+
+	return NULL;
+}
+
+/* upload_start: Starts the endpoint on a free port of 127.0.0.1.  Returns 1 on success, 0 on failure. */
+static int upload_start(){
+
+	pthread_t thread;
+
+	pthread_mutex_init(&server.lock, NULL);
+	if( ((server.fd = test_listen(&server.port)) < 0)) return 0;
+	if(pthread_create(&thread, NULL, upload_accept, NULL) != 0) return 0;
+	pthread_detach(thread);
+
+	return 1;
+}
+
+/* same_file: Whether the files at a and b hold the same bytes */
+static int same_file(char *a, char *b){
+
+	unsigned char bufa[65536], bufb[65536];
+	size_t na = 0, nb = 0;
+	FILE *fa = NULL, *fb = NULL;
+	int same = 0;
+
+	if( ((fa = fopen(a, "rb")) == NULL)) return 0;
+	if( ((fb = fopen(b, "rb")) == NULL)) goto done;
+	do{
+		na = fread(bufa, 1, sizeof(bufa), fa);
+		nb = fread(bufb, 1, sizeof(bufb), fb);
+		if((na != nb) || memcmp(bufa, bufb, na)) goto done;
+	}while(na);
+	same = 1;
+
+done:
+	fclose(fa);
+	if(fb) fclose(fb);
+
+	return same;
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_key *key = NULL;
+	CPOR_tag_upload *upload = NULL;
+	CPOR_tag *tag = NULL;
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	struct stat st;
+	char url[128], tagpath[64];
+	unsigned long long next = 0;
+	size_t sigma_size = 0;
+	uint64_t i = 0;
+	int puts = 0, retried = 0, final = 0;
+	FILE *tagfile = NULL, *input = NULL;
+	struct rlimit limit;
+	pid_t pid = 0;
+	int status = 0;
+
+	CHECK(curl_global_init(CURL_GLOBAL_ALL) == 0);
+	test_params(&p, UPLOAD_BLOCK_SIZE);
+	unlink(UPLOAD_KEY);
+	unlink(UPLOAD_COPY);
+	unlink(UPLOAD_STREAM);
+	CHECK(test_tag_random_file(&p, UPLOAD_DATA, UPLOAD_BLOCKS * UPLOAD_BLOCK_SIZE, UPLOAD_KEY));
+	snprintf(tagpath, sizeof(tagpath), "%s", p.tag_filename);
+	CHECK((key = cpor_get_keys(&p)) != NULL);
+	sigma_size = BN_num_bytes(key->global->Zp);
+	destroy_cpor_key(&p, key);
+	CHECK(upload_start());
+
+	/* Send cpor_tag_file's tags through an upload */
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", server.port, UPLOAD_COPY);
+	CHECK((upload = cpor_tag_upload_begin(&p, url, sigma_size)) != NULL);
+	CHECK((tagfile = fopen(tagpath, "rb")) != NULL);
+	for(i = 0; i < UPLOAD_BLOCKS; i++){
+		CHECK((tag = read_cpor_tag(tagfile, i)) != NULL);
+		CHECK(cpor_tag_sink_upload(upload, tag, sigma_size));
+		destroy_cpor_tag(tag);
+	}
+	fclose(tagfile);
+	CHECK(cpor_tag_upload_finish(upload));
+	CHECK(same_file(tagpath, UPLOAD_COPY));
+
+	/* The chunks went up in order, each following the last, and the failed one was resent; then the header */
+	CHECK(stat(tagpath, &st) == 0);
+	pthread_mutex_lock(&server.lock);
+	for(i = 0; i < (uint64_t)server.numlog; i++){
+		if(server.log[i].total){
+			CHECK((server.log[i].offset == 0) && (server.log[i].len == sizeof(CPOR_file_header)));
+			CHECK(server.log[i].total == (unsigned long long)st.st_size);
+			CHECK(i == (uint64_t)server.numlog - 1);
+			final++;
+		}else if(server.log[i].status == 503){
+			CHECK((i + 1 < (uint64_t)server.numlog) && (server.log[i + 1].offset == server.log[i].offset) &&
+				(server.log[i + 1].len == server.log[i].len));
+			retried++;
+		}else{
+			CHECK(server.log[i].offset == next);
+			next += server.log[i].len;
+			puts++;
+		}
+	}
+	server.numlog = 0;
+	pthread_mutex_unlock(&server.lock);
+	CHECK((final == 1) && (retried == 1) && (puts >= 3));
+	CHECK(next == (unsigned long long)st.st_size);
+
+	/* Tag a stream while uploading it, and prove from what was uploaded */
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", server.port, UPLOAD_STREAM);
+	CHECK((input = fopen(UPLOAD_DATA, "rb")) != NULL);
+	CHECK(cpor_tag_stream_upload(&p, input, url, UPLOAD_STREAM_T));
+	fclose(input);
+	p.tag_filename = UPLOAD_STREAM;
+	p.t_filename = UPLOAD_STREAM_T;
+	CHECK((challenge = cpor_challenge_file(&p)) != NULL);
+	CHECK((proof = cpor_prove_file(&p, challenge)) != NULL);
+	CHECK(cpor_verify_file(&p, challenge, proof) == 1);
+	destroy_cpor_proof(&p, proof);
+	destroy_cpor_challenge(challenge);
+
+	/* An endpoint refusing the upload fails it, leaving no t behind */
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/refused/%s", server.port, UPLOAD_REFUSED);
+	CHECK((input = fopen(UPLOAD_DATA, "rb")) != NULL);
+	CHECK(!cpor_tag_stream_upload(&p, input, url, UPLOAD_STREAM_T));
+	fclose(input);
+	CHECK(access(UPLOAD_STREAM_T, F_OK) != 0);
+
+	/* A t that can't be written (here, over a file size limit) fails the upload before its final header */
+	pthread_mutex_lock(&server.lock);
+	server.numlog = 0;
+	pthread_mutex_unlock(&server.lock);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", server.port, UPLOAD_NO_T);
+	CHECK((pid = fork()) >= 0);
+	if(pid == 0){
+		signal(SIGXFSZ, SIG_IGN);
+		limit.rlim_cur = limit.rlim_max = sizeof(CPOR_file_header) / 2;
+		setrlimit(RLIMIT_FSIZE, &limit);
+		if( ((input = fopen(UPLOAD_DATA, "rb")) == NULL)) _exit(2);
+		_exit(cpor_tag_stream_upload(&p, input, url, UPLOAD_STREAM_T));
+	}
+	CHECK(waitpid(pid, &status, 0) == pid);
+	CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+	CHECK(access(UPLOAD_STREAM_T, F_OK) != 0);
+	pthread_mutex_lock(&server.lock);
+	CHECK(server.numlog > 0);
+	for(i = 0; i < (uint64_t)server.numlog; i++) CHECK(!server.log[i].total);
+	pthread_mutex_unlock(&server.lock);
+
+	curl_global_cleanup();
+	unlink(UPLOAD_DATA);
+	unlink(tagpath);
+	unlink(UPLOAD_DATA ".t");
+	unlink(UPLOAD_COPY);
+	unlink(UPLOAD_STREAM);
+	unlink(UPLOAD_NO_T);
+	unlink(UPLOAD_KEY);
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+* test-verifier.c
+*
+* Loopback test of the verifier daemon and its client.  Several clients, each on its own connection, pipeline
+* challenge requests until every audit slot the daemon has is taken, so the daemon holds them all in flight at
+* once; a request beyond that must be refused.  Each client then proves some of its audits against the data
+* file and has them verified, and makes sure a damaged proof, and a proof for an audit already answered, fail.
+* Finally a challenge asking for more than CPOR_MAX_CHALLENGE blocks, or for a longer run, must be refused, and
+* a request written out byte by byte in the big-endian layout must be answered in it.
+*/
+
+#include "test-common.h"
+#include <pthread.h>
+
+#define VERIFIER_DATA "verifier.dat"
+#define VERIFIER_KEY "verifier.key"
+#define VERIFIER_SOCKET "verifier.sock"
+#define VERIFIER_BLOCKS 64
+#define VERIFIER_CLIENTS 4
+#define VERIFIER_AUDITS 256			/* Challenges each client holds in flight */
+#define VERIFIER_WINDOW 64			/* Requests a client sends before reading the responses */
+#define VERIFIER_PROVEN 16			/* Audits each client proves */
+#define VERIFIER_L 10
+
+static CPOR_params verifier_params;
+
+/* verifier_raw: Asks for a challenge with a request built by hand, and checks the response byte by byte, so the
+* layout on the socket doesn't depend on this host's byte order
+*/
+static void verifier_raw(){
+
+	unsigned char request[CPOR_MSG_HEADER_SIZE + 8 + MAXPATHLEN], response[CPOR_MSG_HEADER_SIZE];
+	unsigned char *seed = NULL;
+	static const unsigned char magic[4] = {'C', 'P', 'M', '1'};
+	size_t path_len = strlen(verifier_params.t_filename);
+	uint32_t length = 0;
+	CPOR_msg_conn *conn = NULL;
+
+	memset(request, 0, sizeof(request));
+	memcpy(request, magic, 4);
+	request[7] = CPOR_MSG_CHALLENGE;
+	request[20] = ((8 + path_len) >> 24) & 0xff;
+	request[21] = ((8 + path_len) >> 16) & 0xff;
+	request[22] = ((8 + path_len) >> 8) & 0xff;
+	request[23] = (8 + path_len) & 0xff;
+	request[CPOR_MSG_HEADER_SIZE + 3] = VERIFIER_L;
+	memcpy(request + CPOR_MSG_HEADER_SIZE + 8, verifier_params.t_filename, path_len);
+
+	CHECK((conn = cpor_verifier_connect(VERIFIER_SOCKET)) != NULL);
+	CHECK(test_send_all(conn->fd, request, CPOR_MSG_HEADER_SIZE + 8 + path_len));
+	CHECK(recv(conn->fd, response, CPOR_MSG_HEADER_SIZE, MSG_WAITALL) == CPOR_MSG_HEADER_SIZE);
+	CHECK(!memcmp(response, magic, 4));
+	CHECK(!response[4] && !response[5] && !response[6] && (response[7] == CPOR_MSG_CHALLENGE));
+	CHECK(!response[16] && !response[17] && !response[18] && (response[19] == 1));
+	length = ((uint32_t)response[20] << 24) | ((uint32_t)response[21] << 16) | ((uint32_t)response[22] << 8) | response[23];
+	CHECK((length > CPOR_MSG_SEED_SIZE) && (length <= CPOR_MSG_SEED_SIZE + 256));
+	CHECK((seed = malloc(length)) != NULL);
+	CHECK(recv(conn->fd, seed, length, MSG_WAITALL) == (ssize_t)length);
+	/* l, run and n follow the seed */
+	CHECK(!seed[CPOR_CHALLENGE_SEED_SIZE] && !seed[CPOR_CHALLENGE_SEED_SIZE + 1] && !seed[CPOR_CHALLENGE_SEED_SIZE + 2] &&
+		(seed[CPOR_CHALLENGE_SEED_SIZE + 3] == VERIFIER_L));
+	CHECK(!seed[CPOR_CHALLENGE_SEED_SIZE + 14] && (seed[CPOR_CHALLENGE_SEED_SIZE + 15] == VERIFIER_BLOCKS));
+	free(seed);
+	cpor_msg_close(conn);
+}
+static pthread_barrier_t issued, refused;
+
+/* verifier_client: One client's share of the test.  A failed check ends the whole test. */
+static void *verifier_client(void *arg){
+
+	CPOR_params myparams = verifier_params;
+	CPOR_global *global = NULL;
+	CPOR_challenge_seed *seeds[VERIFIER_AUDITS];
+	CPOR_challenge *challenge = NULL;
+	CPOR_proof *proof = NULL;
+	uint64_t audits[VERIFIER_AUDITS];
+	uint64_t audit = 0;
+	CPOR_msg_conn *conn = NULL;
+	int i = 0, j = 0;
+
+	CHECK((global = allocate_cpor_global()) != NULL);
+	CHECK((conn = cpor_verifier_connect(VERIFIER_SOCKET)) != NULL);
+
+	/* Take our share of the audit slots, a window of pipelined requests at a time */
+	for(i = 0; i < VERIFIER_AUDITS; i += VERIFIER_WINDOW){
+		for(j = i; j < i + VERIFIER_WINDOW; j++)
+			CHECK(cpor_verifier_send_challenge(conn, myparams.t_filename, VERIFIER_L, 0));
+		for(j = i; j < i + VERIFIER_WINDOW; j++){
+			CHECK((seeds[j] = cpor_verifier_recv_challenge(conn, &audits[j], global)) != NULL);
+			CHECK((seeds[j]->l == VERIFIER_L) && (seeds[j]->n == VERIFIER_BLOCKS));
+		}
+	}
+	pthread_barrier_wait(&issued);
+	pthread_barrier_wait(&refused);
+
+	for(i = 0; i < VERIFIER_PROVEN; i++){
+		CHECK((challenge = cpor_expand_challenge(global, seeds[i])) != NULL);
+		CHECK((proof = cpor_prove_file(&myparams, challenge)) != NULL);
+		/* The last one is damaged and must fail */
+		if(i == VERIFIER_PROVEN - 1) CHECK(BN_add_word(proof->sigma, 1));
+		CHECK(cpor_verifier_send_proof(&myparams, conn, audits[i], global, proof));
+		CHECK(cpor_verifier_recv_result(conn, &audit) == ((i == VERIFIER_PROVEN - 1) ? 0 : 1));
+		CHECK(audit == audits[i]);
+		/* Each audit is answered once */
+		if(i == 0){
+			CHECK(cpor_verifier_send_proof(&myparams, conn, audits[i], global, proof));
+			CHECK(cpor_verifier_recv_result(conn, NULL) == -1);
+		}
+		destroy_cpor_proof(&myparams, proof);
+		destroy_cpor_challenge(challenge);
+	}
+
+	for(i = 0; i < VERIFIER_AUDITS; i++) destroy_cpor_challenge_seed(seeds[i]);
+	cpor_msg_close(conn);
+	destroy_cpor_global(global);
+
+	return NULL;
+}
+
+int main(){
+
+	CPOR_verifier *verifier = NULL;
+	CPOR_global *global = NULL;
+	CPOR_challenge_seed *seed = NULL;
+	pthread_t clients[VERIFIER_CLIENTS];
+	uint64_t audit = 0;
+	CPOR_msg_conn *conn = NULL;
+	int i = 0;
+
+	test_params(&verifier_params, 4096);
+	unlink(VERIFIER_KEY);
+	CHECK(test_tag_random_file(&verifier_params, VERIFIER_DATA, VERIFIER_BLOCKS * verifier_params.block_size, VERIFIER_KEY));
+	CHECK((verifier = cpor_start_verifier(&verifier_params, VERIFIER_SOCKET, VERIFIER_CLIENTS * VERIFIER_AUDITS, 0)) != NULL);
+
+	CHECK(pthread_barrier_init(&issued, NULL, VERIFIER_CLIENTS + 1) == 0);
+	CHECK(pthread_barrier_init(&refused, NULL, VERIFIER_CLIENTS + 1) == 0);
+	for(i = 0; i < VERIFIER_CLIENTS; i++)
+		CHECK(pthread_create(&clients[i], NULL, verifier_client, NULL) == 0);
+
+	/* With every slot taken, another challenge is refused */
+	pthread_barrier_wait(&issued);
+	CHECK((global = allocate_cpor_global()) != NULL);
+	CHECK((conn = cpor_verifier_connect(VERIFIER_SOCKET)) != NULL);
+	CHECK(cpor_verifier_send_challenge(conn, verifier_params.t_filename, VERIFIER_L, 0));
+	CHECK((seed = cpor_verifier_recv_challenge(conn, &audit, global)) == NULL);
+	cpor_msg_close(conn);
+	destroy_cpor_global(global);
+	pthread_barrier_wait(&refused);
+
+	for(i = 0; i < VERIFIER_CLIENTS; i++)
+		CHECK(pthread_join(clients[i], NULL) == 0);
+
+	verifier_raw();
+
+	/* Oversized challenges are refused, and the connection still serves */
+	CHECK((global = allocate_cpor_global()) != NULL);
+	CHECK((conn = cpor_verifier_connect(VERIFIER_SOCKET)) != NULL);
+	CHECK(cpor_verifier_send_challenge(conn, verifier_params.t_filename, CPOR_MAX_CHALLENGE + 1, 0));
+	CHECK(cpor_verifier_recv_challenge(conn, &audit, global) == NULL);
+	CHECK(cpor_verifier_send_challenge(conn, verifier_params.t_filename, VERIFIER_L, 0xffffffff));
+	CHECK(cpor_verifier_recv_challenge(conn, &audit, global) == NULL);
+	CHECK(cpor_verifier_send_challenge(conn, verifier_params.t_filename, VERIFIER_L, 0));
+	CHECK((seed = cpor_verifier_recv_challenge(conn, &audit, global)) != NULL);
+	destroy_cpor_challenge_seed(seed);
+	cpor_msg_close(conn);
+	destroy_cpor_global(global);
+
+	cpor_stop_verifier(verifier);
+	pthread_barrier_destroy(&issued);
+	pthread_barrier_destroy(&refused);
+	unlink(VERIFIER_DATA);
+	unlink(verifier_params.tag_filename);
+	unlink(verifier_params.t_filename);
+	unlink(VERIFIER_KEY);
+
+	return 0;
+}
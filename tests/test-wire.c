@@ -0,0 +1,168 @@
+/*
+* test-wire.c
+*
+* Tests the wire encoding of challenges and proofs: a challenge encoded, decoded in place and copied back out
+* must carry the same indices and nu's, at its own width or a padded one, and the proof made from it must
+* verify through cpor_decode_proof and cpor_verify_finish_view.  Buffers one byte short or long, with a count
+* larger than what arrived, or with the wrong magic, version or kind must be rejected.
+*/
+
+#include "test-common.h"
+
+#define WIRE_DATA "wire.dat"
+#define WIRE_KEY "wire.key"
+#define WIRE_BLOCKS 200
+
+/* wire_decode: Decodes len bytes at buf as a proof if proof is set, or else as a challenge.  Returns the decoder's
+* result.
+*/
+static int wire_decode(CPOR_params *p, unsigned char *buf, size_t len, int proof){
+
+	CPOR_challenge_view challenge_view;
+	CPOR_proof_view proof_view;
+
+	if(proof) return cpor_decode_proof(p, buf, len, &proof_view);
+	return cpor_decode_challenge(buf, len, &challenge_view);
+}
+
+/* wire_check_rejects: Checks that cpor_decode_challenge (or cpor_decode_proof if proof is set) accepts the len
+* bytes at buf but rejects every broken copy of them
+*/
+static void wire_check_rejects(CPOR_params *p, unsigned char *buf, size_t len, int proof){
+
+	unsigned char *copy = NULL;
+	int i = 0;
+
+	CHECK((copy = malloc(len + 1)) != NULL);
+	memcpy(copy, buf, len);
+	copy[len] = 0;
+	CHECK(wire_decode(p, copy, len, proof));
+
+	/* Short, long, and too short for the header */
+	CHECK(!wire_decode(p, copy, len - 1, proof));
+	CHECK(!wire_decode(p, copy, len + 1, proof));
+	CHECK(!wire_decode(p, copy, CPOR_WIRE_HEADER_SIZE - 1, proof));
+	CHECK(!wire_decode(p, NULL, len, proof));
+
+	/* Each header field broken in turn: the magic, version, kind, element width and count */
+	for(i = 0; i < 12; i++){
+		memcpy(copy, buf, len);
+		copy[i] ^= (i == 8) ? 0x80 : 0x01;
+		CHECK(!wire_decode(p, copy, len, proof));
+	}
+	memcpy(copy, buf, len);
+	cpor_put_be32(copy + 8, 0xFFFFFFFF);
+	CHECK(!wire_decode(p, copy, len, proof));
+	memset(copy + 6, 0, 2);
+	CHECK(!wire_decode(p, copy, len, proof));
+
+	/* Nor is one kind taken for the other */
+	memcpy(copy, buf, len);
+	CHECK(!wire_decode(p, copy, len, !proof));
+
+	free(copy);
+}
+
+/* wire_round_trip: Encodes challenge at element_size, decodes it and checks the view against challenge, then
+* proves the copy made from the view and checks the encoded proof verifies against prepared.  Returns the
+* encoded challenge, which the caller frees, and its length in *len.
+*/
+static unsigned char *wire_round_trip(CPOR_params *p, CPOR_challenge *challenge, CPOR_prepared *prepared, size_t element_size, size_t *len){
+
+	CPOR_challenge_view view;
+	CPOR_proof_view proof_view;
+	CPOR_challenge *copy = NULL;
+	CPOR_proof *proof = NULL;
+	unsigned char *buf = NULL, *proofbuf = NULL;
+	size_t prooflen = 0, pad = element_size - challenge->element_size;
+	unsigned int i = 0;
+	size_t k = 0;
+
+	*len = cpor_challenge_wire_size(challenge->l, element_size);
+	CHECK((buf = malloc(*len)) != NULL);
+	CHECK(cpor_encode_challenge(challenge, element_size, buf, *len - 1) == 0);
+	CHECK(cpor_encode_challenge(challenge, element_size, buf, *len) == *len);
+	CHECK(cpor_decode_challenge(buf, *len, &view));
+	CHECK((view.l == challenge->l) && (view.element_size == element_size));
+	for(i = 0; i < challenge->l; i++){
+		const unsigned char *nu = view.nu + ((size_t)i * element_size);
+
+		CHECK(cpor_challenge_view_index(&view, i) == challenge->I[i]);
+		for(k = 0; k < pad; k++) CHECK(nu[k] == 0);
+		CHECK(memcmp(nu + pad, cpor_challenge_nu(challenge, i), challenge->element_size) == 0);
+	}
+	wire_check_rejects(p, buf, *len, 0);
+
+	CHECK((copy = cpor_challenge_from_view(&view)) != NULL);
+	CHECK(BN_cmp(copy->global->Zp, challenge->global->Zp) == 0);
+	CHECK((proof = cpor_prove_file(p, copy)) != NULL);
+	prooflen = cpor_proof_wire_size(p, element_size);
+	CHECK((proofbuf = malloc(prooflen)) != NULL);
+	CHECK(cpor_encode_proof(p, proof, element_size, proofbuf, prooflen) == prooflen);
+	CHECK(cpor_decode_proof(p, proofbuf, prooflen, &proof_view));
+	CHECK(cpor_verify_finish_view(p, prepared, &proof_view) == 1);
+	wire_check_rejects(p, proofbuf, prooflen, 1);
+
+	/* A changed sigma, or mu, doesn't verify */
+	proofbuf[CPOR_WIRE_HEADER_SIZE + element_size - 1] ^= 1;
+	CHECK(cpor_verify_finish_view(p, prepared, &proof_view) == 0);
+	proofbuf[CPOR_WIRE_HEADER_SIZE + element_size - 1] ^= 1;
+	proofbuf[prooflen - 1] ^= 1;
+	CHECK(cpor_verify_finish_view(p, prepared, &proof_view) == 0);
+
+	free(proofbuf);
+	destroy_cpor_proof(p, proof);
+	destroy_cpor_challenge(copy);
+
+	return buf;
+}
+
+int main(){
+
+	CPOR_params p;
+	CPOR_key *key = NULL;
+	CPOR_challenge_seed *seed = NULL;
+	CPOR_challenge *challenge = NULL, *padded = NULL;
+	CPOR_prepared *prepared = NULL;
+	CPOR_challenge_view view;
+	unsigned char *buf = NULL, *paddedbuf = NULL, *again = NULL;
+	size_t len = 0, paddedlen = 0, element_size = 0;
+
+	test_params(&p, 1024);
+	unlink(WIRE_KEY);
+	CHECK(test_tag_random_file(&p, WIRE_DATA, (WIRE_BLOCKS * p.block_size) + 9, WIRE_KEY));
+	CHECK((key = cpor_get_keys(&p)) != NULL);
+	element_size = BN_num_bytes(key->global->Zp);
+	CHECK((prepared = cpor_prepare_challenge_file(&p, p.t_filename, &seed)) != NULL);
+	CHECK((challenge = cpor_expand_challenge(key->global, seed)) != NULL);
+	CHECK(challenge->element_size == element_size);
+
+	/* At Zp's own width, then padded by three bytes */
+	buf = wire_round_trip(&p, challenge, prepared, element_size, &len);
+	paddedbuf = wire_round_trip(&p, challenge, prepared, element_size + 3, &paddedlen);
+
+	/* A padded challenge encodes back to its own width unchanged */
+	CHECK(cpor_decode_challenge(paddedbuf, paddedlen, &view));
+	CHECK((padded = cpor_challenge_from_view(&view)) != NULL);
+	CHECK((again = malloc(len)) != NULL);
+	CHECK(cpor_encode_challenge(padded, element_size, again, len) == len);
+	CHECK(memcmp(again, buf, len) == 0);
+
+	/* Narrower than Zp doesn't fit */
+	CHECK(cpor_encode_challenge(challenge, element_size - 1, again, len) == 0);
+
+	free(again);
+	free(paddedbuf);
+	free(buf);
+	destroy_cpor_challenge(padded);
+	destroy_cpor_challenge(challenge);
+	destroy_cpor_prepared(&p, prepared);
+	destroy_cpor_challenge_seed(seed);
+	destroy_cpor_key(&p, key);
+	unlink(WIRE_DATA);
+	unlink(p.tag_filename);
+	unlink(p.t_filename);
+	unlink(WIRE_KEY);
+
+	return 0;
+}